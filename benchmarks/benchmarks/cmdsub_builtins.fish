@@ -0,0 +1,6 @@
+# Many small command substitutions which only run builtins.
+set -l x a,b,c
+for i in (seq 20000)
+    set -l y (string split , $x)
+    set -l z (count $y)
+end
@@ -0,0 +1,7 @@
+# A command substitution producing many lines, up to the expansion limit.
+set -l file (mktemp)
+seq 500000 | string replace -r '$' ' some text after the number' >$file
+for i in (seq 5)
+    set -l lines (cat $file)
+end
+rm $file
@@ -0,0 +1,12 @@
+# Complete a command whose completions depend on its subcommands, like git or apt.
+complete -c subcmds -f
+for i in (seq 500)
+    complete -c subcmds -n __fish_use_subcommand -a sub$i -d "Subcommand $i"
+    complete -c subcmds -n "__fish_seen_subcommand_from sub$i; and not __fish_contains_opt -s q quiet" -l opt$i
+end
+
+for i in (seq 50)
+    complete -C'subcmds '
+    complete -C'subcmds sub7 --'
+    complete -C'subcmds sub7 -q --opt'
+end >/dev/null
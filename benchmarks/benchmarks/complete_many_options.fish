@@ -0,0 +1,12 @@
+# Complete the arguments of a command with thousands of options, like git or ffmpeg have.
+for i in (seq 3000)
+    complete -c manyopts -l option-$i -d "Option $i"
+    complete -c manyopts -s (string sub -l 1 -s (math $i % 26 + 1) abcdefghijklmnopqrstuvwxyz) -d Short
+end
+complete -c manyopts -l color -xa 'auto always never'
+
+for i in (seq 300)
+    complete -C'manyopts --option-1 -a --color '
+    complete -C'manyopts --option-12'
+    complete -C'manyopts --color=a'
+end >/dev/null
@@ -0,0 +1,9 @@
+# Many exported variables, of which one changes before each external command.
+for i in (seq 200)
+    set -gx FISH_BENCHMARK_EXPORT_$i (string repeat -n 20 value)
+end
+
+for i in (seq 2000)
+    set -gx FISH_BENCHMARK_COUNTER $i
+    command true
+end
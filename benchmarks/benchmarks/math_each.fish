@@ -0,0 +1 @@
+seq 100000 | math --each i "i + i" >/dev/null
@@ -0,0 +1,13 @@
+# Launch external commands in the foreground with job control, as an interactive shell does, first
+# with posix_spawn and then with fork. A big heap makes fork more expensive.
+status job-control full
+set -g big (seq 200000)
+
+time for i in (seq 1000)
+    command true
+end
+
+set -g fish_use_posix_spawn 0
+time for i in (seq 1000)
+    command true
+end
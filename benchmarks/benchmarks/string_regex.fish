@@ -0,0 +1,7 @@
+# Many short invocations of `string` reusing the same regular expressions.
+set -l address '^[a-z0-9._%+-]+@(?:[a-z0-9](?:[a-z0-9-]*[a-z0-9])?\.)+[a-z]{2,}$'
+set -l ipv4 '\b(?:(?:25[0-5]|2[0-4][0-9]|[01]?[0-9][0-9]?)\.){3}(?:25[0-5]|2[0-4][0-9]|[01]?[0-9][0-9]?)\b'
+for i in (seq 10000)
+    string match -qr -- $address "user$i@example.com"
+    string replace -r -- $ipv4 '<addr>' "connect to 10.0.0.1 port $i" >/dev/null
+end
@@ -0,0 +1,8 @@
+# `string` reading many lines from a pipe.
+set -l lines (seq 100000 | string replace -r '$' ' the quick brown fox jumps over the lazy dog')
+for i in (seq 3)
+    printf '%s\n' $lines | string length >/dev/null
+    printf '%s\n' $lines | string match '*99*' >/dev/null
+    printf '%s\n' $lines | string replace o 0 >/dev/null
+    printf '%s\n' $lines | string split ' ' >/dev/null
+end
@@ -0,0 +1,202 @@
+#!/usr/bin/env python3
+
+""" Startup time benchmarks.
+
+Measures how long fish takes to start in a few common ways, and optionally compares the results
+with a baseline saved by an earlier run:
+
+    startup.py /path/to/fish --save baseline.json
+    startup.py /path/to/fish --compare baseline.json
+
+Each benchmark runs fish with HOME and the XDG directories pointing to a temporary directory, so
+the user's configuration does not affect the results. "Cold" runs start from empty directories, so
+fish has to create its universal variables file and has no caches; "warm" runs reuse the
+directories of an earlier run. The time to the first prompt, and the time taken by each phase of
+startup, come from fish's --print-startup-profile.
+
+All times are medians, in milliseconds.
+"""
+
+import argparse
+import json
+import os
+import pty
+import re
+import shutil
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+
+PROFILE_LINE = re.compile(r"^\s*([0-9.]+)\s+([0-9.]+)\s+(.*?)\s*$")
+AUTOLOAD_LINE = re.compile(r"^\s*autoloading: ([0-9.]+) ms")
+
+
+def make_env(root):
+    env = dict(os.environ)
+    for var, sub in (
+        ("HOME", "home"),
+        ("XDG_CONFIG_HOME", "config"),
+        ("XDG_DATA_HOME", "data"),
+        ("XDG_CACHE_HOME", "cache"),
+    ):
+        path = os.path.join(root, sub)
+        os.makedirs(path, exist_ok=True)
+        env[var] = path
+    env.pop("fish_function_path", None)
+    env.pop("fish_complete_path", None)
+    env.setdefault("TERM", "xterm")
+    return env
+
+
+def parse_profile(text):
+    """ Return a dict from phase name to the phase's duration, from --print-startup-profile. """
+    phases = {}
+    total = None
+    for line in text.splitlines():
+        line = line.replace("\r", "")
+        m = PROFILE_LINE.match(line)
+        if m:
+            phases[m.group(3)] = float(m.group(2))
+            total = float(m.group(1))
+            continue
+        m = AUTOLOAD_LINE.match(line)
+        if m:
+            phases["autoloading"] = float(m.group(1))
+    if total is not None:
+        phases["total"] = total
+    return phases
+
+
+def run_command(fish, args, env):
+    """ Run fish with args, returning the wall time and the startup profile. """
+    start = time.perf_counter()
+    proc = subprocess.run(
+        [fish, "--print-startup-profile"] + args,
+        env=env,
+        cwd=env["HOME"],
+        stdin=subprocess.DEVNULL,
+        stdout=subprocess.DEVNULL,
+        stderr=subprocess.PIPE,
+        universal_newlines=True,
+    )
+    elapsed = (time.perf_counter() - start) * 1000
+    if proc.returncode != 0:
+        sys.exit("fish %s failed with status %d" % (" ".join(args), proc.returncode))
+    return elapsed, parse_profile(proc.stderr)
+
+
+def run_interactive(fish, env):
+    """ Run an interactive fish on a pty until it exits, returning its startup profile. """
+    pid, fd = pty.fork()
+    if pid == 0:
+        os.chdir(env["HOME"])
+        os.execve(fish, [fish, "--print-startup-profile"], env)
+    # The input is buffered until fish reads it at its first prompt.
+    os.write(fd, b"exit\r")
+    output = b""
+    while True:
+        try:
+            data = os.read(fd, 4096)
+        except OSError:
+            break
+        if not data:
+            break
+        output += data
+    os.waitpid(pid, 0)
+    os.close(fd)
+    return parse_profile(output.decode("utf-8", "replace"))
+
+
+def bench(name, runs, results, func):
+    """ Run func runs times, and record the median of each time it returns in results. """
+    samples = {}
+    for _ in range(runs):
+        for key, value in func().items():
+            samples.setdefault(key, []).append(value)
+    for key, values in samples.items():
+        results[name + ": " + key] = statistics.median(values)
+
+
+def run_benchmarks(fish, runs):
+    results = {}
+    tmpdir = tempfile.mkdtemp(prefix="fish_startup_")
+    try:
+
+        def cold():
+            root = tempfile.mkdtemp(dir=tmpdir)
+            elapsed, _ = run_command(fish, ["-c", "true"], make_env(root))
+            shutil.rmtree(root)
+            return {"wall": elapsed}
+
+        warm_env = make_env(os.path.join(tmpdir, "warm"))
+        # Populate the directories.
+        run_command(fish, ["-c", "true"], warm_env)
+        run_interactive(fish, warm_env)
+
+        def warm():
+            elapsed, phases = run_command(fish, ["-c", "true"], warm_env)
+            phases["wall"] = elapsed
+            return phases
+
+        def no_config():
+            elapsed, _ = run_command(fish, ["--no-config", "-c", "true"], warm_env)
+            return {"wall": elapsed}
+
+        def interactive():
+            return run_interactive(fish, warm_env)
+
+        bench("fish -c true (cold)", runs, results, cold)
+        bench("fish -c true (warm)", runs, results, warm)
+        bench("fish --no-config -c true", runs, results, no_config)
+        bench("fish -i", runs, results, interactive)
+    finally:
+        shutil.rmtree(tmpdir)
+    return results
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Benchmark fish startup time.")
+    parser.add_argument("fish", help="the fish binary to benchmark")
+    parser.add_argument("-n", "--runs", type=int, default=20, help="runs per benchmark")
+    parser.add_argument("--save", metavar="FILE", help="save the results as a baseline")
+    parser.add_argument("--compare", metavar="FILE", help="compare with a saved baseline")
+    parser.add_argument(
+        "--threshold",
+        type=float,
+        default=10,
+        help="with --compare, exit with status 1 if a total or wall time is this many "
+        "percent slower than the baseline",
+    )
+    args = parser.parse_args()
+    fish = os.path.abspath(args.fish)
+
+    results = run_benchmarks(fish, args.runs)
+
+    baseline = {}
+    if args.compare:
+        with open(args.compare) as f:
+            baseline = json.load(f)
+
+    regressed = False
+    width = max(len(name) for name in results)
+    for name, value in results.items():
+        line = "%-*s %9.3f ms" % (width, name, value)
+        if name in baseline and baseline[name] > 0:
+            change = (value - baseline[name]) * 100 / baseline[name]
+            line += "  (baseline %9.3f ms, %+6.1f%%)" % (baseline[name], change)
+            if name.endswith((": wall", ": total")) and change > args.threshold:
+                line += "  REGRESSION"
+                regressed = True
+        print(line)
+
+    if args.save:
+        with open(args.save, "w") as f:
+            json.dump(results, f, indent=2)
+            f.write("\n")
+    return 1 if regressed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
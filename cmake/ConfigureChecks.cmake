@@ -118,8 +118,12 @@ check_include_file_cxx(sys/select.h HAVE_SYS_SELECT_H)
 check_include_files("sys/types.h;sys/sysctl.h" HAVE_SYS_SYSCTL_H)
 check_include_file_cxx(termios.h HAVE_TERMIOS_H) # Needed for TIOCGWINSZ
 
+check_cxx_symbol_exists(epoll_create1 sys/epoll.h HAVE_EPOLL_CREATE1)
 check_cxx_symbol_exists(eventfd sys/eventfd.h HAVE_EVENTFD)
+check_cxx_symbol_exists(inotify_init1 sys/inotify.h HAVE_INOTIFY_INIT1)
 check_cxx_symbol_exists(pipe2 unistd.h HAVE_PIPE2)
+check_cxx_symbol_exists(posix_spawn_file_actions_addtcsetpgrp_np spawn.h
+                        HAVE_POSIX_SPAWN_FILE_ACTIONS_ADDTCSETPGRP_NP)
 check_cxx_symbol_exists(wcscasecmp wchar.h HAVE_WCSCASECMP)
 check_cxx_symbol_exists(wcsdup wchar.h HAVE_WCSDUP)
 check_cxx_symbol_exists(wcslcpy wchar.h HAVE_WCSLCPY)
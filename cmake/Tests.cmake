@@ -71,6 +71,8 @@ add_custom_target(test_prep
     COMMAND ${CMAKE_COMMAND} -E make_directory ${TEST_DIR}/xdg_data
     COMMAND ${CMAKE_COMMAND} -E remove_directory ${TEST_DIR}/xdg_config
     COMMAND ${CMAKE_COMMAND} -E make_directory ${TEST_DIR}/xdg_config
+    COMMAND ${CMAKE_COMMAND} -E remove_directory ${TEST_DIR}/xdg_cache
+    COMMAND ${CMAKE_COMMAND} -E make_directory ${TEST_DIR}/xdg_cache
     COMMAND ${CMAKE_COMMAND} -E remove_directory ${TEST_DIR}/xdg_runtime
     COMMAND ${CMAKE_COMMAND} -E make_directory ${TEST_DIR}/xdg_runtime
 
@@ -85,6 +87,7 @@ foreach(TESTTYPE test serial_test)
   add_custom_target(${TESTTYPE}_low_level
     COMMAND env XDG_DATA_HOME=${CMAKE_CURRENT_BINARY_DIR}/test/xdg_data
                 XDG_CONFIG_HOME=${CMAKE_CURRENT_BINARY_DIR}/test/xdg_config
+                XDG_CACHE_HOME=${CMAKE_CURRENT_BINARY_DIR}/test/xdg_cache
                 XDG_RUNTIME_HOME=${CMAKE_CURRENT_BINARY_DIR}/test/xdg_runtime
                 ./fish_tests
     WORKING_DIRECTORY ${CMAKE_CURRENT_BINARY_DIR}
@@ -96,6 +99,7 @@ foreach(TESTTYPE test serial_test)
                         cd tests &&
                         env XDG_DATA_HOME=${CMAKE_CURRENT_BINARY_DIR}/test/xdg_data
                             XDG_CONFIG_HOME=${CMAKE_CURRENT_BINARY_DIR}/test/xdg_config
+                            XDG_CACHE_HOME=${CMAKE_CURRENT_BINARY_DIR}/test/xdg_cache
                             XDG_RUNTIME_HOME=${CMAKE_CURRENT_BINARY_DIR}/test/xdg_runtime
                         ${TEST_ROOT_DIR}/bin/fish test.fish
                     DEPENDS test_prep
@@ -105,6 +109,7 @@ foreach(TESTTYPE test serial_test)
       COMMAND cd tests &&
                 env XDG_DATA_HOME=${CMAKE_CURRENT_BINARY_DIR}/test/xdg_data
                     XDG_CONFIG_HOME=${CMAKE_CURRENT_BINARY_DIR}/test/xdg_config
+                    XDG_CACHE_HOME=${CMAKE_CURRENT_BINARY_DIR}/test/xdg_cache
                     XDG_RUNTIME_HOME=${CMAKE_CURRENT_BINARY_DIR}/test/xdg_runtime
                 ${TEST_ROOT_DIR}/bin/fish interactive.fish
       DEPENDS test_prep
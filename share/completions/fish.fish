@@ -3,6 +3,7 @@ complete -c fish -s C -l init-command -d "Run specified command before session"
 complete -c fish -s h -l help -d "Display help and exit"
 complete -c fish -s v -l version -d "Display version and exit"
 complete -c fish -s n -l no-execute -d "Only parse input, do not execute"
+complete -c fish -s N -l no-config -d "Do not read configuration files"
 complete -c fish -s i -l interactive -d "Run in interactive mode"
 complete -c fish -s l -l login -d "Run as a login shell"
 complete -c fish -s p -l profile -d "Output profiling information (excluding startup) to a file" -r
@@ -19,6 +20,7 @@ function __fish_complete_features
 end
 complete -c fish -s f -l features -d "Run with comma-separated feature flags enabled" -a "(__fish_complete_features)" -x
 complete -c fish -l print-rusage-self -d "Print stats from getrusage at exit" -f
+complete -c fish -l print-startup-profile -d "Print the time taken by each phase of startup at exit" -f
 complete -c fish -l print-debug-categories -d "Print the debug categories fish knows" -f
 
 complete -c fish -k -x -a "(__fish_complete_suffix .fish)"
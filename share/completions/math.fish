@@ -1,2 +1,3 @@
 complete -f -c math -r
 complete -f -c math -s s -l scale -r -x
+complete -f -c math -l each -x -d 'Evaluate for each value, named by the argument'
@@ -1303,6 +1303,285 @@ ast_t ast_t::parse_argument_list(const wcstring &src, parse_tree_flags_t flags,
     return parse_from_top(src, flags, out_errors, type_t::freestanding_argument_list);
 }
 
+namespace {
+// The serialized form of an ast is a sequence of unsigned varints, seven bits per byte with the
+// high bit marking continuation. Nodes are written in field order, so a node's type is implied by
+// its position, except at union fields which record the type they hold. Leaves record whether
+// they are sourced, their range, and their token type or keyword. Lists record their length and
+// optional fields whether they are present.
+
+// Flags recorded with the tree.
+enum { serialized_any_error = 1 << 0 };
+
+// Write the fields of an ast, in the form read by deserializer_t.
+class serializer_t {
+   public:
+    explicit serializer_t(std::string *out) : out_(out) {}
+
+    void write(uint64_t val) {
+        while (val >= 0x80) {
+            out_->push_back(static_cast<char>((val & 0x7F) | 0x80));
+            val >>= 7;
+        }
+        out_->push_back(static_cast<char>(val));
+    }
+
+    template <typename Node>
+    enable_if_t<Node::Category == category_t::branch> visit_node_field(Node &node) {
+        node.accept(*this);
+    }
+
+    template <typename Node>
+    enable_if_t<Node::Category == category_t::leaf> visit_node_field(Node &leaf) {
+        write_leaf(leaf);
+    }
+
+    template <parse_token_type_t... TokTypes>
+    void visit_node_field(token_t<TokTypes...> &token) {
+        if (write_leaf(token)) write(static_cast<uint64_t>(token.type));
+    }
+
+    template <parse_keyword_t... KWs>
+    void visit_node_field(keyword_t<KWs...> &keyword) {
+        if (write_leaf(keyword)) write(static_cast<uint64_t>(keyword.kw));
+    }
+
+    template <typename Node>
+    void visit_pointer_field(Node *&node) {
+        template_goo::visit_1_field(*this, *node);
+    }
+
+    template <typename AstNode>
+    void visit_optional_field(optional_t<AstNode> &opt) {
+        write(opt.has_value());
+        if (opt.has_value()) template_goo::visit_1_field(*this, *opt.contents);
+    }
+
+    template <type_t ListNodeType, typename ContentsNode>
+    void visit_list_field(list_t<ListNodeType, ContentsNode> &list) {
+        write(list.count());
+        for (const ContentsNode &child : list) {
+            template_goo::visit_1_field(*this, const_cast<ContentsNode &>(child));
+        }
+    }
+
+    template <typename... Nodes>
+    void visit_union_field(union_ptr_t<Nodes...> &ptr) {
+        node_t *node = ptr.contents.get();
+        write(static_cast<uint64_t>(node->type));
+        // Visit the node as whichever of our types it is.
+        int dummy[] = {(visit_if_is<Nodes>(node), 0)...};
+        (void)dummy;
+    }
+
+    void will_visit_fields_of(const node_t &) {}
+    void did_visit_fields_of(const node_t &) {}
+
+   private:
+    template <typename Node>
+    void visit_if_is(node_t *node) {
+        if (node->type == Node::AstType) template_goo::visit_1_field(*this, *node->as<Node>());
+    }
+
+    // Write the common fields of a leaf, returning whether it is sourced.
+    template <typename Leaf>
+    bool write_leaf(const Leaf &leaf) {
+        write(leaf.unsourced);
+        write(leaf.range.start);
+        write(leaf.range.length);
+        return !leaf.unsourced;
+    }
+
+    std::string *const out_;
+};
+
+// Populate the fields of an ast from the form written by serializer_t.
+// Once anything is out of place, we mark ourselves as failed and stop reading; the partially
+// constructed tree is then discarded.
+class deserializer_t {
+   public:
+    deserializer_t(const char *data, size_t len, size_t src_len)
+        : cursor_(reinterpret_cast<const unsigned char *>(data)),
+          end_(cursor_ + len),
+          src_len_(src_len) {}
+
+    bool failed() const { return failed_; }
+    bool at_end() const { return cursor_ == end_; }
+
+    uint64_t read() {
+        uint64_t result = 0;
+        for (unsigned shift = 0; !failed_; shift += 7) {
+            if (cursor_ == end_ || shift > 63) {
+                failed_ = true;
+                break;
+            }
+            unsigned char c = *cursor_++;
+            result |= static_cast<uint64_t>(c & 0x7F) << shift;
+            if (!(c & 0x80)) return result;
+        }
+        return 0;
+    }
+
+    source_range_t read_range() {
+        uint64_t start = read();
+        uint64_t length = read();
+        if (start > src_len_ || length > src_len_ - start) {
+            failed_ = true;
+            return source_range_t{0, 0};
+        }
+        return source_range_t{static_cast<uint32_t>(start), static_cast<uint32_t>(length)};
+    }
+
+    template <typename Node>
+    enable_if_t<Node::Category == category_t::branch> visit_node_field(Node &node) {
+        if (!failed_) node.accept(*this);
+    }
+
+    template <typename Node>
+    enable_if_t<Node::Category == category_t::leaf> visit_node_field(Node &leaf) {
+        read_leaf(leaf);
+    }
+
+    template <parse_token_type_t... TokTypes>
+    void visit_node_field(token_t<TokTypes...> &token) {
+        if (!read_leaf(token)) return;
+        uint64_t type = read();
+        if (type > UINT8_MAX || !token.allows_token(static_cast<parse_token_type_t>(type))) {
+            failed_ = true;
+            return;
+        }
+        token.type = static_cast<parse_token_type_t>(type);
+    }
+
+    template <parse_keyword_t... KWs>
+    void visit_node_field(keyword_t<KWs...> &keyword) {
+        if (!read_leaf(keyword)) return;
+        uint64_t kw = read();
+        if (kw > UINT8_MAX || !keyword.allows_keyword(static_cast<parse_keyword_t>(kw))) {
+            failed_ = true;
+            return;
+        }
+        keyword.kw = static_cast<parse_keyword_t>(kw);
+    }
+
+    template <typename Node>
+    void visit_pointer_field(Node *&node) {
+        node = new Node();
+        template_goo::visit_1_field(*this, *node);
+    }
+
+    template <typename AstNode>
+    void visit_optional_field(optional_t<AstNode> &opt) {
+        if (read() == 0 || failed_) return;
+        opt.contents = make_unique<AstNode>();
+        template_goo::visit_1_field(*this, *opt.contents);
+    }
+
+    template <type_t ListNodeType, typename ContentsNode>
+    void visit_list_field(list_t<ListNodeType, ContentsNode> &list) {
+        uint64_t count = read();
+        // Every node occupies at least one byte, which bounds a sane count.
+        if (count == 0 || failed_) return;
+        if (count > static_cast<uint64_t>(end_ - cursor_)) {
+            failed_ = true;
+            return;
+        }
+        using contents_ptr_t = typename list_t<ListNodeType, ContentsNode>::contents_ptr_t;
+        auto *array = new contents_ptr_t[count];
+        list.length = static_cast<uint32_t>(count);
+        list.contents = array;
+        for (uint64_t i = 0; i < count && !failed_; i++) {
+            array[i] = make_unique<ContentsNode>();
+            template_goo::visit_1_field(*this, *array[i].ptr);
+        }
+    }
+
+    template <typename... Nodes>
+    void visit_union_field(union_ptr_t<Nodes...> &ptr) {
+        uint64_t type = read();
+        int dummy[] = {(construct_if_is<Nodes>(type, ptr), 0)...};
+        (void)dummy;
+        if (!ptr) failed_ = true;
+    }
+
+    void will_visit_fields_of(const node_t &) {
+        // Guard the stack against malformed data which nests too deeply.
+        if (++depth_ > kMaxDepth) failed_ = true;
+    }
+
+    void did_visit_fields_of(const node_t &) { --depth_; }
+
+   private:
+    template <typename Node, typename Union>
+    void construct_if_is(uint64_t type, Union &ptr) {
+        if (failed_ || type != static_cast<uint64_t>(Node::AstType)) return;
+        auto node = make_unique<Node>();
+        template_goo::visit_1_field(*this, *node);
+        ptr = std::move(node);
+    }
+
+    // Read the common fields of a leaf, returning whether it is sourced.
+    template <typename Leaf>
+    bool read_leaf(Leaf &leaf) {
+        leaf.unsourced = read() != 0;
+        leaf.range = read_range();
+        return !leaf.unsourced && !failed_;
+    }
+
+    static constexpr size_t kMaxDepth = 4096;
+
+    const unsigned char *cursor_;
+    const unsigned char *const end_;
+    const size_t src_len_;
+    size_t depth_{0};
+    bool failed_{false};
+};
+}  // namespace
+
+void ast_t::serialize(std::string *out) const {
+    serializer_t s(out);
+    s.write(any_error_ ? serialized_any_error : 0);
+    for (const auto *ranges : {&extras_.comments, &extras_.semis, &extras_.errors}) {
+        s.write(ranges->size());
+        for (source_range_t r : *ranges) {
+            s.write(r.start);
+            s.write(r.length);
+        }
+    }
+    s.write(static_cast<uint64_t>(top_->type));
+    if (auto *list = top_->try_as<job_list_t>()) {
+        template_goo::visit_1_field(s, *list);
+    } else {
+        template_goo::visit_1_field(s, *top_->as<freestanding_argument_list_t>());
+    }
+}
+
+// static
+maybe_t<ast_t> ast_t::deserialize(const char *data, size_t len, size_t src_len) {
+    deserializer_t d(data, len, src_len);
+    ast_t ast;
+    ast.any_error_ = d.read() & serialized_any_error;
+    for (auto *ranges : {&ast.extras_.comments, &ast.extras_.semis, &ast.extras_.errors}) {
+        uint64_t count = d.read();
+        for (uint64_t i = 0; i < count && !d.failed(); i++) {
+            ranges->push_back(d.read_range());
+        }
+    }
+    uint64_t top_type = d.read();
+    if (top_type == static_cast<uint64_t>(type_t::job_list)) {
+        auto top = make_unique<job_list_t>();
+        template_goo::visit_1_field(d, *top);
+        ast.top_.reset(top.release());
+    } else if (top_type == static_cast<uint64_t>(type_t::freestanding_argument_list)) {
+        auto top = make_unique<freestanding_argument_list_t>();
+        template_goo::visit_1_field(d, *top);
+        ast.top_.reset(top.release());
+    }
+    if (!ast.top_ || d.failed() || !d.at_end()) return none();
+    set_parents(ast.top());
+    return ast;
+}
+
 // \return the depth of a node, i.e. number of parent links.
 static int get_depth(const node_t *node) {
     int result = 0;
@@ -987,6 +987,15 @@ class ast_t {
     /// Pass the original source as \p orig.
     wcstring dump(const wcstring &orig) const;
 
+    /// Append a compact binary encoding of the tree to \p out. Like the tree itself, the encoding
+    /// refers to the source only through ranges; the source is not stored.
+    void serialize(std::string *out) const;
+
+    /// Reconstruct a tree from \p len bytes of output of serialize(), at \p data. \p src_len is
+    /// the length of the source that the tree was parsed from.
+    /// \return none if the data is truncated or malformed.
+    static maybe_t<ast_t> deserialize(const char *data, size_t len, size_t src_len);
+
     /// Extra source ranges.
     /// These are only generated if the corresponding flags are set.
     struct extras_t {
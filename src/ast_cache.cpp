@@ -0,0 +1,152 @@
+// An on-disk cache of parsed scripts.
+//
+// Each script gets a file in the "parsed" subdirectory of the cache directory, named for a hash of
+// the script's path. The file is a header identifying the script, followed by the serialized ast.
+// An entry is used only if its header matches exactly: the same fish version and feature flags,
+// and the same path, file metadata, and contents. Only scripts without parse errors are stored,
+// so a hit also skips error detection.
+#include "config.h"  // IWYU pragma: keep
+
+#include "ast_cache.h"
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <string>
+
+#include "fallback.h"  // IWYU pragma: keep
+#include "fds.h"
+#include "fish_version.h"
+#include "flog.h"
+#include "future_feature_flags.h"
+#include "parse_tree.h"
+#include "path.h"
+#include "wutil.h"  // IWYU pragma: keep
+
+// The header at the start of each cache file. Bump the trailing digit when the format changes.
+static constexpr char kAstCacheMagic[8] = {'\0', 'f', 'i', 's', 'h', 'a', 's', '1'};
+
+// Scripts modified more recently than this many seconds ago are not stored. Such files are often
+// transient, like the output of psub, and caching them would only fill the cache with entries
+// which are never read.
+static constexpr time_t kMinCacheableAge = 10;
+
+/// Hash some data, using FNV-1a.
+template <typename Char>
+static uint64_t hash_chars(const Char *data, size_t len) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= static_cast<uint64_t>(data[i]);
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static void append_u64(std::string *out, uint64_t val) {
+    out->append(reinterpret_cast<const char *>(&val), sizeof val);
+}
+
+static void append_str(std::string *out, const char *str, size_t len) {
+    append_u64(out, len);
+    out->append(str, len);
+}
+
+/// \return the path of the cache file for the script at \p narrow_path, or an empty string if
+/// there is no cache directory.
+static std::string cache_file_path(const std::string &narrow_path) {
+    wcstring dir;
+    if (!path_get_cache(dir)) return {};
+    char name[32];
+    snprintf(name, sizeof name, "/parsed/%016llx",
+             static_cast<unsigned long long>(hash_chars(narrow_path.data(), narrow_path.size())));
+    return wcs2string(dir) + name;
+}
+
+/// \return the header which a cache file for the given script must start with.
+static std::string cache_header(const std::string &narrow_path, const struct stat &buf,
+                                const wcstring &src) {
+    std::string result(kAstCacheMagic, sizeof kAstCacheMagic);
+    const char *version = get_fish_version();
+    append_str(&result, version, std::strlen(version));
+    uint64_t features = 0;
+    for (int i = 0; i < features_t::flag_count; i++) {
+        if (feature_test(static_cast<features_t::flag_t>(i))) features |= 1ULL << i;
+    }
+    append_u64(&result, features);
+    append_str(&result, narrow_path.data(), narrow_path.size());
+    file_id_t id = file_id_t::from_stat(buf);
+    for (uint64_t val :
+         {static_cast<uint64_t>(id.device), static_cast<uint64_t>(id.inode), id.size,
+          static_cast<uint64_t>(id.change_seconds), static_cast<uint64_t>(id.change_nanoseconds),
+          static_cast<uint64_t>(id.mod_seconds), static_cast<uint64_t>(id.mod_nanoseconds)}) {
+        append_u64(&result, val);
+    }
+    // The contents guard against changes which leave the metadata alone, and against the file
+    // being decoded differently, e.g. in another locale.
+    append_u64(&result, src.size());
+    append_u64(&result, hash_chars(src.data(), src.size()));
+    return result;
+}
+
+maybe_t<ast::ast_t> ast_cache_load(const wcstring &path, const struct stat &buf,
+                                   const wcstring &src) {
+    std::string narrow_path = wcs2string(path);
+    std::string cache_path = cache_file_path(narrow_path);
+    if (cache_path.empty()) return none();
+
+    autoclose_fd_t fd{open_cloexec(cache_path, O_RDONLY)};
+    struct stat cache_buf;
+    if (!fd.valid() || fstat(fd.fd(), &cache_buf) != 0) return none();
+
+    std::string header = cache_header(narrow_path, buf, src);
+    if (cache_buf.st_size < static_cast<off_t>(header.size())) return none();
+    size_t len = static_cast<size_t>(cache_buf.st_size);
+    void *map = mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd.fd(), 0);
+    if (map == MAP_FAILED) return none();
+
+    const char *data = static_cast<const char *>(map);
+    maybe_t<ast::ast_t> result{};
+    if (std::memcmp(data, header.data(), header.size()) == 0) {
+        result = ast::ast_t::deserialize(data + header.size(), len - header.size(), src.size());
+        if (!result) FLOGF(ast_cache, L"Malformed cache entry for '%ls'", path.c_str());
+    }
+    munmap(map, len);
+    return result;
+}
+
+void ast_cache_store(const wcstring &path, const struct stat &buf, const parsed_source_t &ps) {
+    if (time(nullptr) - buf.st_mtime < kMinCacheableAge) return;
+    std::string narrow_path = wcs2string(path);
+    std::string cache_path = cache_file_path(narrow_path);
+    if (cache_path.empty()) return;
+
+    std::string contents = cache_header(narrow_path, buf, ps.src);
+    ps.ast.serialize(&contents);
+
+    // Write a temporary file and move it into place, so that readers never see a partial entry.
+    std::string tmp_path = cache_path + ".XXXXXX";
+    autoclose_fd_t fd{fish_mkstemp_cloexec(&tmp_path[0])};
+    if (!fd.valid() && errno == ENOENT) {
+        // Create the "parsed" directory and try again.
+        mkdir(cache_path.substr(0, cache_path.rfind('/')).c_str(), 0700);
+        tmp_path = cache_path + ".XXXXXX";
+        fd.reset(fish_mkstemp_cloexec(&tmp_path[0]));
+    }
+    if (!fd.valid()) {
+        FLOGF(ast_cache, L"Unable to create cache entry for '%ls': %s", path.c_str(),
+              std::strerror(errno));
+        return;
+    }
+    bool ok = write_loop(fd.fd(), contents.data(), contents.size()) >= 0;
+    fd.close();
+    if (!ok || rename(tmp_path.c_str(), cache_path.c_str()) != 0) {
+        FLOGF(ast_cache, L"Unable to write cache entry for '%ls': %s", path.c_str(),
+              std::strerror(errno));
+        unlink(tmp_path.c_str());
+    }
+}
@@ -0,0 +1,23 @@
+// An on-disk cache of parsed scripts.
+#ifndef FISH_AST_CACHE_H
+#define FISH_AST_CACHE_H
+
+#include <sys/stat.h>
+
+#include "ast.h"
+#include "common.h"
+#include "maybe.h"
+
+struct parsed_source_t;
+
+/// Look up the cached ast for the script at the absolute path \p path, whose file has the metadata
+/// \p buf and whose (decoded) contents are \p src.
+/// \return none if there is no entry, or if the entry is stale.
+maybe_t<ast::ast_t> ast_cache_load(const wcstring &path, const struct stat &buf,
+                                   const wcstring &src);
+
+/// Store the parsed script \p ps, read from the absolute path \p path with file metadata \p buf.
+/// This may decline to store scripts which are unlikely to be read again.
+void ast_cache_store(const wcstring &path, const struct stat &buf, const parsed_source_t &ps);
+
+#endif
@@ -3,18 +3,27 @@
 
 #include "autoload.h"
 
+#include <time.h>
+
 #include <chrono>
+#include <cwchar>
+#include <unordered_set>
 
 #include "common.h"
 #include "env.h"
 #include "exec.h"
 #include "lru.h"
 #include "parser.h"
+#include "util.h"
+#include "wcstringutil.h"
 #include "wutil.h"  // IWYU pragma: keep
 
 /// The time before we'll recheck an autoloaded file.
 static const int kAutoloadStalenessInterval = 15;
 
+/// The file name suffix of autoloadable files.
+static const wchar_t *const kAutoloadSuffix = L".fish";
+
 /// Represents a file that we might want to autoload.
 struct autoloadable_file_t {
     /// The path to the file.
@@ -33,6 +42,22 @@ class autoload_file_cache_t {
     /// The directories from which to load.
     const wcstring_list_t dirs_{};
 
+    /// The commands which have a file in a directory, as of when it was listed.
+    struct dir_index_t {
+        std::unordered_set<wcstring> cmds;
+
+        /// The directory's metadata when it was listed, or kInvalidFileID if the listing must be
+        /// redone the next time the directory is revalidated.
+        file_id_t dir_id;
+
+        /// When we last checked that the directory is unchanged.
+        timestamp_t last_checked;
+    };
+
+    /// The index of each of our directories which we have listed.
+    /// The key is the directory.
+    std::unordered_map<wcstring, dir_index_t> dir_indexes_;
+
     /// Our LRU cache of checks that were misses.
     /// The key is the command, the  value is the time of the check.
     struct misses_lru_cache_t : public lru_cache_t<misses_lru_cache_t, timestamp_t> {};
@@ -52,9 +77,16 @@ class autoload_file_cache_t {
     /// \return whether a timestamp is fresh enough to use.
     static bool is_fresh(timestamp_t then, timestamp_t now);
 
+    /// \return the index of directory \p dir, listing it if we have not yet.
+    /// If \p revalidate is set, or the directory was last checked too long ago, first check that
+    /// the directory has not changed since listing it.
+    const dir_index_t &index_dir(const wcstring &dir, bool revalidate);
+
     /// Attempt to find an autoloadable file by searching our path list for a given comand.
+    /// If \p revalidate is set, directories are checked for changes; otherwise the directories are
+    /// assumed unchanged if they were checked recently.
     /// \return the file, or none() if none.
-    maybe_t<autoloadable_file_t> locate_file(const wcstring &cmd) const;
+    maybe_t<autoloadable_file_t> locate_file(const wcstring &cmd, bool revalidate);
 
    public:
     /// Initialize with a set of directories.
@@ -70,17 +102,66 @@ class autoload_file_cache_t {
     /// If \p allow_stale is true, allow stale entries; otherwise discard them.
     /// This returns an autoloadable file, or none() if there is no such file.
     maybe_t<autoloadable_file_t> check(const wcstring &cmd, bool allow_stale = false);
+
+    /// Add the names of all commands which have a file in one of our directories to \p out.
+    void get_commands(std::unordered_set<wcstring> *out);
 };
 
-maybe_t<autoloadable_file_t> autoload_file_cache_t::locate_file(const wcstring &cmd) const {
+const autoload_file_cache_t::dir_index_t &autoload_file_cache_t::index_dir(const wcstring &dir,
+                                                                           bool revalidate) {
+    const timestamp_t now = current_timestamp();
+    auto iter = dir_indexes_.find(dir);
+    if (iter != dir_indexes_.end() && !revalidate && is_fresh(iter->second.last_checked, now)) {
+        return iter->second;
+    }
+
+    file_id_t dir_id = file_id_for_path(dir);
+    if (iter != dir_indexes_.end() && dir_id != kInvalidFileID && dir_id == iter->second.dir_id) {
+        iter->second.last_checked = now;
+        return iter->second;
+    }
+
+    dir_index_t &index = dir_indexes_[dir];
+    index.cmds.clear();
+    index.dir_id = dir_id;
+    index.last_checked = now;
+    // A directory modified within the granularity of its timestamp may change again without its
+    // timestamp changing, so list it again next time.
+    if (dir_id.mod_seconds >= time(nullptr) - 1) index.dir_id = kInvalidFileID;
+
+    dir_t dir_handle(dir);
+    if (!dir_handle.valid()) return index;
+    const size_t suffix_len = std::wcslen(kAutoloadSuffix);
+    wcstring name;
+    while (dir_handle.read(name)) {
+        if (name.size() > suffix_len && string_suffixes_string(kAutoloadSuffix, name)) {
+            name.resize(name.size() - suffix_len);
+            index.cmds.insert(std::move(name));
+        }
+    }
+    return index;
+}
+
+void autoload_file_cache_t::get_commands(std::unordered_set<wcstring> *out) {
+    for (const wcstring &dir : dirs()) {
+        const dir_index_t &index = index_dir(dir, true /* revalidate */);
+        out->insert(index.cmds.begin(), index.cmds.end());
+    }
+}
+
+maybe_t<autoloadable_file_t> autoload_file_cache_t::locate_file(const wcstring &cmd,
+                                                                bool revalidate) {
     // Re-use the storage for path.
     wcstring path;
     for (const wcstring &dir : dirs()) {
+        // Only directories whose listing has the command need to be checked on disk.
+        if (!index_dir(dir, revalidate).cmds.count(cmd)) continue;
+
         // Construct the path as dir/cmd.fish
         path = dir;
         path += L"/";
         path += cmd;
-        path += L".fish";
+        path += kAutoloadSuffix;
 
         file_id_t file_id = file_id_for_path(path);
         if (file_id != kInvalidFileID) {
@@ -121,8 +202,10 @@ maybe_t<autoloadable_file_t> autoload_file_cache_t::check(const wcstring &cmd, b
         misses_cache_.evict_node(cmd);
     }
 
-    // We couldn't satisfy this request from the cache. Hit the disk.
-    maybe_t<autoloadable_file_t> file = locate_file(cmd);
+    // We couldn't satisfy this request from the cache. Consult the directory listings, which must
+    // be checked for changes unless stale entries are allowed; even then, they are checked again
+    // once they are no longer fresh, so that new files are eventually found.
+    maybe_t<autoloadable_file_t> file = locate_file(cmd, !allow_stale);
     if (file.has_value()) {
         auto ins = known_files_.emplace(cmd, known_file_t{*file, current_timestamp()});
         assert(ins.second && "Known files cache should not have contained this cmd");
@@ -150,6 +233,17 @@ bool autoload_t::can_autoload(const wcstring &cmd) {
     return cache_->check(cmd, true /* allow stale */).has_value();
 }
 
+wcstring_list_t autoload_t::get_autoloadable_commands(const environment_t &env) {
+    wcstring_list_t paths;
+    if (maybe_t<env_var_t> mvar = env.get(env_var_name_)) paths = mvar->as_list();
+    if (paths != cache_->dirs()) {
+        cache_ = make_unique<autoload_file_cache_t>(std::move(paths));
+    }
+    std::unordered_set<wcstring> cmds;
+    cache_->get_commands(&cmds);
+    return wcstring_list_t(cmds.begin(), cmds.end());
+}
+
 wcstring_list_t autoload_t::get_autoloaded_commands() const {
     wcstring_list_t result;
     result.reserve(autoloaded_files_.size());
@@ -198,6 +292,16 @@ maybe_t<wcstring> autoload_t::resolve_command(const wcstring &cmd, const wcstrin
 }
 
 void autoload_t::perform_autoload(const wcstring &path, parser_t &parser) {
+    // Files autoloaded while loading another one count towards that one's time.
+    static size_t s_autoload_depth = 0;
+    bool profiling = startup_profile_recording();
+    bool timed = profiling && s_autoload_depth == 0;
+    long long start = timed ? get_time() : 0;
+
     wcstring script_source = L"source " + escape_string(path, ESCAPE_ALL);
+    ++s_autoload_depth;
     exec_subshell(script_source, parser, false /* do not apply exit status */);
+    --s_autoload_depth;
+
+    if (profiling) startup_profile_add_autoload(timed ? get_time() - start : 0);
 }
@@ -88,6 +88,10 @@ class autoload_t {
     /// This does not actually mark the command as being autoloaded.
     bool can_autoload(const wcstring &cmd);
 
+    /// \return the names of all commands which could be autoloaded from the paths given by our
+    /// environment variable in \p env, in no particular order.
+    wcstring_list_t get_autoloadable_commands(const environment_t &env);
+
     /// \return the names of all commands that have been autoloaded. Note this includes "in-flight"
     /// commands.
     wcstring_list_t get_autoloaded_commands() const;
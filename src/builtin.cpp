@@ -357,6 +357,12 @@ static const builtin_data_t builtin_datas[] = {
     {L":", &builtin_true, N_(L"Return a successful result")},
     {L"[", &builtin_test, N_(L"Test a condition")},
     {L"_", &builtin_gettext, N_(L"Translate a string")},
+    {L"__fish_contains_opt", &builtin_fish_contains_opt,
+     N_(L"Test if an option has been given in the current commandline")},
+    {L"__fish_seen_subcommand_from", &builtin_fish_seen_subcommand_from,
+     N_(L"Test if any of the given subcommands is in the current commandline")},
+    {L"__fish_use_subcommand", &builtin_fish_use_subcommand,
+     N_(L"Test if a non-switch argument has been given in the current commandline")},
     {L"and", &builtin_generic, N_(L"Execute command if previous command succeeded")},
     {L"argparse", &builtin_argparse, N_(L"Parse options in fish script")},
     {L"begin", &builtin_generic, N_(L"Create a block of code")},
@@ -7,6 +7,7 @@
 #include <cwchar>
 
 #include "builtin.h"
+#include "builtin_commandline.h"
 #include "common.h"
 #include "fallback.h"  // IWYU pragma: keep
 #include "input.h"
@@ -16,6 +17,7 @@
 #include "proc.h"
 #include "reader.h"
 #include "tokenizer.h"
+#include "wcstringutil.h"
 #include "wgetopt.h"
 #include "wutil.h"  // IWYU pragma: keep
 
@@ -83,6 +85,27 @@ static void replace_part(const wchar_t *begin, const wchar_t *end, const wchar_t
     reader_set_buffer(out, out_pos);
 }
 
+/// Append the unescaped string tokens of the selection to \p out.
+///
+/// \param begin start of selection
+/// \param end  end of selection
+/// \param cut_at_cursor whether to stop at the token which contains or touches the cursor
+/// \param pos the position of the cursor relative to \p begin
+static void tokenize_part(const wchar_t *begin, const wchar_t *end, bool cut_at_cursor, size_t pos,
+                          wcstring_list_t *out) {
+    wcstring buff(begin, end - begin);
+    tokenizer_t tok(buff.c_str(), TOK_ACCEPT_UNFINISHED);
+    while (auto token = tok.next()) {
+        if ((cut_at_cursor) && (token->offset + token->length >= pos)) break;
+
+        if (token->type == token_type_t::string) {
+            wcstring tmp = tok.text_of(*token);
+            unescape_string_in_place(&tmp, UNESCAPE_INCOMPLETE);
+            out->push_back(std::move(tmp));
+        }
+    }
+}
+
 /// Output the specified selection.
 ///
 /// \param begin start of selection
@@ -97,21 +120,13 @@ static void write_part(const wchar_t *begin, const wchar_t *end, int cut_at_curs
     size_t pos = cursor_pos - (begin - buffer);
 
     if (tokenize) {
-        // std::fwprintf( stderr, L"Subshell: %ls, end char %lc\n", buff, *end );
+        wcstring_list_t tokens;
+        tokenize_part(begin, end, cut_at_cursor, pos, &tokens);
         wcstring out;
-        wcstring buff(begin, end - begin);
-        tokenizer_t tok(buff.c_str(), TOK_ACCEPT_UNFINISHED);
-        while (auto token = tok.next()) {
-            if ((cut_at_cursor) && (token->offset + token->length >= pos)) break;
-
-            if (token->type == token_type_t::string) {
-                wcstring tmp = tok.text_of(*token);
-                unescape_string_in_place(&tmp, UNESCAPE_INCOMPLETE);
-                out.append(tmp);
-                out.push_back(L'\n');
-            }
+        for (const wcstring &token : tokens) {
+            out.append(token);
+            out.push_back(L'\n');
         }
-
         streams.out.append(out);
     } else {
         if (cut_at_cursor) {
@@ -123,6 +138,134 @@ static void write_part(const wchar_t *begin, const wchar_t *end, int cut_at_curs
     }
 }
 
+bool commandline_get_state(const parser_t &parser, wcstring *out_buffer, size_t *out_cursor) {
+    const auto &ld = parser.libdata();
+    if (!ld.transient_commandlines.empty()) {
+        *out_buffer = ld.transient_commandlines.back();
+        *out_cursor = out_buffer->size();
+        return true;
+    }
+    const wchar_t *buffer = reader_get_buffer();
+    if (!buffer) return false;
+    *out_buffer = buffer;
+    *out_cursor = reader_get_cursor_pos();
+    return true;
+}
+
+commandline_tokens_t commandline_get_tokens(const wcstring &buffer, size_t cursor) {
+    commandline_tokens_t result;
+    const wchar_t *begin = nullptr, *end = nullptr;
+    parse_util_process_extent(buffer.c_str(), cursor, &begin, &end, nullptr);
+    if (begin && end) {
+        tokenize_part(begin, end, true, cursor - (begin - buffer.c_str()), &result.process_tokens);
+    }
+    parse_util_token_extent(buffer.c_str(), cursor, &begin, &end, nullptr, nullptr);
+    if (begin) {
+        result.current_token.assign(begin, cursor - (begin - buffer.c_str()));
+    }
+    return result;
+}
+
+int commandline_seen_subcommand_from(const commandline_tokens_t &tokens,
+                                     const wcstring_list_t &args) {
+    const wcstring_list_t &cmd = tokens.process_tokens;
+    for (size_t i = 1; i < cmd.size(); i++) {
+        if (contains(args, cmd[i])) return STATUS_CMD_OK;
+    }
+    return STATUS_CMD_ERROR;
+}
+
+int commandline_use_subcommand(const commandline_tokens_t &tokens) {
+    const wcstring_list_t &cmd = tokens.process_tokens;
+    for (size_t i = 1; i < cmd.size(); i++) {
+        if (!string_prefixes_string(L"-", cmd[i])) return STATUS_CMD_ERROR;
+    }
+    return STATUS_CMD_OK;
+}
+
+/// \return whether \p token is a group of short options containing \p opt, i.e. whether it
+/// matches the regex ^-[^-]*opt.
+static bool short_opt_matches(const wcstring &token, const wcstring &opt) {
+    if (token.empty() || token[0] != L'-') return false;
+    for (size_t pos = 1; pos < token.size(); pos++) {
+        if (token.compare(pos, opt.size(), opt) == 0) return true;
+        if (token[pos] == L'-') break;
+    }
+    return false;
+}
+
+int commandline_contains_opt(const commandline_tokens_t &tokens, const wcstring_list_t &args,
+                             wcstring *out_err) {
+    wcstring_list_t short_opts, long_opts;
+    bool next_short = false;
+    for (const wcstring &arg : args) {
+        if (next_short) {
+            next_short = false;
+            short_opts.push_back(arg);
+        } else if (arg == L"-s") {
+            next_short = true;
+        } else if (string_prefixes_string(L"-", arg)) {
+            *out_err = format_string(_(L"%ls: Unknown option %ls\n"), L"__fish_contains_opt",
+                                     arg.c_str());
+            return STATUS_CMD_ERROR;
+        } else {
+            long_opts.push_back(arg);
+        }
+    }
+
+    const wcstring_list_t &cmd = tokens.process_tokens;
+    for (const wcstring &opt : short_opts) {
+        if (opt.empty()) continue;
+        for (const wcstring &token : cmd) {
+            if (short_opt_matches(token, opt)) return STATUS_CMD_OK;
+        }
+        if (short_opt_matches(tokens.current_token, opt)) return STATUS_CMD_OK;
+    }
+    for (const wcstring &opt : long_opts) {
+        if (opt.empty()) continue;
+        if (contains(cmd, L"--" + opt)) return STATUS_CMD_OK;
+    }
+    return STATUS_CMD_ERROR;
+}
+
+/// Get the tokens for the completion helper builtins. Without a command line, these behave as if
+/// it were empty.
+static commandline_tokens_t get_tokens_for_helper(const parser_t &parser) {
+    wcstring buffer;
+    size_t cursor;
+    if (!commandline_get_state(parser, &buffer, &cursor)) return {};
+    return commandline_get_tokens(buffer, cursor);
+}
+
+/// Collect the arguments of a builtin, which does not take any options.
+static wcstring_list_t builtin_args(wchar_t **argv) {
+    wcstring_list_t result;
+    for (int i = 1; argv[i]; i++) result.push_back(argv[i]);
+    return result;
+}
+
+/// The __fish_seen_subcommand_from builtin, used by completions.
+maybe_t<int> builtin_fish_seen_subcommand_from(parser_t &parser, io_streams_t &streams,
+                                               wchar_t **argv) {
+    UNUSED(streams);
+    return commandline_seen_subcommand_from(get_tokens_for_helper(parser), builtin_args(argv));
+}
+
+/// The __fish_use_subcommand builtin, used by completions.
+maybe_t<int> builtin_fish_use_subcommand(parser_t &parser, io_streams_t &streams, wchar_t **argv) {
+    UNUSED(streams);
+    UNUSED(argv);
+    return commandline_use_subcommand(get_tokens_for_helper(parser));
+}
+
+/// The __fish_contains_opt builtin, used by completions.
+maybe_t<int> builtin_fish_contains_opt(parser_t &parser, io_streams_t &streams, wchar_t **argv) {
+    wcstring err;
+    int status = commandline_contains_opt(get_tokens_for_helper(parser), builtin_args(argv), &err);
+    streams.err.append(err);
+    return status;
+}
+
 /// The commandline builtin. It is used for specifying a new value for the commandline.
 maybe_t<int> builtin_commandline(parser_t &parser, io_streams_t &streams, wchar_t **argv) {
     // Pointer to what the commandline builtin considers to be the current contents of the command
@@ -151,14 +294,11 @@ maybe_t<int> builtin_commandline(parser_t &parser, io_streams_t &streams, wchar_
     const wchar_t *begin = nullptr, *end = nullptr;
 
     const auto &ld = parser.libdata();
-    wcstring transient_commandline;
-    if (!ld.transient_commandlines.empty()) {
-        transient_commandline = ld.transient_commandlines.back();
-        current_buffer = transient_commandline.c_str();
-        current_cursor_pos = transient_commandline.size();
-    } else {
-        current_buffer = reader_get_buffer();
-        current_cursor_pos = reader_get_cursor_pos();
+    wcstring state_buffer;
+    size_t state_cursor;
+    if (commandline_get_state(parser, &state_buffer, &state_cursor)) {
+        current_buffer = state_buffer.c_str();
+        current_cursor_pos = state_cursor;
     }
 
     if (!current_buffer) {
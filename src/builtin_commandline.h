@@ -5,7 +5,46 @@
 #include <cstring>
 #include <cwchar>
 
+#include "common.h"
+
 class parser_t;
 
 maybe_t<int> builtin_commandline(parser_t &parser, io_streams_t &streams, wchar_t **argv);
+
+/// The parts of the command line that the completion helpers look at.
+struct commandline_tokens_t {
+    /// The unescaped tokens of the process under the cursor, which precede the cursor. This is what
+    /// `commandline -opc` prints.
+    wcstring_list_t process_tokens;
+
+    /// The token under the cursor, up to the cursor, without unescaping. This is what
+    /// `commandline -ct` prints.
+    wcstring current_token;
+};
+
+/// Get the command line that the commandline builtin operates on: the innermost transient
+/// command line if there is one, or else the reader's buffer.
+/// \return false if there is no command line, e.g. in a non-interactive shell.
+bool commandline_get_state(const parser_t &parser, wcstring *out_buffer, size_t *out_cursor);
+
+/// Extract the tokens of \p buffer that the completion helpers look at, with the cursor at
+/// \p cursor.
+commandline_tokens_t commandline_get_tokens(const wcstring &buffer, size_t cursor);
+
+/// Native implementations of the completion helpers. These return a status.
+/// __fish_seen_subcommand_from: whether any token after the command is one of \p args.
+int commandline_seen_subcommand_from(const commandline_tokens_t &tokens,
+                                     const wcstring_list_t &args);
+/// __fish_use_subcommand: whether every token after the command looks like an option.
+int commandline_use_subcommand(const commandline_tokens_t &tokens);
+/// __fish_contains_opt: whether any of the options in \p args has been given. \p args are
+/// long option names, or short option characters preceded by -s.
+/// \return STATUS_CMD_ERROR and set \p out_err if \p args are invalid.
+int commandline_contains_opt(const commandline_tokens_t &tokens, const wcstring_list_t &args,
+                             wcstring *out_err);
+
+maybe_t<int> builtin_fish_seen_subcommand_from(parser_t &parser, io_streams_t &streams,
+                                               wchar_t **argv);
+maybe_t<int> builtin_fish_use_subcommand(parser_t &parser, io_streams_t &streams, wchar_t **argv);
+maybe_t<int> builtin_fish_contains_opt(parser_t &parser, io_streams_t &streams, wchar_t **argv);
 #endif
@@ -20,12 +20,21 @@
 #include "wgetopt.h"
 #include "wutil.h"  // IWYU pragma: keep
 
-enum hist_cmd_t { HIST_SEARCH = 1, HIST_DELETE, HIST_CLEAR, HIST_MERGE, HIST_SAVE, HIST_UNDEF };
+enum hist_cmd_t {
+    HIST_SEARCH = 1,
+    HIST_DELETE,
+    HIST_CLEAR,
+    HIST_MERGE,
+    HIST_SAVE,
+    HIST_EXPORT,
+    HIST_UNDEF
+};
 
 // Must be sorted by string, not enum or random.
 static const enum_map<hist_cmd_t> hist_enum_map[] = {
-    {HIST_CLEAR, L"clear"}, {HIST_DELETE, L"delete"}, {HIST_MERGE, L"merge"},
-    {HIST_SAVE, L"save"},   {HIST_SEARCH, L"search"}, {HIST_UNDEF, nullptr}};
+    {HIST_CLEAR, L"clear"}, {HIST_DELETE, L"delete"}, {HIST_EXPORT, L"export"},
+    {HIST_MERGE, L"merge"}, {HIST_SAVE, L"save"},     {HIST_SEARCH, L"search"},
+    {HIST_UNDEF, nullptr}};
 
 struct history_cmd_opts_t {
     hist_cmd_t hist_cmd = HIST_UNDEF;
@@ -303,6 +312,14 @@ maybe_t<int> builtin_history(parser_t &parser, io_streams_t &streams, wchar_t **
             history->save();
             break;
         }
+        case HIST_EXPORT: {
+            if (check_for_unexpected_hist_args(opts, cmd, args, streams)) {
+                status = STATUS_INVALID_ARGS;
+                break;
+            }
+            history->export_as_text(streams);
+            break;
+        }
         case HIST_UNDEF: {
             DIE("Unexpected HIST_UNDEF seen");
         }
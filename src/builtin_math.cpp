@@ -5,16 +5,21 @@
 
 #include <algorithm>
 #include <cerrno>
+#include <clocale>
 #include <cmath>
 #include <cstddef>
 #include <cstring>
 #include <limits>
+#include <memory>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include "builtin.h"
 #include "common.h"
 #include "fallback.h"  // IWYU pragma: keep
 #include "io.h"
+#include "lru.h"
 #include "tinyexpr.h"
 #include "wgetopt.h"
 #include "wutil.h"  // IWYU pragma: keep
@@ -32,6 +37,8 @@ struct math_cmd_opts_t {
     bool have_scale = false;
     int scale = kDefaultScale;
     int base = 10;
+    // The variable for --each, or null if the expression is evaluated once.
+    const wchar_t *each = nullptr;
 };
 
 // This command is atypical in using the "+" (REQUIRE_ORDER) option for flag parsing.
@@ -40,8 +47,21 @@ static const wchar_t *const short_options = L"+:hs:b:";
 static const struct woption long_options[] = {{L"scale", required_argument, nullptr, 's'},
                                               {L"base", required_argument, nullptr, 'b'},
                                               {L"help", no_argument, nullptr, 'h'},
+                                              {L"each", required_argument, nullptr, 'e'},
                                               {nullptr, 0, nullptr, 0}};
 
+/// \return whether \p name can be used as a variable in an expression. It must look like the
+/// function names, and "x" is taken by multiplication.
+static bool valid_each_name(const wchar_t *name) {
+    if (!(name[0] >= L'a' && name[0] <= L'z') || std::wcscmp(name, L"x") == 0) return false;
+    for (const wchar_t *c = name; *c; c++) {
+        if (!((*c >= L'a' && *c <= L'z') || (*c >= L'0' && *c <= L'9') || *c == L'_')) {
+            return false;
+        }
+    }
+    return true;
+}
+
 static int parse_cmd_opts(math_cmd_opts_t &opts, int *optind,  //!OCLINT(high ncss method)
                           int argc, wchar_t **argv, parser_t &parser, io_streams_t &streams) {
     const wchar_t *cmd = L"math";
@@ -79,6 +99,16 @@ static int parse_cmd_opts(math_cmd_opts_t &opts, int *optind,  //!OCLINT(high nc
                 }
                 break;
             }
+            case 'e': {
+                // Only the long option exists, `math -e` is the negative of Euler's number.
+                if (!valid_each_name(w.woptarg)) {
+                    streams.err.append_format(_(L"%ls: '%ls' is not a valid variable name\n"),
+                                              cmd, w.woptarg);
+                    return STATUS_INVALID_ARGS;
+                }
+                opts.each = w.woptarg;
+                break;
+            }
             case 'h': {
                 opts.print_help = true;
                 break;
@@ -113,29 +143,45 @@ static bool math_args_from_stdin(const io_streams_t &streams) {
     return streams.stdin_is_directly_redirected;
 }
 
-/// Get the arguments from stdin.
-static const wchar_t *math_get_arg_stdin(wcstring *storage, const io_streams_t &streams) {
-    std::string arg;
-    for (;;) {
-        char ch = '\0';
-        long rc = read_blocked(streams.stdin_fd, &ch, 1);
+/// Input read from stdin that has not been returned as arguments yet. We read all of stdin either
+/// way, so this reads it in chunks instead of a byte at a time.
+struct math_stdin_t {
+    std::string buffer;
+    // The offset in buffer of the next argument.
+    size_t start = 0;
+    bool eof = false;
+};
 
+/// Get the arguments from stdin, one per line.
+static const wchar_t *math_get_arg_stdin(wcstring *storage, math_stdin_t *input,
+                                         const io_streams_t &streams) {
+    std::string &buffer = input->buffer;
+    size_t scanned = input->start;
+    size_t end;
+    while ((end = buffer.find('\n', scanned)) == std::string::npos && !input->eof) {
+        scanned = buffer.size();
+        char chunk[4096];
+        long rc = read_blocked(streams.stdin_fd, chunk, sizeof chunk);
         if (rc < 0) {  // error
             wperror(L"read");
             return nullptr;
         }
+        if (rc == 0) input->eof = true;
+        buffer.append(chunk, rc);
+    }
 
-        if (rc == 0) {  // EOF
-            if (arg.empty()) return nullptr;
-            break;
-        }
-
-        if (ch == '\n') break;  // we're done
-
-        arg += ch;
+    if (end == std::string::npos) {  // EOF
+        if (input->start == buffer.size()) return nullptr;
+        end = buffer.size();
     }
 
-    *storage = str2wcstring(arg);
+    *storage = str2wcstring(&buffer[input->start], end - input->start);
+    input->start = std::min(end + 1, buffer.size());
+    // Drop what we have returned once it is at least half of the buffer.
+    if (input->start >= buffer.size() / 2) {
+        buffer.erase(0, input->start);
+        input->start = 0;
+    }
     return storage->c_str();
 }
 
@@ -147,11 +193,11 @@ static const wchar_t *math_get_arg_argv(int *argidx, wchar_t **argv) {
 /// Get the arguments from argv or stdin based on the execution context. This mimics how builtin
 /// `string` does it.
 static const wchar_t *math_get_arg(int *argidx, wchar_t **argv, wcstring *storage,
-                                   const io_streams_t &streams) {
+                                   math_stdin_t *input, const io_streams_t &streams) {
     if (math_args_from_stdin(streams)) {
         assert(streams.stdin_fd >= 0 &&
                "stdin should not be closed since it is directly redirected");
-        return math_get_arg_stdin(storage, streams);
+        return math_get_arg_stdin(storage, input, streams);
     }
     return math_get_arg_argv(argidx, argv);
 }
@@ -221,13 +267,96 @@ static wcstring format_double(double v, const math_cmd_opts_t &opts) {
     return ret;
 }
 
-/// Evaluate math expressions.
+/// A compiled expression, shared with the cache.
+using math_expr_ref_t = std::shared_ptr<te_expr>;
+
+/// The number of compiled expressions to remember.
+static constexpr size_t kMathCacheSize = 64;
+
+/// Compiled expressions, keyed by the --each variable and their shape (see te_split_literals).
+/// This lets a loop which runs `math $i + 1` compile the expression only once, because its numbers
+/// are passed in when it is evaluated.
+class math_expr_cache_t : public lru_cache_t<math_expr_cache_t, math_expr_ref_t> {
+   public:
+    math_expr_cache_t() : lru_cache_t<math_expr_cache_t, math_expr_ref_t>(kMathCacheSize) {}
+};
+static owning_lock<math_expr_cache_t> s_math_expr_cache;
+
+/// Compile \p expression, or return it from the cache. The values of its variables, which are
+/// \p var_name (if not null) followed by the numbers in the expression, are stored in \p values,
+/// with 0 for \p var_name. \return nullptr and set \p error if the expression does not compile.
+static math_expr_ref_t get_compiled_expression(const wcstring &expression, const wchar_t *var_name,
+                                               std::vector<double> *values, te_error_t *error) {
+    const int var_count = var_name ? 1 : 0;
+    values->assign(var_count, 0.0);
+    wcstring key = var_name ? var_name : L"";
+    key.push_back(L':');
+    const bool reusable = te_split_literals(expression.c_str(), &key, values);
+    if (reusable) {
+        auto cache = s_math_expr_cache.acquire();
+        if (math_expr_ref_t *cached = cache->get(key)) {
+            error->type = TE_ERROR_NONE;
+            error->position = 0;
+            return *cached;
+        }
+    }
+
+    te_expr *compiled = te_compile(expression.c_str(), &var_name, var_count, reusable, error);
+    if (!compiled) return nullptr;
+    math_expr_ref_t result(compiled, te_free);
+    if (reusable) s_math_expr_cache.acquire()->insert(std::move(key), result);
+    return result;
+}
+
+/// Print the value \p v of \p expression, or the error if it is not a usable number. \p each
+/// describes the value of the --each variable, if any.
+static int print_result(const wchar_t *cmd, io_streams_t &streams, const math_cmd_opts_t &opts,
+                        const wcstring &expression, const wchar_t *each, double v) {
+    // Check some runtime errors after the fact.
+    // TODO: Really, this should be done in tinyexpr
+    // (e.g. infinite is the result of "x / 0"),
+    // but that's much more work.
+    const wchar_t *error_message = nullptr;
+    if (std::isinf(v)) {
+        error_message = L"Result is infinite";
+    } else if (std::isnan(v)) {
+        error_message = L"Result is not a number";
+    } else if (std::abs(v) >= kMaximumContiguousInteger) {
+        error_message = L"Result magnitude is too large";
+    }
+    if (error_message) {
+        streams.err.append_format(L"%ls: Error: %ls\n", cmd, error_message);
+        if (each) {
+            streams.err.append_format(L"'%ls' with %ls = %ls\n", expression.c_str(), opts.each,
+                                      each);
+        } else {
+            streams.err.append_format(L"'%ls'\n", expression.c_str());
+        }
+        return STATUS_CMD_ERROR;
+    }
+    streams.out.append(format_double(v, opts));
+    streams.out.push_back(L'\n');
+    return STATUS_CMD_OK;
+}
+
+/// Evaluate math expressions. With --each, evaluate it once for each of the values from \p argv
+/// or stdin.
 static int evaluate_expression(const wchar_t *cmd, const parser_t &parser, io_streams_t &streams,
-                               const math_cmd_opts_t &opts, wcstring &expression) {
+                               const math_cmd_opts_t &opts, wcstring &expression, int *argidx,
+                               wchar_t **argv, math_stdin_t *input) {
     UNUSED(parser);
 
-    int retval = STATUS_CMD_OK;
     te_error_t error;
+    std::vector<double> values;
+    math_expr_ref_t compiled = get_compiled_expression(expression, opts.each, &values, &error);
+    if (!compiled) {
+        streams.err.append_format(L"%ls: Error: %ls\n", cmd, math_describe_error(error));
+        streams.err.append_format(L"'%ls'\n", expression.c_str());
+        streams.err.append_format(L"%*ls%ls\n", error.position - 1, L" ", L"^");
+        return STATUS_CMD_ERROR;
+    }
+
+    int retval = STATUS_CMD_OK;
     // Switch locale while computing stuff.
     // This means that the "." is always the radix character,
     // so numbers work the same across locales.
@@ -235,39 +364,37 @@ static int evaluate_expression(const wchar_t *cmd, const parser_t &parser, io_st
     // TODO: Technically this is only needed for *output* currently,
     // because we already use wcstod_l while computing,
     // but we can't have math print numbers that it won't then also read.
-    char *saved_locale = strdup(setlocale(LC_NUMERIC, nullptr));
-    setlocale(LC_NUMERIC, "C");
-    double v = te_interp(expression.c_str(), &error);
-
-    if (error.position == 0) {
-        // Check some runtime errors after the fact.
-        // TODO: Really, this should be done in tinyexpr
-        // (e.g. infinite is the result of "x / 0"),
-        // but that's much more work.
-        const wchar_t *error_message = nullptr;
-        if (std::isinf(v)) {
-            error_message = L"Result is infinite";
-        } else if (std::isnan(v)) {
-            error_message = L"Result is not a number";
-        } else if (std::abs(v) >= kMaximumContiguousInteger) {
-            error_message = L"Result magnitude is too large";
-        }
-        if (error_message) {
-            streams.err.append_format(L"%ls: Error: %ls\n", cmd, error_message);
-            streams.err.append_format(L"'%ls'\n", expression.c_str());
-            retval = STATUS_CMD_ERROR;
-        } else {
-            streams.out.append(format_double(v, opts));
-            streams.out.push_back(L'\n');
-        }
+    //
+    // Switching costs about as much as the rest of a simple `math` call, so skip it when the radix
+    // character already is ".".
+    char *saved_locale = nullptr;
+    if (std::strcmp(localeconv()->decimal_point, ".") != 0) {
+        saved_locale = strdup(setlocale(LC_NUMERIC, nullptr));
+        setlocale(LC_NUMERIC, "C");
+    }
+    if (!opts.each) {
+        retval = print_result(cmd, streams, opts, expression, nullptr,
+                              te_eval(compiled.get(), values.data()));
     } else {
-        streams.err.append_format(L"%ls: Error: %ls\n", cmd, math_describe_error(error));
-        streams.err.append_format(L"'%ls'\n", expression.c_str());
-        streams.err.append_format(L"%*ls%ls\n", error.position - 1, L" ", L"^");
-        retval = STATUS_CMD_ERROR;
+        wcstring storage;
+        while (const wchar_t *arg = math_get_arg(argidx, argv, &storage, input, streams)) {
+            wchar_t *end = nullptr;
+            values[0] = fish_wcstod(arg, &end);
+            if (end == arg || *end != L'\0') {
+                streams.err.append_format(_(L"%ls: '%ls' is not a number\n"), cmd, arg);
+                retval = STATUS_CMD_ERROR;
+                continue;
+            }
+            if (print_result(cmd, streams, opts, expression, arg,
+                             te_eval(compiled.get(), values.data())) != STATUS_CMD_OK) {
+                retval = STATUS_CMD_ERROR;
+            }
+        }
+    }
+    if (saved_locale) {
+        setlocale(LC_NUMERIC, saved_locale);
+        free(saved_locale);
     }
-    setlocale(LC_NUMERIC, saved_locale);
-    free(saved_locale);
     return retval;
 }
 
@@ -291,14 +418,24 @@ maybe_t<int> builtin_math(parser_t &parser, io_streams_t &streams, wchar_t **arg
 
     wcstring expression;
     wcstring storage;
-    while (const wchar_t *arg = math_get_arg(&optind, argv, &storage, streams)) {
-        if (!expression.empty()) expression.push_back(L' ');
-        expression.append(arg);
+    math_stdin_t input;
+    if (opts.each) {
+        // The expression is one argument, the rest (or the lines of stdin) are the values.
+        if (optind < argc) expression = argv[optind++];
+        if (math_args_from_stdin(streams) && optind < argc) {
+            streams.err.append_format(BUILTIN_ERR_TOO_MANY_ARGUMENTS, cmd);
+            return STATUS_INVALID_ARGS;
+        }
+    } else {
+        while (const wchar_t *arg = math_get_arg(&optind, argv, &storage, &input, streams)) {
+            if (!expression.empty()) expression.push_back(L' ');
+            expression.append(arg);
+        }
     }
 
     if (expression.empty()) {
         streams.err.append_format(BUILTIN_ERR_MIN_ARG_COUNT1, L"math", 1, 0);
         return STATUS_CMD_ERROR;
     }
-    return evaluate_expression(cmd, parser, streams, opts, expression);
+    return evaluate_expression(cmd, parser, streams, opts, expression, &optind, argv, &input);
 }
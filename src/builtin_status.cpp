@@ -12,6 +12,7 @@
 #include "fallback.h"  // IWYU pragma: keep
 #include "future_feature_flags.h"
 #include "io.h"
+#include "iothread.h"
 #include "parser.h"
 #include "proc.h"
 #include "wgetopt.h"
@@ -37,6 +38,7 @@ enum status_cmd_t {
     STATUS_SET_JOB_CONTROL,
     STATUS_STACK_TRACE,
     STATUS_TEST_FEATURE,
+    STATUS_THREAD_POOL,
     STATUS_UNDEF
 };
 
@@ -67,6 +69,7 @@ const enum_map<status_cmd_t> status_enum_map[] = {
     {STATUS_STACK_TRACE, L"print-stack-trace"},
     {STATUS_STACK_TRACE, L"stack-trace"},
     {STATUS_TEST_FEATURE, L"test-feature"},
+    {STATUS_THREAD_POOL, L"thread-pool"},
     {STATUS_UNDEF, nullptr}};
 #define status_enum_map_len (sizeof status_enum_map / sizeof *status_enum_map)
 
@@ -453,6 +456,28 @@ maybe_t<int> builtin_status(parser_t &parser, io_streams_t &streams, wchar_t **a
             }
             break;
         }
+        case STATUS_THREAD_POOL: {
+            CHECK_FOR_UNEXPECTED_STATUS_ARGS(opts.status_cmd)
+            const iothread_counters_t counters = iothread_get_counters();
+            streams.out.append_format(_(L"Threads: %lu (%lu waiting)\n"),
+                                      static_cast<unsigned long>(counters.threads),
+                                      static_cast<unsigned long>(counters.waiting_threads));
+            auto print_queue = [&](const wchar_t *name,
+                                   const iothread_counters_t::queue_counters_t &queue) {
+                double average_wait_ms =
+                    queue.dequeued ? queue.total_wait_usec / 1000.0 / queue.dequeued : 0;
+                streams.out.append_format(
+                    _(L"%ls work: %lu queued (max %lu), %llu performed, "
+                      L"average wait %.2f ms, max wait %.2f ms\n"),
+                    name, static_cast<unsigned long>(queue.queued),
+                    static_cast<unsigned long>(queue.max_queued),
+                    static_cast<unsigned long long>(queue.dequeued), average_wait_ms,
+                    queue.max_wait_usec / 1000.0);
+            };
+            print_queue(_(L"Interactive"), counters.interactive);
+            print_queue(_(L"Bulk"), counters.bulk);
+            break;
+        }
         case STATUS_FISH_PATH: {
             CHECK_FOR_UNEXPECTED_STATUS_ARGS(opts.status_cmd)
             streams.out.append(str2wcstring(get_executable_path("fish")));
@@ -12,6 +12,7 @@
 #include <cstddef>
 #include <cstdint>
 #include <cstdlib>
+#include <cstring>
 #include <cwchar>
 #include <cwctype>
 #include <functional>
@@ -28,6 +29,7 @@
 #include "fallback.h"  // IWYU pragma: keep
 #include "future_feature_flags.h"
 #include "io.h"
+#include "lru.h"
 #include "parse_util.h"
 #include "parser.h"
 #include "pcre2.h"
@@ -37,9 +39,9 @@
 #include "wutil.h"  // IWYU pragma: keep
 
 // How many bytes we read() at once.
-// Bash uses 128 here, so we do too (see READ_CHUNK_SIZE).
-// This should be about the size of a line.
-#define STRING_CHUNK_SIZE 128
+// string consumes all of its input and splits lines itself, so reads need not stop at a line.
+// A page at a time keeps the number of read() calls low for large inputs.
+#define STRING_CHUNK_SIZE 4096
 
 static void string_error(io_streams_t &streams, const wchar_t *fmt, ...) {
     streams.err.append(L"string ");
@@ -66,51 +68,116 @@ static const wchar_t *string_get_arg_argv(int *argidx, const wchar_t *const *arg
 
 // A helper type for extracting arguments from either argv or stdin.
 namespace {
+/// An output stream which collects output and passes it on to another stream in batches. `string`
+/// often writes a line of output for each argument or line of input, and writing each of those
+/// to an fd separately would mean a system call per line.
+class batched_output_stream_t final : public output_stream_t {
+    output_stream_t &target_;
+    wcstring pending_;
+
+    // Pass output on once we have this many characters.
+    static constexpr size_t kBatchSize = 4096;
+
+   public:
+    explicit batched_output_stream_t(output_stream_t &target) : target_(target) {}
+    ~batched_output_stream_t() override { flush(); }
+
+    void append(const wchar_t *s, size_t amt) override {
+        pending_.append(s, amt);
+        if (pending_.size() >= kBatchSize) flush();
+    }
+
+    void append_with_separation(const wchar_t *s, size_t len, separation_type_t type) override {
+        if (!target_.keeps_separation()) {
+            output_stream_t::append_with_separation(s, len, type);
+            return;
+        }
+        flush();
+        target_.append_with_separation(s, len, type);
+    }
+
+    bool discarded() const override { return target_.discarded(); }
+    bool keeps_separation() const override { return target_.keeps_separation(); }
+
+    void flush() override {
+        if (pending_.empty()) return;
+        target_.append(pending_);
+        pending_.clear();
+    }
+};
+
 class arg_iterator_t {
     // The list of arguments passed to the string builtin.
     const wchar_t *const *argv_;
     // If using argv, index of the next argument to return.
     int argidx_;
-    // If not using argv, a string to store bytes that have been read but not yet returned.
+    // If not using argv, a string to store bytes that have been read. Bytes before buffer_start_
+    // have already been returned.
     std::string buffer_;
+    size_t buffer_start_{0};
+    // The offset in buffer_ up to which we know there is no newline.
+    size_t scanned_{0};
     // If set, when reading from a stream, split on newlines.
     const bool split_;
     // Backing storage for the next() string.
     wcstring storage_;
     const io_streams_t &streams_;
 
+    /// Set storage_ to the bytes in buffer_ from buffer_start_ up to \p end, and mark them as
+    /// returned. Reusing storage_ means we don't allocate a string for each line.
+    void take_buffer(size_t end) {
+        storage_.clear();
+        str2wcstring_appending(&buffer_[buffer_start_], end - buffer_start_, &storage_);
+        buffer_start_ = scanned_ = end;
+    }
+
     /// Reads the next argument from stdin, returning true if an argument was produced and false if
     /// not. On true, the string is stored in storage_.
     bool get_arg_stdin() {
         assert(string_args_from_stdin(streams_) && "should not be reading from stdin");
         assert(streams_.stdin_fd >= 0 && "should have a valid fd");
         // Read in chunks from fd until buffer has a line (or the end if split_ is unset).
-        size_t pos;
-        while (!split_ || (pos = buffer_.find('\n')) == std::string::npos) {
-            char buf[STRING_CHUNK_SIZE];
-            long n = read_blocked(streams_.stdin_fd, buf, STRING_CHUNK_SIZE);
+        const void *sep;
+        while (!split_ ||
+               !(sep = std::memchr(&buffer_[scanned_], '\n', buffer_.size() - scanned_))) {
+            scanned_ = buffer_.size();
+            // Drop the bytes we have already returned, but only once they are at least half of the
+            // buffer. That way each byte is moved a bounded number of times, however long the
+            // lines are.
+            if (buffer_start_ > 0 && buffer_start_ >= buffer_.size() / 2) {
+                buffer_.erase(0, buffer_start_);
+                scanned_ -= buffer_start_;
+                buffer_start_ = 0;
+            }
+
+            // Output for the lines we have already returned should not wait on more input.
+            streams_.out.flush();
+
+            size_t old_size = buffer_.size();
+            buffer_.resize(old_size + STRING_CHUNK_SIZE);
+            long n = read_blocked(streams_.stdin_fd, &buffer_[old_size], STRING_CHUNK_SIZE);
+            buffer_.resize(old_size + std::max(n, 0L));
             if (n == 0) {
                 // If we still have buffer contents, flush them,
                 // in case there was no trailing sep.
-                if (buffer_.empty()) return false;
-                storage_ = str2wcstring(buffer_);
-                buffer_.clear();
+                if (buffer_start_ == buffer_.size()) return false;
+                take_buffer(buffer_.size());
                 return true;
             }
             if (n == -1) {
                 // Some error happened. We can't do anything about it,
                 // so ignore it.
                 // (read_blocked already retries for EAGAIN and EINTR)
-                storage_ = str2wcstring(buffer_);
-                buffer_.clear();
+                take_buffer(buffer_.size());
                 return false;
             }
-            buffer_.append(buf, n);
         }
 
         // Split the buffer on the sep and return the first part.
-        storage_ = str2wcstring(buffer_, pos);
-        buffer_.erase(0, pos + 1);
+        size_t pos = static_cast<const char *>(sep) - buffer_.data();
+        take_buffer(pos);
+        // Skip the separator.
+        buffer_start_ = scanned_ = pos + 1;
         return true;
     }
 
@@ -740,6 +807,47 @@ class wildcard_matcher_t : public string_matcher_t {
    private:
     wcstring wcpattern;
 
+    // If the pattern has no ? wildcards, the literal text between its * wildcards. Such a pattern
+    // matches if each of these appears in order, so we can find them with a substring search
+    // instead of running the general glob matcher at each position.
+    bool has_only_stars{false};
+    wcstring_list_t literals;
+
+    void init_literals() {
+        if (wcpattern.find(ANY_CHAR) != wcstring::npos) return;
+        has_only_stars = true;
+        literals.emplace_back();
+        for (wchar_t c : wcpattern) {
+            if (c == ANY_STRING || c == ANY_STRING_RECURSIVE) {
+                literals.emplace_back();
+            } else {
+                literals.back().push_back(c);
+            }
+        }
+    }
+
+    // Match \p arg against a pattern which has no ? wildcards. The first literal must be a prefix
+    // and the last a suffix; the ones in between may appear anywhere, and taking the leftmost
+    // occurrence of each leaves the most room for the rest.
+    bool match_literals(const wcstring &arg) const {
+        if (literals.size() == 1) return arg == literals.front();
+        const wcstring &first = literals.front();
+        const wcstring &last = literals.back();
+        if (arg.size() < first.size() + last.size()) return false;
+        if (arg.compare(0, first.size(), first) != 0) return false;
+        size_t end = arg.size() - last.size();
+        if (arg.compare(end, last.size(), last) != 0) return false;
+
+        size_t pos = first.size();
+        for (size_t i = 1; i + 1 < literals.size(); i++) {
+            const wcstring &literal = literals.at(i);
+            size_t found = arg.find(literal, pos);
+            if (found == wcstring::npos || found + literal.size() > end) return false;
+            pos = found + literal.size();
+        }
+        return true;
+    }
+
    public:
     wildcard_matcher_t(const wchar_t * /*argv0*/, const wcstring &pattern, const options_t &opts,
                        io_streams_t &streams)
@@ -756,6 +864,7 @@ class wildcard_matcher_t : public string_matcher_t {
                 wcpattern.push_back(ANY_STRING);
             }
         }
+        init_literals();
     }
 
     ~wildcard_matcher_t() override = default;
@@ -766,9 +875,11 @@ class wildcard_matcher_t : public string_matcher_t {
         bool match;
 
         if (opts.ignore_case) {
-            match = wildcard_match(wcstolower(arg), wcpattern, false);
+            wcstring lowered = wcstolower(arg);
+            match = has_only_stars ? match_literals(lowered)
+                                   : wildcard_match(lowered, wcpattern, false);
         } else {
-            match = wildcard_match(arg, wcpattern, false);
+            match = has_only_stars ? match_literals(arg) : wildcard_match(arg, wcpattern, false);
         }
         if (match ^ opts.invert_match) {
             total_matched++;
@@ -793,7 +904,72 @@ static wcstring pcre2_strerror(int err_code) {
     return buf;
 }
 
+/// A compiled pattern, which may be shared by several uses of the same regex.
+struct regex_code_t {
+    pcre2_code *const code;
+
+    // Whether we have tried to JIT compile the pattern.
+    bool jit_attempted{false};
+
+    explicit regex_code_t(pcre2_code *code) : code(code) {}
+    ~regex_code_t() { pcre2_code_free(code); }
+
+    regex_code_t(const regex_code_t &) = delete;
+    void operator=(const regex_code_t &) = delete;
+};
+
+/// The number of compiled patterns to remember.
+static constexpr size_t kRegexCacheSize = 64;
+
+/// Compiled patterns, keyed by their compile options and pattern text. This lets a loop which
+/// runs `string match -r` or `string replace -r` with the same pattern compile it only once.
+class regex_cache_t : public lru_cache_t<regex_cache_t, std::shared_ptr<regex_code_t>> {
+   public:
+    regex_cache_t()
+        : lru_cache_t<regex_cache_t, std::shared_ptr<regex_code_t>>(kRegexCacheSize) {}
+};
+static owning_lock<regex_cache_t> s_regex_cache;
+
+/// Compile \p pattern with \p options, or return it from the cache. Patterns are JIT compiled
+/// (when PCRE2 supports that) the second time they are used, so that one-off patterns don't pay
+/// for it. \return nullptr and report an error if the pattern does not compile.
+static std::shared_ptr<regex_code_t> get_compiled_regex(const wchar_t *argv0,
+                                                        const wcstring &pattern, uint32_t options,
+                                                        io_streams_t &streams) {
+    wcstring key = to_string(size_t{options});
+    key.push_back(L':');
+    key.append(pattern);
+    {
+        auto cache = s_regex_cache.acquire();
+        if (std::shared_ptr<regex_code_t> *cached = cache->get(key)) {
+            std::shared_ptr<regex_code_t> result = *cached;
+            // JIT compiling modifies the pattern, so only do it if nobody else is using it.
+            if (!result->jit_attempted && result.use_count() == 2) {
+                result->jit_attempted = true;
+                (void)pcre2_jit_compile(result->code, PCRE2_JIT_COMPLETE);
+            }
+            return result;
+        }
+    }
+
+    int err_code = 0;
+    PCRE2_SIZE err_offset = 0;
+    pcre2_code *code = pcre2_compile(PCRE2_SPTR(pattern.c_str()), pattern.length(), options,
+                                     &err_code, &err_offset, nullptr);
+    if (code == nullptr) {
+        string_error(streams, _(L"%ls: Regular expression compile error: %ls\n"), argv0,
+                     pcre2_strerror(err_code).c_str());
+        string_error(streams, L"%ls: %ls\n", argv0, pattern.c_str());
+        string_error(streams, L"%ls: %*ls\n", argv0, err_offset, L"^");
+        return nullptr;
+    }
+    auto result = std::make_shared<regex_code_t>(code);
+    s_regex_cache.acquire()->insert(std::move(key), result);
+    return result;
+}
+
 struct compiled_regex_t {
+    std::shared_ptr<regex_code_t> shared;
     pcre2_code *code;
     pcre2_match_data *match;
 
@@ -805,28 +981,28 @@ struct compiled_regex_t {
 #if PCRE2_CODE_UNIT_WIDTH < 32
         options |= PCRE2_NEVER_BACKSLASH_C;
 #endif
+        if (ignore_case) options |= PCRE2_CASELESS;
 
-        int err_code = 0;
-        PCRE2_SIZE err_offset = 0;
-
-        code = pcre2_compile(PCRE2_SPTR(pattern.c_str()), pattern.length(),
-                             options | (ignore_case ? PCRE2_CASELESS : 0), &err_code, &err_offset,
-                             nullptr);
-        if (code == nullptr) {
-            string_error(streams, _(L"%ls: Regular expression compile error: %ls\n"), argv0,
-                         pcre2_strerror(err_code).c_str());
-            string_error(streams, L"%ls: %ls\n", argv0, pattern.c_str());
-            string_error(streams, L"%ls: %*ls\n", argv0, err_offset, L"^");
-            return;
-        }
+        shared = get_compiled_regex(argv0, pattern, options, streams);
+        if (!shared) return;
+        code = shared->code;
 
         match = pcre2_match_data_create_from_pattern(code, nullptr);
         assert(match);
     }
 
-    ~compiled_regex_t() {
-        pcre2_match_data_free(match);
-        pcre2_code_free(code);
+    ~compiled_regex_t() { pcre2_match_data_free(match); }
+
+    /// Call pcre2_match on \p subject. If a JIT compiled pattern runs out of stack, this retries
+    /// without JIT, which is slower but has no such limit.
+    int match_at(const wcstring &subject, PCRE2_SIZE offset, uint32_t options) const {
+        int rc = pcre2_match(code, PCRE2_SPTR(subject.c_str()), subject.length(), offset, options,
+                             match, nullptr);
+        if (rc == PCRE2_ERROR_JIT_STACKLIMIT) {
+            rc = pcre2_match(code, PCRE2_SPTR(subject.c_str()), subject.length(), offset,
+                             options | PCRE2_NO_JIT, match, nullptr);
+        }
+        return rc;
     }
 };
 
@@ -1066,8 +1242,7 @@ class pcre2_matcher_t : public string_matcher_t {
 
         // See pcre2demo.c for an explanation of this logic.
         PCRE2_SIZE arglen = arg.length();
-        auto rc = report_match(arg, pcre2_match(regex.code, PCRE2_SPTR(arg.c_str()), arglen, 0, 0,
-                                                regex.match, nullptr));
+        auto rc = report_match(arg, regex.match_at(arg, 0, 0));
         // We only import variables for the *first matching argument*
         bool had_match = false;
         if (rc == match_result_t::match && !imported_vars) {
@@ -1096,8 +1271,7 @@ class pcre2_matcher_t : public string_matcher_t {
                 options = PCRE2_NOTEMPTY_ATSTART | PCRE2_ANCHORED;
             }
 
-            rc = report_match(arg, pcre2_match(regex.code, PCRE2_SPTR(arg.c_str()), arglen, offset,
-                                               options, regex.match, nullptr));
+            rc = report_match(arg, regex.match_at(arg, offset, options));
 
             if (rc == match_result_t::pcre2_error) {
                 // This shouldn't happen as we've already validated the regex above
@@ -1299,13 +1473,25 @@ bool literal_replacer_t::replace_matches(const wcstring &arg) {
     if (patlen == 0) {
         replacement_occurred = true;
         result = arg;
+    } else if (!opts.ignore_case) {
+        // Search for each occurrence, rather than comparing against the pattern at every position.
+        size_t pos = 0;
+        size_t found;
+        while ((opts.all || !replacement_occurred) &&
+               (found = arg.find(pattern, pos)) != wcstring::npos) {
+            result.append(arg, pos, found - pos);
+            result += replacement;
+            pos = found + patlen;
+            replacement_occurred = true;
+            total_replaced++;
+        }
+        result.append(arg, pos, wcstring::npos);
     } else {
-        auto &cmp_func = opts.ignore_case ? wcsncasecmp : std::wcsncmp;
         const wchar_t *cur = arg.c_str();
         const wchar_t *end = cur + arg.size();
         while (cur < end) {
             if ((opts.all || !replacement_occurred) &&
-                cmp_func(cur, pattern.c_str(), patlen) == 0) {
+                wcsncasecmp(cur, pattern.c_str(), patlen) == 0) {
                 result += replacement;
                 cur += patlen;
                 replacement_occurred = true;
@@ -1356,7 +1542,11 @@ bool regex_replacer_t::replace_matches(const wcstring &arg) {
                                     PCRE2_SPTR(replacement->c_str()), replacement->length(),
                                     reinterpret_cast<PCRE2_UCHAR *>(output), &outlen);
 
-        if (pcre2_rc != PCRE2_ERROR_NOMEMORY || bufsize >= outlen) {
+        if (pcre2_rc == PCRE2_ERROR_JIT_STACKLIMIT && !(options & PCRE2_NO_JIT)) {
+            // The JIT compiled pattern ran out of stack; retry without JIT.
+            options |= PCRE2_NO_JIT;
+            outlen = bufsize;
+        } else if (pcre2_rc != PCRE2_ERROR_NOMEMORY || bufsize >= outlen) {
             done = true;
         } else {
             bufsize = outlen;
@@ -1437,12 +1627,12 @@ static int string_split_maybe0(parser_t &parser, io_streams_t &streams, int argc
 
     const wcstring sep = is_split0 ? wcstring(1, L'\0') : wcstring(opts.arg1);
 
-    std::vector<wcstring_list_t> all_splits;
     size_t split_count = 0;
     size_t arg_count = 0;
+    wcstring_list_t splits;
     arg_iterator_t aiter(argv, optind, streams, !is_split0);
     while (const wcstring *arg = aiter.nextstr()) {
-        wcstring_list_t splits;
+        splits.clear();
         if (opts.right) {
             split_about(arg->rbegin(), arg->rend(), sep.rbegin(), sep.rend(), &splits, opts.max,
                         opts.no_empty);
@@ -1450,14 +1640,12 @@ static int string_split_maybe0(parser_t &parser, io_streams_t &streams, int argc
             split_about(arg->begin(), arg->end(), sep.begin(), sep.end(), &splits, opts.max,
                         opts.no_empty);
         }
-        all_splits.push_back(splits);
         // If we're quiet, we return early if we've found something to split.
         if (opts.quiet && splits.size() > 1) return STATUS_CMD_OK;
         split_count += splits.size();
         arg_count++;
-    }
 
-    for (auto &splits : all_splits) {
+        // Print this argument's splits now, rather than holding on to every argument's.
         // If we are from the right, split_about gave us reversed strings, in reversed order!
         if (opts.right) {
             for (auto &split : splits) {
@@ -1801,5 +1989,7 @@ maybe_t<int> builtin_string(parser_t &parser, io_streams_t &streams, wchar_t **a
     }
     argc--;
     argv++;
-    return subcmd->handler(parser, streams, argc, argv);
+    batched_output_stream_t out(streams.out);
+    io_streams_t batched_streams(out, streams.err, streams);
+    return subcmd->handler(parser, batched_streams, argc, argv);
 }
@@ -36,8 +36,10 @@
 
 #include <algorithm>
 #include <atomic>
+#include <chrono>
 #include <memory>  // IWYU pragma: keep
 #include <type_traits>
+#include <utility>
 
 #include "common.h"
 #include "env.h"
@@ -90,6 +92,70 @@ bool g_profiling_active = false;
 const wchar_t *program_name;
 std::atomic<int> debug_level{1};  // default maximum debug output level (errors and warnings)
 
+namespace {
+/// The phases of startup recorded for --print-startup-profile.
+struct startup_profile_t {
+    using clock_t = std::chrono::steady_clock;
+
+    // When profiling was enabled, which is the start of the first phase.
+    clock_t::time_point start{};
+
+    // The phases, with the time each finished.
+    std::vector<std::pair<wcstring, clock_t::time_point>> phases;
+
+    // Time spent autoloading files during startup, and the number of files.
+    long long autoload_usec{0};
+    size_t autoload_count{0};
+
+    // Whether phases are being recorded.
+    bool recording{false};
+};
+}  // namespace
+
+static startup_profile_t s_startup_profile;
+
+void startup_profile_enable() {
+    ASSERT_IS_MAIN_THREAD();
+    s_startup_profile.start = startup_profile_t::clock_t::now();
+    s_startup_profile.recording = true;
+}
+
+bool startup_profile_recording() { return is_main_thread() && s_startup_profile.recording; }
+
+void startup_profile_mark(const wcstring &name) {
+    if (!startup_profile_recording()) return;
+    s_startup_profile.phases.emplace_back(name, startup_profile_t::clock_t::now());
+}
+
+void startup_profile_finish(const wcstring &name) {
+    startup_profile_mark(name);
+    s_startup_profile.recording = false;
+}
+
+void startup_profile_add_autoload(long long usec) {
+    if (!startup_profile_recording()) return;
+    s_startup_profile.autoload_usec += usec;
+    s_startup_profile.autoload_count++;
+}
+
+void startup_profile_print(FILE *fp) {
+    using namespace std::chrono;
+    const startup_profile_t &prof = s_startup_profile;
+    auto to_msec = [](startup_profile_t::clock_t::duration d) {
+        return duration_cast<microseconds>(d).count() / 1000.0;
+    };
+    std::fprintf(fp, "  startup profile:\n");
+    std::fprintf(fp, "%10s %10s  %s\n", "total ms", "phase ms", "phase");
+    auto last = prof.start;
+    for (const auto &phase : prof.phases) {
+        std::fprintf(fp, "%10.3f %10.3f  %ls\n", to_msec(phase.second - prof.start),
+                     to_msec(phase.second - last), phase.first.c_str());
+        last = phase.second;
+    }
+    std::fprintf(fp, "  autoloading: %.3f ms for %lu file(s)\n", prof.autoload_usec / 1000.0,
+                 static_cast<unsigned long>(prof.autoload_count));
+}
+
 /// Be able to restore the term's foreground process group.
 /// This is set during startup and not modified after.
 static relaxed_atomic_t<pid_t> initial_fg_process_group{-1};
@@ -306,12 +372,11 @@ static size_t count_ascii_prefix(const char *in, size_t in_len) {
 ///
 /// This function encodes illegal character sequences in a reversible way using the private use
 /// area.
-static wcstring str2wcs_internal(const char *in, const size_t in_len) {
-    if (in_len == 0) return wcstring();
+static void str2wcs_internal(const char *in, const size_t in_len, wcstring &result) {
+    if (in_len == 0) return;
     assert(in != nullptr);
 
-    wcstring result;
-    result.reserve(in_len);
+    result.reserve(result.size() + in_len);
 
     // In the unlikely event that MB_CUR_MAX is 1, then we are just going to append.
     if (MB_CUR_MAX == 1) {
@@ -320,7 +385,7 @@ static wcstring str2wcs_internal(const char *in, const size_t in_len) {
             result.push_back(static_cast<unsigned char>(in[in_pos]));
             in_pos++;
         }
-        return result;
+        return;
     }
 
     size_t in_pos = 0;
@@ -390,7 +455,11 @@ static wcstring str2wcs_internal(const char *in, const size_t in_len) {
             in_pos += ret;
         }
     }
+}
 
+static wcstring str2wcs_internal(const char *in, const size_t in_len) {
+    wcstring result;
+    str2wcs_internal(in, in_len, result);
     return result;
 }
 
@@ -408,6 +477,11 @@ wcstring str2wcstring(const std::string &in, size_t len) {
     return str2wcs_internal(in.data(), len);
 }
 
+void str2wcstring_appending(const char *in, size_t len, wcstring *receiver) {
+    assert(receiver && "Null receiver");
+    str2wcs_internal(in, len, *receiver);
+}
+
 std::string wcs2string(const wcstring &input) { return wcs2string(input.data(), input.size()); }
 
 std::string wcs2string(const wchar_t *in, size_t len) {
@@ -205,6 +205,26 @@ wchar_t get_obfuscation_read_char();
 /// Profiling flag. True if commands should be profiled.
 extern bool g_profiling_active;
 
+/// Startup profiling, for --print-startup-profile. Once enabled, startup_profile_mark() records the
+/// time at which each phase of startup finished, until startup_profile_finish() is called. Phases
+/// are only recorded on the main thread.
+void startup_profile_enable();
+
+/// Record that the startup phase \p name has finished.
+void startup_profile_mark(const wcstring &name);
+
+/// Mark the final phase \p name and stop recording.
+void startup_profile_finish(const wcstring &name);
+
+/// Add \p usec to the time spent autoloading files during startup.
+void startup_profile_add_autoload(long long usec);
+
+/// \return whether startup phases are being recorded.
+bool startup_profile_recording();
+
+/// Print the recorded startup phases to \p fp.
+void startup_profile_print(FILE *fp);
+
 /// Name of the current program. Should be set at startup. Used by the debug function.
 extern const wchar_t *program_name;
 
@@ -299,6 +319,9 @@ wcstring str2wcstring(const char *in, size_t len);
 wcstring str2wcstring(const std::string &in);
 wcstring str2wcstring(const std::string &in, size_t len);
 
+/// Like str2wcstring, but appends to \p receiver instead of returning a new string.
+void str2wcstring_appending(const char *in, size_t len, wcstring *receiver);
+
 /// Returns a newly allocated multibyte character string equivalent of the specified wide character
 /// string.
 ///
@@ -28,14 +28,17 @@
 #include <unordered_set>
 #include <utility>
 
+#include "ast.h"
 #include "autoload.h"
 #include "builtin.h"
+#include "builtin_commandline.h"
 #include "common.h"
 #include "env.h"
 #include "exec.h"
 #include "expand.h"
 #include "fallback.h"  // IWYU pragma: keep
 #include "function.h"
+#include "global_safety.h"
 #include "history.h"
 #include "iothread.h"
 #include "parse_constants.h"
@@ -123,13 +126,134 @@ using complete_entry_opt_t = struct complete_entry_opt {
 /// Last value used in the order field of completion_entry_t.
 static std::atomic<unsigned int> k_complete_order{0};
 
-/// Struct describing a command completion.
 using option_list_t = std::list<complete_entry_opt_t>;
+
+/// An index of the options of a command, so that finding the options that match an argument does
+/// not need to look at every option. It is built from the options when first needed, and is
+/// immutable, so it can be used without holding the lock on the completion set.
+class completion_option_index_t {
+   public:
+    explicit completion_option_index_t(const option_list_t &option_list);
+
+    /// All options, in the order in which they are tried (most recently added first). Options are
+    /// referred to by their position here.
+    std::vector<complete_entry_opt_t> options;
+
+    /// The distinct conditions of the options, and the position of each option's condition.
+    wcstring_list_t conditions;
+    std::vector<size_t> condition_idxs;
+
+    /// The options without a switch, and the short options.
+    std::vector<size_t> args_only_options;
+    std::vector<size_t> short_options;
+
+    /// \return the short options for the character \p c, or nullptr if there are none.
+    const std::vector<size_t> *short_options_for(wchar_t c) const;
+
+    /// \return the long options of type \p type named \p name, or nullptr if there are none.
+    const std::vector<size_t> *long_options_named(const wcstring &name,
+                                                  complete_option_type_t type) const;
+
+    /// Append the long options of type \p type whose name starts with \p prefix, ignoring case,
+    /// to \p out.
+    void append_long_options_with_prefix(const wcstring &prefix, complete_option_type_t type,
+                                         std::vector<size_t> *out) const;
+
+   private:
+    using name_map_t = std::unordered_map<wcstring, std::vector<size_t>>;
+    // The lowercased names of long options with the option, sorted by name.
+    using sorted_names_t = std::vector<std::pair<wcstring, size_t>>;
+
+    std::vector<size_t> short_by_char_[256];
+    std::unordered_map<wchar_t, std::vector<size_t>> short_by_wide_char_;
+    name_map_t single_long_by_name_;
+    name_map_t double_long_by_name_;
+    sorted_names_t single_long_sorted_;
+    sorted_names_t double_long_sorted_;
+};
+
+completion_option_index_t::completion_option_index_t(const option_list_t &option_list)
+    : options(option_list.begin(), option_list.end()) {
+    std::unordered_map<wcstring, size_t> condition_positions;
+    for (size_t idx = 0; idx < options.size(); idx++) {
+        const complete_entry_opt_t &o = options[idx];
+        auto ins = condition_positions.emplace(o.condition, conditions.size());
+        if (ins.second) conditions.push_back(o.condition);
+        condition_idxs.push_back(ins.first->second);
+
+        switch (o.type) {
+            case option_type_args_only: {
+                args_only_options.push_back(idx);
+                break;
+            }
+            case option_type_short: {
+                short_options.push_back(idx);
+                wchar_t c = o.option.at(0);
+                if (c >= 0 && c < 256) {
+                    short_by_char_[c].push_back(idx);
+                } else {
+                    short_by_wide_char_[c].push_back(idx);
+                }
+                break;
+            }
+            case option_type_single_long: {
+                single_long_by_name_[o.option].push_back(idx);
+                single_long_sorted_.emplace_back(wcstolower(o.option), idx);
+                break;
+            }
+            case option_type_double_long: {
+                double_long_by_name_[o.option].push_back(idx);
+                double_long_sorted_.emplace_back(wcstolower(o.option), idx);
+                break;
+            }
+        }
+    }
+    std::sort(single_long_sorted_.begin(), single_long_sorted_.end());
+    std::sort(double_long_sorted_.begin(), double_long_sorted_.end());
+}
+
+const std::vector<size_t> *completion_option_index_t::short_options_for(wchar_t c) const {
+    if (c >= 0 && c < 256) {
+        return short_by_char_[c].empty() ? nullptr : &short_by_char_[c];
+    }
+    auto iter = short_by_wide_char_.find(c);
+    return iter == short_by_wide_char_.end() ? nullptr : &iter->second;
+}
+
+const std::vector<size_t> *completion_option_index_t::long_options_named(
+    const wcstring &name, complete_option_type_t type) const {
+    assert((type == option_type_single_long || type == option_type_double_long) &&
+           "Not a long option type");
+    const name_map_t &map =
+        type == option_type_single_long ? single_long_by_name_ : double_long_by_name_;
+    auto iter = map.find(name);
+    return iter == map.end() ? nullptr : &iter->second;
+}
+
+void completion_option_index_t::append_long_options_with_prefix(const wcstring &prefix,
+                                                               complete_option_type_t type,
+                                                               std::vector<size_t> *out) const {
+    assert((type == option_type_single_long || type == option_type_double_long) &&
+           "Not a long option type");
+    const sorted_names_t &names =
+        type == option_type_single_long ? single_long_sorted_ : double_long_sorted_;
+    wcstring lowered = wcstolower(prefix);
+    auto iter = std::lower_bound(names.begin(), names.end(), std::make_pair(lowered, size_t(0)));
+    for (; iter != names.end() && string_prefixes_string(lowered, iter->first); ++iter) {
+        out->push_back(iter->second);
+    }
+}
+
+/// Struct describing a command completion.
 class completion_entry_t {
    public:
     /// List of all options.
     option_list_t options;
 
+    /// The index of the options, or null if it has not been built since the options changed.
+    /// Protected by the lock on the completion set.
+    mutable std::shared_ptr<const completion_option_index_t> index;
+
     /// Command string.
     const wcstring cmd;
     /// True if command is a path.
@@ -141,6 +265,9 @@ class completion_entry_t {
     /// Getters for option list.
     const option_list_t &get_options() const;
 
+    /// \return the index of the options, building it if necessary.
+    std::shared_ptr<const completion_option_index_t> get_index() const;
+
     /// Adds or removes an option.
     void add_option(const complete_entry_opt_t &opt);
     bool remove_option(const wcstring &option, complete_option_type_t type);
@@ -178,10 +305,18 @@ static bool compare_completions_by_order(const completion_entry_t &p1,
     return p1.order < p2.order;
 }
 
-void completion_entry_t::add_option(const complete_entry_opt_t &opt) { options.push_front(opt); }
+void completion_entry_t::add_option(const complete_entry_opt_t &opt) {
+    options.push_front(opt);
+    index.reset();
+}
 
 const option_list_t &completion_entry_t::get_options() const { return options; }
 
+std::shared_ptr<const completion_option_index_t> completion_entry_t::get_index() const {
+    if (!index) index = std::make_shared<const completion_option_index_t>(options);
+    return index;
+}
+
 description_func_t const_desc(const wcstring &s) {
     return [=](const wcstring &ignored) {
         UNUSED(ignored);
@@ -343,6 +478,15 @@ void completions_sort_and_prioritize(completion_list_t *comps, completion_reques
     }
 }
 
+/// The completion helpers, which completion conditions can call without running any script.
+enum class condition_helper_t { seen_subcommand_from, use_subcommand, contains_opt, COUNT };
+
+static const wchar_t *const condition_helper_names[] = {
+    L"__fish_seen_subcommand_from", L"__fish_use_subcommand", L"__fish_contains_opt"};
+static_assert(sizeof condition_helper_names / sizeof *condition_helper_names ==
+                  static_cast<size_t>(condition_helper_t::COUNT),
+              "Missing helper names");
+
 /// Class representing an attempt to compute completions.
 class completer_t {
     /// The operation context for this completion.
@@ -391,6 +535,11 @@ class completer_t {
 
     bool complete_variable(const wcstring &str, size_t start_offset);
 
+    /// Whether the completion helpers are shadowed by functions, by condition_helper_t.
+    maybe_t<bool> helper_shadowed[static_cast<size_t>(condition_helper_t::COUNT)];
+
+    maybe_t<bool> native_condition_test(const wcstring &condition);
+
     bool condition_test(const wcstring &condition);
 
     void complete_strings(const wcstring &wc_escaped, const description_func_t &desc_func,
@@ -467,6 +616,227 @@ void append_completion(completion_list_t *completions, wcstring comp, wcstring d
     completions->emplace_back(std::move(comp), std::move(desc), match, flags);
 }
 
+namespace {
+/// A completion condition which only calls the completion helpers with literal arguments, like
+/// `__fish_seen_subcommand_from add; and not __fish_contains_opt -s f force`. The helpers only
+/// look at the command line, so these conditions are evaluated natively.
+struct native_condition_t {
+    /// Whether a job runs depending on the status of the previous one.
+    enum class gate_t { always, if_success, if_failure };
+
+    /// A call to a helper, preceded by any number of `not`s.
+    struct call_t {
+        gate_t gate;
+        condition_helper_t helper;
+        bool negate;
+        wcstring_list_t args;
+    };
+
+    /// A job conjunction: calls separated by && or ||, maybe with a leading and / or.
+    struct conjunction_t {
+        gate_t gate;
+        std::vector<call_t> calls;
+    };
+    std::vector<conjunction_t> conjunctions;
+
+    /// Which helpers are called.
+    bool uses_helper[static_cast<size_t>(condition_helper_t::COUNT)]{};
+
+    /// Evaluate the condition for the command line \p tokens.
+    bool evaluate(const commandline_tokens_t &tokens) const {
+        bool success = true;
+        auto passes = [&](gate_t gate) {
+            return gate == gate_t::always || success == (gate == gate_t::if_success);
+        };
+        for (const conjunction_t &conj : conjunctions) {
+            if (!passes(conj.gate)) continue;
+            for (const call_t &call : conj.calls) {
+                if (!passes(call.gate)) continue;
+                int status = STATUS_CMD_ERROR;
+                switch (call.helper) {
+                    case condition_helper_t::seen_subcommand_from:
+                        status = commandline_seen_subcommand_from(tokens, call.args);
+                        break;
+                    case condition_helper_t::use_subcommand:
+                        status = commandline_use_subcommand(tokens);
+                        break;
+                    case condition_helper_t::contains_opt: {
+                        wcstring err;
+                        status = commandline_contains_opt(tokens, call.args, &err);
+                        break;
+                    }
+                    case condition_helper_t::COUNT:
+                        DIE("Invalid helper");
+                }
+                success = (status == STATUS_CMD_OK) != call.negate;
+            }
+        }
+        return success;
+    }
+};
+
+/// \return the value of the argument or command name whose source is \p src, if it is a literal
+/// that does not need any expansion.
+maybe_t<wcstring> literal_source(const wcstring &src) {
+    wcstring result;
+    if (src.find(L'(') != wcstring::npos || !unescape_string(src, &result, UNESCAPE_SPECIAL)) {
+        return none();
+    }
+    result.erase(std::remove(result.begin(), result.end(), INTERNAL_SEPARATOR), result.end());
+    for (wchar_t c : result) {
+        if (c >= RESERVED_CHAR_BASE && c < RESERVED_CHAR_END) return none();
+    }
+    return result;
+}
+
+/// Compile a call of a helper from the job \p job in the condition \p src.
+/// \return false if the job is not a plain call of a helper.
+bool compile_helper_call(const ast::job_t &job, const wcstring &src,
+                         native_condition_t::call_t *out_call) {
+    if (job.time || !job.variables.empty() || !job.continuation.empty() || job.bg) return false;
+    const ast::statement_t *statement = &job.statement;
+    bool negate = false;
+    while (const auto *not_statement = statement->contents->try_as<ast::not_statement_t>()) {
+        if (not_statement->time || !not_statement->variables.empty()) return false;
+        negate = !negate;
+        statement = &not_statement->contents;
+    }
+    const auto *decorated = statement->contents->try_as<ast::decorated_statement_t>();
+    if (!decorated || decorated->opt_decoration) return false;
+
+    maybe_t<wcstring> command = literal_source(decorated->command.source(src));
+    if (!command) return false;
+    const auto *name = std::find_if(
+        std::begin(condition_helper_names), std::end(condition_helper_names),
+        [&](const wchar_t *helper_name) { return *command == helper_name; });
+    if (name == std::end(condition_helper_names)) return false;
+
+    out_call->helper = static_cast<condition_helper_t>(name - std::begin(condition_helper_names));
+    out_call->negate = negate;
+    for (const ast::argument_or_redirection_t &arg : decorated->args_or_redirs) {
+        if (!arg.is_argument()) return false;
+        maybe_t<wcstring> value = literal_source(arg.argument().source(src));
+        if (!value) return false;
+        out_call->args.push_back(value.acquire());
+    }
+    if (out_call->helper == condition_helper_t::contains_opt) {
+        // Leave invalid arguments to the builtin, which reports them.
+        wcstring err;
+        commandline_contains_opt(commandline_tokens_t{}, out_call->args, &err);
+        if (!err.empty()) return false;
+    }
+    return true;
+}
+
+/// Compile the completion condition \p src.
+/// \return null if it is not a native condition.
+std::shared_ptr<const native_condition_t> compile_native_condition(const wcstring &src) {
+    using gate_t = native_condition_t::gate_t;
+    auto ast = ast::ast_t::parse(src);
+    if (ast.errored()) return nullptr;
+
+    auto result = std::make_shared<native_condition_t>();
+    for (const ast::job_conjunction_t &jc : *ast.top()->as<ast::job_list_t>()) {
+        native_condition_t::conjunction_t conj{gate_t::always, {}};
+        if (jc.decorator) {
+            // A leading and / or would look at the status before the condition.
+            if (result->conjunctions.empty()) return nullptr;
+            conj.gate = jc.decorator->kw == parse_keyword_t::kw_and ? gate_t::if_success
+                                                                   : gate_t::if_failure;
+        }
+        native_condition_t::call_t call{gate_t::always, {}, false, {}};
+        if (!compile_helper_call(jc.job, src, &call)) return nullptr;
+        conj.calls.push_back(std::move(call));
+        for (const ast::job_conjunction_continuation_t &jcc : jc.continuations) {
+            native_condition_t::call_t call{gate_t::always, {}, false, {}};
+            call.gate = jcc.conjunction.type == parse_token_type_t::andand ? gate_t::if_success
+                                                                            : gate_t::if_failure;
+            if (!compile_helper_call(jcc.job, src, &call)) return nullptr;
+            conj.calls.push_back(std::move(call));
+        }
+        result->conjunctions.push_back(std::move(conj));
+    }
+    if (result->conjunctions.empty()) return nullptr;
+    for (const auto &conj : result->conjunctions) {
+        for (const auto &call : conj.calls) {
+            result->uses_helper[static_cast<size_t>(call.helper)] = true;
+        }
+    }
+    return result;
+}
+
+/// Results of native conditions for a command line.
+struct native_condition_results_t {
+    wcstring buffer;
+    size_t cursor;
+    commandline_tokens_t tokens;
+    std::unordered_map<wcstring, bool> results;
+};
+
+/// Compiled completion conditions, and the results of native conditions for the most recently
+/// used command lines. As these only depend on the command line, they are kept across completion
+/// runs, so they are not evaluated again when the user asks for completions of the same command
+/// line, or when the completions wrap other commands.
+struct condition_data_t {
+    /// Compiled conditions. This is null for conditions which are not native.
+    std::unordered_map<wcstring, std::shared_ptr<const native_condition_t>> compiled;
+
+    /// Results for recent command lines, most recent first.
+    std::list<native_condition_results_t> lines;
+    static constexpr size_t max_lines = 8;
+
+    /// \return the results for a command line.
+    native_condition_results_t &results_for(const wcstring &buffer, size_t cursor) {
+        auto iter =
+            std::find_if(lines.begin(), lines.end(), [&](const native_condition_results_t &r) {
+                return r.cursor == cursor && r.buffer == buffer;
+            });
+        if (iter != lines.end()) {
+            lines.splice(lines.begin(), lines, iter);
+        } else {
+            commandline_tokens_t tokens = commandline_get_tokens(buffer, cursor);
+            lines.push_front(native_condition_results_t{buffer, cursor, std::move(tokens), {}});
+            if (lines.size() > max_lines) lines.pop_back();
+        }
+        return lines.front();
+    }
+};
+static mainthread_t<condition_data_t> s_condition_data;
+}  // namespace
+
+/// Test if a native condition is true, if the helpers it calls are not shadowed by functions.
+/// \return none if the condition must be run as script.
+maybe_t<bool> completer_t::native_condition_test(const wcstring &condition) {
+    condition_data_t &data = s_condition_data;
+    auto compiled = data.compiled.find(condition);
+    if (compiled == data.compiled.end()) {
+        compiled = data.compiled.emplace(condition, compile_native_condition(condition)).first;
+    }
+    const native_condition_t *native = compiled->second.get();
+    if (!native) return none();
+
+    for (size_t i = 0; i < static_cast<size_t>(condition_helper_t::COUNT); i++) {
+        if (!native->uses_helper[i]) continue;
+        if (!helper_shadowed[i]) {
+            helper_shadowed[i] = function_exists(condition_helper_names[i], *ctx.parser) != 0;
+        }
+        if (*helper_shadowed[i]) return none();
+    }
+
+    wcstring buffer;
+    size_t cursor;
+    if (!commandline_get_state(*ctx.parser, &buffer, &cursor)) {
+        buffer.clear();
+        cursor = 0;
+    }
+    native_condition_results_t &line = data.results_for(buffer, cursor);
+    auto cached = line.results.find(condition);
+    if (cached != line.results.end()) return cached->second;
+    bool result = native->evaluate(line.tokens);
+    line.results.emplace(condition, result);
+    return result;
+}
+
 /// Test if the specified script returns zero. The result is cached, so that if multiple completions
 /// use the same condition, it needs only be evaluated once. condition_cache_clear must be called
 /// after a completion run to make sure that there are no stale completions.
@@ -480,6 +850,10 @@ bool completer_t::condition_test(const wcstring &condition) {
     }
 
     ASSERT_IS_MAIN_THREAD();
+    if (auto native_result = native_condition_test(condition)) {
+        return *native_result;
+    }
+
     bool test_res;
     auto cached_entry = condition_cache.find(condition);
     if (cached_entry == condition_cache.end()) {
@@ -535,6 +909,7 @@ void complete_add(const wchar_t *cmd, bool cmd_is_path, const wcstring &option,
 /// option strings. Returns true if it is now empty and should be deleted, false if it's not empty.
 /// Must be called while locked.
 bool completion_entry_t::remove_option(const wcstring &option, complete_option_type_t type) {
+    this->index.reset();
     auto iter = this->options.begin();
     while (iter != this->options.end()) {
         if (iter->option == option && iter->type == type) {
@@ -766,8 +1141,17 @@ void completer_t::complete_cmd(const wcstring &str_cmd) {
 
         possible_comp.clear();
 
-        // Append all matching builtins
+        // Append all matching builtins. Those whose names start with "__" are internal, so they
+        // are hidden like functions.
         builtin_get_names(&possible_comp);
+        if (!include_hidden) {
+            possible_comp.erase(std::remove_if(possible_comp.begin(), possible_comp.end(),
+                                               [](const completion_t &c) {
+                                                   return string_prefixes_string(L"__",
+                                                                                 c.completion);
+                                               }),
+                                possible_comp.end());
+        }
         this->complete_strings(str_cmd, builtin_get_desc, possible_comp, 0);
     }
 }
@@ -883,19 +1267,13 @@ static const wchar_t *param_match2(const complete_entry_opt_t *e, const wchar_t
 /// Returns the position of the last option character (e.g. the position of z which is 2).
 /// Everything after that is assumed to be part of the parameter.
 /// Returns wcstring::npos if there is no valid short option.
-static size_t short_option_pos(const wcstring &arg, const option_list_t &options) {
+static size_t short_option_pos(const wcstring &arg, const completion_option_index_t &index) {
     if (arg.size() <= 1 || leading_dash_count(arg.c_str()) != 1) {
         return wcstring::npos;
     }
     for (size_t pos = 1; pos < arg.size(); pos++) {
-        wchar_t arg_char = arg.at(pos);
-        const complete_entry_opt_t *match = nullptr;
-        for (const complete_entry_opt_t &o : options) {
-            if (o.type == option_type_short && o.option.at(0) == arg_char) {
-                match = &o;
-                break;
-            }
-        }
+        const std::vector<size_t> *matches = index.short_options_for(arg.at(pos));
+        const complete_entry_opt_t *match = matches ? &index.options[matches->front()] : nullptr;
         if (match == nullptr) {
             // The first character after the dash is not a valid option.
             if (pos == 1) return wcstring::npos;
@@ -967,30 +1345,65 @@ bool completer_t::complete_param_for_command(const wcstring &cmd_orig, const wcs
         iothread_perform_on_main([&]() { complete_load(cmd); });
     }
 
-    // Make a list of lists of all options that we care about.
-    std::vector<option_list_t> all_options;
+    // Make a list of the option indexes of all commands that we care about.
+    std::vector<std::shared_ptr<const completion_option_index_t>> all_indexes;
     {
         auto completion_set = s_completion_set.acquire();
         for (const completion_entry_t &i : *completion_set) {
             const wcstring &match = i.cmd_is_path ? path : cmd;
             if (wildcard_match(match, i.cmd)) {
-                // Copy all of their options into our list.
-                all_options.push_back(i.get_options());  // Oof, this is a lot of copying
+                all_indexes.push_back(i.get_index());
             }
         }
     }
 
     // Now release the lock and test each option that we captured above. We have to do this outside
     // the lock because callouts (like the condition) may add or remove completions. See issue 2.
-    for (const option_list_t &options : all_options) {
-        size_t short_opt_pos = short_option_pos(str, options);
+    // The indexes are immutable, so this is safe.
+    for (const auto &index_ptr : all_indexes) {
+        const completion_option_index_t &index = *index_ptr;
+
+        // Test the condition of the option at \p idx. Many options share a condition, so remember
+        // the result for each distinct condition.
+        std::vector<signed char> condition_results(index.conditions.size(), -1);
+        auto option_condition_test = [&](size_t idx) {
+            size_t condition_idx = index.condition_idxs[idx];
+            signed char &result = condition_results[condition_idx];
+            if (result < 0) result = this->condition_test(index.conditions[condition_idx]);
+            return result > 0;
+        };
+
+        // The options that may match, in the order in which they are to be tried.
+        std::vector<size_t> candidates;
+        auto add_candidates = [&](const std::vector<size_t> *idxs) {
+            if (idxs) candidates.insert(candidates.end(), idxs->begin(), idxs->end());
+        };
+        auto sort_candidates = [&] { std::sort(candidates.begin(), candidates.end()); };
+
+        size_t short_opt_pos = short_option_pos(str, index);
         bool last_option_requires_param = false;
         use_common = true;
         if (use_switches) {
             if (str[0] == L'-') {
                 // Check if we are entering a combined option and argument (like --color=auto or
                 // -I/usr/include).
-                for (const complete_entry_opt_t &o : options) {
+                candidates.clear();
+                if (short_opt_pos != wcstring::npos) {
+                    add_candidates(index.short_options_for(str.at(short_opt_pos)));
+                }
+                size_t dashes = leading_dash_count(str.c_str());
+                auto long_type = dashes == 1 ? option_type_single_long : option_type_double_long;
+                if (dashes == 1 || dashes == 2) {
+                    // The option name ends at one of the equal signs.
+                    for (size_t eq = str.find(L'=', dashes); eq != wcstring::npos;
+                         eq = str.find(L'=', eq + 1)) {
+                        add_candidates(index.long_options_named(
+                            wcstring(str, dashes, eq - dashes), long_type));
+                    }
+                }
+                sort_candidates();
+                for (size_t idx : candidates) {
+                    const complete_entry_opt_t &o = index.options[idx];
                     const wchar_t *arg;
                     if (o.type == option_type_short) {
                         if (short_opt_pos == wcstring::npos) continue;
@@ -1000,7 +1413,7 @@ bool completer_t::complete_param_for_command(const wcstring &cmd_orig, const wcs
                     } else {
                         arg = param_match2(&o, str.c_str());
                     }
-                    if (arg != nullptr && this->condition_test(o.condition)) {
+                    if (arg != nullptr && option_condition_test(idx)) {
                         if (o.result_mode.requires_param) use_common = false;
                         if (o.result_mode.no_files) use_files = false;
                         if (o.result_mode.force_files) has_force = true;
@@ -1012,11 +1425,18 @@ bool completer_t::complete_param_for_command(const wcstring &cmd_orig, const wcs
                 // Here we are testing the previous argument,
                 // to see how we should complete the current argument
                 bool old_style_match = false;
+                size_t popt_dashes = leading_dash_count(popt.c_str());
 
                 // If we are using old style long options, check for them first.
-                for (const complete_entry_opt_t &o : options) {
+                candidates.clear();
+                if (popt_dashes == 1) {
+                    add_candidates(index.long_options_named(wcstring(popt, 1),
+                                                            option_type_single_long));
+                }
+                for (size_t idx : candidates) {
+                    const complete_entry_opt_t &o = index.options[idx];
                     if (o.type == option_type_single_long && param_match(&o, popt.c_str()) &&
-                        this->condition_test(o.condition)) {
+                        option_condition_test(idx)) {
                         old_style_match = true;
                         if (o.result_mode.requires_param) use_common = false;
                         if (o.result_mode.no_files) use_files = false;
@@ -1028,8 +1448,18 @@ bool completer_t::complete_param_for_command(const wcstring &cmd_orig, const wcs
                 // No old style option matched, or we are not using old style options. We check if
                 // any short (or gnu style) options do.
                 if (!old_style_match) {
-                    size_t prev_short_opt_pos = short_option_pos(popt, options);
-                    for (const complete_entry_opt_t &o : options) {
+                    size_t prev_short_opt_pos = short_option_pos(popt, index);
+                    candidates.clear();
+                    if (prev_short_opt_pos != wcstring::npos) {
+                        add_candidates(index.short_options_for(popt.at(prev_short_opt_pos)));
+                    }
+                    if (popt_dashes == 2) {
+                        add_candidates(index.long_options_named(wcstring(popt, 2),
+                                                                option_type_double_long));
+                    }
+                    sort_candidates();
+                    for (size_t idx : candidates) {
+                        const complete_entry_opt_t &o = index.options[idx];
                         // Gnu-style options with _optional_ arguments must be specified as a single
                         // token, so that it can be differed from a regular argument.
                         // Here we are testing the previous argument for a GNU-style match,
@@ -1046,7 +1476,7 @@ bool completer_t::complete_param_for_command(const wcstring &cmd_orig, const wcs
                         } else if (o.type == option_type_double_long) {
                             match = param_match(&o, popt.c_str());
                         }
-                        if (match && this->condition_test(o.condition)) {
+                        if (match && option_condition_test(idx)) {
                             if (o.result_mode.requires_param) use_common = false;
                             if (o.result_mode.no_files) use_files = false;
                             if (o.result_mode.force_files) has_force = true;
@@ -1061,10 +1491,28 @@ bool completer_t::complete_param_for_command(const wcstring &cmd_orig, const wcs
             continue;
         }
 
-        // Now we try to complete an option itself
-        for (const complete_entry_opt_t &o : options) {
+        // Now we try to complete an option itself. Only look at the options which may match: those
+        // without a switch, short options if a short option may be appended, and long options
+        // which the argument is a prefix of.
+        candidates = index.args_only_options;
+        if (use_switches && str[0] == L'-') {
+            bool short_options_apply = short_opt_pos == wcstring::npos
+                                           ? str == L"-"
+                                           : short_opt_pos + 1 == str.size() &&
+                                                 !last_option_requires_param;
+            if (short_options_apply) add_candidates(&index.short_options);
+            index.append_long_options_with_prefix(wcstring(str, 1), option_type_single_long,
+                                                  &candidates);
+            if (str == L"-" || str[1] == L'-') {
+                index.append_long_options_with_prefix(str == L"-" ? wcstring() : wcstring(str, 2),
+                                                      option_type_double_long, &candidates);
+            }
+        }
+        sort_candidates();
+        for (size_t idx : candidates) {
+            const complete_entry_opt_t &o = index.options[idx];
             // If this entry is for the base command, check if any of the arguments match.
-            if (!this->condition_test(o.condition)) continue;
+            if (!option_condition_test(idx)) continue;
             if (o.option.empty()) {
                 use_files = use_files && (!(o.result_mode.no_files));
                 complete_from_args(str, o.comp, o.localized_desc(), o.flags);
@@ -387,10 +387,13 @@ void env_init(const struct config_paths_t *paths /* or NULL */) {
     // Set fish_bind_mode to "default".
     vars.set_one(FISH_BIND_MODE_VAR, ENV_GLOBAL, DEFAULT_BIND_MODE);
 
+    startup_profile_mark(L"environment");
+
     // Allow changes to variables to produce events.
     env_dispatch_init(vars);
 
     init_input();
+    startup_profile_mark(L"terminal and input setup");
 
     // Complain about invalid config paths.
     path_emit_config_directory_errors(vars);
@@ -400,6 +403,7 @@ void env_init(const struct config_paths_t *paths /* or NULL */) {
     callback_data_list_t callbacks;
     s_universal_variables->initialize(callbacks);
     env_universal_callbacks(&vars, callbacks);
+    startup_profile_mark(L"universal variables");
 
     // Do not import variables that have the same name and value as
     // an exported universal variable. See issues #5258 and #5348.
@@ -558,6 +562,17 @@ class env_scoped_impl_t : public environment_t {
     // If this differs from the current export generations then we need to regenerate the array.
     std::vector<export_generation_t> export_array_generations_{};
 
+    // The exported variables as of the last regeneration of the export array, each with its
+    // encoding as "key=value". Regenerating re-encodes only variables that have changed since.
+    struct export_encoding_t {
+        env_var_t var;
+        std::string str;
+        // The regeneration which last saw this variable.
+        uint64_t pass;
+    };
+    std::unordered_map<wcstring, export_encoding_t> export_encodings_{};
+    uint64_t export_encoding_pass_{0};
+
    private:
     // These "try" methods return true on success, false on failure. On a true return, \p result is
     // populated. A maybe_t<maybe_t<...>> is a bridge too far.
@@ -583,8 +598,8 @@ class env_scoped_impl_t : public environment_t {
     /// \return whether the current export array is empty or out-of-date.
     bool export_array_needs_regeneration() const;
 
-    /// \return a newly allocated export array.
-    std::shared_ptr<const null_terminated_array_t<char>> create_export_array() const;
+    /// \return a newly allocated export array, updating our cached encodings.
+    std::shared_ptr<const null_terminated_array_t<char>> create_export_array();
 };
 
 /// Get the exported variables into a variable table.
@@ -631,10 +646,7 @@ bool env_scoped_impl_t::export_array_needs_regeneration() const {
     return mismatch;
 }
 
-std::shared_ptr<const null_terminated_array_t<char>> env_scoped_impl_t::create_export_array()
-    const {
-    var_table_t table;
-
+std::shared_ptr<const null_terminated_array_t<char>> env_scoped_impl_t::create_export_array() {
     FLOG(env_export, L"create_export_array() recalc");
     var_table_t vals;
     get_exported(this->globals_, vals);
@@ -656,14 +668,35 @@ std::shared_ptr<const null_terminated_array_t<char>> env_scoped_impl_t::create_e
     // Dorky way to add our single exported computed variable.
     vals[L"PWD"] = env_var_t(L"PWD", perproc_data().pwd);
 
-    // Construct the export list: a list of strings of the form key=value.
+    // Construct the export list: a list of strings of the form key=value. Typically only a few
+    // variables have changed since the last time, so reuse the encodings of the others.
+    const uint64_t pass = ++export_encoding_pass_;
     std::vector<std::string> export_list;
     export_list.reserve(vals.size());
-    for (const auto &kv : vals) {
-        std::string str = wcs2string(kv.first);
-        str.push_back('=');
-        str.append(wcs2string(kv.second.as_string()));
-        export_list.push_back(std::move(str));
+    for (auto &kv : vals) {
+        auto iter = export_encodings_.find(kv.first);
+        if (iter == export_encodings_.end() || iter->second.var != kv.second) {
+            std::string str = wcs2string(kv.first);
+            str.push_back('=');
+            str.append(wcs2string(kv.second.as_string()));
+            export_encoding_t encoding{std::move(kv.second), std::move(str), pass};
+            if (iter == export_encodings_.end()) {
+                iter = export_encodings_.emplace(kv.first, std::move(encoding)).first;
+            } else {
+                iter->second = std::move(encoding);
+            }
+        }
+        iter->second.pass = pass;
+        export_list.push_back(iter->second.str);
+    }
+
+    // Forget variables which are no longer exported.
+    for (auto iter = export_encodings_.begin(); iter != export_encodings_.end();) {
+        if (iter->second.pass != pass) {
+            iter = export_encodings_.erase(iter);
+        } else {
+            ++iter;
+        }
     }
     return std::make_shared<null_terminated_array_t<char>>(export_list);
 }
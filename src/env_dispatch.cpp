@@ -49,6 +49,7 @@
 #include "maybe.h"
 #include "output.h"
 #include "parser.h"
+#include "path.h"
 #include "proc.h"
 #include "reader.h"
 #include "screen.h"
@@ -240,6 +241,11 @@ static void handle_function_path_change(const env_stack_t &vars) {
     function_invalidate_path();
 }
 
+static void handle_path_change(const env_stack_t &vars) {
+    UNUSED(vars);
+    path_invalidate_dir_cache();
+}
+
 static void handle_complete_path_change(const env_stack_t &vars) {
     UNUSED(vars);
     complete_invalidate_path();
@@ -301,6 +307,7 @@ static std::unique_ptr<const var_dispatch_table_t> create_dispatch_table() {
     var_dispatch_table->add(L"fish_ambiguous_width", handle_change_ambiguous_width);
     var_dispatch_table->add(L"LINES", handle_term_size_change);
     var_dispatch_table->add(L"COLUMNS", handle_term_size_change);
+    var_dispatch_table->add(L"PATH", handle_path_change);
     var_dispatch_table->add(L"fish_complete_path", handle_complete_path_change);
     var_dispatch_table->add(L"fish_function_path", handle_function_path_change);
     var_dispatch_table->add(L"fish_read_limit", handle_read_limit_change);
@@ -25,15 +25,20 @@
 #ifdef HAVE_SYS_SELECT_H
 #include <sys/select.h>  // IWYU pragma: keep
 #endif
+#ifdef HAVE_INOTIFY_INIT1
+#include <sys/inotify.h>
+#endif
 #include <signal.h>
 #include <sys/stat.h>
 #include <sys/time.h>   // IWYU pragma: keep
 #include <sys/types.h>  // IWYU pragma: keep
 #include <unistd.h>
 
+#include <algorithm>
 #include <atomic>
 #include <cwchar>
 #include <map>
+#include <random>
 #include <string>
 #include <type_traits>
 #include <utility>
@@ -43,6 +48,7 @@
 #include "env_universal_common.h"
 #include "fallback.h"  // IWYU pragma: keep
 #include "flog.h"
+#include "inotify_queue.h"
 #include "path.h"
 #include "signal.h"
 #include "utf8.h"
@@ -69,6 +75,15 @@
 /// Version for fish 3.0
 #define UVARS_VERSION_3_0 "3.0"
 
+/// Start of the comment line with the journal id, which identifies one compacted version of the
+/// file. Changes are appended to the file as further records, until it is compacted again.
+#define UVARS_JOURNAL_ID "# JOURNAL: "
+
+// Once the file has more than this many records per variable, plus the slack, changes are written
+// by compacting the file instead of appending to it.
+static constexpr size_t k_journal_records_per_var = 2;
+static constexpr size_t k_journal_slack_records = 64;
+
 // Maximum file size we'll read.
 static constexpr size_t k_max_read_size = 16 * 1024 * 1024;
 
@@ -379,6 +394,123 @@ void env_universal_t::acquire_variables(var_table_t &vars_to_acquire) {
     this->vars = std::move(vars_to_acquire);
 }
 
+void env_universal_t::apply_appended_variables(var_table_t &changed_vars,
+                                               callback_data_list_t &callbacks) {
+    for (auto &kv : changed_vars) {
+        const wcstring &key = kv.first;
+        // Skip modified values.
+        if (this->modified.count(key)) continue;
+
+        // See if the value has changed. Appended records never erase a variable.
+        const env_var_t &new_entry = kv.second;
+        auto existing = this->vars.find(key);
+        bool old_exports = (existing != this->vars.end() && existing->second.exports());
+        bool export_changed = (old_exports != new_entry.exports());
+        bool value_changed = existing != this->vars.end() && existing->second != new_entry;
+        if (export_changed || value_changed) {
+            export_generation += 1;
+        }
+        if (existing == this->vars.end() || export_changed || value_changed) {
+            callbacks.push_back(callback_data_t(key, new_entry.as_string()));
+            this->vars[key] = std::move(kv.second);
+        }
+    }
+}
+
+/// \return the length of \p contents up to the end of its last complete line.
+static size_t complete_lines_length(const std::string &contents) {
+    size_t newline = contents.rfind('\n');
+    return newline == std::string::npos ? 0 : newline + 1;
+}
+
+/// Read the contents of \p fd from its current position.
+static std::string read_contents(int fd) {
+    // Read everything from the fd. Put a sane limit on it.
+    std::string contents;
+    while (contents.size() < k_max_read_size) {
+        char buffer[4096];
+        ssize_t amt = read_loop(fd, buffer, sizeof buffer);
+        if (amt <= 0) {
+            break;
+        }
+        contents.append(buffer, amt);
+    }
+
+    // Handle overlong files.
+    if (contents.size() > k_max_read_size) {
+        contents.resize(k_max_read_size);
+        // Back up to a newline.
+        contents.resize(complete_lines_length(contents));
+    }
+    return contents;
+}
+
+/// \return the leading comments of \p contents up to and including the journal id, or an empty
+/// string if there is no journal id.
+static std::string journal_header_for_contents(const std::string &contents) {
+    size_t cursor = 0;
+    while (cursor < contents.size() && contents.at(cursor) == '#') {
+        size_t end = contents.find('\n', cursor);
+        if (end == std::string::npos) break;
+        if (contents.compare(cursor, const_strlen(UVARS_JOURNAL_ID), UVARS_JOURNAL_ID) == 0) {
+            return contents.substr(0, end + 1);
+        }
+        cursor = end + 1;
+    }
+    return {};
+}
+
+/// \return a new random journal id.
+static std::string new_journal_id() {
+    std::random_device rd;
+    char buff[32];
+    snprintf(buff, sizeof buff, "%08x%08x", rd(), rd());
+    return buff;
+}
+
+// Try reading only the records which were appended to the file since we last read it.
+// \return false if that is not possible, because the file was replaced or compacted.
+bool env_universal_t::load_appended_records(int fd, const file_id_t &current_file,
+                                            callback_data_list_t &callbacks) {
+    ASSERT_IS_LOCKED(lock);
+    if (journal_header.empty() || current_file.device != last_read_file.device ||
+        current_file.inode != last_read_file.inode || current_file.size < journal_offset) {
+        return false;
+    }
+
+    // The inode may have been reused for a new file, so check that it starts the same way.
+    std::string header(journal_header.size(), '\0');
+    if (pread(fd, &header[0], header.size(), 0) != static_cast<ssize_t>(header.size()) ||
+        header != journal_header) {
+        return false;
+    }
+
+    if (lseek(fd, static_cast<off_t>(journal_offset), SEEK_SET) < 0) return false;
+    // Ignore a trailing partial line, which may be a record that is being appended.
+    std::string records = read_contents(fd);
+    records.resize(complete_lines_length(records));
+
+    var_table_t changed_vars;
+    line_iterator_t<std::string> iter{records};
+    wcstring wide_line;
+    wcstring storage;
+    while (iter.next()) {
+        const std::string &line = iter.line();
+        if (line.empty() || line.front() == '#') continue;
+        wide_line.clear();
+        if (!utf8_to_wchar(line.data(), line.size(), &wide_line, 0)) continue;
+        env_universal_t::parse_message_30_internal(wide_line, &changed_vars, &storage);
+        journal_records++;
+    }
+    FLOGF(uvar_file, L"universal log read %lu appended bytes",
+          static_cast<unsigned long>(records.size()));
+
+    this->apply_appended_variables(changed_vars, callbacks);
+    journal_offset += records.size();
+    last_read_file = current_file;
+    return true;
+}
+
 void env_universal_t::load_from_fd(int fd, callback_data_list_t &callbacks) {
     ASSERT_IS_LOCKED(lock);
     assert(fd >= 0);
@@ -386,10 +518,26 @@ void env_universal_t::load_from_fd(int fd, callback_data_list_t &callbacks) {
     const file_id_t current_file = file_id_for_fd(fd);
     if (current_file == last_read_file) {
         FLOGF(uvar_file, L"universal log sync elided based on fstat()");
+    } else if (this->load_appended_records(fd, current_file, callbacks)) {
+        FLOGF(uvar_file, L"universal log sync read appended records");
     } else {
-        // Read a variables table from the file.
+        // Read a variables table from the file. Another fish may be appending a record to a
+        // journaled file, and we may not hold the lock, so ignore a trailing partial line there.
+        // Other files, e.g. hand-edited ones, are parsed whole.
+        std::string contents = read_contents(fd);
+        std::string header = journal_header_for_contents(contents);
+        if (!header.empty()) contents.resize(complete_lines_length(contents));
         var_table_t new_vars;
-        uvar_format_t format = this->read_message_internal(fd, &new_vars);
+        uvar_format_t format = populate_variables(contents, &new_vars);
+
+        // Remember where the records end, so that we can later read only appended ones.
+        journal_header.clear();
+        if (format == uvar_format_t::fish_3_0) {
+            journal_header = std::move(header);
+        }
+        // A file which ends with an incomplete line is never appended to.
+        journal_offset = complete_lines_length(contents);
+        journal_records = std::count(contents.begin(), contents.end(), '\n');
 
         // Hacky: if the read format is in the future, avoid overwriting the file: never try to
         // save.
@@ -437,11 +585,17 @@ uint64_t env_universal_t::get_export_generation() const {
 }
 
 /// Serialize the contents to a string.
-std::string env_universal_t::serialize_with_vars(const var_table_t &vars) {
+std::string env_universal_t::serialize_with_vars(const var_table_t &vars,
+                                                 const std::string &journal_id) {
     std::string storage;
     std::string contents;
     contents.append(SAVE_MSG);
     contents.append("# VERSION: " UVARS_VERSION_3_0 "\n");
+    if (!journal_id.empty()) {
+        contents.append(UVARS_JOURNAL_ID);
+        contents.append(journal_id);
+        contents.push_back('\n');
+    }
 
     // Preserve legacy behavior by sorting the values first
     using env_pair_t =
@@ -467,7 +621,7 @@ bool env_universal_t::write_to_fd(int fd, const wcstring &path) {
     ASSERT_IS_LOCKED(lock);
     assert(fd >= 0);
     bool success = true;
-    std::string contents = serialize_with_vars(vars);
+    std::string contents = serialize_with_vars(vars, new_journal_id());
     if (write_loop(fd, contents.data(), contents.size()) < 0) {
         const char *error = std::strerror(errno);
         FLOGF(error, _(L"Unable to write to universal variables file '%ls': %s"), path.c_str(),
@@ -477,11 +631,65 @@ bool env_universal_t::write_to_fd(int fd, const wcstring &path) {
 
     // Since we just wrote out this file, it matches our internal state; pretend we read from it.
     this->last_read_file = file_id_for_fd(fd);
+    this->journal_header = success ? journal_header_for_contents(contents) : std::string();
+    this->journal_offset = contents.size();
+    this->journal_records = vars.size();
 
     // We don't close the file.
     return success;
 }
 
+/// \return whether our modifications may be appended to the file we just read.
+bool env_universal_t::can_append_to_file() const {
+    ASSERT_IS_LOCKED(lock);
+    // The file must be one that we can replay, and must not end with an incomplete record, e.g.
+    // from a fish which was killed while appending.
+    if (journal_header.empty() || last_read_file.size != journal_offset) return false;
+
+    // Erasing a variable cannot be expressed as a record, as fish versions which do not know
+    // about appending would not understand it.
+    for (const wcstring &key : modified) {
+        if (!vars.count(key)) return false;
+    }
+
+    // Compact the file once it is mostly outdated records.
+    size_t max_records = k_journal_records_per_var * vars.size() + k_journal_slack_records;
+    return journal_records + modified.size() <= max_records;
+}
+
+/// Append records for our modified variables to the file. path is provided only for error
+/// reporting.
+bool env_universal_t::append_to_fd(int fd, const wcstring &path) {
+    ASSERT_IS_LOCKED(lock);
+    assert(fd >= 0);
+    // Write the records in sorted order, like the rest of the file.
+    std::vector<wcstring> keys(modified.begin(), modified.end());
+    std::sort(keys.begin(), keys.end());
+    std::string storage;
+    std::string contents;
+    for (const wcstring &key : keys) {
+        const env_var_t &var = vars.at(key);
+        append_file_entry(var.get_flags(), key, encode_serialized(var.as_list()), &contents,
+                          &storage);
+    }
+
+    // A single write keeps the records together, so concurrent readers see all or none of them.
+    if (lseek(fd, static_cast<off_t>(journal_offset), SEEK_SET) < 0 ||
+        write_loop(fd, contents.data(), contents.size()) < 0) {
+        const char *error = std::strerror(errno);
+        FLOGF(error, _(L"Unable to write to universal variables file '%ls': %s"), path.c_str(),
+              error);
+        return false;
+    }
+
+    // Since we just wrote the records, the file matches our internal state.
+    this->last_read_file = file_id_for_fd(fd);
+    this->journal_offset += contents.size();
+    this->journal_records += keys.size();
+    modified.clear();
+    return true;
+}
+
 bool env_universal_t::move_new_vars_file_into_place(const wcstring &src, const wcstring &dst) {
     int ret = wrename(src, dst);
     if (ret != 0) {
@@ -650,9 +858,13 @@ bool env_universal_t::sync(callback_data_list_t &callbacks) {
     // 2. Lock the file (may be combined with step 1 on systems with O_EXLOCK)
     // 3. After taking the lock, check if the file at the given path is different from what we
     // opened. If so, start over.
-    // 4. Read from the file. This can be elided if its dev/inode is unchanged since the last read
-    // 5. Open an adjacent temporary file
-    // 6. Write our changes to an adjacent file
+    // 4. Read from the file. This can be elided if its dev/inode is unchanged since the last read,
+    // and if records were only appended since then, only those are read.
+    // 5. If only some variables were set, append records for them to the file, and skip to step 8.
+    // Readers replay the file in order, so the last record for a variable wins. The file is
+    // compacted with the following steps when variables were erased, or when it has too many
+    // outdated records.
+    // 6. Open an adjacent temporary file, and write all variables to it
     // 7. Move the adjacent file into place via rename. This is assumed to be atomic.
     // 8. Release the lock and close the file
     //
@@ -661,8 +873,8 @@ bool env_universal_t::sync(callback_data_list_t &callbacks) {
     // the original file, or process 2's new file. If it sees the new file, we're OK: it's going to
     // read from the new file, and so there's no data loss. If it sees the old file, then process 2
     // must have locked it (if process 1 locks it, switch their roles). The lock will block until
-    // process 2 reaches step 7; at that point process 1 will reach step 2, notice that the file has
-    // changed, and then start over.
+    // process 2 reaches step 8; at that point process 1 will reach step 2, notice if the file has
+    // been replaced and start over, and otherwise read the records process 2 appended.
     //
     // It's possible that the underlying filesystem does not support locks (lockless NFS). In this
     // case, we risk data loss if two shells try to write their universal variables simultaneously.
@@ -713,7 +925,12 @@ bool env_universal_t::sync(callback_data_list_t &callbacks) {
     }
 
     if (success && ok_to_save) {
-        success = this->save(directory, explicit_vars_path);
+        if (this->can_append_to_file()) {
+            FLOGF(uvar_file, L"universal log appending to file");
+            success = this->append_to_fd(vars_fd.fd(), explicit_vars_path);
+        } else {
+            success = this->save(directory, explicit_vars_path);
+        }
     }
     return success;
 }
@@ -792,29 +1009,6 @@ bool env_universal_t::save(const wcstring &directory, const wcstring &vars_path)
     return success;
 }
 
-uvar_format_t env_universal_t::read_message_internal(int fd, var_table_t *vars) {
-    // Read everything from the fd. Put a sane limit on it.
-    std::string contents;
-    while (contents.size() < k_max_read_size) {
-        char buffer[4096];
-        ssize_t amt = read_loop(fd, buffer, sizeof buffer);
-        if (amt <= 0) {
-            break;
-        }
-        contents.append(buffer, amt);
-    }
-
-    // Handle overlong files.
-    if (contents.size() >= k_max_read_size) {
-        contents.resize(k_max_read_size);
-        // Back up to a newline.
-        size_t newline = contents.rfind('\n');
-        contents.resize(newline == wcstring::npos ? 0 : newline);
-    }
-
-    return populate_variables(contents, vars);
-}
-
 /// \return the format corresponding to file contents \p s.
 uvar_format_t env_universal_t::format_for_contents(const std::string &s) {
     // Walk over leading comments, looking for one like '# version'
@@ -1577,6 +1771,134 @@ class universal_notifier_named_pipe_t final : public universal_notifier_t {
 #endif
 };
 
+// Inotify-based notifier. There is nothing to post: writing the variables file is itself the
+// notification. We watch the directory containing the file rather than the file itself, because
+// the file is replaced via rename when it is rewritten, and only wake for events about the file
+// once its writer has closed it or moved it into place. Unrelated changes in the config directory,
+// and sessions that did not change anything, do not cause any work.
+//
+// To coalesce bursts of writes (e.g. a script doing many `set -U`), after waking we stop watching
+// the fd for a short while, and then check once whether anything else changed in the meantime.
+//
+// The inotify instance is shared with the rest of fish, see inotify_queue_t. Other users may read
+// our events on the main thread; they are then queued for us, and picked up when polling.
+//
+// If we cannot watch the directory (e.g. because we are out of inotify watches), we fall back to
+// checking once a second whether the file's identity has changed.
+class universal_notifier_inotify_t final : public universal_notifier_t {
+#ifdef HAVE_INOTIFY_INIT1
+    // Our watch in the shared inotify queue, or -1.
+    int watch_{-1};
+    std::string vars_path_;
+    std::string vars_name_;
+
+    // How long to wait after a notification before reporting another one.
+    static constexpr long long k_coalesce_duration_usec = 1e4;
+
+    // If nonzero, we are coalescing notifications until this time.
+    long long coalesce_until_usec_{0};
+
+    // How often to check the file when we cannot watch it.
+    static constexpr long long k_fallback_poll_usec = 1e6;
+
+    // The identity of the file when we last checked it, if we cannot watch it.
+    file_id_t last_file_id_{kInvalidFileID};
+
+    // Take our queued events. If any of them may concern the variables file, start coalescing and
+    // \return true.
+    bool check_events() {
+        bool result = false;
+        for (const auto &event : inotify_queue_t::shared().acquire()->take_events(watch_)) {
+            if (event.mask & IN_Q_OVERFLOW) {
+                // We lost events, so assume the worst.
+                result = true;
+            } else if (vars_name_ == event.name) {
+                result = true;
+            }
+        }
+        if (result) coalesce_until_usec_ = get_time() + k_coalesce_duration_usec;
+        return result;
+    }
+
+   public:
+    explicit universal_notifier_inotify_t(const wchar_t *test_path) {
+        wcstring vars_path;
+        if (test_path) {
+            vars_path = test_path;
+        } else if (auto path = default_vars_path()) {
+            vars_path = path.acquire();
+        } else {
+            return;
+        }
+        vars_path_ = wcs2string(vars_path);
+        vars_name_ = wcs2string(wbasename(vars_path));
+        last_file_id_ = file_id_for_path(vars_path_);
+
+        uint32_t mask = IN_CLOSE_WRITE | IN_MOVED_TO | IN_ONLYDIR;
+        std::string dir = wcs2string(wdirname(vars_path));
+        watch_ = inotify_queue_t::shared().acquire()->add_watch(dir, mask);
+        if (watch_ < 0) {
+            FLOGF(uvar_file, L"Unable to watch directory '%s': %s", dir.c_str(),
+                  std::strerror(errno));
+        }
+    }
+
+    ~universal_notifier_inotify_t() override {
+        if (watch_ >= 0) inotify_queue_t::shared().acquire()->remove_watch(watch_);
+    }
+
+    int notification_fd() const override {
+        // While coalescing, events are left in the queue and picked up by poll().
+        if (coalesce_until_usec_ || watch_ < 0) return -1;
+        return inotify_queue_t::shared().acquire()->fd();
+    }
+
+    bool notification_fd_became_readable(int fd) override {
+        UNUSED(fd);
+        inotify_queue_t::shared().acquire()->read_events();
+        return check_events();
+    }
+
+    unsigned long usec_delay_between_polls() const override {
+        if (watch_ < 0) {
+            return vars_path_.empty() ? 0 : static_cast<unsigned long>(k_fallback_poll_usec);
+        }
+        if (!coalesce_until_usec_) {
+            // Someone else may have read events for us; have poll() pick them up right away.
+            return inotify_queue_t::shared().acquire()->has_events(watch_) ? 1 : 0;
+        }
+        long long now = get_time();
+        // Don't return 0, as that means no polling.
+        return now >= coalesce_until_usec_ ? 1
+                                           : static_cast<unsigned long>(coalesce_until_usec_ - now);
+    }
+
+    bool poll() override {
+        if (watch_ < 0) {
+            if (vars_path_.empty()) return false;
+            file_id_t file_id = file_id_for_path(vars_path_);
+            if (file_id == last_file_id_) return false;
+            last_file_id_ = file_id;
+            return true;
+        }
+        if (coalesce_until_usec_) {
+            if (get_time() < coalesce_until_usec_) return false;
+            // Our coalescing period is over. Report anything that happened during it, and if
+            // something did, coalesce again.
+            coalesce_until_usec_ = 0;
+            inotify_queue_t::shared().acquire()->read_events();
+        }
+        return check_events();
+    }
+#else  // this class isn't valid on this system
+   public:
+    explicit universal_notifier_inotify_t(const wchar_t *test_path) {
+        static_cast<void>(test_path);
+        DIE("universal_notifier_inotify_t cannot be used on this system");
+    }
+#endif
+};
+
 universal_notifier_t::notifier_strategy_t universal_notifier_t::resolve_default_strategy() {
 #ifdef FISH_NOTIFYD_AVAILABLE
     return strategy_notifyd;
@@ -1592,6 +1914,12 @@ universal_notifier_t::notifier_strategy_t universal_notifier_t::resolve_default_
         return strategy_named_pipe;
     }
     return strategy_sigio;
+#elif defined(HAVE_INOTIFY_INIT1)
+    // WSL 1 only partially implements inotify.
+    if (is_windows_subsystem_for_linux()) {
+        return strategy_named_pipe;
+    }
+    return strategy_inotify;
 #else
     return strategy_named_pipe;
 #endif
@@ -1618,6 +1946,9 @@ std::unique_ptr<universal_notifier_t> universal_notifier_t::new_notifier_for_str
         case strategy_named_pipe: {
             return make_unique<universal_notifier_named_pipe_t>(test_path);
         }
+        case strategy_inotify: {
+            return make_unique<universal_notifier_inotify_t>(test_path);
+        }
     }
     DIE("should never reach this statement");
     return nullptr;
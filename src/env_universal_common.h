@@ -74,6 +74,17 @@ class env_universal_t {
     // File id from which we last read.
     file_id_t last_read_file = kInvalidFileID;
 
+    // The start of the file we last read, up to and including its journal id; or empty if it has
+    // none. Records may be appended to a file, which are then read by replaying only the new part.
+    // This is only safe if the file still starts the same way, as its inode may have been reused.
+    std::string journal_header;
+
+    // The offset just past the last complete record we read from the file.
+    uint64_t journal_offset{0};
+
+    // The number of records in the file up to journal_offset, used to decide when to compact it.
+    size_t journal_records{0};
+
     // Given a variable table, generate callbacks representing the difference between our vars and
     // the new vars. Also update our exports generation count as necessary.
     void generate_callbacks_and_update_exports(const var_table_t &new_vars,
@@ -83,6 +94,16 @@ class env_universal_t {
     // vars_to_acquire.
     void acquire_variables(var_table_t &vars_to_acquire);
 
+    // Given variables read from records appended to the file, generate callbacks for the changed
+    // ones, and copy unmodified values into self. May destructively modify changed_vars.
+    void apply_appended_variables(var_table_t &changed_vars, callback_data_list_t &callbacks);
+
+    // Functions concerned with appending to the file.
+    bool load_appended_records(int fd, const file_id_t &current_file,
+                               callback_data_list_t &callbacks);
+    bool can_append_to_file() const;
+    bool append_to_fd(int fd, const wcstring &path);
+
     static bool populate_1_variable(const wchar_t *input, env_var_t::env_var_flags_t flags,
                                     var_table_t *vars, wcstring *storage);
 
@@ -90,7 +111,6 @@ class env_universal_t {
                                           wcstring *storage);
     static void parse_message_30_internal(const wcstring &msg, var_table_t *vars,
                                           wcstring *storage);
-    static uvar_format_t read_message_internal(int fd, var_table_t *vars);
 
     bool save(const wcstring &directory, const wcstring &vars_path);
 
@@ -130,8 +150,9 @@ class env_universal_t {
     /// Guess a file format. Exposed for testing only.
     static uvar_format_t format_for_contents(const std::string &s);
 
-    /// Serialize a variable list. Exposed for testing only.
-    static std::string serialize_with_vars(const var_table_t &vars);
+    /// Serialize a variable list, with the given journal id if not empty. Exposed for testing only.
+    static std::string serialize_with_vars(const var_table_t &vars,
+                                           const std::string &journal_id = {});
 
     /// Exposed for testing only.
     bool is_ok_to_save() const { return ok_to_save; }
@@ -172,6 +193,10 @@ class universal_notifier_t {
         // Strategy that uses a named pipe. Somewhat complex, but portable and doesn't require
         // polling most of the time.
         strategy_named_pipe,
+
+        // Linux-specific strategy that watches the variables file with inotify. Only wakes when
+        // the file actually changed.
+        strategy_inotify,
     };
 
    protected:
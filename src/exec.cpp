@@ -130,19 +130,11 @@ enum class launch_result_t {
 // Returns whether we can use posix spawn for a given process in a given job.
 //
 // To avoid the race between the caller calling tcsetpgrp() and the client checking the
-// foreground process group, we don't use posix_spawn if we're going to foreground the process. (If
-// we use fork(), we can call tcsetpgrp after the fork, before the exec, and avoid the race).
-static bool can_use_posix_spawn_for_job(const std::shared_ptr<job_t> &job,
-                                        const dup2_list_t &dup2s) {
-    // Hack - do not use posix_spawn if there are self-fd redirections.
-    // For example if you were to write:
-    //   cmd 6< /dev/null
-    // it is possible that the open() of /dev/null would result in fd 6. Here even if we attempted
-    // to add a dup2 action, it would be ignored and the CLO_EXEC bit would remain. So don't use
-    // posix_spawn in this case; instead we'll call fork() and clear the CLO_EXEC bit manually.
-    for (const auto &action : dup2s.get_actions()) {
-        if (action.src == action.target) return false;
-    }
+// foreground process group, the child must assign the terminal to itself before it executes. (If
+// we use fork(), we can call tcsetpgrp after the fork, before the exec, and avoid the race). So
+// unless posix_spawn can do the same, we don't use it if we're going to foreground the process.
+static bool can_use_posix_spawn_for_job(const std::shared_ptr<job_t> &job) {
+#ifndef HAVE_POSIX_SPAWN_FILE_ACTIONS_ADDTCSETPGRP_NP
     if (job->wants_job_control()) {  //!OCLINT(collapsible if statements)
         // We are going to use job control; therefore when we launch this job it will get its own
         // process group ID. But will it be foregrounded?
@@ -152,6 +144,21 @@ static bool can_use_posix_spawn_for_job(const std::shared_ptr<job_t> &job,
             return false;
         }
     }
+#else
+    UNUSED(job);
+#endif
+    return true;
+}
+
+/// Create the pipes of the buffers that \p ios fills, so that it can be resolved into dup2s.
+/// \return false if a pipe could not be created, after printing an error.
+static bool ensure_buffer_pipes(const io_chain_t &ios) {
+    for (const auto &io : ios) {
+        if (io->io_mode == io_mode_t::bufferfill &&
+            !static_cast<const io_bufferfill_t &>(*io).buffer()->ensure_pipe()) {
+            return false;
+        }
+    }
     return true;
 }
 
@@ -159,7 +166,8 @@ static void internal_exec(env_stack_t &vars, job_t *j, const io_chain_t &block_i
     // Do a regular launch -  but without forking first...
     process_t *p = j->processes.front().get();
     io_chain_t all_ios = block_io;
-    if (!all_ios.append_from_specs(p->redirection_specs(), vars.get_pwd_slash())) {
+    if (!all_ios.append_from_specs(p->redirection_specs(), vars.get_pwd_slash()) ||
+        !ensure_buffer_pipes(all_ios)) {
         return;
     }
 
@@ -195,10 +203,11 @@ static pid_t maybe_assign_pgid_from_child(const std::shared_ptr<job_t> &j, pid_t
 /// Construct an internal process for the process p. In the background, write the data \p outdata to
 /// stdout and \p errdata to stderr, respecting the io chain \p ios. For example if target_fd is 1
 /// (stdout), and there is a dup2 3->1, then we need to write to fd 3. Then exit the internal
-/// process.
-static void run_internal_process(process_t *p, std::string &&outdata, std::string &&errdata,
-                                 const io_chain_t &ios) {
+/// process. \return failed if the io chain cannot be set up.
+static launch_result_t run_internal_process(process_t *p, std::string &&outdata,
+                                            std::string &&errdata, const io_chain_t &ios) {
     p->check_generations_before_launch();
+    if (!ensure_buffer_pipes(ios)) return launch_result_t::failed;
 
     // We want both the dup2s and the io_chain_ts to be kept alive by the background thread, because
     // they may own an fd that we want to write to. Move them all to a shared_ptr. The strings as
@@ -248,7 +257,7 @@ static void run_internal_process(process_t *p, std::string &&outdata, std::strin
     // TODO: support eliding output to /dev/null.
     if (f->skip_out() && f->skip_err()) {
         f->internal_proc->mark_exited(p->status);
-        return;
+        return launch_result_t::ok;
     }
 
     // Ensure that ios stays alive, it may own fds.
@@ -285,13 +294,16 @@ static void run_internal_process(process_t *p, std::string &&outdata, std::strin
         }
         f->internal_proc->mark_exited(status);
     });
+    return launch_result_t::ok;
 }
 
 /// If \p outdata or \p errdata are both empty, then mark the process as completed immediately.
 /// Otherwise, run an internal process.
-static void run_internal_process_or_short_circuit(parser_t &parser, const std::shared_ptr<job_t> &j,
-                                                  process_t *p, std::string &&outdata,
-                                                  std::string &&errdata, const io_chain_t &ios) {
+static launch_result_t run_internal_process_or_short_circuit(parser_t &parser,
+                                                             const std::shared_ptr<job_t> &j,
+                                                             process_t *p, std::string &&outdata,
+                                                             std::string &&errdata,
+                                                             const io_chain_t &ios) {
     if (outdata.empty() && errdata.empty()) {
         p->completed = true;
         if (p->is_last_in_job) {
@@ -311,8 +323,9 @@ static void run_internal_process_or_short_circuit(parser_t &parser, const std::s
             }
         }
     } else {
-        run_internal_process(p, std::move(outdata), std::move(errdata), ios);
+        return run_internal_process(p, std::move(outdata), std::move(errdata), ios);
     }
+    return launch_result_t::ok;
 }
 
 bool blocked_signals_for_job(const job_t &job, sigset_t *sigmask) {
@@ -477,8 +490,9 @@ static std::unique_ptr<output_stream_t> create_output_stream_for_builtin(
 
 /// Handle output from a builtin, by printing the contents of builtin_io_streams to the redirections
 /// given in io_chain.
-static void handle_builtin_output(parser_t &parser, const std::shared_ptr<job_t> &j, process_t *p,
-                                  const io_chain_t &io_chain, const io_streams_t &streams) {
+static launch_result_t handle_builtin_output(parser_t &parser, const std::shared_ptr<job_t> &j,
+                                             process_t *p, const io_chain_t &io_chain,
+                                             const io_streams_t &streams) {
     assert(p->type == process_type_t::builtin && "Process is not a builtin");
 
     // Mark if we discarded output.
@@ -495,8 +509,8 @@ static void handle_builtin_output(parser_t &parser, const std::shared_ptr<job_t>
     if (!errbuff.empty()) fflush(stderr);
 
     // Construct and run our background process.
-    run_internal_process_or_short_circuit(parser, j, p, std::move(outbuff), std::move(errbuff),
-                                          io_chain);
+    return run_internal_process_or_short_circuit(parser, j, p, std::move(outbuff),
+                                                 std::move(errbuff), io_chain);
 }
 
 /// Executes an external command.
@@ -510,6 +524,7 @@ static launch_result_t exec_external_command(parser_t &parser, const std::shared
     convert_wide_array_to_narrow(p->get_argv_array(), &argv_array);
 
     // Convert our IO chain to a dup2 sequence.
+    if (!ensure_buffer_pipes(proc_io_chain)) return launch_result_t::failed;
     auto dup2s = dup2_list_t::resolve_chain(proc_io_chain);
 
     // Ensure that stdin is blocking before we hand it off (see issue #176). It's a
@@ -529,7 +544,7 @@ static launch_result_t exec_external_command(parser_t &parser, const std::shared
 
 #if FISH_USE_POSIX_SPAWN
     // Prefer to use posix_spawn, since it's faster on some systems like OS X.
-    bool use_posix_spawn = g_use_posix_spawn && can_use_posix_spawn_for_job(j, dup2s);
+    bool use_posix_spawn = g_use_posix_spawn && can_use_posix_spawn_for_job(j);
     if (use_posix_spawn) {
         s_fork_count++;  // spawn counts as a fork+exec
 
@@ -698,9 +713,8 @@ static launch_result_t exec_block_or_func_process(parser_t &parser, const std::s
             io_bufferfill_t::finish(std::move(block_output_bufferfill)).newline_serialized();
     }
 
-    run_internal_process_or_short_circuit(parser, j, p, std::move(buffer_contents),
-                                          {} /* errdata */, io_chain);
-    return launch_result_t::ok;
+    return run_internal_process_or_short_circuit(parser, j, p, std::move(buffer_contents),
+                                                 {} /* errdata */, io_chain);
 }
 
 /// Executes a process \p \p in \p job, using the pipes \p pipes (which may have invalid fds if this
@@ -828,7 +842,10 @@ static launch_result_t exec_process_in_job(parser_t &parser, process_t *p,
             builtin_io_streams.job_group = j->group;
 
             exec_internal_builtin_proc(parser, p, process_net_io_chain, builtin_io_streams);
-            handle_builtin_output(parser, j, p, process_net_io_chain, builtin_io_streams);
+            if (handle_builtin_output(parser, j, p, process_net_io_chain, builtin_io_streams) ==
+                launch_result_t::failed) {
+                return launch_result_t::failed;
+            }
             break;
         }
 
@@ -1103,15 +1120,16 @@ static int exec_subshell_internal(const wcstring &cmd, parser_t &parser,
 
     const bool split_output = !parser.vars().get(L"IFS").missing_or_empty();
 
-    // IO buffer creation may fail (e.g. if we have too many open files to make a pipe), so this may
-    // be null.
+    // Note the pipe to the buffer is only made if an external command needs it; builtins write to
+    // the buffer directly. Creating that pipe may fail, e.g. with too many open fds.
     auto bufferfill = io_bufferfill_t::create(ld.read_limit);
-    if (!bufferfill) {
+    eval_res_t eval_res = parser.eval(cmd, io_chain_t{bufferfill}, job_group, block_type_t::subst);
+    const bool pipe_failed = bufferfill->buffer()->pipe_failed();
+    separated_buffer_t buffer = io_bufferfill_t::finish(std::move(bufferfill));
+    if (pipe_failed) {
         *break_expand = true;
         return STATUS_CMD_ERROR;
     }
-    eval_res_t eval_res = parser.eval(cmd, io_chain_t{bufferfill}, job_group, block_type_t::subst);
-    separated_buffer_t buffer = io_bufferfill_t::finish(std::move(bufferfill));
     if (buffer.discarded()) {
         *break_expand = true;
         return STATUS_READ_TOO_MUCH;
@@ -610,10 +610,32 @@ static expand_result_t expand_braces(wcstring &&instr, expand_flags_t flags,
     return expand_result_t::ok;
 }
 
+/// \return whether \p input is a single command substitution and nothing else, like `(cat foo)`,
+/// optionally followed by a slice of plain numbers, like `(cat foo)[1..3]`.
+static bool is_lone_cmdsubst(const wcstring &input) {
+    size_t cursor = 0;
+    size_t paren_begin = 0;
+    size_t paren_end = 0;
+    if (parse_util_locate_cmdsubst_range(input, &cursor, nullptr, &paren_begin, &paren_end,
+                                         false) != 1 ||
+        paren_begin != 0) {
+        return false;
+    }
+    size_t tail_begin = paren_end + 1;
+    if (tail_begin == input.size()) return true;
+    // The slice must end the input, and must not need any other expansion.
+    return input.at(tail_begin) == L'[' && input.back() == L']' &&
+           input.find_first_not_of(L"0123456789-. \t", tail_begin + 1) == input.size() - 1;
+}
+
 /// Expand a command substitution \p input, executing on \p ctx, and inserting the results into
 /// \p out_list, or any errors into \p errors. \return an expand result.
+/// If \p final is set, \p input must be a lone command substitution (see is_lone_cmdsubst), and
+/// the output lines (after any slice) are inserted as they are, rather than escaped for the later
+/// expansion stages.
 static expand_result_t expand_cmdsubst(wcstring input, const operation_context_t &ctx,
-                                       completion_receiver_t *out, parse_error_list_t *errors) {
+                                       completion_receiver_t *out, parse_error_list_t *errors,
+                                       bool final = false) {
     assert(ctx.parser && "Cannot expand without a parser");
     size_t cursor = 0;
     size_t paren_begin = 0;
@@ -690,6 +712,16 @@ static expand_result_t expand_cmdsubst(wcstring input, const operation_context_t
         sub_res = std::move(sub_res2);
     }
 
+    if (final) {
+        assert(paren_begin == 0 && tail_begin == input.size() && "Not a lone cmdsubst");
+        for (wcstring &sub_item : sub_res) {
+            if (!out->add(std::move(sub_item))) {
+                return append_overflow_error(errors);
+            }
+        }
+        return expand_result_t::ok;
+    }
+
     // Recursively call ourselves to expand any remaining command substitutions. The result of this
     // recursive call using the tail of the string is inserted into the tail_expand array list
     completion_receiver_t tail_expand_recv = out->subreceiver();
@@ -1026,9 +1058,22 @@ expand_result_t expander_t::stage_wildcards(wcstring path_to_expand, completion_
                 if (paths.empty()) {
                     paths.emplace_back(for_cd ? L"." : L"");
                 }
+                // When completing a command, skip directories whose cached listing has no
+                // possible match, which saves reading them. This mirrors the matching done by
+                // wildcard completion for a token without wildcards.
+                const bool fuzzy = flags & expand_flag::fuzzy_match;
+                auto could_complete = [&](const wcstring &name) {
+                    auto match = string_fuzzy_match_string(path_to_expand, name);
+                    return match && (fuzzy || match->is_exact_or_prefix());
+                };
                 for (const wcstring &next_path : paths) {
-                    effective_working_dirs.push_back(
-                        path_apply_working_directory(next_path, working_dir));
+                    wcstring dir = path_apply_working_directory(next_path, working_dir);
+                    maybe_t<bool> has_match{};
+                    if (for_command && !has_wildcard) {
+                        has_match = path_dir_has_entry_matching(dir, could_complete);
+                    }
+                    if (has_match && !*has_match) continue;
+                    effective_working_dirs.push_back(std::move(dir));
                 }
             }
         }
@@ -1085,6 +1130,14 @@ expand_result_t expander_t::expand_string(wcstring input, completion_receiver_t
         return expand_result_t::ok;
     }
 
+    // A lone command substitution, like `(cat foo)`, produces its lines with nothing left to
+    // expand. Skip escaping each line and passing it through every stage.
+    if (!(flags & expand_flag::for_completions) && !(flags & expand_flag::skip_cmdsubst) &&
+        is_lone_cmdsubst(input)) {
+        if (ctx.check_cancel()) return expand_result_t::cancel;
+        return expand_cmdsubst(std::move(input), ctx, out_completions, errors, true);
+    }
+
     expander_t expand(ctx, flags, errors);
 
     // Our expansion stages.
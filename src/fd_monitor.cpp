@@ -3,8 +3,15 @@
 
 #include "fd_monitor.h"
 
+#ifdef HAVE_EPOLL_CREATE1
+#include <sys/epoll.h>
+#endif
+
+#include <climits>
 #include <cstring>
+#include <set>
 #include <thread> //this_thread::sleep_for
+#include <unordered_map>
 
 #include "flog.h"
 #include "io.h"
@@ -98,17 +105,16 @@ uint64_t fd_monitor_item_t::usec_remaining(const time_point_t &now) const {
 }
 
 bool fd_monitor_item_t::service_item(const fd_set *fds, const time_point_t &now) {
-    bool should_retain = true;
     bool readable = FD_ISSET(fd.fd(), fds);
-    bool timed_out = !readable && usec_remaining(now) == 0;
-    if (readable || timed_out) {
-        last_time = now;
-        item_wake_reason_t reason =
-            readable ? item_wake_reason_t::readable : item_wake_reason_t::timeout;
-        callback(fd, reason);
-        should_retain = fd.valid();
-    }
-    return should_retain;
+    if (readable) return wake(item_wake_reason_t::readable, now);
+    if (usec_remaining(now) == 0) return wake(item_wake_reason_t::timeout, now);
+    return true;
+}
+
+bool fd_monitor_item_t::wake(item_wake_reason_t reason, const time_point_t &now) {
+    last_time = now;
+    callback(fd, reason);
+    return fd.valid();
 }
 
 bool fd_monitor_item_t::poke_item(const poke_list_t &pokelist) {
@@ -122,6 +128,49 @@ bool fd_monitor_item_t::poke_item(const poke_list_t &pokelist) {
 
 void fd_monitor_t::run_in_background() {
     ASSERT_IS_BACKGROUND_THREAD();
+#ifdef HAVE_EPOLL_CREATE1
+    autoclose_fd_t epoll_fd{epoll_create1(EPOLL_CLOEXEC)};
+    if (epoll_fd.valid()) {
+        run_in_background_epoll(std::move(epoll_fd));
+        return;
+    }
+    FLOGF(fd_monitor, L"epoll_create1 failed, falling back to select: %s", std::strerror(errno));
+#endif
+    run_in_background_select();
+}
+
+bool fd_monitor_t::take_changes_in_background(item_list_t *new_items, poke_list_t *pokelist,
+                                              bool exit_if_idle) {
+    // Clear the change signaller before processing incoming changes.
+    change_signaller_.try_consume();
+    auto data = data_.acquire();
+
+    *new_items = std::move(data->pending);
+    data->pending.clear();
+
+    assert(pokelist->empty() && "pokelist should be empty or else we're dropping pokes");
+    *pokelist = std::move(data->pokelist);
+    data->pokelist.clear();
+
+    if (data->terminate || (exit_if_idle && new_items->empty())) {
+        // Maybe terminate is set.
+        // Alternatively, maybe we had no items, waited a bit, and still have no items.
+        // It's important to do this while holding the lock, otherwise we race with new
+        // items being added.
+        assert(data->running && "Thread should be running because we're that thread");
+        FLOG(fd_monitor, "Thread exiting");
+        data->running = false;
+        return false;
+    }
+    return true;
+}
+
+// If we are not monitoring any fds, we wish to allow the thread to exit, but after a time, so we
+// aren't spinning up and tearing down the thread repeatedly. We wait this long; if nothing is added
+// by then we will exit. We refer to this as the wait-lap.
+static constexpr uint64_t kWaitLapUsec = 16 * kUsecPerMsec;
+
+void fd_monitor_t::run_in_background_select() {
     poke_list_t pokelist;
     for (;;) {
         // Poke any items that need it.
@@ -148,16 +197,11 @@ void fd_monitor_t::run_in_background() {
             max_fd = std::max(max_fd, item.fd.fd());
         }
 
-        // If we have only one item, it means that we are not actively monitoring any fds other than
-        // our self-pipe. In this case we wish to allow the thread to exit, but after a time, so we
-        // aren't spinning up and tearing down the thread repeatedly.
-        // Set a timeout of 16 msec; if nothing becomes readable by then we will exit.
-        // We refer to this as the wait-lap.
-        bool is_wait_lap = (items_.size() == 1);
+        bool is_wait_lap = items_.empty();
         if (is_wait_lap) {
             assert(timeout_usec == fd_monitor_item_t::kNoTimeout &&
                    "Should not have a timeout on wait-lap");
-            timeout_usec = 16 * kUsecPerMsec;
+            timeout_usec = kWaitLapUsec;
         }
 
         // Call select().
@@ -184,33 +228,163 @@ void fd_monitor_t::run_in_background() {
         // Handle any changes if the change signaller was set. Alternatively this may be the wait
         // lap, in which case we might want to commit to exiting.
         if (FD_ISSET(change_signal_fd, &fds) || is_wait_lap) {
-            // Clear the change signaller before processing incoming changes.
-            change_signaller_.try_consume();
-            auto data = data_.acquire();
-
-            // Move from 'pending' to 'items'.
-            items_.insert(items_.end(), std::make_move_iterator(data->pending.begin()),
-                          std::make_move_iterator(data->pending.end()));
-            data->pending.clear();
-
-            // Grab any pokelist.
-            assert(pokelist.empty() && "pokelist should be empty or else we're dropping pokes");
-            pokelist = std::move(data->pokelist);
-            data->pokelist.clear();
-
-            if (data->terminate || (is_wait_lap && items_.empty())) {
-                // Maybe terminate is set.
-                // Alternatively, maybe we had no items, waited a bit, and still have no items.
-                // It's important to do this while holding the lock, otherwise we race with new
-                // items being added.
-                assert(data->running && "Thread should be running because we're that thread");
-                FLOG(fd_monitor, "Thread exiting");
-                data->running = false;
+            item_list_t new_items;
+            if (!take_changes_in_background(&new_items, &pokelist, is_wait_lap && items_.empty())) {
                 return;
             }
+            items_.insert(items_.end(), std::make_move_iterator(new_items.begin()),
+                          std::make_move_iterator(new_items.end()));
+        }
+    }
+}
+
+#ifdef HAVE_EPOLL_CREATE1
+// The epoll loop keeps every fd registered, so that a wakeup costs time proportional to the number
+// of items that are ready or timed out, rather than to the number of items. Each fd is registered
+// with EPOLLONESHOT and re-armed after its callback runs. This matters because callbacks may close
+// their fd, and we cannot deregister an fd after it is closed: if its file description were still
+// open elsewhere, a level-triggered registration would keep firing. A oneshot registration fires at
+// most once, and events for items we no longer have are ignored.
+void fd_monitor_t::run_in_background_epoll(autoclose_fd_t epoll_fd) {
+    using time_point_t = fd_monitor_item_t::time_point_t;
+
+    // The ID reserved for the change signaller.
+    constexpr fd_monitor_item_id_t kSignallerId = 0;
+
+    // The index of each item in items_, by ID.
+    std::unordered_map<fd_monitor_item_id_t, size_t> indexes;
+
+    // The times at which items with timeouts will time out.
+    std::set<std::pair<time_point_t, fd_monitor_item_id_t>> deadlines;
+
+    // Items whose fds epoll cannot monitor, such as regular files. These are always readable.
+    std::vector<fd_monitor_item_id_t> always_ready;
+
+    auto watch = [&](int op, int fd, fd_monitor_item_id_t item_id) {
+        struct epoll_event event {};
+        event.events = EPOLLIN;
+        if (item_id != kSignallerId) event.events |= EPOLLONESHOT;
+        event.data.u64 = item_id;
+        return epoll_ctl(epoll_fd.fd(), op, fd, &event) == 0;
+    };
+    auto deadline_of = [](const fd_monitor_item_t &item) {
+        return *item.last_time + std::chrono::microseconds(item.timeout_usec);
+    };
+
+    // Add an item, as of \p now.
+    auto add_item = [&](fd_monitor_item_t &&item, const time_point_t &now) {
+        item.last_time = now;
+        if (!watch(EPOLL_CTL_ADD, item.fd.fd(), item.item_id)) {
+            if (errno != EPERM) wperror(L"epoll_ctl");
+            always_ready.push_back(item.item_id);
+        }
+        if (item.timeout_usec != fd_monitor_item_t::kNoTimeout) {
+            deadlines.emplace(deadline_of(item), item.item_id);
+        }
+        indexes[item.item_id] = items_.size();
+        items_.push_back(std::move(item));
+    };
+
+    // Wake the item with the given ID for \p reason. Afterwards, remove it if it closed its fd, and
+    // otherwise re-arm it and update its deadline.
+    auto wake_item = [&](fd_monitor_item_id_t item_id, item_wake_reason_t reason,
+                         const time_point_t &now) {
+        auto where = indexes.find(item_id);
+        if (where == indexes.end()) return;
+        size_t idx = where->second;
+        fd_monitor_item_t &item = items_.at(idx);
+        const bool has_timeout = item.timeout_usec != fd_monitor_item_t::kNoTimeout;
+        if (has_timeout) deadlines.erase({deadline_of(item), item_id});
+        // Pokes do not count as servicing the item, so do not affect its timeout.
+        const time_point_t last_time = *item.last_time;
+        bool retain = item.wake(reason, now);
+        if (reason == item_wake_reason_t::poke) item.last_time = last_time;
+        if (retain) {
+            if (reason != item_wake_reason_t::poke) watch(EPOLL_CTL_MOD, item.fd.fd(), item_id);
+            if (has_timeout) deadlines.emplace(deadline_of(item), item_id);
+            return;
+        }
+        FLOG(fd_monitor, "Removing item", item_id);
+        always_ready.erase(std::remove(always_ready.begin(), always_ready.end(), item_id),
+                           always_ready.end());
+        indexes.erase(where);
+        if (idx + 1 != items_.size()) {
+            items_[idx] = std::move(items_.back());
+            indexes[items_[idx].item_id] = idx;
+        }
+        items_.pop_back();
+    };
+
+    if (!watch(EPOLL_CTL_ADD, change_signaller_.read_fd(), kSignallerId)) {
+        wperror(L"epoll_ctl");
+    }
+
+    poke_list_t pokelist;
+    std::vector<struct epoll_event> events(64);
+    for (;;) {
+        auto now = std::chrono::steady_clock::now();
+        for (fd_monitor_item_id_t item_id : pokelist) {
+            wake_item(item_id, item_wake_reason_t::poke, now);
+        }
+        pokelist.clear();
+
+        // Wait until the first deadline, rounding up to whole milliseconds.
+        int timeout_msec = -1;
+        bool is_wait_lap = items_.empty();
+        uint64_t timeout_usec = is_wait_lap ? kWaitLapUsec : fd_monitor_item_t::kNoTimeout;
+        if (!deadlines.empty()) {
+            auto first = deadlines.begin()->first;
+            timeout_usec = first <= now ? 0
+                                        : std::chrono::duration_cast<std::chrono::microseconds>(
+                                              first - now)
+                                              .count();
+        }
+        if (!always_ready.empty()) timeout_usec = 0;
+        if (timeout_usec != fd_monitor_item_t::kNoTimeout) {
+            timeout_msec = static_cast<int>(
+                std::min<uint64_t>((timeout_usec + kUsecPerMsec - 1) / kUsecPerMsec, INT_MAX));
+        }
+
+        int count = epoll_wait(epoll_fd.fd(), events.data(), static_cast<int>(events.size()),
+                               timeout_msec);
+        if (count < 0) {
+            if (errno != EINTR) wperror(L"epoll_wait");
+            count = 0;
+        }
+
+        // Service readable items, then any which have timed out.
+        now = std::chrono::steady_clock::now();
+        bool change_signalled = false;
+        for (int i = 0; i < count; i++) {
+            fd_monitor_item_id_t item_id = events[i].data.u64;
+            if (item_id == kSignallerId) {
+                change_signalled = true;
+            } else {
+                wake_item(item_id, item_wake_reason_t::readable, now);
+            }
+        }
+        for (fd_monitor_item_id_t item_id : std::vector<fd_monitor_item_id_t>(always_ready)) {
+            wake_item(item_id, item_wake_reason_t::readable, now);
+        }
+        while (!deadlines.empty() && deadlines.begin()->first <= now) {
+            wake_item(deadlines.begin()->second, item_wake_reason_t::timeout, now);
+        }
+
+        // If we filled the event buffer, there may be more events next time; make room for them.
+        if (static_cast<size_t>(count) == events.size()) events.resize(events.size() * 2);
+
+        if (change_signalled || is_wait_lap) {
+            item_list_t new_items;
+            if (!take_changes_in_background(&new_items, &pokelist, is_wait_lap && items_.empty())) {
+                return;
+            }
+            for (fd_monitor_item_t &item : new_items) {
+                add_item(std::move(item), now);
+            }
         }
     }
 }
+#endif
 
 void fd_monitor_t::poke_in_background(const poke_list_t &pokelist) {
     ASSERT_IS_BACKGROUND_THREAD();
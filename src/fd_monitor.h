@@ -73,6 +73,10 @@ struct fd_monitor_item_t {
     // \return true to retain the item, false to remove it.
     bool service_item(const fd_set *fds, const time_point_t &now);
 
+    // Invoke this item's callback for \p reason, as of \p now.
+    // \return true to retain the item, false to remove it.
+    bool wake(item_wake_reason_t reason, const time_point_t &now);
+
     // Invoke this item's callback with a poke, if its ID is present in the (sorted) pokelist.
     // \return true to retain the item, false to remove it.
     using poke_list_t = std::vector<fd_monitor_item_id_t>;
@@ -100,19 +104,27 @@ class fd_monitor_t {
     void poke_item(fd_monitor_item_id_t item_id);
 
    private:
-    // The background thread runner.
+    // The background thread runner. This uses epoll where available, and select() otherwise.
     void run_in_background();
+    void run_in_background_select();
+#ifdef HAVE_EPOLL_CREATE1
+    void run_in_background_epoll(autoclose_fd_t epoll_fd);
+#endif
 
-    // If our self-signaller is reported as ready, this reads from it and handles any changes.
+    // Move any pending items to \p new_items and any pokes to \p pokelist, consuming our
+    // self-signaller. If we are terminating, or \p exit_if_idle is set and there are no new items,
+    // mark the thread as no longer running and return false; the thread must then exit.
     // Called in the background thread.
-    void handle_self_signal_in_background();
+    bool take_changes_in_background(item_list_t *new_items, poke_list_t *pokelist,
+                                    bool exit_if_idle);
 
     // Poke items in the pokelist, removing any items that close their FD.
     // The pokelist is consumed after this.
     // This is only called in the background thread.
     void poke_in_background(const poke_list_t &pokelist);
 
-    // The list of items to monitor. This is only accessed on the background thread.
+    // The list of items to monitor. This is only accessed on the background thread. The epoll
+    // loop does not keep these in any order.
     item_list_t items_{};
 
     struct data_t {
@@ -184,6 +184,18 @@ maybe_t<autoclose_pipes_t> make_autoclose_pipes() {
     return autoclose_pipes_t(std::move(read_end), std::move(write_end));
 }
 
+autoclose_fd_t dup_to_high_fd(int fd) {
+    int tmp_fd;
+    do {
+        tmp_fd = dup(fd);
+    } while (tmp_fd < 0 && errno == EINTR);
+    if (tmp_fd < 0) {
+        wperror(L"dup");
+        return autoclose_fd_t{};
+    }
+    return heightenize_fd(autoclose_fd_t{tmp_fd}, false);
+}
+
 int set_cloexec(int fd, bool should_set) {
     // Note we don't want to overwrite existing flags like O_NONBLOCK which may be set. So fetch the
     // existing flags and modify them.
@@ -80,6 +80,11 @@ struct autoclose_pipes_t {
 /// \return pipes on success, none() on error.
 maybe_t<autoclose_pipes_t> make_autoclose_pipes();
 
+/// Duplicate \p fd into the high fd range. The original fd is left alone.
+/// \return the new fd, which has CLO_EXEC set; or an invalid fd on failure, in which case an error
+/// will have been printed.
+autoclose_fd_t dup_to_high_fd(int fd);
+
 /// An event signaller implemented using a file descriptor, so it can plug into select().
 /// This is like a binary semaphore. A call to post() will signal an event, making the fd readable.
 /// Multiple calls to post() may be coalesced. On Linux this uses eventfd(); on other systems this
@@ -68,14 +68,20 @@ class fish_cmd_opts_t {
     // File path for profiling output, or empty for none.
     std::string profile_output;
     std::string profile_startup_output;
+    // The format of the profiling output.
+    profile_format_t profile_format{profile_format_t::log};
     // Commands to be executed in place of interactive shell.
     std::vector<std::string> batch_cmds;
     // Commands to execute after the shell's config has been read.
     std::vector<std::string> postconfig_cmds;
     /// Whether to print rusage-self stats after execution.
     bool print_rusage_self{false};
+    /// Whether to print the time taken by each phase of startup after execution.
+    bool print_startup_profile{false};
     /// Whether no-exec is set.
     bool no_exec{false};
+    /// Whether to skip reading the configuration files.
+    bool no_config{false};
     /// Whether this is a login shell.
     bool is_login{false};
     /// Whether this is an interactive session.
@@ -238,7 +244,9 @@ static void source_config_in_directory(parser_t &parser, const wcstring &dir) {
 /// Parse init files. exec_path is the path of fish executable as determined by argv[0].
 static void read_init(parser_t &parser, const struct config_paths_t &paths) {
     source_config_in_directory(parser, paths.data);
+    startup_profile_mark(L"$__fish_data_dir/config.fish");
     source_config_in_directory(parser, paths.sysconf);
+    startup_profile_mark(L"$__fish_sysconf_dir/config.fish");
 
     // We need to get the configuration directory before we can source the user configuration file.
     // If path_get_config returns false then we have no configuration directory and no custom config
@@ -246,6 +254,7 @@ static void read_init(parser_t &parser, const struct config_paths_t &paths) {
     wcstring config_dir;
     if (path_get_config(config_dir)) {
         source_config_in_directory(parser, config_dir);
+        startup_profile_mark(L"$__fish_config_dir/config.fish");
     }
 }
 
@@ -261,7 +270,7 @@ static int run_command_list(parser_t &parser, std::vector<std::string> *cmds,
 
 /// Parse the argument list, return the index of the first non-flag arguments.
 static int fish_parse_opt(int argc, char **argv, fish_cmd_opts_t *opts) {
-    static const char *const short_opts = "+hPilnvc:C:p:d:f:D:o:";
+    static const char *const short_opts = "+hPilNnvc:C:p:d:f:D:o:";
     static const struct option long_opts[] = {
         {"command", required_argument, nullptr, 'c'},
         {"init-command", required_argument, nullptr, 'C'},
@@ -271,11 +280,14 @@ static int fish_parse_opt(int argc, char **argv, fish_cmd_opts_t *opts) {
         {"debug-stack-frames", required_argument, nullptr, 'D'},
         {"interactive", no_argument, nullptr, 'i'},
         {"login", no_argument, nullptr, 'l'},
+        {"no-config", no_argument, nullptr, 'N'},
         {"no-execute", no_argument, nullptr, 'n'},
         {"print-rusage-self", no_argument, nullptr, 1},
         {"print-debug-categories", no_argument, nullptr, 2},
         {"profile", required_argument, nullptr, 'p'},
         {"profile-startup", required_argument, nullptr, 3},
+        {"profile-format", required_argument, nullptr, 4},
+        {"print-startup-profile", no_argument, nullptr, 5},
         {"private", no_argument, nullptr, 'P'},
         {"help", no_argument, nullptr, 'h'},
         {"version", no_argument, nullptr, 'v'},
@@ -331,6 +343,10 @@ static int fish_parse_opt(int argc, char **argv, fish_cmd_opts_t *opts) {
                 opts->is_login = true;
                 break;
             }
+            case 'N': {
+                opts->no_config = true;
+                break;
+            }
             case 'n': {
                 opts->no_exec = true;
                 break;
@@ -366,6 +382,24 @@ static int fish_parse_opt(int argc, char **argv, fish_cmd_opts_t *opts) {
                 g_profiling_active = true;
                 break;
             }
+            case 4: {
+                if (!std::strcmp(optarg, "log")) {
+                    opts->profile_format = profile_format_t::log;
+                } else if (!std::strcmp(optarg, "folded")) {
+                    opts->profile_format = profile_format_t::folded;
+                } else if (!std::strcmp(optarg, "summary")) {
+                    opts->profile_format = profile_format_t::summary;
+                } else {
+                    std::fwprintf(stderr, _(L"%s: Invalid profile format '%s'\n"), "fish", optarg);
+                    exit(1);
+                }
+                break;
+            }
+            case 5: {
+                opts->print_startup_profile = true;
+                startup_profile_enable();
+                break;
+            }
             case 'P': {
                 opts->enable_private_mode = true;
                 break;
@@ -484,11 +518,13 @@ int main(int argc, char **argv) {
     proc_init();
     builtin_init();
     misc_init();
+    startup_profile_mark(L"proc_init, builtin_init, misc_init");
     reader_init();
+    startup_profile_mark(L"reader_init");
 
     parser_t &parser = parser_t::principal_parser();
 
-    if (!opts.no_exec) {
+    if (!opts.no_exec && !opts.no_config) {
         read_init(parser, paths);
     }
     // Stomp the exit status of any initialization commands (issue #635).
@@ -497,7 +533,7 @@ int main(int argc, char **argv) {
     // If we're profiling startup to a separate file, write it now.
     if (!opts.profile_startup_output.empty()
         && opts.profile_startup_output != opts.profile_output) {
-        parser.emit_profiling(opts.profile_startup_output.c_str());
+        parser.emit_profiling(opts.profile_startup_output.c_str(), opts.profile_format);
 
         // If we are profiling both, ensure the startup data only
         // ends up in the startup file.
@@ -509,8 +545,12 @@ int main(int argc, char **argv) {
     // Run post-config commands specified as arguments, if any.
     if (!opts.postconfig_cmds.empty()) {
         res = run_command_list(parser, &opts.postconfig_cmds, {});
+        startup_profile_mark(L"init commands");
     }
 
+    // Startup ends with the first prompt in interactive sessions, see reader_data_t::readline.
+    if (!is_interactive_session()) startup_profile_finish(L"startup finished");
+
     if (!opts.batch_cmds.empty()) {
         // Run the commands specified as arguments, if any.
         if (get_login()) {
@@ -572,13 +612,16 @@ int main(int argc, char **argv) {
     restore_term_foreground_process_group_for_exit();
 
     if (!opts.profile_output.empty()) {
-        parser.emit_profiling(opts.profile_output.c_str());
+        parser.emit_profiling(opts.profile_output.c_str(), opts.profile_format);
     }
 
     history_save_all();
     if (opts.print_rusage_self) {
         print_rusage_self(stderr);
     }
+    if (opts.print_startup_profile) {
+        startup_profile_print(stderr);
+    }
     if (debug_output) {
         fclose(debug_output);
     }
@@ -22,6 +22,9 @@
 #include <sys/utsname.h>
 #include <sys/wait.h>
 #include <time.h>
+#ifdef HAVE_INOTIFY_INIT1
+#include <sys/inotify.h>
+#endif
 #include <unistd.h>
 #include <wctype.h>
 
@@ -56,8 +59,11 @@
 #include "future_feature_flags.h"
 #include "highlight.h"
 #include "history.h"
+#include "history_file.h"
 #include "input.h"
+#include "inotify_queue.h"
 #include "input_common.h"
+#include "intern.h"
 #include "io.h"
 #include "iothread.h"
 #include "lru.h"
@@ -940,6 +946,81 @@ static void test_fd_monitor() {
     do_test(item_pokee.pokes == 1);
 }
 
+static void test_fd_monitor_many() {
+    say(L"Testing fd_monitor with many fds");
+
+    // Monitor \p count pipes. Write to every pipe once, then to random pipes, waiting for each byte
+    // to be read before sending the next. Then close the write ends. Every item must be woken for
+    // each of its bytes and for its end of file.
+    auto check_wakeups = [](size_t count) {
+        constexpr size_t random_writes = 500;
+        std::vector<autoclose_fd_t> writers;
+        std::unique_ptr<std::atomic<size_t>[]> bytes_read(new std::atomic<size_t>[count]);
+        std::atomic<size_t> total_read{0};
+        std::atomic<size_t> total_closed{0};
+        std::vector<size_t> expected(count, 0);
+
+        auto wait_until = [](const std::function<bool()> &done) {
+            double deadline = timef() + 5;
+            while (!done() && timef() < deadline) {
+                std::this_thread::yield();
+            }
+            return done();
+        };
+
+        fd_monitor_t monitor;
+        for (size_t i = 0; i < count; i++) {
+            bytes_read[i] = 0;
+            auto pipes = make_autoclose_pipes().acquire();
+            writers.push_back(std::move(pipes.write));
+            std::atomic<size_t> *counter = &bytes_read[i];
+            auto callback = [counter, &total_read, &total_closed](autoclose_fd_t &fd,
+                                                                  item_wake_reason_t reason) {
+                if (reason != item_wake_reason_t::readable) return;
+                char buff[64];
+                ssize_t amt = read(fd.fd(), buff, sizeof buff);
+                if (amt <= 0) {
+                    fd.close();
+                    total_closed += 1;
+                    return;
+                }
+                *counter += amt;
+                total_read += amt;
+            };
+            monitor.add(fd_monitor_item_t(std::move(pipes.read), std::move(callback)));
+        }
+
+        for (size_t i = 0; i < count + random_writes; i++) {
+            size_t idx = i < count ? i : random() % count;
+            expected[idx] += 1;
+            char c = 'x';
+            (void)write_loop(writers[idx].fd(), &c, 1);
+            if (!wait_until([&] { return total_read >= i + 1; })) {
+                err(L"fd_monitor with %lu fds did not wake for write %lu", (unsigned long)count,
+                    (unsigned long)i);
+                return;
+            }
+        }
+        for (size_t i = 0; i < count; i++) {
+            if (bytes_read[i] != expected[i]) {
+                err(L"fd_monitor item %lu of %lu read %lu bytes, expected %lu", (unsigned long)i,
+                    (unsigned long)count, (unsigned long)bytes_read[i],
+                    (unsigned long)expected[i]);
+            }
+        }
+
+        writers.clear();
+        if (!wait_until([&] { return total_closed == count; })) {
+            err(L"fd_monitor with %lu fds saw end of file on only %lu of them",
+                (unsigned long)count, (unsigned long)total_closed);
+        }
+    };
+
+    for (size_t count : {4, 64, 300}) {
+        check_wakeups(count);
+    }
+}
+
 static void test_iothread() {
     say(L"Testing iothreads");
     std::unique_ptr<std::atomic<int>> int_ptr = make_unique<std::atomic<int>>(0);
@@ -956,6 +1037,40 @@ static void test_iothread() {
     }
 }
 
+static void test_iothread_priority() {
+    say(L"Testing iothread priorities");
+    const iothread_counters_t before = iothread_get_counters();
+
+    // Occupy every thread that may do bulk work, and then some.
+    std::atomic<bool> release_bulk{false};
+    std::atomic<int> bulk_done{0};
+    const int bulk_count = 2 * std::max(2u, std::thread::hardware_concurrency()) + 4;
+    for (int i = 0; i < bulk_count; i++) {
+        iothread_perform_bulk([&] {
+            while (!release_bulk) usleep(1000);
+            bulk_done += 1;
+        });
+    }
+
+    // Interactive work still runs, and bulk work is left waiting.
+    std::atomic<bool> ran_interactive{false};
+    iothread_perform([&] { ran_interactive = true; });
+    for (int i = 0; i < 5000 && !ran_interactive; i++) usleep(1000);
+    do_test(ran_interactive);
+    const iothread_counters_t during = iothread_get_counters();
+    do_test(during.bulk.queued > 0);
+    do_test(during.bulk.max_queued > 0);
+    do_test(during.interactive.dequeued > before.interactive.dequeued);
+
+    release_bulk = true;
+    iothread_drain_all();
+    do_test(bulk_done == bulk_count);
+    const iothread_counters_t after = iothread_get_counters();
+    do_test(after.bulk.queued == 0);
+    do_test(after.bulk.dequeued == before.bulk.dequeued + bulk_count);
+    do_test(after.bulk.max_wait_usec > 0);
+}
+
 static void test_pthread() {
     say(L"Testing pthreads");
     std::atomic<int> val{3};
@@ -1956,6 +2071,47 @@ class test_lru_t : public lru_cache_t<test_lru_t, int> {
     }
 };
 
+static void test_intern() {
+    say(L"Testing intern");
+    const wchar_t *foo = intern(L"intern_test_foo");
+    do_test(std::wcscmp(foo, L"intern_test_foo") == 0);
+    do_test(intern(wcstring(L"intern_test_foo").c_str()) == foo);
+    do_test(intern(L"intern_test_bar") != foo);
+    do_test(intern(nullptr) == nullptr);
+
+    static const wchar_t *const literal = L"intern_test_static";
+    do_test(intern_static(literal) == literal);
+    do_test(intern(wcstring(literal).c_str()) == literal);
+
+    // A string too long to share a block.
+    wcstring long_str(100000, L'x');
+    const wchar_t *long_interned = intern(long_str.c_str());
+    do_test(long_interned != long_str.c_str() && long_str == long_interned);
+    do_test(intern(long_str.c_str()) == long_interned);
+
+    // Intern many distinct names, as when loading many functions.
+    constexpr size_t count = 100000;
+    wcstring_list_t names;
+    names.reserve(count);
+    for (size_t i = 0; i < count; i++) {
+        names.push_back(format_string(L"intern_test_function_%lu.fish", (unsigned long)i));
+    }
+    std::vector<const wchar_t *> interned;
+    interned.reserve(count);
+    double start = timef();
+    for (const wcstring &name : names) {
+        interned.push_back(intern(name.c_str()));
+    }
+    double elapsed = timef() - start;
+    for (size_t i = 0; i < count; i++) {
+        if (names.at(i) != interned.at(i) || intern(names.at(i).c_str()) != interned.at(i)) {
+            err(L"Interned string %lu is wrong", (unsigned long)i);
+            break;
+        }
+    }
+    say(L"\tinterned %lu distinct names in %.1f ms", (unsigned long)count, elapsed * 1000);
+}
+
 static void test_lru() {
     say(L"Testing LRU cache");
 
@@ -2212,6 +2368,19 @@ static void test_expand() {
     expand_test(L"test/fish_expand_test/**/q", noflags, L"test/fish_expand_test/lol/nub/q", wnull,
                 L"Glob did the wrong thing 7");
 
+    // Highlighting expands recursive wildcards off the main thread, which may not use the pool.
+    std::thread([] {
+        completion_list_t output;
+        pwd_environment_t pwd{};
+        operation_context_t ctx{pwd};
+        auto res = expand_string(L"test/fish_expand_test/**/q", &output,
+                                 expand_flag::skip_cmdsubst, ctx);
+        if (res != expand_result_t::ok || output.size() != 1 ||
+            output.at(0).completion != L"test/fish_expand_test/lol/nub/q") {
+            err(L"Glob did the wrong thing off the main thread");
+        }
+    }).join();
+
     expand_test(L"test/fish_expand_test/BA", expand_flag::for_completions,
                 L"test/fish_expand_test/bar", L"test/fish_expand_test/bax/",
                 L"test/fish_expand_test/baz/", wnull, L"Case insensitive test did the wrong thing");
@@ -2455,6 +2624,83 @@ static void test_path() {
     do_test(path_apply_working_directory(L"abc", L"") == L"abc");
 }
 
+static void test_path_dir_cache() {
+    say(L"Testing cached PATH directory listings");
+    char t1[] = "/tmp/fish_test_path_cache.XXXXXX";
+    const wcstring dir = str2wcstring(mkdtemp(t1));
+    const wcstring cmd_path = dir + L"/fish_test_cmd";
+    test_environment_t vars;
+    vars.vars[L"PATH"] = dir;
+
+    // Lookups must notice changes to the directory as soon as they are made.
+    wcstring found;
+    do_test(!path_get_path(L"fish_test_cmd", nullptr, vars));
+    for (int round = 0; round < 2; round++) {
+        autoclose_fd_t fd{wopen_cloexec(cmd_path, O_WRONLY | O_CREAT, 0755)};
+        do_test(fd.valid());
+        fd.close();
+        do_test(path_get_path(L"fish_test_cmd", &found, vars));
+        do_test(found == cmd_path);
+        // On a case-insensitive filesystem, the name in another case finds the file too.
+        do_test(path_get_path(L"FISH_TEST_CMD", nullptr, vars) ==
+                (waccess(dir + L"/FISH_TEST_CMD", X_OK) == 0));
+        do_test(path_get_paths(L"fish_test_cmd", vars) == wcstring_list_t{cmd_path});
+        do_test(path_dir_has_entry_matching(
+                    dir, [](const wcstring &name) { return name == L"fish_test_cmd"; }) !=
+                false);
+
+        // The listing only rules out files; permissions are checked on each lookup.
+        do_test(chmod(wcs2string(cmd_path).c_str(), 0644) == 0);
+        do_test(!path_get_path(L"fish_test_cmd", nullptr, vars));
+        do_test(chmod(wcs2string(cmd_path).c_str(), 0755) == 0);
+        do_test(path_get_path(L"fish_test_cmd", nullptr, vars));
+
+        do_test(wunlink(cmd_path) == 0);
+        do_test(!path_get_path(L"fish_test_cmd", nullptr, vars));
+    }
+    do_test(path_dir_has_entry_matching(L"relative/dir", [](const wcstring &) { return true; }) ==
+            none());
+    path_invalidate_dir_cache();
+    do_test(rmdir(wcs2string(dir).c_str()) == 0);
+}
+
+static void test_inotify_queue() {
+#ifdef HAVE_INOTIFY_INIT1
+    say(L"Testing the shared inotify queue");
+    char t1[] = "/tmp/fish_test_inotify.XXXXXX";
+    const std::string dir = mkdtemp(t1);
+    const std::string file = dir + "/file";
+    auto queue = inotify_queue_t::shared().acquire();
+
+    // Two watches of the same directory each see the events in their own mask.
+    int creates = queue->add_watch(dir, IN_CREATE);
+    int writes = queue->add_watch(dir, IN_CLOSE_WRITE);
+    do_test(creates >= 0 && writes >= 0 && creates != writes);
+    do_test(queue->fd() >= 0);
+    autoclose_fd_t fd{open_cloexec(file, O_WRONLY | O_CREAT, 0644)};
+    do_test(fd.valid());
+    fd.close();
+    queue->read_events();
+    do_test(queue->has_events(creates) && queue->has_events(writes));
+    auto events = queue->take_events(creates);
+    do_test(events.size() == 1 && (events.at(0).mask & IN_CREATE) && events.at(0).name == "file");
+    do_test(!queue->has_events(creates));
+    events = queue->take_events(writes);
+    do_test(events.size() == 1 && (events.at(0).mask & IN_CLOSE_WRITE));
+
+    // Removing one watch leaves the other working.
+    queue->remove_watch(creates);
+    fd.reset(open_cloexec(file, O_WRONLY));
+    fd.close();
+    queue->read_events();
+    do_test(queue->take_events(writes).size() == 1);
+    queue->remove_watch(writes);
+
+    do_test(unlink(file.c_str()) == 0);
+    do_test(rmdir(dir.c_str()) == 0);
+#endif
+}
+
 static void test_pager_navigation() {
     say(L"Testing pager navigation");
 
@@ -3061,6 +3307,17 @@ struct autoload_tester_t {
         do_test(autoload.resolve_command(L"file1", paths));
         autoload.mark_autoload_finished(L"file1");
 
+        // A file added to a directory which was already listed is found without invalidating.
+        run(L"touch %ls/file3.fish %ls/other.txt", p2.c_str(), p2.c_str());
+        do_test(autoload.resolve_command(L"file3", paths));
+        autoload.mark_autoload_finished(L"file3");
+
+        test_environment_t vars;
+        vars.vars[L"test_var"] = p2;
+        wcstring_list_t cmds = autoload.get_autoloadable_commands(vars);
+        std::sort(cmds.begin(), cmds.end());
+        do_test((cmds == wcstring_list_t{L"file2", L"file3"}));
+
         run(L"rm -Rf %ls", p1.c_str());
         run(L"rm -Rf %ls", p2.c_str());
     }
@@ -3640,6 +3897,24 @@ static void test_input() {
     } else if (evt.get_readline() != readline_cmd_t::down_line) {
         err(L"Expected to read char down_line");
     }
+
+    // User bindings take precedence over preset ones, even longer ones. The characters after the
+    // binding which matched are read again.
+    {
+        auto input_mapping = input_mappings();
+        input_mapping->add(L"zzzzbc", L"backward-char", DEFAULT_BIND_MODE, DEFAULT_BIND_MODE,
+                           false);
+        input_mapping->add(L"zzzz", L"forward-char");
+        input_mapping->add(L"bc", L"end-of-line");
+        input_mapping->add(L"zzzzb", L"beginning-of-line", L"other-mode");
+    }
+    for (wchar_t c : wcstring{L"zzzzbc"}) {
+        input.queue_ch(c);
+    }
+    evt = input.readch();
+    do_test(evt.is_readline() && evt.get_readline() == readline_cmd_t::forward_char);
+    evt = input.readch();
+    do_test(evt.is_readline() && evt.get_readline() == readline_cmd_t::end_of_line);
 }
 
 static void test_line_iterator() {
@@ -3900,6 +4175,106 @@ static void test_universal_callbacks() {
     system_assert("rm -Rf test/fish_uvars_test/");
 }
 
+static void test_universal_journal() {
+    say(L"Testing universal variable journal");
+    if (system("mkdir -p test/fish_uvars_test/")) err(L"mkdir failed");
+    callback_data_list_t callbacks;
+    env_universal_t uvars1(UVARS_TEST_PATH);
+    env_universal_t uvars2(UVARS_TEST_PATH);
+    env_var_t::env_var_flags_t noflags = 0;
+
+    // The first write creates the file.
+    uvars1.set(L"alpha", env_var_t{L"1", noflags});
+    uvars1.set(L"beta", env_var_t{L"1", noflags});
+    do_test(uvars1.sync(callbacks));
+    uvars2.sync(callbacks);
+    file_id_t created_id = file_id_for_path(UVARS_TEST_PATH);
+
+    // Setting a variable appends to the same file, and others see only the change.
+    uvars1.set(L"alpha", env_var_t{L"2", env_var_t::flag_export});
+    do_test(uvars1.sync(callbacks));
+    file_id_t appended_id = file_id_for_path(UVARS_TEST_PATH);
+    do_test(appended_id.inode == created_id.inode);
+    do_test(appended_id.size > created_id.size);
+    callbacks.clear();
+    uvars2.sync(callbacks);
+    do_test(callbacks.size() == 1);
+    do_test(callbacks.at(0).key == L"alpha");
+    do_test(callbacks.at(0).val == wcstring{L"2"});
+    do_test(uvars2.get(L"alpha") == env_var_t(L"2", env_var_t::flag_export));
+
+    // Replaying the whole file, as older fish versions do, gives the same variables.
+    auto read_file = [] {
+        std::string contents;
+        FILE *fp = fopen(wcs2string(UVARS_TEST_PATH).c_str(), "r");
+        char buff[4096];
+        while (size_t amt = fread(buff, 1, sizeof buff, fp)) contents.append(buff, amt);
+        fclose(fp);
+        return contents;
+    };
+    var_table_t replayed;
+    env_universal_t::populate_variables(read_file(), &replayed);
+    do_test(replayed == uvars1.get_table());
+
+    // Erasing a variable compacts the file.
+    uvars2.remove(L"beta");
+    do_test(uvars2.sync(callbacks));
+    do_test(file_id_for_path(UVARS_TEST_PATH).inode != appended_id.inode);
+    callbacks.clear();
+    uvars1.sync(callbacks);
+    do_test(callbacks.size() == 1);
+    do_test(callbacks.at(0).key == L"beta");
+    do_test(callbacks.at(0).val == none());
+
+    // Frequent changes do not make the file grow without bound.
+    for (int i = 0; i < 500; i++) {
+        uvars1.set(L"alpha", env_var_t{to_string(i), noflags});
+        do_test(uvars1.sync(callbacks));
+    }
+    std::string contents = read_file();
+    do_test(std::count(contents.begin(), contents.end(), '\n') < 100);
+    callbacks.clear();
+    uvars2.sync(callbacks);
+    do_test(uvars2.get(L"alpha") == env_var_t(L"499", noflags));
+
+    // A fresh reader sees the same variables.
+    env_universal_t uvars3(UVARS_TEST_PATH);
+    uvars3.initialize(callbacks);
+    do_test(uvars3.get_table() == uvars1.get_table());
+
+    // A record which is still being appended to a journaled file is ignored until it is complete.
+    const std::string narrow_path = wcs2string(UVARS_TEST_PATH);
+    FILE *fp = fopen(narrow_path.c_str(), "a");
+    fputs("SETUVAR zpartial:hel", fp);
+    fclose(fp);
+    env_universal_t uvars4(UVARS_TEST_PATH);
+    uvars4.initialize(callbacks);
+    do_test(!uvars4.get(L"zpartial"));
+    do_test(uvars4.get(L"alpha") == env_var_t(L"499", noflags));
+    fp = fopen(narrow_path.c_str(), "a");
+    fputs("lo\n", fp);
+    fclose(fp);
+    callbacks.clear();
+    uvars4.sync(callbacks);
+    do_test(uvars4.get(L"zpartial") == env_var_t(L"hello", noflags));
+
+    // A file without a journal id, e.g. a hand-edited one, is read whole even if its last line is
+    // not terminated, and is not appended to.
+    fp = fopen(narrow_path.c_str(), "w");
+    fputs("# VERSION: 3.0\nSETUVAR zlast:hello", fp);
+    fclose(fp);
+    env_universal_t uvars5(UVARS_TEST_PATH);
+    uvars5.initialize(callbacks);
+    do_test(uvars5.get(L"zlast") == env_var_t(L"hello", noflags));
+    uvars5.set(L"gamma", env_var_t{L"1", noflags});
+    do_test(uvars5.sync(callbacks));
+    env_universal_t uvars6(UVARS_TEST_PATH);
+    uvars6.initialize(callbacks);
+    do_test(uvars6.get(L"zlast") == env_var_t(L"hello", noflags));
+    do_test(uvars6.get(L"gamma") == env_var_t(L"1", noflags));
+    system_assert("rm -Rf test/fish_uvars_test/");
+}
+
 static void test_universal_formats() {
     say(L"Testing universal format detection");
     const struct {
@@ -3981,6 +4356,19 @@ static void trigger_or_wait_for_notification(universal_notifier_t::notifier_stra
         case universal_notifier_t::strategy_sigio: {
             break;  // nothing required
         }
+        case universal_notifier_t::strategy_inotify: {
+            // Let the notifiers stop coalescing (which takes 10 ms), and then change the file, as
+            // posting does nothing with this strategy.
+            usleep(20000);
+            FILE *f = fopen(wcs2string(UVARS_TEST_PATH).c_str(), "a");
+            if (!f) {
+                err(L"Unable to open '%ls'", UVARS_TEST_PATH);
+                break;
+            }
+            fputs("\n", f);
+            fclose(f);
+            break;
+        }
     }
 }
 
@@ -4061,12 +4449,21 @@ static void test_universal_notifiers() {
 
     auto strategy = universal_notifier_t::resolve_default_strategy();
     test_notifiers_with_strategy(strategy);
+#if !defined(__CYGWIN__)
+    // The named pipe strategy is the fallback where the default one cannot be used.
+    if (strategy != universal_notifier_t::strategy_named_pipe) {
+        test_notifiers_with_strategy(universal_notifier_t::strategy_named_pipe);
+    }
+#endif
 }
 
 class history_tests_t {
    public:
     static void test_history();
     static void test_history_merge();
+    static void test_history_index();
+    static void test_history_binary_format();
+    static void test_history_parallel_search();
     static void test_history_path_detection();
     static void test_history_formats();
     // static void test_history_speed(void);
@@ -4506,6 +4903,260 @@ void history_tests_t::test_history_path_detection() {
     history->clear();
 }
 
+void history_tests_t::test_history_index() {
+    say(L"Testing history index");
+    const wcstring name = L"index_test";
+    const wcstring_list_t items = {L"git checkout master", L"git commit -a", L"make test",
+                                   L"GIT STATUS",          L"ls",            L"echo git"};
+    const history_search_flags_t nocase = history_search_ignore_case;
+    wcstring data_path;
+    if (!path_get_data(data_path)) {
+        err(L"Failed to get data directory");
+        return;
+    }
+    const std::string index_path = wcs2string(data_path + L"/" + name + L"_history.idx");
+
+    auto populate = [&](const wcstring_list_t &texts) {
+        history_t hist(name);
+        hist.clear();
+        for (const wcstring &text : texts) {
+            hist.add(text);
+        }
+        hist.save();
+    };
+
+    // Run the searches on a fresh history, which reads the file and its index.
+    auto check_searches = [&](unsigned from_line) {
+        time_barrier();
+        history_t hist(name);
+        history_search_t searcher(&hist, L"git");
+        test_history_matches(searcher, {L"echo git", L"git commit -a", L"git checkout master"},
+                             from_line);
+        searcher = history_search_t(&hist, L"git", history_search_type_t::contains, nocase);
+        test_history_matches(
+            searcher, {L"echo git", L"GIT STATUS", L"git commit -a", L"git checkout master"},
+            from_line);
+        searcher = history_search_t(&hist, L"git c", history_search_type_t::prefix, 0);
+        test_history_matches(searcher, {L"git commit -a", L"git checkout master"}, from_line);
+        searcher = history_search_t(&hist, L"make test", history_search_type_t::exact, 0);
+        test_history_matches(searcher, {L"make test"}, from_line);
+        searcher = history_search_t(&hist, L"nope", history_search_type_t::contains, nocase);
+        test_history_matches(searcher, {}, from_line);
+    };
+
+    // Saving builds the index.
+    populate(items);
+    check_searches(__LINE__);
+
+    // Rewriting the file rebuilds the index, so it covers every item.
+    {
+        wcstring_list_t texts = items;
+        texts.push_back(L"git deleted");
+        populate(texts);
+        history_t hist(name);
+        hist.remove(L"git deleted");
+        hist.save();
+        autoclose_fd_t index_fd{open(index_path.c_str(), O_RDONLY | O_CLOEXEC)};
+        do_test(index_fd.valid());
+        if (index_fd.valid()) do_test(read_history_index(index_fd.fd()).size() == items.size());
+    }
+    check_searches(__LINE__);
+
+    // A stale index must not hide items: swap in the index of a different history file.
+    std::string stale_index_path = index_path + ".stale";
+    populate({L"git a", L"git b", L"something else entirely"});
+    do_test(rename(index_path.c_str(), stale_index_path.c_str()) == 0);
+    populate(items);
+    do_test(rename(stale_index_path.c_str(), index_path.c_str()) == 0);
+    check_searches(__LINE__);
+
+    // Searching works without any index.
+    do_test(unlink(index_path.c_str()) == 0);
+    check_searches(__LINE__);
+
+    history_t(name).clear();
+    do_test(access(index_path.c_str(), F_OK) != 0);
+}
+
+void history_tests_t::test_history_binary_format() {
+    say(L"Testing binary history format");
+    const wcstring name = L"binary_test";
+    wcstring data_path;
+    if (!path_get_data(data_path)) {
+        err(L"Failed to get data directory");
+        return;
+    }
+    const std::string history_path = wcs2string(data_path + L"/" + name + L"_history");
+    auto read_magic = [&] {
+        char magic[4] = {};
+        FILE *f = fopen(history_path.c_str(), "r");
+        do_test(f && fread(magic, 1, sizeof magic, f) == sizeof magic);
+        if (f) fclose(f);
+        return std::string(magic, sizeof magic);
+    };
+
+    // Without the feature, saving a new history writes the text format.
+    {
+        history_t hist(name);
+        hist.clear();
+        hist.add(L"text item");
+        hist.save();
+    }
+    do_test(read_magic() == "- cm");
+    history_t(name).clear();
+
+    // With it, saving a new history writes the binary format.
+    const bool saved_flag = feature_test(features_t::binary_history);
+    mutable_fish_features().set(features_t::binary_history, true);
+    history_item_list_t before;
+    {
+        history_t hist(name);
+        hist.clear();
+        for (size_t i = 1; i <= 50; i++) {
+            wcstring value = L"binary item " + to_string(i);
+            if (i % 3 == 0) value.append(L"\nwith a\\newline");
+            history_item_t item(value, i);
+            for (size_t count = i % 4; count > 0; count--) {
+                item.required_paths.push_back(L"/path/" + to_string(count) + L"\\ with\nstuff");
+            }
+            before.push_back(item);
+            hist.add(item);
+        }
+        hist.save();
+    }
+    do_test(read_magic() == std::string("\0fis", 4));
+
+    // A new instance decodes the same items, including ones appended later.
+    time_barrier();
+    history_t reader(name);
+    do_test(reader.size() == before.size());
+    for (size_t i = 0; i < before.size(); i++) {
+        history_item_t item = reader.item_at_index(before.size() - i);
+        do_test(item.str() == before.at(i).str());
+        do_test(item.timestamp() == before.at(i).timestamp());
+        do_test(item.get_required_paths() == before.at(i).get_required_paths());
+    }
+    reader.add(L"appended item");
+    reader.save();
+    time_barrier();
+    do_test(history_t(name).item_at_index(1).str() == L"appended item");
+
+    // Text items, which an older fish appends, are read too.
+    FILE *f = fopen(history_path.c_str(), "a");
+    if (f) {
+        fputs("- cmd: text item\n  when: 1000\n  paths:\n    - /text/path\n", f);
+        fclose(f);
+    }
+    time_barrier();
+    {
+        history_t hist(name);
+        history_item_t item = hist.item_at_index(1);
+        do_test(item.str() == L"text item");
+        do_test(item.timestamp() == 1000);
+        do_test(item.get_required_paths() == path_list_t{L"/text/path"});
+        do_test(hist.item_at_index(2).str() == L"appended item");
+        history_search_t searcher(&hist, L"text it");
+        do_test(searcher.go_backwards() && searcher.current_string() == L"text item");
+    }
+
+    // Exporting produces the text format, which reads back the same.
+    string_output_stream_t outs{};
+    null_output_stream_t errs{};
+    io_streams_t streams(outs, errs);
+    reader.export_as_text(streams);
+    do_test(string_prefixes_string(L"- cmd: binary item 1\n", outs.contents()));
+    const std::string export_path = wcs2string(data_path + L"/binary_export_history");
+    f = fopen(export_path.c_str(), "w");
+    if (f) {
+        fputs(wcs2string(outs.contents()).c_str(), f);
+        fclose(f);
+    }
+    history_t exported(L"binary_export");
+    do_test(exported.size() == before.size() + 1);
+    for (size_t i = 0; i < before.size(); i++) {
+        history_item_t item = exported.item_at_index(before.size() + 1 - i);
+        do_test(item.str() == before.at(i).str());
+        do_test(item.get_required_paths() == before.at(i).get_required_paths());
+    }
+    exported.clear();
+    reader.clear();
+    mutable_fish_features().set(features_t::binary_history, saved_flag);
+}
+
+void history_tests_t::test_history_parallel_search() {
+    say(L"Testing parallel history search");
+    const wcstring name = L"parallel_test";
+    {
+        // Enough items that searches are split into several chunks, with duplicates across them.
+        history_t hist(name);
+        hist.clear();
+        for (size_t i = 0; i < 20000; i++) {
+            hist.add(history_item_t(L"Command " + to_string(i % 7919), i + 1));
+        }
+        hist.save();
+    }
+    time_barrier();
+    history_t hist(name);
+    hist.add(L"command 12 is new");
+
+    // The serial searcher gives the expected results.
+    auto serial_search = [&](history_search_type_t type, const wcstring &term, bool case_sensitive,
+                             size_t max_items) {
+        wcstring result;
+        history_search_t searcher(&hist, term, type,
+                                  case_sensitive ? 0 : history_search_ignore_case);
+        while (max_items-- > 0 && searcher.go_backwards()) {
+            result.append(searcher.current_string());
+            result.push_back(L'\n');
+        }
+        return result;
+    };
+    auto parallel_search = [&](history_search_type_t type, const wcstring &term,
+                               bool case_sensitive, size_t max_items) {
+        string_output_stream_t outs{};
+        null_output_stream_t errs{};
+        io_streams_t streams(outs, errs);
+        wcstring_list_t args;
+        if (!term.empty()) args.push_back(term);
+        hist.search(type, args, nullptr, max_items, case_sensitive, false, false, no_cancel,
+                    streams);
+        return outs.contents();
+    };
+
+    const struct {
+        history_search_type_t type;
+        const wchar_t *term;
+        bool case_sensitive;
+        size_t max_items;
+    } tests[] = {
+        {history_search_type_t::contains, L"12", true, SIZE_MAX},
+        {history_search_type_t::contains, L"command 1", false, SIZE_MAX},
+        {history_search_type_t::contains, L"command 1", true, SIZE_MAX},
+        {history_search_type_t::prefix, L"Command 77", true, 5},
+        {history_search_type_t::exact, L"Command 4000", true, SIZE_MAX},
+        {history_search_type_t::contains_glob, L"and*99", true, SIZE_MAX},
+        {history_search_type_t::match_everything, L"", true, SIZE_MAX},
+    };
+    for (const auto &test : tests) {
+        wcstring expected =
+            serial_search(test.type, test.term, test.case_sensitive, test.max_items);
+        wcstring actual =
+            parallel_search(test.type, test.term, test.case_sensitive, test.max_items);
+        if (expected.empty() || actual != expected) {
+            err(L"Parallel search for '%ls' differs from serial search", test.term);
+        }
+    }
+
+    // Cancelling stops the search.
+    string_output_stream_t outs{};
+    null_output_stream_t errs{};
+    io_streams_t streams(outs, errs);
+    hist.search(history_search_type_t::match_everything, {}, nullptr, SIZE_MAX, true, false, false,
+                [] { return true; }, streams);
+    do_test(outs.contents().empty());
+    hist.clear();
+}
+
 static bool install_sample_history(const wchar_t *name) {
     wcstring path;
     if (!path_get_data(path)) {
@@ -4905,6 +5556,54 @@ static void test_new_parser_ad_hoc() {
     do_test(errors.size() == 1 && errors.at(0).code == parse_error_tokenizer_unterminated_quote);
 }
 
+static void test_ast_serialization() {
+    using namespace ast;
+    say(L"Testing ast serialization");
+    const wchar_t *srcs[] = {
+        L"",
+        L"echo hello >/dev/null 2>&1 | cat; and not true || false &",
+        L"function foo --argument x # comment\n  if test $x; echo (string upper $x)\n"
+        L"  else if time builtin true\n  end\n  while false; end\nend",
+        L"switch $x; case 'a' \"b\"; for i in 1 2 3; begin; end; end; case '*'; end",
+        L"a=b c=d command env 2>| cat\nexec echo $a[1..2] {x,y}*",
+        L"if true; echo unterminated",
+        L"echo )",
+    };
+    parse_tree_flags_t flags = parse_flag_continue_after_error | parse_flag_include_comments |
+                               parse_flag_show_extra_semis;
+    using range_list_t = ast_t::source_range_list_t;
+    auto same_ranges = [](const range_list_t &a, const range_list_t &b) {
+        return a.size() == b.size() &&
+               std::equal(a.begin(), a.end(), b.begin(), [](source_range_t x, source_range_t y) {
+                   return x.start == y.start && x.length == y.length;
+               });
+    };
+    for (const wchar_t *src : srcs) {
+        auto ast = ast_t::parse(src, flags);
+        std::string data;
+        ast.serialize(&data);
+
+        auto copy = ast_t::deserialize(data.data(), data.size(), std::wcslen(src));
+        if (!copy) {
+            err(L"Failed to deserialize ast for '%ls'", src);
+            continue;
+        }
+        do_test(copy->dump(src) == ast.dump(src));
+        do_test(copy->errored() == ast.errored());
+        do_test(same_ranges(copy->extras().comments, ast.extras().comments));
+        do_test(same_ranges(copy->extras().semis, ast.extras().semis));
+        do_test(same_ranges(copy->extras().errors, ast.extras().errors));
+
+        // Truncated data, or data which refers past the end of the source, is rejected.
+        for (size_t len = 0; len < data.size(); len++) {
+            do_test(!ast_t::deserialize(data.data(), len, std::wcslen(src)));
+        }
+        if (std::wcslen(src) > 0) {
+            do_test(!ast_t::deserialize(data.data(), data.size(), std::wcslen(src) - 1));
+        }
+    }
+}
+
 static void test_new_parser_errors() {
     say(L"Testing new parser error reporting");
     const struct {
@@ -5360,6 +6059,9 @@ static void test_highlighting() {
     highlight_tests.push_back({{L"$EMPTY_VARIABLE", highlight_role_t::error}});
     highlight_tests.push_back({{L"\"$EMPTY_VARIABLE\"", highlight_role_t::error}});
 
+    // A cache shared by all tests, whose results must not differ from those without one.
+    highlight_cache_t cache;
+    cache.discard_if_stale(vars.get_pwd_slash(), 0);
     for (const highlight_component_list_t &components : highlight_tests) {
         // Generate the text.
         wcstring text;
@@ -5393,9 +6095,39 @@ static void test_highlighting() {
                     i, expected_colors.at(i), colors.at(i), text.c_str(), spaces.c_str());
             }
         }
+
+        for (int pass = 0; pass < 2; pass++) {
+            std::vector<highlight_spec_t> cached_colors(text.size());
+            highlight_shell(text, cached_colors, operation_context_t{vars}, true /* io_ok */,
+                            &cache);
+            if (cached_colors != colors) {
+                err(L"Highlighting with a cache gave different colors in pass %d for: %ls", pass,
+                    text.c_str());
+            }
+        }
     }
     vars.remove(L"VARIABLE_IN_COMMAND", ENV_DEFAULT);
     vars.remove(L"VARIABLE_IN_COMMAND2", ENV_DEFAULT);
+
+    // Cached results are reused until they are discarded.
+    if (system("rm -f test/fish_highlight_test/baz")) err(L"rm failed");
+    const wcstring text = L"echo test/fish_highlight_test/baz";
+    auto baz_is_path = [&] {
+        std::vector<highlight_spec_t> colors(text.size());
+        highlight_shell(text, colors, operation_context_t{vars}, true /* io_ok */, &cache);
+        return colors.back().valid_path;
+    };
+    do_test(!baz_is_path());
+    if (system("touch test/fish_highlight_test/baz")) err(L"touch failed");
+    do_test(!baz_is_path());
+    cache.discard_if_stale(vars.get_pwd_slash(), 0);
+    do_test(!baz_is_path());
+    cache.discard_if_stale(vars.get_pwd_slash(), 1);
+    do_test(baz_is_path());
+    if (system("rm test/fish_highlight_test/baz")) err(L"rm failed");
+    do_test(baz_is_path());
+    cache.discard_if_stale(L"/", 1);
+    do_test(!baz_is_path());
 }
 
 static void test_wcstring_tok() {
@@ -6456,6 +7188,7 @@ int main(int argc, char **argv) {
     if (should_test_function("new_parser_correctness")) test_new_parser_correctness();
     if (should_test_function("new_parser_ad_hoc")) test_new_parser_ad_hoc();
     if (should_test_function("new_parser_errors")) test_new_parser_errors();
+    if (should_test_function("ast_serialization")) test_ast_serialization();
     if (should_test_function("error_messages")) test_error_messages();
     if (should_test_function("escape")) test_unescape_sane();
     if (should_test_function("escape")) test_escape_crazy();
@@ -6468,7 +7201,9 @@ int main(int argc, char **argv) {
     if (should_test_function("convert_nulls")) test_convert_nulls();
     if (should_test_function("tokenizer")) test_tokenizer();
     if (should_test_function("fd_monitor")) test_fd_monitor();
+    if (should_test_function("fd_monitor_many")) test_fd_monitor_many();
     if (should_test_function("iothread")) test_iothread();
+    if (should_test_function("iothread_priority")) test_iothread_priority();
     if (should_test_function("pthread")) test_pthread();
     if (should_test_function("debounce")) test_debounce();
     if (should_test_function("debounce")) test_debounce_timeout();
@@ -6479,6 +7214,7 @@ int main(int argc, char **argv) {
     if (should_test_function("feature_flags")) test_feature_flags();
     if (should_test_function("escape_sequences")) test_escape_sequences();
     if (should_test_function("pcre2_escape")) test_pcre2_escape();
+    if (should_test_function("intern")) test_intern();
     if (should_test_function("lru")) test_lru();
     if (should_test_function("expand")) test_expand();
     if (should_test_function("expand")) test_expand_overflow();
@@ -6491,6 +7227,8 @@ int main(int argc, char **argv) {
     if (should_test_function("dup2s")) test_dup2s();
     if (should_test_function("dup2s")) test_dup2s_fd_for_target_fd();
     if (should_test_function("path")) test_path();
+    if (should_test_function("path_cache")) test_path_dir_cache();
+    if (should_test_function("inotify_queue")) test_inotify_queue();
     if (should_test_function("pager_navigation")) test_pager_navigation();
     if (should_test_function("pager_layout")) test_pager_layout();
     if (should_test_function("word_motion")) test_word_motion();
@@ -6506,6 +7244,7 @@ int main(int argc, char **argv) {
     if (should_test_function("universal")) test_universal_parsing();
     if (should_test_function("universal")) test_universal_parsing_legacy();
     if (should_test_function("universal")) test_universal_callbacks();
+    if (should_test_function("universal")) test_universal_journal();
     if (should_test_function("universal")) test_universal_formats();
     if (should_test_function("universal")) test_universal_ok_to_save();
     if (should_test_function("notifiers")) test_universal_notifiers();
@@ -6515,6 +7254,10 @@ int main(int argc, char **argv) {
     if (should_test_function("autosuggest_suggest_special")) test_autosuggest_suggest_special();
     if (should_test_function("history")) history_tests_t::test_history();
     if (should_test_function("history_merge")) history_tests_t::test_history_merge();
+    if (should_test_function("history_index")) history_tests_t::test_history_index();
+    if (should_test_function("history_binary")) history_tests_t::test_history_binary_format();
+    if (should_test_function("history_parallel"))
+        history_tests_t::test_history_parallel_search();
     if (should_test_function("history_paths")) history_tests_t::test_history_path_detection();
     if (!is_windows_subsystem_for_linux()) {
         // this test always fails under WSL
@@ -66,6 +66,7 @@ class category_list_t {
 
     category_t output_invalid{L"output-invalid", L"Trying to print invalid output"};
     category_t ast_construction{L"ast-construction", L"Parsing fish AST"};
+    category_t ast_cache{L"ast-cache", L"Reading/writing the cache of parsed scripts"};
 
     category_t proc_job_run{L"proc-job-run", L"Jobs getting started or continued"};
 
@@ -112,33 +112,13 @@ static void try_autoload(const wcstring &name, parser_t &parser) {
 }
 
 /// Insert a list of all dynamically loaded functions into the specified list.
-static void autoload_names(std::unordered_set<wcstring> &names, int get_hidden) {
-    size_t i;
-
+static void autoload_names(autoload_t &autoloader, std::unordered_set<wcstring> &names,
+                           int get_hidden) {
     // TODO: justfy this.
     auto &vars = env_stack_t::principal();
-    const auto path_var = vars.get(L"fish_function_path");
-    if (path_var.missing_or_empty()) return;
-
-    const wcstring_list_t &path_list = path_var->as_list();
-
-    for (i = 0; i < path_list.size(); i++) {
-        const wcstring &ndir_str = path_list.at(i);
-        dir_t dir(ndir_str);
-        if (!dir.valid()) continue;
-
-        wcstring name;
-        while (dir.read(name)) {
-            const wchar_t *fn = name.c_str();
-            const wchar_t *suffix;
-            if (!get_hidden && fn[0] == L'_') continue;
-
-            suffix = std::wcsrchr(fn, L'.');
-            if (suffix && (std::wcscmp(suffix, L".fish") == 0)) {
-                wcstring name(fn, suffix - fn);
-                names.insert(name);
-            }
-        }
+    for (wcstring &name : autoloader.get_autoloadable_commands(vars)) {
+        if (!get_hidden && name.at(0) == L'_') continue;
+        names.insert(std::move(name));
     }
 }
 
@@ -279,7 +259,7 @@ bool function_copy(const wcstring &name, const wcstring &new_name) {
 wcstring_list_t function_get_names(int get_hidden) {
     std::unordered_set<wcstring> names;
     auto funcset = function_set.acquire();
-    autoload_names(names, get_hidden);
+    autoload_names(funcset->autoloader, names, get_hidden);
     for (const auto &func : funcset->funcs) {
         const wcstring &name = func.first;
 
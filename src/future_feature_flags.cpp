@@ -15,6 +15,7 @@ const features_t::metadata_t features_t::metadata[features_t::flag_count] = {
     {stderr_nocaret, L"stderr-nocaret", L"3.0", L"^ no longer redirects stderr"},
     {qmark_noglob, L"qmark-noglob", L"3.0", L"? no longer globs"},
     {string_replace_backslash, L"regex-easyesc", L"3.1", L"string replace -r needs fewer \\'s"},
+    {binary_history, L"binary-history", L"3.3", L"history is saved in a binary format"},
 };
 
 const struct features_t::metadata_t *features_t::metadata_for(const wchar_t *name) {
@@ -22,6 +22,9 @@ class features_t {
         /// Whether string replace -r double-unescapes the replacement.
         string_replace_backslash,
 
+        /// Whether history files are written in the binary format, which older fish cannot read.
+        binary_history,
+
         /// The number of flags.
         flag_count
     };
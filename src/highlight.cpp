@@ -779,6 +779,8 @@ class highlighter_t {
     const bool io_ok;
     // Working directory.
     const wcstring working_directory;
+    // Where to cache the results of checks which do I/O, or null.
+    highlight_cache_t *const cache;
     // The ast we produced.
     ast::ast_t ast;
     // The resulting colors.
@@ -808,6 +810,16 @@ class highlighter_t {
     /// \return a substring of our buffer.
     wcstring get_source(source_range_t r) const;
 
+    // Perform the check \p check of \p key by calling \p func, unless it is cached.
+    template <typename Func>
+    bool cached_check(highlight_cache_t::check_t check, const wcstring &key, const Func &func) {
+        if (!cache) return func();
+        if (auto result = cache->get(check, key)) return *result;
+        bool result = func();
+        if (!ctx.check_cancel()) cache->set(check, key, result);
+        return result;
+    }
+
    public:
     // Visit the children of a node.
     void visit_children(const ast::node_t &node) {
@@ -830,11 +842,13 @@ class highlighter_t {
     void visit(const ast::node_t &node) { visit_children(node); }
 
     // Constructor
-    highlighter_t(const wcstring &str, const operation_context_t &ctx, wcstring wd, bool can_do_io)
+    highlighter_t(const wcstring &str, const operation_context_t &ctx, wcstring wd, bool can_do_io,
+                  highlight_cache_t *cache)
         : buff(str),
           ctx(ctx),
           io_ok(can_do_io),
           working_directory(std::move(wd)),
+          cache(cache),
           ast(ast::ast_t::parse(buff, ast_flags)) {}
 
     // Perform highlighting, returning an array of colors.
@@ -903,7 +917,7 @@ void highlighter_t::color_as_argument(const ast::node_t &node) {
 
         // Highlight it recursively.
         highlighter_t cmdsub_highlighter(cmdsub_contents, this->ctx, this->working_directory,
-                                         this->io_ok);
+                                         this->io_ok, this->cache);
         const color_array_t &subcolors = cmdsub_highlighter.highlight();
 
         // Copy out the subcolors back into our array.
@@ -1013,7 +1027,9 @@ void highlighter_t::visit(const ast::argument_t &arg, bool cmd_is_cd) {
             bool is_help =
                 string_prefixes_string(param, L"--help") || string_prefixes_string(param, L"-h");
             if (!is_help && this->io_ok &&
-                !is_potential_cd_path(param, working_directory, ctx, PATH_EXPAND_TILDE)) {
+                !cached_check(highlight_cache_t::check_t::cd_argument, param, [&] {
+                    return is_potential_cd_path(param, working_directory, ctx, PATH_EXPAND_TILDE);
+                })) {
                 this->color_node(arg, highlight_role_t::error);
             }
         }
@@ -1052,8 +1068,12 @@ void highlighter_t::visit(const ast::decorated_statement_t &stmt) {
         // Try expanding it. If we cannot, it's an error.
         bool expanded = statement_get_expanded_command(buff, stmt, ctx, &expanded_cmd);
         if (expanded && !has_expand_reserved(expanded_cmd)) {
-            is_valid_cmd =
-                command_is_valid(expanded_cmd, stmt.decoration(), working_directory, ctx.vars);
+            wcstring key(1, static_cast<wchar_t>(stmt.decoration()));
+            key.append(expanded_cmd);
+            is_valid_cmd = cached_check(highlight_cache_t::check_t::command, key, [&] {
+                return command_is_valid(expanded_cmd, stmt.decoration(), working_directory,
+                                        ctx.vars);
+            });
         }
     }
 
@@ -1120,6 +1140,82 @@ static bool contains_pending_variable(const std::vector<wcstring> &pending_varia
     return false;
 }
 
+/// \return whether \p target, an expanded redirection target, can be used with redirections with
+/// mode \p mode. This does I/O.
+static bool redirection_target_is_valid(const wcstring &target, const wcstring &working_directory,
+                                        redirection_mode_t mode) {
+    // We will probably need it as a path (but not in the case of fd redirections).
+    bool target_is_valid = true;
+    const wcstring target_path = path_apply_working_directory(target, working_directory);
+    switch (mode) {
+        case redirection_mode_t::fd: {
+            if (target == L"-") {
+                target_is_valid = true;
+            } else {
+                int fd = fish_wcstoi(target.c_str());
+                target_is_valid = !errno && fd >= 0;
+            }
+            break;
+        }
+        case redirection_mode_t::input: {
+            // Input redirections must have a readable non-directory.
+            struct stat buf = {};
+            target_is_valid = !waccess(target_path, R_OK) && !wstat(target_path, &buf) &&
+                              !S_ISDIR(buf.st_mode);
+            break;
+        }
+        case redirection_mode_t::overwrite:
+        case redirection_mode_t::append:
+        case redirection_mode_t::noclob: {
+            // Test whether the file exists, and whether it's writable (possibly after
+            // creating it). access() returns failure if the file does not exist.
+            bool file_exists = false, file_is_writable = false;
+            int err = 0;
+
+            struct stat buf = {};
+            if (wstat(target_path, &buf) < 0) {
+                err = errno;
+            }
+
+            if (string_suffixes_string(L"/", target)) {
+                // Redirections to things that are directories is definitely not
+                // allowed.
+                file_exists = false;
+                file_is_writable = false;
+            } else if (err == 0) {
+                // No err. We can write to it if it's not a directory and we have
+                // permission.
+                file_exists = true;
+                file_is_writable = !S_ISDIR(buf.st_mode) && !waccess(target_path, W_OK);
+            } else if (err == ENOENT) {
+                // File does not exist. Check if its parent directory is writable.
+                wcstring parent = wdirname(target_path);
+
+                // Ensure that the parent ends with the path separator. This will ensure
+                // that we get an error if the parent directory is not really a
+                // directory.
+                if (!string_suffixes_string(L"/", parent)) parent.push_back(L'/');
+
+                // Now the file is considered writable if the parent directory is
+                // writable.
+                file_exists = false;
+                file_is_writable = (0 == waccess(parent, W_OK));
+            } else {
+                // Other errors we treat as not writable. This includes things like
+                // ENOTDIR.
+                file_exists = false;
+                file_is_writable = false;
+            }
+
+            // NOCLOB means that we must not overwrite files that exist.
+            target_is_valid =
+                file_is_writable && !(file_exists && mode == redirection_mode_t::noclob);
+            break;
+        }
+    }
+    return target_is_valid;
+}
+
 void highlighter_t::visit(const ast::redirection_t &redir) {
     maybe_t<pipe_or_redir_t> oper =
         pipe_or_redir_t::from_string(redir.oper.source(this->buff));  // like 2>
@@ -1159,76 +1255,12 @@ void highlighter_t::visit(const ast::redirection_t &redir) {
             target_is_valid = false;
         } else {
             // Ok, we successfully expanded our target. Now verify that it works with this
-            // redirection. We will probably need it as a path (but not in the case of fd
-            // redirections). Note that the target is now unescaped.
-            const wcstring target_path =
-                path_apply_working_directory(target, this->working_directory);
-            switch (oper->mode) {
-                case redirection_mode_t::fd: {
-                    if (target == L"-") {
-                        target_is_valid = true;
-                    } else {
-                        int fd = fish_wcstoi(target.c_str());
-                        target_is_valid = !errno && fd >= 0;
-                    }
-                    break;
-                }
-                case redirection_mode_t::input: {
-                    // Input redirections must have a readable non-directory.
-                    struct stat buf = {};
-                    target_is_valid = !waccess(target_path, R_OK) && !wstat(target_path, &buf) &&
-                                      !S_ISDIR(buf.st_mode);
-                    break;
-                }
-                case redirection_mode_t::overwrite:
-                case redirection_mode_t::append:
-                case redirection_mode_t::noclob: {
-                    // Test whether the file exists, and whether it's writable (possibly after
-                    // creating it). access() returns failure if the file does not exist.
-                    bool file_exists = false, file_is_writable = false;
-                    int err = 0;
-
-                    struct stat buf = {};
-                    if (wstat(target_path, &buf) < 0) {
-                        err = errno;
-                    }
-
-                    if (string_suffixes_string(L"/", target)) {
-                        // Redirections to things that are directories is definitely not
-                        // allowed.
-                        file_exists = false;
-                        file_is_writable = false;
-                    } else if (err == 0) {
-                        // No err. We can write to it if it's not a directory and we have
-                        // permission.
-                        file_exists = true;
-                        file_is_writable = !S_ISDIR(buf.st_mode) && !waccess(target_path, W_OK);
-                    } else if (err == ENOENT) {
-                        // File does not exist. Check if its parent directory is writable.
-                        wcstring parent = wdirname(target_path);
-
-                        // Ensure that the parent ends with the path separator. This will ensure
-                        // that we get an error if the parent directory is not really a
-                        // directory.
-                        if (!string_suffixes_string(L"/", parent)) parent.push_back(L'/');
-
-                        // Now the file is considered writable if the parent directory is
-                        // writable.
-                        file_exists = false;
-                        file_is_writable = (0 == waccess(parent, W_OK));
-                    } else {
-                        // Other errors we treat as not writable. This includes things like
-                        // ENOTDIR.
-                        file_exists = false;
-                        file_is_writable = false;
-                    }
-
-                    // NOCLOB means that we must not overwrite files that exist.
-                    target_is_valid = file_is_writable &&
-                                      !(file_exists && oper->mode == redirection_mode_t::noclob);
-                    break;
-                }
-            }
+            // redirection. Note that the target is now unescaped.
+            wcstring key(1, static_cast<wchar_t>(oper->mode));
+            key.append(target);
+            target_is_valid = cached_check(highlight_cache_t::check_t::redirection, key, [&] {
+                return redirection_target_is_valid(target, this->working_directory, oper->mode);
+            });
         }
         this->color_node(redir.target,
                          target_is_valid ? highlight_role_t::redirection : highlight_role_t::error);
@@ -1314,7 +1346,10 @@ highlighter_t::color_array_t highlighter_t::highlight() {
             const ast::argument_t *arg = node.try_as<ast::argument_t>();
             if (!arg || arg->unsourced) continue;
             if (ctx.check_cancel()) break;
-            if (range_is_potential_path(buff, arg->range, ctx, working_directory)) {
+            bool is_path = cached_check(highlight_cache_t::check_t::path, arg->source(buff), [&] {
+                return range_is_potential_path(buff, arg->range, ctx, working_directory);
+            });
+            if (is_path) {
                 // Don't color highlight_role_t::error because it looks dorky. For example,
                 // trying to cd into a non-directory would show an underline and also red.
                 for (size_t i = arg->range.start, end = arg->range.start + arg->range.length;
@@ -1349,9 +1384,44 @@ std::string colorize(const wcstring &text, const std::vector<highlight_spec_t> &
     return outp.contents();
 }
 
+/// How long the results of highlight checks are kept. They are discarded earlier if commands run,
+/// but files may also be created or removed by other processes.
+static constexpr long kHighlightCacheLifetimeMs = 5000;
+
+/// The most results of each kind of check which are kept.
+static constexpr size_t kHighlightCacheMaxEntries = 4096;
+
+void highlight_cache_t::discard_if_stale(const wcstring &working_directory, uint64_t generation) {
+    auto now = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> locker(lock_);
+    if (working_directory == working_directory_ && generation == generation_ &&
+        now - created_ < std::chrono::milliseconds(kHighlightCacheLifetimeMs)) {
+        return;
+    }
+    for (auto &results : results_) results.clear();
+    working_directory_ = working_directory;
+    generation_ = generation;
+    created_ = now;
+}
+
+maybe_t<bool> highlight_cache_t::get(check_t check, const wcstring &key) const {
+    std::lock_guard<std::mutex> locker(lock_);
+    const auto &results = results_[static_cast<size_t>(check)];
+    auto where = results.find(key);
+    if (where == results.end()) return none();
+    return where->second;
+}
+
+void highlight_cache_t::set(check_t check, const wcstring &key, bool result) {
+    std::lock_guard<std::mutex> locker(lock_);
+    auto &results = results_[static_cast<size_t>(check)];
+    if (results.size() >= kHighlightCacheMaxEntries) results.clear();
+    results[key] = result;
+}
+
 void highlight_shell(const wcstring &buff, std::vector<highlight_spec_t> &color,
-                     const operation_context_t &ctx, bool io_ok) {
+                     const operation_context_t &ctx, bool io_ok, highlight_cache_t *cache) {
     const wcstring working_directory = ctx.vars.get_pwd_slash();
-    highlighter_t highlighter(buff, ctx, working_directory, io_ok);
+    highlighter_t highlighter(buff, ctx, working_directory, io_ok, cache);
     color = highlighter.highlight();
 }
@@ -5,6 +5,8 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include <chrono>
+#include <mutex>
 #include <unordered_map>
 #include <vector>
 
@@ -90,6 +92,34 @@ class operation_context_t;
 std::string colorize(const wcstring &text, const std::vector<highlight_spec_t> &colors,
                      const environment_t &vars);
 
+/// The results of the checks that highlighting does I/O for, like whether a command exists or an
+/// argument is a path. The reader keeps these across highlighting passes, so that after an edit
+/// only the commands and arguments which changed are checked again. This is thread safe.
+class highlight_cache_t {
+   public:
+    /// The kinds of checks.
+    enum class check_t { command, cd_argument, redirection, path, COUNT };
+
+    /// Discard the results if they may be out of date: if they are for another working directory,
+    /// if \p generation is not the same as last time, or if they are more than a few seconds old.
+    /// The reader passes the number of commands it has executed as the generation, as commands can
+    /// define functions, change $PATH, create files, etc.
+    void discard_if_stale(const wcstring &working_directory, uint64_t generation);
+
+    /// \return the cached result of the check \p check of \p key, if any.
+    maybe_t<bool> get(check_t check, const wcstring &key) const;
+
+    /// Cache the result of the check \p check of \p key.
+    void set(check_t check, const wcstring &key, bool result);
+
+   private:
+    mutable std::mutex lock_;
+    wcstring working_directory_;
+    uint64_t generation_{0};
+    std::chrono::steady_clock::time_point created_{};
+    std::unordered_map<wcstring, bool> results_[static_cast<size_t>(check_t::COUNT)];
+};
+
 /// Perform syntax highlighting for the shell commands in buff. The result is stored in the color
 /// array as a color_code from the HIGHLIGHT_ enum for each character in buff.
 ///
@@ -99,8 +129,10 @@ std::string colorize(const wcstring &text, const std::vector<highlight_spec_t> &
 /// \param ctx The variables and cancellation check for this operation.
 /// \param io_ok If set, allow IO which may block. This means that e.g. invalid commands may be
 /// detected.
+/// \param cache If set, the results of checks which need IO are taken from and stored in this.
 void highlight_shell(const wcstring &buffstr, std::vector<highlight_spec_t> &color,
-                     const operation_context_t &ctx, bool io_ok = false);
+                     const operation_context_t &ctx, bool io_ok = false,
+                     highlight_cache_t *cache = nullptr);
 
 /// highlight_color_resolver_t resolves highlight specs (like "a command") to actual RGB colors.
 /// It maintains a cache with no invalidation mechanism. The lifetime of these should typically be
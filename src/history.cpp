@@ -20,12 +20,15 @@
 #include <algorithm>
 #include <atomic>
 #include <chrono>
+#include <condition_variable>
 #include <cwchar>
 #include <functional>
 #include <iterator>
 #include <map>
+#include <mutex>
 #include <numeric>
 #include <random>
+#include <thread>
 #include <type_traits>
 #include <unordered_set>
 
@@ -34,6 +37,7 @@
 #include "env.h"
 #include "fallback.h"  // IWYU pragma: keep
 #include "flog.h"
+#include "future_feature_flags.h"
 #include "global_safety.h"
 #include "history.h"
 #include "history_file.h"
@@ -49,7 +53,10 @@
 #include "wildcard.h"  // IWYU pragma: keep
 #include "wutil.h"     // IWYU pragma: keep
 
-// Our history format is intended to be valid YAML. Here it is:
+// Our history format is intended to be valid YAML. With the binary-history feature, history is
+// instead saved in a binary format with length-prefixed records, see history_file.cpp; files are
+// converted between the two when they are rewritten, and appended to in the format they have.
+// Here is the text format:
 //
 //   - cmd: ssh blah blah blah
 //     when: 2348237
@@ -59,6 +66,13 @@
 //
 //   Newlines are replaced by \n. Backslashes are replaced by \\.
 
+/// \return the format in which we write history files. Older fish cannot read the binary format, so
+/// it is opt-in.
+static history_file_type_t history_file_type_to_save() {
+    return feature_test(features_t::binary_history) ? history_type_fish_3_3
+                                                    : history_type_fish_2_0;
+}
+
 // This is the history session ID we use by default if the user has not set env var fish_history.
 #define DFLT_FISH_HISTORY_SESSION_ID L"fish"
 
@@ -122,6 +136,19 @@ maybe_t<wcstring> history_filename(const wcstring &session_id, const wcstring &s
     return result;
 }
 
+/// Append \p item to \p buffer in the fish 2.0 format. The buffer will be written at \p
+/// buffer_offset in the history file; add the item's index record to \p index.
+static void append_history_item_and_index_record(const history_item_t &item, std::string *buffer,
+                                                 uint64_t buffer_offset,
+                                                 std::vector<history_index_record_t> *index) {
+    size_t start = buffer->size();
+    append_history_item_to_buffer(item, buffer, history_type_fish_2_0);
+    size_t line_end = buffer->find('\n', start);
+    assert(line_end != std::string::npos && "History item should end with a newline");
+    index->push_back(history_index_record_t::create(
+        item.str(), buffer_offset + start, buffer->data() + start, line_end - start));
+}
+
 /// Lock the history file.
 /// Returns true on success, false on failure.
 bool history_file_lock(int fd, int lock_type) {
@@ -233,6 +260,22 @@ bool history_item_t::matches_search(const wcstring &term, enum history_search_ty
     DIE("unexpected history_search_type_t value");
 }
 
+/// A copy of the items of a history, which may be searched from background threads without holding
+/// the history's lock. The file contents are shared, so they remain valid even if the history
+/// reloads its file.
+struct history_snapshot_t {
+    // Resolved new items, most recent first.
+    std::vector<history_item_t> new_items;
+
+    // The history file contents, and the offsets and signatures of its items, oldest first.
+    std::shared_ptr<const history_file_contents_t> file_contents;
+    std::vector<size_t> old_item_offsets;
+    std::vector<history_signature_t> old_item_signatures;
+};
+
+// Parallel searches split the old items into chunks of this many items.
+static constexpr size_t kParallelSearchChunkSize = 4096;
+
 struct history_impl_t {
     // Add a new history item to the end. If pending is set, the item will not be returned by
     // item_at_index until a call to resolve_pending(). Pending items are tracked with an offset
@@ -264,8 +307,9 @@ struct history_impl_t {
     // Deleted item contents.
     std::unordered_set<wcstring> deleted_items{};
 
-    // The buffer containing the history file contents.
-    std::unique_ptr<history_file_contents_t> file_contents{};
+    // The buffer containing the history file contents. This is shared with any searches that are
+    // running in the background, which keep it alive if we reload the file.
+    std::shared_ptr<const history_file_contents_t> file_contents{};
 
     // The file ID of the history file.
     file_id_t history_file_id = kInvalidFileID;
@@ -288,14 +332,18 @@ struct history_impl_t {
     // List of old items, as offsets into out mmap data.
     std::deque<size_t> old_item_offsets{};
 
+    // Signatures of the old items, parallel to old_item_offsets. Items not found in the history
+    // index have kUnknownHistorySignature until they are first decoded by a search.
+    std::deque<history_signature_t> old_item_signatures{};
+
     /// \return a timestamp for new items - see the implementation for a subtlety.
     time_t timestamp_now() const;
 
     /// \return a new item identifier, incrementing our counter.
     history_identifier_t next_identifier() { return ++last_identifier; }
 
-    // Figure out the offsets of our file contents.
-    void populate_from_file_contents();
+    // Figure out the offsets of our file contents, and their signatures from the given index.
+    void populate_from_file_contents(const std::vector<history_index_record_t> &index);
 
     // Loads old items if necessary.
     void load_old_if_needed();
@@ -308,9 +356,11 @@ struct history_impl_t {
     // removes them.
     void remove_ephemeral_items();
 
-    // Attempts to rewrite the existing file to a target temporary file
+    // Attempts to rewrite the existing file to a target temporary file, in the format \p
+    // file_type. For text files, populates \p index with the index of the new file.
     // Returns false on error, true on success
-    bool rewrite_to_temporary_file(int existing_fd, int dst_fd) const;
+    bool rewrite_to_temporary_file(int existing_fd, int dst_fd, history_file_type_t file_type,
+                                   std::vector<history_index_record_t> *index) const;
 
     // Saves history by rewriting the file.
     bool save_internal_via_rewrite();
@@ -375,6 +425,13 @@ struct history_impl_t {
     // commandline. (So the most recent item is at index 1.)
     history_item_t item_at_index(size_t idx);
 
+    // Starting at \p *idx, return the first item which may match a term with the given signature.
+    history_item_t next_candidate_item(size_t *idx, history_signature_t term_signature);
+
+    // \return a snapshot of our items for a parallel search, or nullptr if there are too few old
+    // items for a parallel search to pay off.
+    std::shared_ptr<const history_snapshot_t> snapshot_for_parallel_search();
+
     // Return the number of history entries.
     size_t size();
 };
@@ -539,6 +596,57 @@ history_item_t history_impl_t::item_at_index(size_t idx) {
     return history_item_t{};
 }
 
+history_item_t history_impl_t::next_candidate_item(size_t *idx,
+                                                   history_signature_t term_signature) {
+    assert(*idx > 0);
+    size_t resolved_new_item_count = new_items.size();
+    if (this->has_pending_item && resolved_new_item_count > 0) {
+        resolved_new_item_count -= 1;
+    }
+
+    // New items are not indexed; they are all candidates.
+    if (*idx - 1 < resolved_new_item_count || term_signature == 0) {
+        return item_at_index(*idx);
+    }
+
+    // Skip old items whose signature does not cover the term. An item with an unknown signature is
+    // a candidate; decode it and remember its signature for the next search.
+    load_old_if_needed();
+    size_t old_item_count = old_item_offsets.size();
+    for (size_t old_idx = *idx - 1 - resolved_new_item_count; old_idx < old_item_count;
+         old_idx++) {
+        size_t pos = old_item_count - old_idx - 1;
+        history_signature_t &sig = old_item_signatures.at(pos);
+        if (!history_signature_covers(sig, term_signature)) continue;
+
+        *idx = old_idx + resolved_new_item_count + 1;
+        history_item_t item = file_contents->decode_item(old_item_offsets.at(pos));
+        if (sig == kUnknownHistorySignature) sig = history_signature_for(item.str());
+        return item;
+    }
+
+    // Past the end.
+    *idx = old_item_count + resolved_new_item_count + 1;
+    return history_item_t{};
+}
+
+std::shared_ptr<const history_snapshot_t> history_impl_t::snapshot_for_parallel_search() {
+    load_old_if_needed();
+    if (old_item_offsets.size() <= kParallelSearchChunkSize) return nullptr;
+
+    auto snapshot = std::make_shared<history_snapshot_t>();
+    size_t resolved_new_item_count = new_items.size();
+    if (this->has_pending_item && resolved_new_item_count > 0) {
+        resolved_new_item_count -= 1;
+    }
+    snapshot->new_items.assign(new_items.rbegin() + (new_items.size() - resolved_new_item_count),
+                               new_items.rend());
+    snapshot->file_contents = file_contents;
+    snapshot->old_item_offsets.assign(old_item_offsets.begin(), old_item_offsets.end());
+    snapshot->old_item_signatures.assign(old_item_signatures.begin(), old_item_signatures.end());
+    return snapshot;
+}
+
 std::unordered_map<long, wcstring> history_impl_t::items_at_indexes(const std::vector<long> &idxs) {
     std::unordered_map<long, wcstring> result;
     for (long idx : idxs) {
@@ -570,17 +678,32 @@ time_t history_impl_t::timestamp_now() const {
     return when;
 }
 
-void history_impl_t::populate_from_file_contents() {
+void history_impl_t::populate_from_file_contents(
+    const std::vector<history_index_record_t> &index) {
     old_item_offsets.clear();
+    old_item_signatures.clear();
+    size_t indexed_count = 0;
     if (file_contents) {
+        // Both the index and the file are in offset order, so walk them together.
+        auto index_iter = index.cbegin();
         size_t cursor = 0;
         while (auto offset = file_contents->offset_of_next_item(&cursor, boundary_timestamp)) {
             // Remember this item.
             old_item_offsets.push_back(*offset);
+
+            // Binary files store signatures themselves; text files may have them in the index.
+            history_signature_t sig = file_contents->signature_at(*offset);
+            while (index_iter != index.cend() && index_iter->offset < *offset) ++index_iter;
+            if (index_iter != index.cend() && index_iter->offset == *offset &&
+                file_contents->index_record_matches(*index_iter)) {
+                sig = index_iter->signature;
+                indexed_count++;
+            }
+            old_item_signatures.push_back(sig);
         }
     }
 
-    FLOGF(history, "Loaded %lu old items", old_item_offsets.size());
+    FLOGF(history, "Loaded %lu old items (%lu indexed)", old_item_offsets.size(), indexed_count);
 }
 
 void history_impl_t::load_old_if_needed() {
@@ -605,10 +728,19 @@ void history_impl_t::load_old_if_needed() {
             if (!history_t::chaos_mode) history_file_lock(fd, LOCK_SH);
             file_contents = history_file_contents_t::create(fd);
             this->history_file_id = file_contents ? file_id_for_fd(fd) : kInvalidFileID;
+
+            // The index is written under the history file's lock, so read it under the lock too.
+            std::vector<history_index_record_t> index;
+            if (file_contents && file_contents->type() == history_type_fish_2_0) {
+                if (maybe_t<wcstring> index_name = history_filename(name, L".idx")) {
+                    autoclose_fd_t index_fd{wopen_cloexec(*index_name, O_RDONLY)};
+                    if (index_fd.valid()) index = read_history_index(index_fd.fd());
+                }
+            }
             if (!history_t::chaos_mode) history_file_lock(fd, LOCK_UN);
 
             time_profiler_t profiler("populate_from_file_contents");  //!OCLINT(side-effect)
-            this->populate_from_file_contents();
+            this->populate_from_file_contents(index);
         }
     }
 }
@@ -621,7 +753,7 @@ bool history_search_t::go_backwards() {
 
     size_t index = current_index_;
     while (++index < max_index) {
-        history_item_t item = history_->item_at_index(index);
+        history_item_t item = history_->next_candidate_item(&index, term_signature_);
 
         // We're done if it's empty or we cancelled.
         if (item.empty()) {
@@ -646,6 +778,19 @@ bool history_search_t::go_backwards() {
     return false;
 }
 
+history_search_t::history_search_t(history_t *hist, const wcstring &str,
+                                   enum history_search_type_t type, history_search_flags_t flags)
+    : history_(hist), orig_term_(str), canon_term_(str), search_type_(type), flags_(flags) {
+    if (ignores_case()) {
+        std::transform(canon_term_.begin(), canon_term_.end(), canon_term_.begin(), towlower);
+    }
+    // Only literal searches can use signatures; an item containing the term has all its trigrams.
+    if (type == history_search_type_t::exact || type == history_search_type_t::contains ||
+        type == history_search_type_t::prefix) {
+        term_signature_ = history_signature_for(canon_term_);
+    }
+}
+
 const history_item_t &history_search_t::current_item() const {
     assert(current_item_ && "No current item");
     return *current_item_;
@@ -658,6 +803,7 @@ void history_impl_t::clear_file_state() {
     file_contents.reset();
     loaded_old = false;
     old_item_offsets.clear();
+    old_item_signatures.clear();
 }
 
 void history_impl_t::compact_new_items() {
@@ -695,7 +841,9 @@ void history_impl_t::remove_ephemeral_items() {
 // Given the fd of an existing history file, or -1 if none, write
 // a new history file to temp_fd. Returns true on success, false
 // on error
-bool history_impl_t::rewrite_to_temporary_file(int existing_fd, int dst_fd) const {
+bool history_impl_t::rewrite_to_temporary_file(int existing_fd, int dst_fd,
+                                               history_file_type_t file_type,
+                                               std::vector<history_index_record_t> *index) const {
     // We are reading FROM existing_fd and writing TO dst_fd
     // dst_fd must be valid; existing_fd does not need to be
     assert(dst_fd >= 0);
@@ -734,14 +882,24 @@ bool history_impl_t::rewrite_to_temporary_file(int existing_fd, int dst_fd) cons
         return item1.timestamp() < item2.timestamp();
     });
 
-    // Write them out.
+    // Write them out, remembering where each item went. Binary files store their signatures
+    // themselves, so only text files are indexed.
     int err = 0;
     std::string buffer;
     buffer.reserve(HISTORY_OUTPUT_BUFFER_SIZE + 128);
+    uint64_t flushed = 0;
+    index->clear();
+    append_history_file_header(file_type, &buffer);
     for (const auto key_item : lru) {
-        append_history_item_to_buffer(key_item.second, &buffer);
+        if (file_type == history_type_fish_2_0) {
+            append_history_item_and_index_record(key_item.second, &buffer, flushed, index);
+        } else {
+            append_history_item_to_buffer(key_item.second, &buffer, file_type);
+        }
+        size_t buffer_size = buffer.size();
         err = flush_to_fd(&buffer, dst_fd, HISTORY_OUTPUT_BUFFER_SIZE);
         if (err) break;
+        if (buffer.empty()) flushed += buffer_size;
     }
     if (!err) {
         err = flush_to_fd(&buffer, dst_fd, 0);
@@ -766,6 +924,25 @@ static autoclose_fd_t create_temporary_file(const wcstring &name_template, wcstr
     return autoclose_fd_t{};
 }
 
+/// Write \p index as the index of the history file, which the caller has locked. The index is
+/// written to a temporary file which is moved into place, so readers never see a partial index.
+static void replace_history_index(const wcstring &session_id,
+                                  const std::vector<history_index_record_t> &index) {
+    const maybe_t<wcstring> target_name = history_filename(session_id, L".idx");
+    const maybe_t<wcstring> tmp_name_template = history_filename(session_id, L".idx.XXXXXX");
+    if (!target_name || !tmp_name_template) return;
+    wcstring tmp_name;
+    autoclose_fd_t tmp_file = create_temporary_file(*tmp_name_template, &tmp_name);
+    if (!tmp_file.valid()) return;
+    if (int err = write_history_index(tmp_file.fd(), index)) {
+        FLOGF(history_file, L"Error %d when writing history index", err);
+        wunlink(tmp_name);
+    } else if (wrename(tmp_name, *target_name) == -1) {
+        FLOGF(history_file, L"Error %d when renaming history index", errno);
+        wunlink(tmp_name);
+    }
+}
+
 bool history_impl_t::save_internal_via_rewrite() {
     FLOGF(history, "Saving %lu items via rewrite",
           new_items.size() - first_unwritten_new_item_index);
@@ -788,13 +965,16 @@ bool history_impl_t::save_internal_via_rewrite() {
         return false;
     }
     const int tmp_fd = tmp_file.fd();
+    const history_file_type_t file_type = history_file_type_to_save();
+    std::vector<history_index_record_t> index;
     bool done = false;
     for (int i = 0; i < max_save_tries && !done; i++) {
         // Open any target file, but do not lock it right away
         autoclose_fd_t target_fd_before{
             wopen_cloexec(*target_name, O_RDONLY | O_CREAT, history_file_mode)};
         file_id_t orig_file_id = file_id_for_fd(target_fd_before.fd());  // possibly invalid
-        bool wrote = this->rewrite_to_temporary_file(target_fd_before.fd(), tmp_fd);
+        bool wrote =
+            this->rewrite_to_temporary_file(target_fd_before.fd(), tmp_fd, file_type, &index);
         target_fd_before.close();
         if (!wrote) {
             // Failed to write, no good
@@ -843,6 +1023,12 @@ bool history_impl_t::save_internal_via_rewrite() {
             // Slide it into place
             if (wrename(tmp_name, *target_name) == -1) {
                 FLOGF(history_file, L"Error %d when renaming history file", errno);
+            } else if (file_type == history_type_fish_2_0) {
+                // Rebuild the index for the new file while we still hold the lock.
+                replace_history_index(name, index);
+            } else if (maybe_t<wcstring> index_name = history_filename(name, L".idx")) {
+                // Binary files need no index, and the old one no longer describes the file.
+                wunlink(*index_name);
             }
 
             // We did it
@@ -894,7 +1080,8 @@ bool history_impl_t::save_internal_via_appending() {
     // Limit our max tries so we don't do this forever.
     autoclose_fd_t history_fd{};
     for (int i = 0; i < max_save_tries; i++) {
-        autoclose_fd_t fd{wopen_cloexec(history_path, O_WRONLY | O_APPEND)};
+        // We read the start of the file to learn its format, so open it for reading too.
+        autoclose_fd_t fd{wopen_cloexec(history_path, O_RDWR | O_APPEND)};
         if (!fd.valid()) {
             // can't open, we're hosed
             break;
@@ -919,7 +1106,16 @@ bool history_impl_t::save_internal_via_appending() {
         }
     }
 
+    // Append in the format of the existing file; an empty file gets the format we save in. fish 1.x
+    // files cannot be appended to, so they get rewritten instead.
+    history_file_type_t file_type = history_file_type_to_save();
     if (history_fd.valid()) {
+        if (auto existing_type = history_file_type_for_fd(history_fd.fd())) {
+            file_type = *existing_type;
+        }
+    }
+
+    if (history_fd.valid() && file_type != history_type_fish_1_x) {
         // We (hopefully successfully) took the exclusive lock. Append to the file.
         // Note that this is sketchy for a few reasons:
         //   - Another shell may have appended its own items with a later timestamp, so our file may
@@ -944,12 +1140,24 @@ bool history_impl_t::save_internal_via_appending() {
         int err = 0;
         // Use a small buffer size for appending, we usually only have 1 item
         std::string buffer;
+        // Track where our items land, so we can append text items to the index. We hold the lock,
+        // so nobody else appends in between.
+        off_t end_offset = lseek(history_fd.fd(), 0, SEEK_END);
+        uint64_t flushed = end_offset < 0 ? 0 : uint64_t(end_offset);
+        std::vector<history_index_record_t> index;
+        if (end_offset == 0) append_history_file_header(file_type, &buffer);
         while (first_unwritten_new_item_index < new_items.size()) {
             const history_item_t &item = new_items.at(first_unwritten_new_item_index);
             if (item.should_write_to_disk()) {
-                append_history_item_to_buffer(item, &buffer);
+                if (file_type == history_type_fish_2_0) {
+                    append_history_item_and_index_record(item, &buffer, flushed, &index);
+                } else {
+                    append_history_item_to_buffer(item, &buffer, file_type);
+                }
+                size_t buffer_size = buffer.size();
                 err = flush_to_fd(&buffer, history_fd.fd(), HISTORY_OUTPUT_BUFFER_SIZE);
                 if (err) break;
+                if (buffer.empty()) flushed += buffer_size;
             }
             // We wrote or skipped this item, hooray.
             first_unwritten_new_item_index++;
@@ -959,6 +1167,20 @@ bool history_impl_t::save_internal_via_appending() {
             err = flush_to_fd(&buffer, history_fd.fd(), 0);
         }
 
+        // Extend the index, unless we don't know where our items went.
+        if (!err && end_offset >= 0 && !index.empty()) {
+            if (maybe_t<wcstring> index_name = history_filename(name, L".idx")) {
+                autoclose_fd_t index_fd{
+                    wopen_cloexec(*index_name, O_RDWR | O_CREAT, history_file_mode)};
+                if (index_fd.valid()) {
+                    if (int index_err = append_history_index(index_fd.fd(), index)) {
+                        FLOGF(history_file, L"Error %d when appending to history index",
+                              index_err);
+                    }
+                }
+            }
+        }
+
         // Since we just modified the file, update our mmap_file_id to match its current state
         // Otherwise we'll think the file has been changed by someone else the next time we go to
         // write.
@@ -1049,9 +1271,13 @@ void history_impl_t::clear() {
     deleted_items.clear();
     first_unwritten_new_item_index = 0;
     old_item_offsets.clear();
+    old_item_signatures.clear();
     if (maybe_t<wcstring> filename = history_filename(name)) {
         wunlink(*filename);
     }
+    if (maybe_t<wcstring> index_name = history_filename(name, L".idx")) {
+        wunlink(*index_name);
+    }
     this->clear_file_state();
 }
 
@@ -1385,7 +1611,7 @@ void history_t::add_pending_with_file_detection(const std::shared_ptr<history_t>
         // and unblock the item.
         // Don't hold the lock while we perform this file detection.
         imp->add(std::move(item), true /* pending */);
-        iothread_perform([=]() {
+        iothread_perform_bulk([=]() {
             // Don't hold the lock while we perform this file detection.
             auto validated_paths = expand_and_detect_paths(potential_paths, *vars);
             auto imp = self->impl();
@@ -1406,19 +1632,142 @@ void history_t::resolve_pending() { impl()->resolve_pending(); }
 
 void history_t::save() { impl()->save(); }
 
+namespace {
+/// The state of a search of a history snapshot, shared between the main thread and the iothreads
+/// that scan it. Old items are split into chunks, newest first; workers claim chunks in order and
+/// publish the matching items of each, and the main thread consumes the results in chunk order so
+/// that matches are reported exactly as a serial search would report them.
+struct parallel_history_search_t {
+    parallel_history_search_t(std::shared_ptr<const history_snapshot_t> snapshot, wcstring term,
+                              history_search_type_t type, bool case_sensitive)
+        : snapshot(std::move(snapshot)),
+          term(std::move(term)),
+          type(type),
+          case_sensitive(case_sensitive),
+          chunk_count((this->snapshot->old_item_offsets.size() + kParallelSearchChunkSize - 1) /
+                      kParallelSearchChunkSize),
+          results(chunk_count) {
+        if (!case_sensitive) this->term = wcstolower(std::move(this->term));
+        // As in history_search_t, only literal searches can use signatures.
+        if (type == history_search_type_t::exact || type == history_search_type_t::contains ||
+            type == history_search_type_t::prefix) {
+            term_signature = history_signature_for(this->term);
+        }
+    }
+
+    const std::shared_ptr<const history_snapshot_t> snapshot;
+    wcstring term;
+    const history_search_type_t type;
+    const bool case_sensitive;
+    history_signature_t term_signature{0};
+    const size_t chunk_count;
+
+    // The next chunk for a worker to scan.
+    std::atomic<size_t> next_chunk{0};
+
+    // Set when the main thread no longer wants results, so workers should stop early.
+    relaxed_atomic_bool_t stop{false};
+
+    // The matches of each chunk, most recent first, once a worker has published them.
+    std::mutex lock;
+    std::condition_variable cond;
+    std::vector<maybe_t<history_item_list_t>> results;
+
+    bool matches(const history_item_t &item) const {
+        return item.matches_search(term, type, case_sensitive);
+    }
+
+    // Scan chunks until there are none left. This is the body of each worker.
+    void run_workers() {
+        const auto &offsets = snapshot->old_item_offsets;
+        const auto &signatures = snapshot->old_item_signatures;
+        size_t chunk;
+        while (!stop && (chunk = next_chunk++) < chunk_count) {
+            // Chunk 0 holds the newest items, which are at the end of the offsets.
+            size_t end = offsets.size() - chunk * kParallelSearchChunkSize;
+            size_t begin = end - std::min(end, kParallelSearchChunkSize);
+            history_item_list_t found;
+            for (size_t pos = end; pos > begin && !stop; pos--) {
+                if (!history_signature_covers(signatures.at(pos - 1), term_signature)) continue;
+                history_item_t item = snapshot->file_contents->decode_item(offsets.at(pos - 1));
+                if (matches(item)) found.push_back(std::move(item));
+            }
+            // Publish even if we stopped early, so the main thread never waits on this chunk.
+            std::lock_guard<std::mutex> locker(lock);
+            results.at(chunk) = std::move(found);
+            cond.notify_all();
+        }
+    }
+
+    // Wait for the results of \p chunk, checking \p cancel_check periodically.
+    // \return the results, or none() if cancelled.
+    maybe_t<history_item_list_t> wait_for_chunk(size_t chunk,
+                                                const cancel_checker_t &cancel_check) {
+        std::unique_lock<std::mutex> locker(lock);
+        while (!results.at(chunk)) {
+            if (cancel_check()) return none();
+            cond.wait_for(locker, std::chrono::milliseconds(10));
+        }
+        return results.at(chunk).acquire();
+    }
+};
+}  // namespace
+
 /// Perform a search of \p hist for \p search_string. Invoke a function \p func for each match. If
 /// \p func returns true, continue the search; else stop it.
-static void do_1_history_search(history_t *hist, history_search_type_t search_type,
-                                const wcstring &search_string, bool case_sensitive,
+/// If \p snapshot is set, the old items are scanned in parallel on the iothread pool.
+static void do_1_history_search(history_t *hist,
+                                const std::shared_ptr<const history_snapshot_t> &snapshot,
+                                history_search_type_t search_type, const wcstring &search_string,
+                                bool case_sensitive,
                                 const std::function<bool(const history_item_t &item)> &func,
                                 const cancel_checker_t &cancel_check) {
-    history_search_t searcher = history_search_t(hist, search_string, search_type,
-                                                 case_sensitive ? 0 : history_search_ignore_case);
-    while (!cancel_check() && searcher.go_backwards()) {
-        if (!func(searcher.current_item())) {
-            break;
+    if (!snapshot) {
+        history_search_t searcher = history_search_t(
+            hist, search_string, search_type, case_sensitive ? 0 : history_search_ignore_case);
+        while (!cancel_check() && searcher.go_backwards()) {
+            if (!func(searcher.current_item())) {
+                break;
+            }
+        }
+        return;
+    }
+
+    auto search = std::make_shared<parallel_history_search_t>(snapshot, search_string, search_type,
+                                                              case_sensitive);
+    // Report a matching item unless it is a duplicate. \return false to stop the search.
+    std::unordered_set<wcstring> deduper;
+    auto report = [&](const history_item_t &item) {
+        return !deduper.insert(item.str()).second || func(item);
+    };
+
+    // New items are few; search them here while the workers start up on the old items.
+    size_t worker_count = std::thread::hardware_concurrency();
+    worker_count = std::max<size_t>(1, std::min(worker_count, search->chunk_count));
+    for (size_t i = 0; i < worker_count; i++) {
+        iothread_perform_bulk([search] { search->run_workers(); });
+    }
+    bool keep_going = true;
+    for (auto iter = snapshot->new_items.begin(); keep_going && iter != snapshot->new_items.end();
+         ++iter) {
+        if (cancel_check()) {
+            keep_going = false;
+        } else if (search->matches(*iter)) {
+            keep_going = report(*iter);
         }
     }
+    for (size_t chunk = 0; keep_going && chunk < search->chunk_count; chunk++) {
+        maybe_t<history_item_list_t> found = search->wait_for_chunk(chunk, cancel_check);
+        if (!found) break;
+        for (const history_item_t &item : *found) {
+            if (!report(item)) {
+                keep_going = false;
+                break;
+            }
+        }
+    }
+    // Any workers still running hold their own reference to the search, and exit soon.
+    search->stop = true;
 }
 
 // Searches history.
@@ -1445,17 +1794,19 @@ bool history_t::search(history_search_type_t search_type, const wcstring_list_t
         return true;
     };
 
+    // Large histories are searched in parallel, from a snapshot taken once for all search terms.
+    std::shared_ptr<const history_snapshot_t> snapshot = impl()->snapshot_for_parallel_search();
     if (search_args.empty()) {
         // The user had no search terms; just append everything.
-        do_1_history_search(this, history_search_type_t::match_everything, {}, false, func,
-                            cancel_check);
+        do_1_history_search(this, snapshot, history_search_type_t::match_everything, {}, false,
+                            func, cancel_check);
     } else {
         for (const wcstring &search_string : search_args) {
             if (search_string.empty()) {
                 streams.err.append_format(L"Searching for the empty string isn't allowed");
                 return false;
             }
-            do_1_history_search(this, search_type, search_string, case_sensitive, func,
+            do_1_history_search(this, snapshot, search_type, search_string, case_sensitive, func,
                                 cancel_check);
         }
     }
@@ -1467,6 +1818,20 @@ bool history_t::search(history_search_type_t search_type, const wcstring_list_t
     return true;
 }
 
+void history_t::export_as_text(io_streams_t &streams) {
+    std::string buffer;
+    {
+        auto imp = this->impl();
+        for (size_t idx = imp->size(); idx > 0; idx--) {
+            history_item_t item = imp->item_at_index(idx);
+            if (item.should_write_to_disk()) {
+                append_history_item_to_buffer(item, &buffer, history_type_fish_2_0);
+            }
+        }
+    }
+    streams.out.append(str2wcstring(buffer));
+}
+
 void history_t::clear() { impl()->clear(); }
 
 void history_t::populate_from_config_path() { impl()->populate_from_config_path(); }
@@ -1483,6 +1848,10 @@ std::unordered_map<long, wcstring> history_t::items_at_indexes(const std::vector
 
 history_item_t history_t::item_at_index(size_t idx) { return impl()->item_at_index(idx); }
 
+history_item_t history_t::next_candidate_item(size_t *idx, uint64_t term_signature) {
+    return impl()->next_candidate_item(idx, term_signature);
+}
+
 size_t history_t::size() { return impl()->size(); }
 
 /// The set of all histories.
@@ -198,6 +198,9 @@ class history_t {
                 bool null_terminate, bool reverse, const cancel_checker_t &cancel_check,
                 io_streams_t &streams);
 
+    // Writes all history items, oldest first, in the text format used by fish 3.2 and earlier.
+    void export_as_text(io_streams_t &streams);
+
     // Irreversibly clears history.
     void clear();
 
@@ -223,6 +226,11 @@ class history_t {
     // commandline. (So the most recent item is at index 1.)
     history_item_t item_at_index(size_t idx);
 
+    // Starting at index \p *idx, return the first item whose signature covers \p term_signature
+    // (see history_signature_t), and set \p *idx to its index. Return an empty item if there is
+    // none. The signature only rules out items, so the caller must still check for a match.
+    history_item_t next_candidate_item(size_t *idx, uint64_t term_signature);
+
     // Return the number of history entries.
     size_t size();
 };
@@ -263,6 +271,9 @@ class history_search_t {
     // Index of the current history item.
     size_t current_index_{0};
 
+    // The signature of the search term, used to skip items which cannot match.
+    uint64_t term_signature_{0};
+
     // If deduping, the items we've seen.
     std::unordered_set<wcstring> deduper_;
 
@@ -289,12 +300,7 @@ class history_search_t {
     // alive.
     history_search_t(history_t *hist, const wcstring &str,
                      enum history_search_type_t type = history_search_type_t::contains,
-                     history_search_flags_t flags = 0)
-        : history_(hist), orig_term_(str), canon_term_(str), search_type_(type), flags_(flags) {
-        if (ignores_case()) {
-            std::transform(canon_term_.begin(), canon_term_.end(), canon_term_.begin(), towlower);
-        }
-    }
+                     history_search_flags_t flags = 0);
 
     // Construct from a shared_ptr. TODO: this should be the only constructor.
     history_search_t(const std::shared_ptr<history_t> &hist, const wcstring &str,
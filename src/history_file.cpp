@@ -2,19 +2,60 @@
 
 #include "history_file.h"
 
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include "fds.h"
 #include "history.h"
 
+#include <algorithm>
 #include <cstring>
+#include <cwctype>
 
 // Some forward declarations.
 static history_item_t decode_item_fish_2_0(const char *base, size_t len);
 static history_item_t decode_item_fish_1_x(const char *begin, size_t length);
+static history_item_t decode_item_fish_3_3(const char *base, size_t len);
 
 static size_t offset_of_next_item_fish_2_0(const history_file_contents_t &contents,
                                            size_t *inout_cursor, time_t cutoff_timestamp);
 static size_t offset_of_next_item_fish_1_x(const char *begin, size_t mmap_length,
                                            size_t *inout_cursor);
+static size_t offset_of_next_item_fish_3_3(const history_file_contents_t &contents,
+                                           size_t *inout_cursor, time_t cutoff_timestamp);
+
+// The header at the start of fish 3.3 history files. It starts with a NUL so it cannot be confused
+// with the text formats.
+static constexpr char kBinaryHistoryMagic[8] = {'\0', 'f', 'i', 's', 'h', 'h', 's', '3'};
+
+// Layout of a fish 3.3 record. All integers are little-endian. The header is followed by the
+// command, and then by each path as a 32 bit length and its bytes. The payload length counts
+// everything after the header.
+namespace binary_record {
+constexpr char magic[4] = {'f', 'h', 'r', '\1'};
+constexpr size_t magic_offset = 0;            // 4 bytes
+constexpr size_t payload_length_offset = 4;   // uint32_t
+constexpr size_t timestamp_offset = 8;        // int64_t
+constexpr size_t signature_offset = 16;       // uint64_t
+constexpr size_t command_length_offset = 24;  // uint32_t
+constexpr size_t path_count_offset = 28;      // uint16_t
+// Two bytes of flags at offset 30 are reserved, and currently always 0.
+constexpr size_t header_size = 32;
+}  // namespace binary_record
+
+static uint64_t read_le(const char *p, size_t width) {
+    uint64_t result = 0;
+    for (size_t i = width; i-- > 0;) {
+        result = (result << 8) | static_cast<unsigned char>(p[i]);
+    }
+    return result;
+}
+
+static void append_le(std::string *buffer, uint64_t val, size_t width) {
+    for (size_t i = 0; i < width; i++) {
+        buffer->push_back(static_cast<char>((val >> (8 * i)) & 0xFF));
+    }
+}
 
 // Check if we should mmap the fd.
 // Don't try mmap() on non-local filesystems.
@@ -51,7 +92,10 @@ static bool read_from_fd(int fd, void *address, size_t len) {
 /// Try to infer the history file type based on inspecting the data.
 static maybe_t<history_file_type_t> infer_file_type(const void *data, size_t len) {
     maybe_t<history_file_type_t> result{};
-    if (len > 0) {  // old fish started with a #
+    if (len >= sizeof kBinaryHistoryMagic &&
+        !std::memcmp(data, kBinaryHistoryMagic, sizeof kBinaryHistoryMagic)) {
+        result = history_type_fish_3_3;
+    } else if (len > 0) {  // old fish started with a #
         if (static_cast<const char *>(data)[0] == '#') {
             result = history_type_fish_1_x;
         } else {  // assume new fish
@@ -158,10 +202,39 @@ history_item_t history_file_contents_t::decode_item(size_t offset) const {
             return decode_item_fish_2_0(base, len);
         case history_type_fish_1_x:
             return decode_item_fish_1_x(base, len);
+        case history_type_fish_3_3:
+            // An older fish may have appended text items.
+            if (len >= sizeof binary_record::magic &&
+                std::memcmp(base, binary_record::magic, sizeof binary_record::magic) != 0) {
+                return decode_item_fish_2_0(base, len);
+            }
+            return decode_item_fish_3_3(base, len);
     }
     return history_item_t{};
 }
 
+history_signature_t history_file_contents_t::signature_at(size_t offset) const {
+    if (this->type() != history_type_fish_3_3) return kUnknownHistorySignature;
+    // Offsets come from offset_of_next_item, which only returns complete records, or text items.
+    const char *record = address_at(offset);
+    if (this->length() - offset < binary_record::header_size ||
+        std::memcmp(record, binary_record::magic, sizeof binary_record::magic) != 0) {
+        return kUnknownHistorySignature;
+    }
+    return read_le(record + binary_record::signature_offset, 8);
+}
+
+bool history_file_contents_t::index_record_matches(const history_index_record_t &rec) const {
+    // Only fish 2.0 files are indexed.
+    if (this->type() != history_type_fish_2_0) return false;
+    if (rec.offset >= this->length() || this->length() - rec.offset <= rec.line_length) {
+        return false;
+    }
+    const char *line = this->address_at(rec.offset);
+    return line[rec.line_length] == '\n' &&
+           history_index_line_hash(line, rec.line_length) == rec.line_hash;
+}
+
 maybe_t<size_t> history_file_contents_t::offset_of_next_item(size_t *cursor, time_t cutoff) const {
     auto offset = size_t(-1);
     switch (this->type()) {
@@ -171,6 +244,9 @@ maybe_t<size_t> history_file_contents_t::offset_of_next_item(size_t *cursor, tim
         case history_type_fish_1_x:
             offset = offset_of_next_item_fish_1_x(this->begin(), this->length(), cursor);
             break;
+        case history_type_fish_3_3:
+            offset = offset_of_next_item_fish_3_3(*this, cursor, cutoff);
+            break;
     }
     if (offset == size_t(-1)) {
         return none();
@@ -431,8 +507,158 @@ static size_t offset_of_next_item_fish_2_0(const history_file_contents_t &conten
     return result;
 }
 
-void append_history_item_to_buffer(const history_item_t &item, std::string *buffer) {
+/// Decode an item via the fish 3.3 format. The caller has checked that the record is complete.
+static history_item_t decode_item_fish_3_3(const char *base, size_t len) {
+    using namespace binary_record;
+    assert(len >= header_size && "Truncated record");
+    size_t payload_length = read_le(base + payload_length_offset, 4);
+    size_t command_length = read_le(base + command_length_offset, 4);
+    size_t path_count = read_le(base + path_count_offset, 2);
+    auto when = static_cast<time_t>(static_cast<int64_t>(read_le(base + timestamp_offset, 8)));
+    if (len - header_size < payload_length || payload_length < command_length) {
+        return history_item_t{};
+    }
+
+    const char *cursor = base + header_size;
+    const char *const end = cursor + payload_length;
+    history_item_t result(str2wcstring(cursor, command_length), when);
+    cursor += command_length;
+
+    path_list_t paths;
+    while (path_count-- > 0 && end - cursor >= 4) {
+        size_t path_length = read_le(cursor, 4);
+        cursor += 4;
+        if (size_t(end - cursor) < path_length) break;
+        paths.push_back(str2wcstring(cursor, path_length));
+        cursor += path_length;
+    }
+    result.set_required_paths(std::move(paths));
+    return result;
+}
+
+/// Same as offset_of_next_item_fish_2_0, but for fish 3.3. Records are skipped using their length,
+/// so nothing is decoded. An older fish may have appended fish 2.0 items as text, which are found
+/// line by line, up to the next record.
+static size_t offset_of_next_item_fish_3_3(const history_file_contents_t &contents,
+                                           size_t *inout_cursor, time_t cutoff_timestamp) {
+    using namespace binary_record;
+    size_t cursor = std::max(*inout_cursor, sizeof kBinaryHistoryMagic);
+    auto result = size_t(-1);
+    const size_t length = contents.length();
+    const char *const begin = contents.begin();
+    const char *const end = contents.end();
+    while (cursor < length) {
+        const char *record = contents.address_at(cursor);
+        if (length - cursor < sizeof magic ||
+            std::memcmp(record + magic_offset, magic, sizeof magic) != 0) {
+            // Not a record, so this is the start of a line of text.
+            const char *limit = std::search(record, end, magic, magic + sizeof magic);
+            auto line_end = static_cast<const char *>(std::memchr(record, '\n', limit - record));
+            if (line_end == nullptr) {
+                // Stop at an incomplete line; it may still be being written.
+                if (limit == end) break;
+                cursor = limit - begin;
+                continue;
+            }
+            constexpr const char cmd_prefix[] = "- cmd: ";
+            constexpr const size_t cmd_prefix_len = const_strlen(cmd_prefix);
+            bool is_item = static_cast<size_t>(line_end - record) >= cmd_prefix_len &&
+                           !std::memcmp(record, cmd_prefix, cmd_prefix_len);
+
+            // Step over the line, and if it starts an item, over the item's indented lines.
+            bool has_timestamp = false;
+            time_t timestamp = 0;
+            const char *next = line_end + 1;
+            while (is_item && next < limit && next[0] == ' ') {
+                auto next_end = static_cast<const char *>(std::memchr(next, '\n', limit - next));
+                if (next_end == nullptr) break;
+                if (!has_timestamp) has_timestamp = parse_timestamp(next, &timestamp);
+                next = next_end + 1;
+            }
+            cursor = next - begin;
+            if (!is_item || (cutoff_timestamp != 0 && has_timestamp &&
+                             timestamp > cutoff_timestamp)) {
+                continue;
+            }
+            result = record - begin;
+            break;
+        }
+
+        // Stop at a truncated record; it may still be being written.
+        if (length - cursor < header_size) break;
+        size_t payload_length = read_le(record + payload_length_offset, 4);
+        if (length - cursor - header_size < payload_length) break;
+        cursor += header_size + payload_length;
+
+        // Skip items created after our cutoff, like offset_of_next_item_fish_2_0.
+        auto timestamp = static_cast<time_t>(
+            static_cast<int64_t>(read_le(record + timestamp_offset, 8)));
+        if (cutoff_timestamp != 0 && timestamp > cutoff_timestamp) continue;
+
+        result = record - begin;
+        break;
+    }
+    *inout_cursor = cursor;
+    return result;
+}
+
+void append_history_file_header(history_file_type_t type, std::string *buffer) {
+    // Only the binary format has a header.
+    if (type == history_type_fish_3_3) {
+        buffer->append(kBinaryHistoryMagic, sizeof kBinaryHistoryMagic);
+    }
+}
+
+maybe_t<history_file_type_t> history_file_type_for_fd(int fd) {
+    char buf[sizeof kBinaryHistoryMagic];
+    ssize_t amt;
+    do {
+        amt = pread(fd, buf, sizeof buf, 0);
+    } while (amt < 0 && errno == EINTR);
+    if (amt <= 0) return none();
+    return infer_file_type(buf, size_t(amt));
+}
+
+/// Append an item in the fish 3.3 format.
+static void append_history_item_to_buffer_fish_3_3(const history_item_t &item,
+                                                   std::string *buffer) {
+    using namespace binary_record;
+    std::string cmd = wcs2string(item.str());
+    std::vector<std::string> paths;
+    size_t payload_length = cmd.size();
+    for (const wcstring &wpath : item.get_required_paths()) {
+        paths.push_back(wcs2string(wpath));
+        payload_length += 4 + paths.back().size();
+    }
+    // Limits which no reasonable command approaches; drop extra paths rather than fail.
+    while (payload_length > UINT32_MAX || paths.size() > UINT16_MAX) {
+        payload_length -= 4 + paths.back().size();
+        paths.pop_back();
+    }
+    if (payload_length > UINT32_MAX) return;
+
+    buffer->append(magic, sizeof magic);
+    append_le(buffer, payload_length, 4);
+    append_le(buffer, static_cast<uint64_t>(static_cast<int64_t>(item.timestamp())), 8);
+    append_le(buffer, history_signature_for(item.str()), 8);
+    append_le(buffer, cmd.size(), 4);
+    append_le(buffer, paths.size(), 2);
+    append_le(buffer, 0, 2);
+    buffer->append(cmd);
+    for (const std::string &path : paths) {
+        append_le(buffer, path.size(), 4);
+        buffer->append(path);
+    }
+}
+
+void append_history_item_to_buffer(const history_item_t &item, std::string *buffer,
+                                   history_file_type_t type) {
     assert(item.should_write_to_disk() && "Item should not be persisted");
+    if (type == history_type_fish_3_3) {
+        append_history_item_to_buffer_fish_3_3(item, buffer);
+        return;
+    }
+    assert(type == history_type_fish_2_0 && "Cannot write fish 1.x history");
     auto append = [=](const char *a, const char *b = nullptr, const char *c = nullptr) {
         if (a) buffer->append(a);
         if (b) buffer->append(b);
@@ -569,3 +795,116 @@ static size_t offset_of_next_item_fish_1_x(const char *begin, size_t mmap_length
     *inout_cursor = (pos - begin);
     return result;
 }
+
+history_signature_t history_signature_for(const wcstring &str) {
+    history_signature_t result = 0;
+    if (str.size() < 3) return result;
+    // Lowercase as we go, so the same signature serves case-sensitive and insensitive searches.
+    // The hash is FNV-1a over the three characters of each trigram.
+    wchar_t a = 0, b = static_cast<wchar_t>(towlower(str[0])),
+            c = static_cast<wchar_t>(towlower(str[1]));
+    for (size_t i = 2; i < str.size(); i++) {
+        a = b;
+        b = c;
+        c = static_cast<wchar_t>(towlower(str[i]));
+        uint32_t hash = 2166136261u;
+        for (wchar_t wc : {a, b, c}) {
+            hash = (hash ^ static_cast<uint32_t>(wc)) * 16777619u;
+        }
+        result |= history_signature_t(1) << ((hash ^ (hash >> 16)) % 64);
+    }
+    return result;
+}
+
+uint32_t history_index_line_hash(const char *line, size_t len) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ static_cast<unsigned char>(line[i])) * 16777619u;
+    }
+    return hash;
+}
+
+history_index_record_t history_index_record_t::create(const wcstring &cmd, uint64_t offset,
+                                                      const char *line, size_t len) {
+    history_index_record_t rec{};
+    rec.offset = offset;
+    rec.signature = history_signature_for(cmd);
+    rec.line_length = static_cast<uint32_t>(len);
+    rec.line_hash = history_index_line_hash(line, len);
+    return rec;
+}
+
+// The index starts with this magic, which also guards against reading an index written by a
+// machine with a different byte order. It is followed by packed history_index_record_t.
+static constexpr char kHistoryIndexMagic[8] = {'f', 'i', 's', 'h', 'i', 'd', 'x', '1'};
+static constexpr size_t kHistoryIndexRecordSize = sizeof(history_index_record_t);
+static_assert(kHistoryIndexRecordSize == 24, "history_index_record_t should be packed");
+
+std::vector<history_index_record_t> read_history_index(int fd) {
+    std::vector<history_index_record_t> result;
+    struct stat buf {};
+    if (fstat(fd, &buf) < 0 || buf.st_size < off_t(sizeof kHistoryIndexMagic)) return result;
+    char magic[sizeof kHistoryIndexMagic];
+    if (pread(fd, magic, sizeof magic, 0) != ssize_t(sizeof magic) ||
+        std::memcmp(magic, kHistoryIndexMagic, sizeof magic) != 0) {
+        return result;
+    }
+
+    // Ignore any trailing partial record.
+    size_t count = (size_t(buf.st_size) - sizeof magic) / kHistoryIndexRecordSize;
+    result.resize(count);
+    size_t want = count * kHistoryIndexRecordSize;
+    auto ptr = reinterpret_cast<char *>(result.data());
+    size_t amt = 0;
+    while (amt < want) {
+        ssize_t got = pread(fd, ptr + amt, want - amt, off_t(sizeof magic + amt));
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) break;
+        amt += size_t(got);
+    }
+    result.resize(amt / kHistoryIndexRecordSize);
+    return result;
+}
+
+int append_history_index(int fd, const std::vector<history_index_record_t> &records) {
+    if (records.empty()) return 0;
+
+    // Check that the existing index is well-formed and precedes our records; if not, the history
+    // file has been replaced behind our back, so start over.
+    struct stat buf {};
+    if (fstat(fd, &buf) < 0) return errno;
+    bool valid = false;
+    off_t end = buf.st_size;
+    if (end >= off_t(sizeof kHistoryIndexMagic)) {
+        char magic[sizeof kHistoryIndexMagic];
+        valid = pread(fd, magic, sizeof magic, 0) == ssize_t(sizeof magic) &&
+                std::memcmp(magic, kHistoryIndexMagic, sizeof magic) == 0;
+        // Drop any trailing partial record.
+        end -= (end - off_t(sizeof magic)) % off_t(kHistoryIndexRecordSize);
+        if (valid && end > off_t(sizeof magic)) {
+            history_index_record_t last{};
+            valid = pread(fd, &last, sizeof last, end - off_t(sizeof last)) ==
+                        ssize_t(sizeof last) &&
+                    last.offset < records.front().offset;
+        }
+    }
+    if (!valid) return write_history_index(fd, records);
+
+    if (end != buf.st_size && ftruncate(fd, end) < 0) return errno;
+    if (lseek(fd, end, SEEK_SET) < 0) return errno;
+    if (write_loop(fd, reinterpret_cast<const char *>(records.data()),
+                   records.size() * kHistoryIndexRecordSize) < 0) {
+        return errno;
+    }
+    return 0;
+}
+
+int write_history_index(int fd, const std::vector<history_index_record_t> &records) {
+    if (ftruncate(fd, 0) < 0 || lseek(fd, 0, SEEK_SET) < 0) return errno;
+    if (write_loop(fd, kHistoryIndexMagic, sizeof kHistoryIndexMagic) < 0 ||
+        write_loop(fd, reinterpret_cast<const char *>(records.data()),
+                   records.size() * kHistoryIndexRecordSize) < 0) {
+        return errno;
+    }
+    return 0;
+}
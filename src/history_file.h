@@ -6,15 +6,30 @@
 #include <sys/mman.h>
 
 #include <cassert>
+#include <cstdint>
 #include <ctime>
 #include <memory>
+#include <vector>
 
+#include "common.h"
 #include "maybe.h"
 
 class history_item_t;
+struct history_index_record_t;
 
 // History file types.
-enum history_file_type_t { history_type_fish_2_0, history_type_fish_1_x };
+// fish 3.3 files start with a magic header, followed by length-prefixed binary records. Each record
+// has a fixed size header holding the timestamp, signature, command length and path count, so items
+// can be skipped and filtered without decoding them.
+enum history_file_type_t { history_type_fish_2_0, history_type_fish_1_x, history_type_fish_3_3 };
+
+/// A history signature is a 64 bit bloom filter of the trigrams of a lowercased string. A history
+/// item can only contain a search term (or start with it) if the item's signature has every bit of
+/// the term's signature set. This lets searches skip most items without decoding them.
+using history_signature_t = uint64_t;
+
+/// The signature of an item whose signature is not (yet) known. It covers every term.
+constexpr history_signature_t kUnknownHistorySignature = ~history_signature_t(0);
 
 /// history_file_contents_t holds the read-only contents of a file.
 class history_file_contents_t {
@@ -31,6 +46,14 @@ class history_file_contents_t {
     /// \return the offset of the next item, or none() on end.
     maybe_t<size_t> offset_of_next_item(size_t *cursor, time_t cutoff) const;
 
+    /// \return the signature stored with the item at a given offset, or kUnknownHistorySignature if
+    /// this file type does not store signatures.
+    history_signature_t signature_at(size_t offset) const;
+
+    /// \return whether the index record \p rec describes the item at its offset. This compares the
+    /// length and hash of the item's first line, so stale records are detected.
+    bool index_record_matches(const history_index_record_t &rec) const;
+
     /// Get the file type.
     history_file_type_t type() const { return type_; }
 
@@ -68,7 +91,61 @@ class history_file_contents_t {
     void operator=(history_file_contents_t &&) = delete;
 };
 
-/// Append a history item to a buffer, in preparation for outputting it to the history file.
-void append_history_item_to_buffer(const history_item_t &item, std::string *buffer);
+/// Append a history item to a buffer, in preparation for outputting it to a history file of type
+/// \p type, which must be history_type_fish_2_0 or history_type_fish_3_3.
+void append_history_item_to_buffer(const history_item_t &item, std::string *buffer,
+                                   history_file_type_t type);
+
+/// Append the header that starts a new history file of type \p type to a buffer.
+void append_history_file_header(history_file_type_t type, std::string *buffer);
+
+/// Infer the type of the history file open on \p fd from its first bytes. This does not move the
+/// file offset. \return none() if the file is empty or cannot be read.
+maybe_t<history_file_type_t> history_file_type_for_fd(int fd);
+
+/// \return the signature of a string. Terms shorter than three characters have signature 0.
+history_signature_t history_signature_for(const wcstring &str);
+
+/// \return whether an item with signature \p item_sig may match a term with signature \p term_sig.
+inline bool history_signature_covers(history_signature_t item_sig, history_signature_t term_sig) {
+    return (item_sig & term_sig) == term_sig;
+}
+
+/// The history index is a sidecar file next to the history file, which stores the signatures of
+/// items keyed by their offset in the history file. It is appended to whenever the history file is
+/// appended to, and rewritten when the history file is vacuumed. Since other versions of fish may
+/// append to the history file without updating the index, each record remembers the length and
+/// hash of the first line of its item, and records which do not match the history file are
+/// ignored.
+struct history_index_record_t {
+    // Offset of the item in the history file.
+    uint64_t offset;
+    // Signature of the item's command.
+    history_signature_t signature;
+    // Length and hash of the item's first line in the history file, not including the newline.
+    uint32_t line_length;
+    uint32_t line_hash;
+
+    /// Construct a record for the item \p cmd, written at \p offset, whose first line is
+    /// [line, line + len).
+    static history_index_record_t create(const wcstring &cmd, uint64_t offset, const char *line,
+                                         size_t len);
+};
+
+/// \return the hash of a line in the history file, as stored in history_index_record_t.
+uint32_t history_index_line_hash(const char *line, size_t len);
+
+/// Read the history index from \p fd. Records are in the order they were written, which is
+/// increasing offset order. A missing or malformed index produces an empty list.
+std::vector<history_index_record_t> read_history_index(int fd);
+
+/// Append \p records to the history index in \p fd, which must be opened for reading and writing.
+/// If the index is malformed, or does not end before the first new record, it is discarded first.
+/// \return 0 on success, or an errno value on failure.
+int append_history_index(int fd, const std::vector<history_index_record_t> &records);
+
+/// Replace the contents of the history index in \p fd with \p records.
+/// \return 0 on success, or an errno value on failure.
+int write_history_index(int fd, const std::vector<history_index_record_t> &records);
 
 #endif
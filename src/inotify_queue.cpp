@@ -0,0 +1,94 @@
+// A single inotify instance, shared by everything in fish which watches the filesystem.
+#include "config.h"  // IWYU pragma: keep
+
+#include "inotify_queue.h"
+
+#include <errno.h>
+#include <unistd.h>
+#ifdef HAVE_INOTIFY_INIT1
+#include <sys/inotify.h>
+#endif
+
+#include <cstring>
+
+owning_lock<inotify_queue_t> &inotify_queue_t::shared() {
+    // Leaked, as its users may be static too.
+    static auto *s_queue = new owning_lock<inotify_queue_t>();
+    return *s_queue;
+}
+
+int inotify_queue_t::add_watch(const std::string &path, uint32_t mask) {
+#ifdef HAVE_INOTIFY_INIT1
+    if (!initialized_) {
+        initialized_ = true;
+        fd_.reset(inotify_init1(IN_NONBLOCK | IN_CLOEXEC));
+        if (!fd_.valid()) init_errno_ = errno;
+    }
+    if (!fd_.valid()) {
+        errno = init_errno_;
+        return -1;
+    }
+    // Another owner may already watch this path, so add to its mask rather than replacing it.
+    int wd = inotify_add_watch(fd_.fd(), path.c_str(), mask | IN_MASK_ADD);
+    if (wd < 0) return -1;
+    int watch = ++last_watch_;
+    watches_[watch] = watch_t{wd, mask, {}};
+    return watch;
+#else
+    UNUSED(path);
+    UNUSED(mask);
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+void inotify_queue_t::remove_watch(int watch) {
+#ifdef HAVE_INOTIFY_INIT1
+    auto iter = watches_.find(watch);
+    if (iter == watches_.end()) return;
+    int wd = iter->second.wd;
+    watches_.erase(iter);
+    for (const auto &kv : watches_) {
+        if (kv.second.wd == wd) return;
+    }
+    inotify_rm_watch(fd_.fd(), wd);
+#else
+    UNUSED(watch);
+#endif
+}
+
+void inotify_queue_t::read_events() {
+    ASSERT_IS_MAIN_THREAD();
+#ifdef HAVE_INOTIFY_INIT1
+    if (!fd_.valid()) return;
+    alignas(struct inotify_event) char buff[4096];
+    ssize_t amt;
+    while ((amt = read(fd_.fd(), buff, sizeof buff)) > 0) {
+        for (ssize_t cursor = 0; cursor < amt;) {
+            const auto *event = reinterpret_cast<const struct inotify_event *>(buff + cursor);
+            cursor += sizeof(struct inotify_event) + event->len;
+            for (auto &kv : watches_) {
+                watch_t &watch = kv.second;
+                bool overflow = event->mask & IN_Q_OVERFLOW;
+                if (overflow || (watch.wd == event->wd && (event->mask & watch.mask))) {
+                    // The name is padded with nuls.
+                    watch.events.push_back(
+                        event_t{event->mask, event->len > 0 ? std::string(event->name) : ""});
+                }
+            }
+        }
+    }
+#endif
+}
+
+bool inotify_queue_t::has_events(int watch) const {
+    auto iter = watches_.find(watch);
+    return iter != watches_.end() && !iter->second.events.empty();
+}
+
+std::vector<inotify_queue_t::event_t> inotify_queue_t::take_events(int watch) {
+    std::vector<event_t> result;
+    auto iter = watches_.find(watch);
+    if (iter != watches_.end()) std::swap(result, iter->second.events);
+    return result;
+}
@@ -0,0 +1,74 @@
+// A single inotify instance, shared by everything in fish which watches the filesystem.
+#ifndef FISH_INOTIFY_QUEUE_H
+#define FISH_INOTIFY_QUEUE_H
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "common.h"
+#include "fds.h"
+
+/// fish's inotify instance, used by the cache of $PATH directory listings and by the universal
+/// variable notifier. Each instance counts against a small per-user limit
+/// (fs.inotify.max_user_instances, 128 by default), so a shell uses only one.
+///
+/// Events are read from the fd only on the main thread, and queued for each watch they concern,
+/// until its owner takes them. Watches of the same path by different owners share the kernel's
+/// watch descriptor, but each sees only the events in its own mask. Where inotify is not available,
+/// no watch can be added.
+class inotify_queue_t {
+   public:
+    struct event_t {
+        /// The event's inotify mask, e.g. IN_CREATE. IN_Q_OVERFLOW is queued for every watch, as
+        /// any of them may have lost events.
+        uint32_t mask;
+
+        /// The name of the directory entry which the event concerns, if any.
+        std::string name;
+    };
+
+    /// \return the shared instance.
+    static owning_lock<inotify_queue_t> &shared();
+
+    /// \return the inotify fd, which becomes readable when there are events to read; or -1 if
+    /// there is none.
+    int fd() const { return fd_.fd(); }
+
+    /// Watch \p path for the events in \p mask. \return the watch, or -1 on failure with errno set.
+    int add_watch(const std::string &path, uint32_t mask);
+
+    /// Stop watching with \p watch, which was returned by add_watch(), dropping its queued events.
+    void remove_watch(int watch);
+
+    /// Read all pending events from the fd and queue them. This may only be called on the main
+    /// thread, which is what waits for the fd to become readable.
+    void read_events();
+
+    /// \return whether any events are queued for \p watch.
+    bool has_events(int watch) const;
+
+    /// Remove and return the events queued for \p watch.
+    std::vector<event_t> take_events(int watch);
+
+   private:
+    struct watch_t {
+        // The kernel's watch descriptor.
+        int wd;
+        uint32_t mask;
+        std::vector<event_t> events;
+    };
+
+    // Our watches, by the ids we hand out.
+    std::unordered_map<int, watch_t> watches_;
+    int last_watch_{0};
+
+    autoclose_fd_t fd_{-1};
+    bool initialized_{false};
+
+    // Why creating the fd failed.
+    int init_errno_{0};
+};
+
+#endif
@@ -17,6 +17,7 @@
 #include <atomic>
 #include <memory>
 #include <string>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
@@ -179,6 +180,81 @@ wcstring describe_char(wint_t c) {
 }
 
 using mapping_list_t = std::vector<input_mapping_t>;
+
+/// The mappings of one bind mode, as a prefix tree of their sequences.
+struct input_mapping_trie_t {
+    static constexpr size_t none = static_cast<size_t>(-1);
+
+    struct node_t {
+        /// The children of this node, by character, sorted.
+        std::vector<std::pair<wchar_t, size_t>> children;
+        /// The mapping whose sequence ends at this node, or none.
+        size_t mapping{none};
+        /// The mapping which takes precedence over all others below this node, or none.
+        size_t best_below{none};
+    };
+
+    /// The nodes. The root is the first.
+    std::vector<node_t> nodes = std::vector<node_t>(1);
+
+    /// The generic mapping, or none.
+    size_t generic{none};
+
+    /// \return the child of \p node for \p c, or none.
+    size_t child(size_t node, wchar_t c) const {
+        const auto &children = nodes[node].children;
+        auto where =
+            std::lower_bound(children.begin(), children.end(), std::make_pair(c, size_t{0}));
+        return where != children.end() && where->first == c ? where->second : none;
+    }
+};
+
+/// All mappings, compiled for lookup.
+struct input_mapping_index_t {
+    /// The mappings: the user's first, then the preset ones, each with longer sequences first.
+    /// Mappings which come first take precedence, and are referred to by their index here.
+    mapping_list_t mappings;
+
+    /// The mappings of each bind mode.
+    std::unordered_map<wcstring, input_mapping_trie_t> tries;
+
+    explicit input_mapping_index_t(mapping_list_t list) : mappings(std::move(list)) {
+        using trie_t = input_mapping_trie_t;
+        for (size_t idx = 0; idx < mappings.size(); idx++) {
+            const input_mapping_t &m = mappings[idx];
+            trie_t &trie = tries[m.mode];
+            if (m.is_generic()) {
+                if (trie.generic == trie_t::none) trie.generic = idx;
+                continue;
+            }
+            size_t node = 0;
+            for (wchar_t c : m.seq) {
+                size_t next = trie.child(node, c);
+                if (next == trie_t::none) {
+                    next = trie.nodes.size();
+                    auto &children = trie.nodes[node].children;
+                    auto pos = std::make_pair(c, next);
+                    children.insert(std::lower_bound(children.begin(), children.end(), pos), pos);
+                    trie.nodes.emplace_back();
+                }
+                node = next;
+            }
+            if (trie.nodes[node].mapping == trie_t::none) trie.nodes[node].mapping = idx;
+        }
+        // Children come after their parents.
+        for (auto &kv : tries) {
+            auto &nodes = kv.second.nodes;
+            for (size_t node = nodes.size(); node-- > 0;) {
+                for (const auto &child : nodes[node].children) {
+                    const auto &cn = nodes[child.second];
+                    nodes[node].best_below =
+                        std::min({nodes[node].best_below, cn.mapping, cn.best_below});
+                }
+            }
+        }
+    }
+};
+
 input_mapping_set_t::input_mapping_set_t() = default;
 input_mapping_set_t::~input_mapping_set_t() = default;
 
@@ -246,7 +322,7 @@ void input_mapping_set_t::add(wcstring sequence, const wchar_t *const *commands,
     assert(commands && mode && sets_mode && "Null parameter");
 
     // Clear cached mappings.
-    all_mappings_cache_.reset();
+    index_cache_.reset();
 
     // Remove existing mappings with this sequence.
     const wcstring_list_t commands_vector(commands, commands + commands_len);
@@ -428,32 +504,6 @@ void inputter_t::mapping_execute(const input_mapping_t &m,
     if (!m.sets_mode.empty()) input_set_bind_mode(*parser_, m.sets_mode);
 }
 
-/// Try reading the specified function mapping.
-bool inputter_t::mapping_is_match(const input_mapping_t &m) {
-    const wcstring &str = m.seq;
-
-    assert(!str.empty() && "zero-length input string passed to mapping_is_match!");
-
-    bool timed = false;
-    for (size_t i = 0; i < str.size(); ++i) {
-        auto evt = timed ? event_queue_.readch_timed() : event_queue_.readch();
-        if (!evt.is_char() || evt.get_char() != str[i]) {
-            // We didn't match the bind sequence/input mapping, (it timed out or they entered
-            // something else). Undo consumption of the read characters since we didn't match the
-            // bind sequence and abort.
-            event_queue_.push_front(evt);
-            event_queue_.insert_front(str.begin(), str.begin() + i);
-            return false;
-        }
-
-        // If we just read an escape, we need to add a timeout for the next char,
-        // to distinguish between the actual escape key and an "alt"-modifier.
-        timed = (str[i] == L'\x1B');
-    }
-
-    return true;
-}
-
 void inputter_t::queue_ch(const char_event_t &ch) {
     if (ch.is_readline()) {
         function_push_args(ch.get_readline());
@@ -466,23 +516,44 @@ void inputter_t::push_front(const char_event_t &ch) { event_queue_.push_front(ch
 /// \return the first mapping that matches, walking first over the user's mapping list, then the
 /// preset list. \return null if nothing matches.
 maybe_t<input_mapping_t> inputter_t::find_mapping() {
-    const input_mapping_t *generic = nullptr;
+    using trie_t = input_mapping_trie_t;
     const auto &vars = parser_->vars();
     const wcstring bind_mode = input_get_bind_mode(vars);
 
-    auto ml = input_mappings()->all_mappings();
-    for (const auto &m : *ml) {
-        if (m.mode != bind_mode) {
-            continue;
-        }
+    auto index = input_mappings()->index();
+    auto trie_iter = index->tries.find(bind_mode);
+    if (trie_iter == index->tries.end()) return none();
+    const trie_t &trie = trie_iter->second;
 
-        if (m.is_generic()) {
-            if (!generic) generic = &m;
-        } else if (mapping_is_match(m)) {
-            return m;
+    // Walk down the trie, reading characters only while they might lead to a mapping which takes
+    // precedence over the best match so far.
+    size_t best = trie_t::none;
+    size_t best_len = 0;
+    wcstring seq;
+    for (size_t node = 0; trie.nodes[node].best_below < best;) {
+        // If we just read an escape, we need to add a timeout for the next char,
+        // to distinguish between the actual escape key and an "alt"-modifier.
+        bool timed = !seq.empty() && seq.back() == L'\x1B';
+        auto evt = timed ? event_queue_.readch_timed() : event_queue_.readch();
+        size_t next = evt.is_char() ? trie.child(node, evt.get_char()) : trie_t::none;
+        if (next == trie_t::none) {
+            // We didn't match any further (it timed out or they entered something else).
+            event_queue_.push_front(evt);
+            break;
+        }
+        seq.push_back(evt.get_char());
+        node = next;
+        if (trie.nodes[node].mapping < best) {
+            best = trie.nodes[node].mapping;
+            best_len = seq.size();
         }
     }
-    return generic ? maybe_t<input_mapping_t>(*generic) : none();
+
+    // Undo consumption of the characters which are not part of the match.
+    event_queue_.insert_front(seq.begin() + best_len, seq.end());
+    if (best != trie_t::none) return index->mappings[best];
+    if (trie.generic != trie_t::none) return index->mappings[trie.generic];
+    return none();
 }
 
 template <size_t N = 16>
@@ -713,7 +784,7 @@ std::vector<input_mapping_name_t> input_mapping_set_t::get_names(bool user) cons
 }
 
 void input_mapping_set_t::clear(const wchar_t *mode, bool user) {
-    all_mappings_cache_.reset();
+    index_cache_.reset();
     mapping_list_t &ml = user ? mapping_list_ : preset_mapping_list_;
     auto should_erase = [=](const input_mapping_t &m) { return mode == nullptr || mode == m.mode; };
     ml.erase(std::remove_if(ml.begin(), ml.end(), should_erase), ml.end());
@@ -721,7 +792,7 @@ void input_mapping_set_t::clear(const wchar_t *mode, bool user) {
 
 bool input_mapping_set_t::erase(const wcstring &sequence, const wcstring &mode, bool user) {
     // Clear cached mappings.
-    all_mappings_cache_.reset();
+    index_cache_.reset();
 
     bool result = false;
     mapping_list_t &ml = user ? mapping_list_ : preset_mapping_list_;
@@ -750,15 +821,15 @@ bool input_mapping_set_t::get(const wcstring &sequence, const wcstring &mode,
     return result;
 }
 
-std::shared_ptr<const mapping_list_t> input_mapping_set_t::all_mappings() {
+std::shared_ptr<const input_mapping_index_t> input_mapping_set_t::index() {
     // Populate the cache if needed.
-    if (!all_mappings_cache_) {
+    if (!index_cache_) {
         mapping_list_t all_mappings = mapping_list_;
         all_mappings.insert(all_mappings.end(), preset_mapping_list_.begin(),
                             preset_mapping_list_.end());
-        all_mappings_cache_ = std::make_shared<const mapping_list_t>(std::move(all_mappings));
+        index_cache_ = std::make_shared<const input_mapping_index_t>(std::move(all_mappings));
     }
-    return all_mappings_cache_;
+    return index_cache_;
 }
 
 /// Create a list of terminfo mappings.
@@ -22,6 +22,7 @@ wcstring describe_char(wint_t c);
 void init_input();
 
 struct input_mapping_t;
+struct input_mapping_index_t;
 class inputter_t {
    public:
     /// Construct from a parser, and the fd from which to read.
@@ -67,7 +68,6 @@ class inputter_t {
     void function_push_args(readline_cmd_t code);
     void mapping_execute(const input_mapping_t &m, const command_handler_t &command_handler);
     void mapping_execute_matching_or_generic(const command_handler_t &command_handler);
-    bool mapping_is_match(const input_mapping_t &m);
     bool have_mouse_tracking_csi();
     maybe_t<input_mapping_t> find_mapping();
     char_event_t read_characters_no_readline();
@@ -87,7 +87,7 @@ class input_mapping_set_t {
 
     mapping_list_t mapping_list_;
     mapping_list_t preset_mapping_list_;
-    std::shared_ptr<const mapping_list_t> all_mappings_cache_;
+    std::shared_ptr<const input_mapping_index_t> index_cache_;
 
     input_mapping_set_t();
 
@@ -120,8 +120,8 @@ class input_mapping_set_t {
              const wchar_t *mode = DEFAULT_BIND_MODE, const wchar_t *sets_mode = DEFAULT_BIND_MODE,
              bool user = true);
 
-    /// \return a snapshot of the list of input mappings.
-    std::shared_ptr<const mapping_list_t> all_mappings();
+    /// \return a snapshot of the input mappings, compiled for lookup.
+    std::shared_ptr<const input_mapping_index_t> index();
 };
 
 /// Access the singleton input mapping set.
@@ -4,36 +4,86 @@
 #include "intern.h"
 
 #include <stddef.h>
+#include <stdint.h>
 
-#include <algorithm>
+#include <cstring>
 #include <cwchar>
 #include <memory>
+#include <unordered_set>
 #include <vector>
 
 #include "common.h"
 #include "fallback.h"  // IWYU pragma: keep
 
-static bool string_less_than_string(const wchar_t *a, const wchar_t *b) {
-    return std::wcscmp(a, b) < 0;
-}
+namespace {
+/// Hash a nul-terminated string, using FNV-1a.
+struct string_hash_t {
+    size_t operator()(const wchar_t *str) const {
+        uint64_t hash = 14695981039346656037ULL;
+        for (; *str; str++) {
+            hash ^= static_cast<uint64_t>(*str);
+            hash *= 1099511628211ULL;
+        }
+        return static_cast<size_t>(hash);
+    }
+};
 
-/// The table of intern'd strings.
-owning_lock<std::vector<const wchar_t *>> string_table;
+struct string_equal_t {
+    bool operator()(const wchar_t *a, const wchar_t *b) const { return std::wcscmp(a, b) == 0; }
+};
 
-static const wchar_t *intern_with_dup(const wchar_t *in, bool dup) {
-    if (!in) return nullptr;
+/// The table of intern'd strings. Copied strings are stored in large blocks, which are never freed,
+/// as interned strings live as long as the process.
+class string_table_t {
+    std::unordered_set<const wchar_t *, string_hash_t, string_equal_t> strings_;
+
+    // Blocks of storage for copied strings.
+    std::vector<std::unique_ptr<wchar_t[]>> blocks_;
+
+    // The free space in the block we are filling.
+    wchar_t *cursor_{nullptr};
+    size_t remaining_{0};
 
-    auto table = string_table.acquire();
+    // The size of each block, in characters. Strings longer than a quarter of this get a block of
+    // their own, so they do not waste the rest of a block.
+    static constexpr size_t kBlockSize = 16 * 1024;
 
-    const wchar_t *result;
-    auto iter = std::lower_bound(table->begin(), table->end(), in, string_less_than_string);
-    if (iter != table->end() && std::wcscmp(*iter, in) == 0) {
-        result = *iter;
-    } else {
-        result = dup ? wcsdup(in) : in;
-        table->insert(iter, result);
+    const wchar_t *copy(const wchar_t *in) {
+        size_t size = std::wcslen(in) + 1;
+        wchar_t *result;
+        if (size > kBlockSize / 4) {
+            blocks_.emplace_back(new wchar_t[size]);
+            result = blocks_.back().get();
+        } else {
+            if (size > remaining_) {
+                blocks_.emplace_back(new wchar_t[kBlockSize]);
+                cursor_ = blocks_.back().get();
+                remaining_ = kBlockSize;
+            }
+            result = cursor_;
+            cursor_ += size;
+            remaining_ -= size;
+        }
+        std::memcpy(result, in, size * sizeof *in);
+        return result;
     }
-    return result;
+
+   public:
+    const wchar_t *intern(const wchar_t *in, bool dup) {
+        auto iter = strings_.find(in);
+        if (iter != strings_.end()) return *iter;
+        const wchar_t *result = dup ? copy(in) : in;
+        strings_.insert(result);
+        return result;
+    }
+};
+}  // namespace
+
+static owning_lock<string_table_t> string_table;
+
+static const wchar_t *intern_with_dup(const wchar_t *in, bool dup) {
+    if (!in) return nullptr;
+    return string_table.acquire()->intern(in, dup);
 }
 
 const wchar_t *intern(const wchar_t *in) { return intern_with_dup(in, true); }
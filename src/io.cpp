@@ -40,7 +40,10 @@ io_pipe_t::~io_pipe_t() = default;
 io_fd_t::~io_fd_t() = default;
 io_close_t::~io_close_t() = default;
 io_file_t::~io_file_t() = default;
-io_bufferfill_t::~io_bufferfill_t() = default;
+io_bufferfill_t::~io_bufferfill_t() {
+    // Widow the pipe, so the fillthread sees the end of the output once other writers are done.
+    buffer_->write_fd_.close();
+}
 
 void io_close_t::print() const { std::fwprintf(stderr, L"close %d\n", fd); }
 
@@ -54,7 +57,7 @@ void io_pipe_t::print() const {
 }
 
 void io_bufferfill_t::print() const {
-    std::fwprintf(stderr, L"bufferfill %d -> %d\n", write_fd_.fd(), fd);
+    std::fwprintf(stderr, L"bufferfill %d -> %d\n", write_fd(), fd);
 }
 
 ssize_t io_buffer_t::read_once(int fd, acquired_lock<separated_buffer_t> &buffer) {
@@ -136,17 +139,18 @@ void io_buffer_t::begin_filling(autoclose_fd_t fd) {
 }
 
 separated_buffer_t io_buffer_t::complete_background_fillthread_and_take_buffer() {
-    // Mark that our fillthread is done, then wake it up.
     ASSERT_IS_MAIN_THREAD();
-    assert(fillthread_running() && "Should have a fillthread");
-    assert(this->item_id_ > 0 && "Should have a valid item ID");
-    shutdown_fillthread_ = true;
-    fd_monitor().poke_item(this->item_id_);
-
-    // Wait for the fillthread to fulfill its promise, and then clear the future so we know we no
-    // longer have one.
-    fill_waiter_->get_future().wait();
-    fill_waiter_.reset();
+    if (fillthread_running()) {
+        // Mark that our fillthread is done, then wake it up.
+        assert(this->item_id_ > 0 && "Should have a valid item ID");
+        shutdown_fillthread_ = true;
+        fd_monitor().poke_item(this->item_id_);
+
+        // Wait for the fillthread to fulfill its promise, and then clear the future so we know we
+        // no longer have one.
+        fill_waiter_->get_future().wait();
+        fill_waiter_.reset();
+    }
 
     // Return our buffer, transferring ownership.
     auto locked_buff = buffer_.acquire();
@@ -157,24 +161,37 @@ separated_buffer_t io_buffer_t::complete_background_fillthread_and_take_buffer()
 
 shared_ptr<io_bufferfill_t> io_bufferfill_t::create(size_t buffer_limit, int target) {
     assert(target >= 0 && "Invalid target fd");
+    auto buffer = std::make_shared<io_buffer_t>(buffer_limit);
+    return std::make_shared<io_bufferfill_t>(target, std::move(buffer));
+}
+
+int io_bufferfill_t::write_fd() const { return buffer_->write_fd_.fd(); }
+
+bool io_buffer_t::ensure_pipe() {
+    ASSERT_IS_MAIN_THREAD();
+    if (write_fd_.valid()) return true;
 
     // Construct our pipes.
     auto pipes = make_autoclose_pipes();
     if (!pipes) {
-        return nullptr;
+        FLOGF(warning, PIPE_ERROR);
+        wperror(L"pipe");
+        pipe_failed_ = true;
+        return false;
     }
-    // Our buffer will read from the read end of the pipe. This end must be non-blocking. This is
-    // because our fillthread needs to poll to decide if it should shut down, and also accept input
-    // from direct buffer transfers.
+    // We will read from the read end of the pipe. This end must be non-blocking. This is because
+    // our fillthread needs to poll to decide if it should shut down, and also accept input from
+    // direct buffer transfers.
     if (make_fd_nonblocking(pipes->read.fd())) {
         FLOGF(warning, PIPE_ERROR);
         wperror(L"fcntl");
-        return nullptr;
+        pipe_failed_ = true;
+        return false;
     }
-    // Our fillthread gets the read end of the pipe; out_pipe gets the write end.
-    auto buffer = std::make_shared<io_buffer_t>(buffer_limit);
-    buffer->begin_filling(std::move(pipes->read));
-    return std::make_shared<io_bufferfill_t>(target, std::move(pipes->write), buffer);
+    // Our fillthread gets the read end of the pipe; the write end is for our io_bufferfill_t.
+    begin_filling(std::move(pipes->read));
+    write_fd_ = std::move(pipes->write);
+    return true;
 }
 
 separated_buffer_t io_bufferfill_t::finish(std::shared_ptr<io_bufferfill_t> &&filler) {
@@ -249,10 +249,10 @@ class io_buffer_t;
 class io_chain_t;
 
 /// Represents filling an io_buffer_t. Very similar to io_pipe_t.
+/// Builtins write directly to the buffer, so the pipe to it is only created when something needs an
+/// fd to write to, e.g. an external command, by calling io_buffer_t::ensure_pipe(). There is no
+/// source_fd; use write_fd().
 class io_bufferfill_t final : public io_data_t {
-    /// Write end. The other end is connected to an io_buffer_t.
-    const autoclose_fd_t write_fd_;
-
     /// The receiving buffer.
     const std::shared_ptr<io_buffer_t> buffer_;
 
@@ -261,19 +261,17 @@ class io_bufferfill_t final : public io_data_t {
 
     // The ctor is public to support make_shared() in the static create function below.
     // Do not invoke this directly.
-    io_bufferfill_t(int target, autoclose_fd_t write_fd, std::shared_ptr<io_buffer_t> buffer)
-        : io_data_t(io_mode_t::bufferfill, target, write_fd.fd()),
-          write_fd_(std::move(write_fd)),
-          buffer_(std::move(buffer)) {
-        assert(write_fd_.valid() && "fd is not valid");
-    }
+    io_bufferfill_t(int target, std::shared_ptr<io_buffer_t> buffer)
+        : io_data_t(io_mode_t::bufferfill, target, -1), buffer_(std::move(buffer)) {}
 
     ~io_bufferfill_t() override;
 
     std::shared_ptr<io_buffer_t> buffer() const { return buffer_; }
 
+    /// \return the write end of the pipe which fills our buffer, or -1 if it has not been created.
+    int write_fd() const;
+
     /// Create an io_bufferfill_t which, when written from, fills a buffer with the contents.
-    /// \returns nullptr on failure, e.g. too many open fds.
     ///
     /// \param target the fd which this will be dup2'd to - typically stdout.
     static shared_ptr<io_bufferfill_t> create(size_t buffer_limit = 0, int target = STDOUT_FILENO);
@@ -301,6 +299,15 @@ class io_buffer_t {
     /// \return true if output was discarded due to exceeding the read limit.
     bool discarded() { return buffer_.acquire()->discarded(); }
 
+    /// Create the pipe which fills this buffer and start reading from it in the background, unless
+    /// that was already done. \return false, after printing an error, if the pipe could not be
+    /// created, e.g. because there are too many open fds. This may only be called on the main
+    /// thread.
+    bool ensure_pipe();
+
+    /// \return true if ensure_pipe() failed to create our pipe.
+    bool pipe_failed() const { return pipe_failed_; }
+
    private:
     /// Read some, filling the buffer. The buffer is passed in to enforce that the append lock is
     /// held. \return positive on success, 0 if closed, -1 on error (in which case errno will be
@@ -310,7 +317,8 @@ class io_buffer_t {
     /// Begin the fill operation, reading from the given fd in the background.
     void begin_filling(autoclose_fd_t readfd);
 
-    /// End the background fillthread operation, and return the buffer, transferring ownership.
+    /// End the background fillthread operation, if any, and return the buffer, transferring
+    /// ownership.
     separated_buffer_t complete_background_fillthread_and_take_buffer();
 
     /// Helper to return whether the fillthread is running.
@@ -329,6 +337,13 @@ class io_buffer_t {
     /// The item id of our background fillthread fd monitor item.
     uint64_t item_id_{0};
 
+    /// The write end of our pipe, if it has been created. It is closed when the io_bufferfill_t
+    /// goes away.
+    autoclose_fd_t write_fd_{};
+
+    /// Whether creating our pipe failed.
+    bool pipe_failed_{false};
+
     friend io_bufferfill_t;
 };
 
@@ -366,6 +381,10 @@ class output_stream_t {
     /// \return true if output was discarded. This only applies to buffered output streams.
     virtual bool discarded() const { return false; }
 
+    /// \return true if explicitly separated output is kept apart, rather than just being followed
+    /// by a newline. This only applies to buffered output streams.
+    virtual bool keeps_separation() const { return false; }
+
     /// \return any internally buffered contents.
     /// This is only implemented for a string_output_stream; others flush data to their underlying
     /// receiver (fd, or separated buffer) immediately and so will return an empty string here.
@@ -374,6 +393,10 @@ class output_stream_t {
     /// An optional override point. This is for explicit separation.
     virtual void append_with_separation(const wchar_t *s, size_t len, separation_type_t type);
 
+    /// An optional override point. Pass on any output that this stream is holding back. Most
+    /// streams pass on output as it arrives, so by default this does nothing.
+    virtual void flush() {}
+
     /// The following are all convenience overrides.
     void append_with_separation(const wcstring &s, separation_type_t type) {
         append_with_separation(s.data(), s.size(), type);
@@ -454,6 +477,7 @@ class buffered_output_stream_t final : public output_stream_t {
     void append(const wchar_t *s, size_t amt) override;
     void append_with_separation(const wchar_t *s, size_t len, separation_type_t type) override;
     bool discarded() const override;
+    bool keeps_separation() const override { return true; }
 
    private:
     /// The buffer we are filling.
@@ -497,6 +521,19 @@ struct io_streams_t {
     void operator=(const io_streams_t &) = delete;
 
     io_streams_t(output_stream_t &out, output_stream_t &err) : out(out), err(err) {}
+
+    /// Construct with the given out and err streams, and the remaining fields from \p other.
+    io_streams_t(output_stream_t &out, output_stream_t &err, const io_streams_t &other)
+        : out(out),
+          err(err),
+          stdin_fd(other.stdin_fd),
+          stdin_is_directly_redirected(other.stdin_is_directly_redirected),
+          out_is_piped(other.out_is_piped),
+          err_is_piped(other.err_is_piped),
+          out_is_redirected(other.out_is_redirected),
+          err_is_redirected(other.err_is_redirected),
+          io_chain(other.io_chain),
+          job_group(other.job_group) {}
 };
 
 #endif
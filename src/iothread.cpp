@@ -12,11 +12,13 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <deque>
 #include <functional>
 #include <future>
-#include <queue>
 #include <thread>
 
 #include "common.h"
@@ -48,6 +50,9 @@ struct work_request_t {
     void_function_t handler;
     void_function_t completion;
 
+    // When the request was enqueued on the thread pool.
+    std::chrono::steady_clock::time_point enqueue_time{};
+
     work_request_t(void_function_t &&f, void_function_t &&comp)
         : handler(std::move(f)), completion(std::move(comp)) {}
 
@@ -77,8 +82,9 @@ struct main_thread_request_t {
 
 struct thread_pool_t {
     struct data_t {
-        /// The queue of outstanding, unclaimed requests.
-        std::queue<work_request_t> request_queue{};
+        /// The queues of outstanding, unclaimed requests, one per priority.
+        std::deque<work_request_t> interactive_queue{};
+        std::deque<work_request_t> bulk_queue{};
 
         /// The number of threads that exist in the pool.
         size_t total_threads{0};
@@ -86,8 +92,17 @@ struct thread_pool_t {
         /// The number of threads which are waiting for more work.
         size_t waiting_threads{0};
 
+        /// The number of threads which are performing bulk work.
+        size_t bulk_threads{0};
+
         /// A flag indicating we should not process new requests.
         bool drain{false};
+
+        /// Counters, for `status thread-pool`.
+        iothread_counters_t counters{};
+
+        /// \return the number of outstanding requests.
+        size_t queued() const { return interactive_queue.size() + bulk_queue.size(); }
     };
 
     /// Data which needs to be atomically accessed.
@@ -103,25 +118,32 @@ struct thread_pool_t {
     const size_t soft_min_threads;
     const size_t max_threads;
 
+    /// The maximum number of threads which may perform bulk work at once.
+    const size_t max_bulk_threads;
+
     /// Construct with a soft minimum and maximum thread count.
     thread_pool_t(size_t soft_min_threads, size_t max_threads)
-        : soft_min_threads(soft_min_threads), max_threads(max_threads) {}
+        : soft_min_threads(soft_min_threads),
+          max_threads(max_threads),
+          max_bulk_threads(std::max(2u, std::thread::hardware_concurrency())) {}
 
     /// Enqueue a new work item onto the thread pool.
     /// The function \p func will execute in one of the pool's threads.
     /// \p completion will run on the main thread, if it is not missing.
     /// If \p cant_wait is set, disrespect the thread limit, because extant threads may
     /// want to wait for new threads.
-    int perform(void_function_t &&func, void_function_t &&completion, bool cant_wait);
+    int perform(void_function_t &&func, void_function_t &&completion, bool cant_wait,
+                iothread_priority_t priority);
 
    private:
     /// The worker loop for this thread.
     void *run();
 
     /// Dequeue a work item (perhaps waiting on the condition variable), or commit to exiting by
-    /// reducing the active thread count.
+    /// reducing the active thread count. \p finished_bulk indicates that the calling thread has
+    /// just finished bulk work; \p out_bulk is set to whether the returned work is bulk work.
     /// This runs in the background thread.
-    maybe_t<work_request_t> dequeue_work_or_commit_to_exit();
+    maybe_t<work_request_t> dequeue_work_or_commit_to_exit(bool finished_bulk, bool *out_bulk);
 
     /// Trampoline function for pthread_spawn compatibility.
     static void *run_trampoline(void *vpool);
@@ -177,11 +199,14 @@ static fd_event_signaller_t &get_notify_signaller() {
 
 /// Dequeue a work item (perhaps waiting on the condition variable), or commit to exiting by
 /// reducing the active thread count.
-maybe_t<work_request_t> thread_pool_t::dequeue_work_or_commit_to_exit() {
+maybe_t<work_request_t> thread_pool_t::dequeue_work_or_commit_to_exit(bool finished_bulk,
+                                                                      bool *out_bulk) {
     auto data = this->req_data.acquire();
+    if (finished_bulk) data->bulk_threads -= 1;
+
     // If the queue is empty, check to see if we should wait.
     // We should wait if our exiting would drop us below the soft min.
-    if (data->request_queue.empty() && data->total_threads == this->soft_min_threads &&
+    if (data->queued() == 0 && data->total_threads == this->soft_min_threads &&
         IO_WAIT_FOR_WORK_DURATION_MS > 0) {
         data->waiting_threads += 1;
         this->queue_cond.wait_for(data.get_lock(),
@@ -189,11 +214,30 @@ maybe_t<work_request_t> thread_pool_t::dequeue_work_or_commit_to_exit() {
         data->waiting_threads -= 1;
     }
 
-    // Now that we've perhaps waited, see if there's something on the queue.
+    // Now that we've perhaps waited, see if there's something on the queue. Interactive work goes
+    // first; bulk work only if not too many threads are already doing bulk work.
     maybe_t<work_request_t> result{};
-    if (!data->request_queue.empty()) {
-        result = std::move(data->request_queue.front());
-        data->request_queue.pop();
+    iothread_counters_t::queue_counters_t *counters = nullptr;
+    *out_bulk = false;
+    if (!data->interactive_queue.empty()) {
+        result = std::move(data->interactive_queue.front());
+        data->interactive_queue.pop_front();
+        counters = &data->counters.interactive;
+    } else if (!data->bulk_queue.empty() && data->bulk_threads < this->max_bulk_threads) {
+        result = std::move(data->bulk_queue.front());
+        data->bulk_queue.pop_front();
+        data->bulk_threads += 1;
+        counters = &data->counters.bulk;
+        *out_bulk = true;
+    }
+    if (counters) {
+        auto wait = std::chrono::steady_clock::now() - result->enqueue_time;
+        auto wait_usec = static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::microseconds>(wait).count());
+        counters->queued -= 1;
+        counters->dequeued += 1;
+        counters->total_wait_usec += wait_usec;
+        counters->max_wait_usec = std::max(counters->max_wait_usec, wait_usec);
     }
     // If we are returning none, then ensure we balance the thread count increment from when we were
     // created. This has to be done here in this awkward place because we've already committed to
@@ -213,7 +257,8 @@ static void enqueue_thread_result(void_function_t req) {
 static void *this_thread() { return (void *)(intptr_t)pthread_self(); }
 
 void *thread_pool_t::run() {
-    while (auto req = dequeue_work_or_commit_to_exit()) {
+    bool is_bulk = false;
+    while (auto req = dequeue_work_or_commit_to_exit(is_bulk, &is_bulk)) {
         FLOGF(iothread, L"pthread %p got work", this_thread());
 
         // Perform the work
@@ -240,10 +285,13 @@ bool thread_pool_t::spawn() const {
     return make_detached_pthread(&run_trampoline, const_cast<thread_pool_t *>(this));
 }
 
-int thread_pool_t::perform(void_function_t &&func, void_function_t &&completion, bool cant_wait) {
+int thread_pool_t::perform(void_function_t &&func, void_function_t &&completion, bool cant_wait,
+                           iothread_priority_t priority) {
     assert(func && "Missing function");
     // Note we permit an empty completion.
     struct work_request_t req(std::move(func), std::move(completion));
+    req.enqueue_time = std::chrono::steady_clock::now();
+    const bool is_bulk = priority == iothread_priority_t::bulk;
     int local_thread_count = -1;
     auto &pool = s_io_thread_pool;
     bool spawn_new_thread = false;
@@ -251,11 +299,18 @@ int thread_pool_t::perform(void_function_t &&func, void_function_t &&completion,
     {
         // Lock around a local region.
         auto data = pool.req_data.acquire();
-        data->request_queue.push(std::move(req));
-        FLOGF(iothread, L"enqueuing work item (count is %lu)", data->request_queue.size());
+        auto &queue = is_bulk ? data->bulk_queue : data->interactive_queue;
+        auto &counters = is_bulk ? data->counters.bulk : data->counters.interactive;
+        queue.push_back(std::move(req));
+        counters.queued += 1;
+        counters.max_queued = std::max(counters.max_queued, counters.queued);
+        FLOGF(iothread, L"enqueuing work item (count is %lu)", data->queued());
         if (data->drain) {
             // Do nothing here.
-        } else if (data->waiting_threads >= data->request_queue.size()) {
+        } else if (is_bulk &&
+                   data->bulk_threads + data->bulk_queue.size() > pool.max_bulk_threads) {
+            // Enough threads are doing bulk work; one of them will pick this up when it finishes.
+        } else if (data->waiting_threads >= data->queued()) {
             // There's enough waiting threads, wake one up.
             wakeup_thread = true;
         } else if (cant_wait || data->total_threads < pool.max_threads) {
@@ -285,10 +340,19 @@ int thread_pool_t::perform(void_function_t &&func, void_function_t &&completion,
     return local_thread_count;
 }
 
-void iothread_perform_impl(void_function_t &&func, void_function_t &&completion, bool cant_wait) {
+void iothread_perform_impl(void_function_t &&func, void_function_t &&completion, bool cant_wait,
+                           iothread_priority_t priority) {
     ASSERT_IS_MAIN_THREAD();
     ASSERT_IS_NOT_FORKED_CHILD();
-    s_io_thread_pool.perform(std::move(func), std::move(completion), cant_wait);
+    s_io_thread_pool.perform(std::move(func), std::move(completion), cant_wait, priority);
+}
+
+iothread_counters_t iothread_get_counters() {
+    auto data = s_io_thread_pool.req_data.acquire();
+    iothread_counters_t result = data->counters;
+    result.threads = data->total_threads;
+    result.waiting_threads = data->waiting_threads;
+    return result;
 }
 
 int iothread_port() { return get_notify_signaller().read_fd(); }
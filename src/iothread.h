@@ -25,9 +25,18 @@ void iothread_service_main_with_timeout(long timeout_usec);
 /// \return the number of threads that were running.
 int iothread_drain_all();
 
+/// The priority of work performed on an iothread. Interactive work is always dequeued before bulk
+/// work, and bulk work may only occupy a limited number of threads, so that work the user is
+/// waiting on (like highlighting) never waits behind bulk work (like history file detection).
+enum class iothread_priority_t : uint8_t {
+    interactive,
+    bulk,
+};
+
 // Internal implementation
 void iothread_perform_impl(std::function<void()> &&func, std::function<void()> &&completion,
-                           bool cant_wait = false);
+                           bool cant_wait = false,
+                           iothread_priority_t priority = iothread_priority_t::interactive);
 
 // This is the glue part of the handler-completion handoff.
 // Given a Handler and Completion, where the return value of Handler should be passed to Completion,
@@ -73,6 +82,11 @@ inline void iothread_perform(std::function<void()> &&func) {
     iothread_perform_impl(std::move(func), {});
 }
 
+/// Variant of iothread_perform for bulk work, see iothread_priority_t.
+inline void iothread_perform_bulk(std::function<void()> &&func) {
+    iothread_perform_impl(std::move(func), {}, false, iothread_priority_t::bulk);
+}
+
 /// Variant of iothread_perform that disrespects the thread limit.
 /// It does its best to spawn a new thread if all other threads are occupied.
 /// This is for cases where deferring a new thread might lead to deadlock.
@@ -80,6 +94,32 @@ inline void iothread_perform_cantwait(std::function<void()> &&func) {
     iothread_perform_impl(std::move(func), {}, true);
 }
 
+/// Counters describing the iothread pool.
+struct iothread_counters_t {
+    /// Counters for one priority of work.
+    struct queue_counters_t {
+        /// The number of requests currently waiting for a thread, and the most there have been.
+        size_t queued{0};
+        size_t max_queued{0};
+
+        /// The number of requests which have been given to a thread.
+        uint64_t dequeued{0};
+
+        /// The total and longest time that requests waited for a thread, in microseconds.
+        uint64_t total_wait_usec{0};
+        uint64_t max_wait_usec{0};
+    };
+    queue_counters_t interactive{};
+    queue_counters_t bulk{};
+
+    /// The number of threads in the pool, and how many of them are waiting for work.
+    size_t threads{0};
+    size_t waiting_threads{0};
+};
+
+/// \return a snapshot of the iothread pool's counters.
+iothread_counters_t iothread_get_counters();
+
 /// Performs a function on the main thread, blocking until it completes.
 void iothread_perform_on_main(std::function<void()> &&func);
 
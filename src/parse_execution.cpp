@@ -55,6 +55,27 @@ static bool specific_statement_type_is_redirectable_block(const ast::node_t &nod
     return type_is_redirectable_block(node.type);
 }
 
+/// \return whether the innermost function, script or command substitution being executed is a
+/// command substitution.
+static bool is_executing_command_substitution(const parser_t &parser) {
+    for (const block_t &b : parser.blocks()) {
+        switch (b.type()) {
+            case block_type_t::while_block:
+            case block_type_t::for_block:
+            case block_type_t::if_block:
+            case block_type_t::switch_block:
+            case block_type_t::begin:
+            case block_type_t::variable_assignment:
+                continue;
+            case block_type_t::subst:
+                return true;
+            default:
+                return false;
+        }
+    }
+    return false;
+}
+
 /// Get the name of a redirectable block, for profiling purposes.
 static wcstring profiling_cmd_name_for_redirectable_block(const ast::node_t &node,
                                                           const parsed_source_t &pstree) {
@@ -1281,6 +1302,15 @@ end_execution_reason_t parse_execution_context_t::run_1_job(const ast::job_t &jo
     // Profiling support.
     profile_item_t *profile_item = this->parser->create_profile_item();
     const auto start_time = profile_item ? profile_item_t::now() : 0;
+    cleanup_t finish_profiling([&] {
+        if (profile_item) parser->finish_profile_item(profile_item);
+    });
+    if (profile_item != nullptr && !is_executing_command_substitution(*parser)) {
+        // Line numbers in a command substitution are relative to its own source, so its commands
+        // keep the location of the command containing it.
+        profile_item->file = parser->current_filename();
+        profile_item->line = this->get_current_line_number();
+    }
 
     // When we encounter a block construct (e.g. while loop) in the general case, we create a "block
     // process" containing its node. This allows us to handle block-level redirections.
@@ -1330,6 +1360,7 @@ end_execution_reason_t parse_execution_context_t::run_1_job(const ast::job_t &jo
             profile_item->level = parser->eval_level;
             profile_item->cmd =
                 profiling_cmd_name_for_redirectable_block(*specific_statement, *this->pstree);
+            profile_item->name = profile_item->cmd.substr(0, profile_item->cmd.find(L' '));
             profile_item->skipped = false;
         }
 
@@ -1411,6 +1442,10 @@ end_execution_reason_t parse_execution_context_t::run_1_job(const ast::job_t &jo
         profile_item->duration = profile_item_t::now() - start_time;
         profile_item->level = parser->eval_level;
         profile_item->cmd = job ? job->command() : wcstring();
+        const wchar_t *argv0 =
+            job && !job->processes.empty() ? job->processes.front()->argv0() : nullptr;
+        profile_item->name =
+            argv0 ? argv0 : profile_item->cmd.substr(0, profile_item->cmd.find(L' '));
         profile_item->skipped = (pop_result != end_execution_reason_t::ok);
     }
 
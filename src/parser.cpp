@@ -8,8 +8,11 @@
 
 #include <algorithm>
 #include <cwchar>
+#include <map>
 #include <memory>
+#include <unordered_map>
 #include <utility>
+#include <vector>
 
 #include "ast.h"
 #include "common.h"
@@ -231,62 +234,129 @@ block_t *parser_t::block_at_index(size_t idx) {
 
 block_t *parser_t::current_block() { return block_at_index(0); }
 
-/// Print profiling information to the specified stream.
-static void print_profile(const std::deque<profile_item_t> &items, FILE *out) {
-    for (size_t idx = 0; idx < items.size(); idx++) {
-        const profile_item_t &item = items.at(idx);
+/// Print profiling information to the specified stream, as a log of each command.
+static bool print_profile_log(const std::deque<profile_item_t> &items, FILE *out) {
+    if (std::fwprintf(out, _(L"Time\tSum\tCommand\n")) < 0) return false;
+    for (const profile_item_t &item : items) {
         if (item.skipped || item.cmd.empty()) continue;
 
-        long long total_time = item.duration;
-
-        // Compute the self time as the total time, minus the total time consumed by subsequent
-        // items exactly one eval level deeper.
-        long long self_time = item.duration;
-        for (size_t i = idx + 1; i < items.size(); i++) {
-            const profile_item_t &nested_item = items.at(i);
-            if (nested_item.skipped) continue;
+        if (std::fwprintf(out, L"%lld\t%lld\t", item.self_duration(), item.duration) < 0) {
+            return false;
+        }
+        for (size_t i = 0; i < item.level; i++) {
+            if (std::fwprintf(out, L"-") < 0) return false;
+        }
+        if (std::fwprintf(out, L"> %ls\n", item.cmd.c_str()) < 0) return false;
+    }
+    return true;
+}
 
-            // If the eval level is not larger, then we have exhausted nested items.
-            if (nested_item.level <= item.level) break;
+/// \return the frame for a profile item in a folded stack, e.g. "foo (config.fish:12)".
+static wcstring profile_frame(const profile_item_t &item) {
+    wcstring result = item.name;
+    if (item.file) append_format(result, L" (%ls:%d)", item.file, item.line);
+    // Semicolons separate frames, and each stack is one line.
+    for (wchar_t &c : result) {
+        if (c == L';') c = L',';
+        if (c == L'\n') c = L' ';
+    }
+    return result;
+}
 
-            // If the eval level is exactly one more than our level, it is a directly nested item.
-            if (nested_item.level == item.level + 1) self_time -= nested_item.duration;
+/// Print profiling information to the specified stream, as folded stacks: each line has the frames
+/// of a call stack, outermost first, separated by semicolons, and then the total self time in
+/// microseconds of the commands with that stack. This is the input format of flame graph tools.
+static bool print_profile_folded(const std::deque<profile_item_t> &items, FILE *out) {
+    std::map<wcstring, long long> stacks;
+    std::vector<const profile_item_t *> frames;
+    for (const profile_item_t &item : items) {
+        if (item.skipped || item.cmd.empty()) continue;
+        frames.clear();
+        for (const profile_item_t *cursor = &item; cursor;
+             cursor = cursor->parent < 0 ? nullptr : &items.at(cursor->parent)) {
+            if (!cursor->skipped) frames.push_back(cursor);
+        }
+        wcstring stack;
+        for (auto iter = frames.rbegin(); iter != frames.rend(); ++iter) {
+            if (!stack.empty()) stack.push_back(L';');
+            stack.append(profile_frame(**iter));
         }
+        stacks[stack] += item.self_duration();
+    }
+    for (const auto &kv : stacks) {
+        if (std::fwprintf(out, L"%ls %lld\n", kv.first.c_str(), kv.second) < 0) return false;
+    }
+    return true;
+}
 
-        if (std::fwprintf(out, L"%lld\t%lld\t", self_time, total_time) < 0) {
-            wperror(L"fwprintf");
-            return;
+/// Print profiling information to the specified stream, as a table with a row for each command
+/// name, sorted by the total time.
+static bool print_profile_summary(const std::deque<profile_item_t> &items, FILE *out) {
+    struct summary_t {
+        long long calls{0};
+        long long self_time{0};
+        long long total_time{0};
+    };
+    std::unordered_map<wcstring, summary_t> summaries;
+    for (const profile_item_t &item : items) {
+        if (item.skipped || item.cmd.empty()) continue;
+        summary_t &summary = summaries[item.name];
+        summary.calls++;
+        summary.self_time += item.self_duration();
+
+        // The time of a recursive call is already part of the time of the outer call.
+        bool recursive = false;
+        for (long long idx = item.parent; idx >= 0 && !recursive; idx = items.at(idx).parent) {
+            recursive = !items.at(idx).skipped && items.at(idx).name == item.name;
         }
+        if (!recursive) summary.total_time += item.duration;
+    }
 
-        for (size_t i = 0; i < item.level; i++) {
-            if (std::fwprintf(out, L"-") < 0) {
-                wperror(L"fwprintf");
-                return;
-            }
+    std::vector<std::pair<wcstring, summary_t>> rows(summaries.begin(), summaries.end());
+    std::sort(rows.begin(), rows.end(), [](const std::pair<wcstring, summary_t> &a,
+                                           const std::pair<wcstring, summary_t> &b) {
+        if (a.second.total_time != b.second.total_time) {
+            return a.second.total_time > b.second.total_time;
         }
+        return a.first < b.first;
+    });
 
-        if (std::fwprintf(out, L"> %ls\n", item.cmd.c_str()) < 0) {
-            wperror(L"fwprintf");
-            return;
+    if (std::fwprintf(out, _(L"Calls\tTime\tSum\tCommand\n")) < 0) return false;
+    for (const auto &row : rows) {
+        if (std::fwprintf(out, L"%lld\t%lld\t%lld\t%ls\n", row.second.calls, row.second.self_time,
+                          row.second.total_time, row.first.c_str()) < 0) {
+            return false;
         }
     }
+    return true;
 }
 
 void parser_t::clear_profiling() {
+    assert(active_profile_items.empty() && "Cannot clear profiling while commands are executing");
     profile_items.clear();
 }
 
-void parser_t::emit_profiling(const char *path) const {
+void parser_t::emit_profiling(const char *path, profile_format_t format) const {
     // Save profiling information. OK to not use CLO_EXEC here because this is called while fish is
     // exiting (and hence will not fork).
     FILE *f = fopen(path, "w");
     if (!f) {
         FLOGF(warning, _(L"Could not write profiling information to file '%s'"), path);
     } else {
-        if (std::fwprintf(f, _(L"Time\tSum\tCommand\n"), profile_items.size()) < 0) {
+        bool ok = false;
+        switch (format) {
+            case profile_format_t::log:
+                ok = print_profile_log(profile_items, f);
+                break;
+            case profile_format_t::folded:
+                ok = print_profile_folded(profile_items, f);
+                break;
+            case profile_format_t::summary:
+                ok = print_profile_summary(profile_items, f);
+                break;
+        }
+        if (!ok) {
             wperror(L"fwprintf");
-        } else {
-            print_profile(profile_items, f);
         }
 
         if (fclose(f)) {
@@ -596,11 +666,30 @@ job_t *parser_t::job_get_from_pid(pid_t pid) const {
 profile_item_t *parser_t::create_profile_item() {
     if (g_profiling_active) {
         profile_items.emplace_back();
-        return &profile_items.back();
+        profile_item_t *item = &profile_items.back();
+        if (!active_profile_items.empty()) {
+            item->parent = active_profile_items.back();
+            // By default, a nested command is attributed to the location of its parent.
+            const profile_item_t &parent = profile_items.at(item->parent);
+            item->file = parent.file;
+            item->line = parent.line;
+        }
+        active_profile_items.push_back(profile_items.size() - 1);
+        return item;
     }
     return nullptr;
 }
 
+void parser_t::finish_profile_item(profile_item_t *item) {
+    assert(!active_profile_items.empty() &&
+           &profile_items.at(active_profile_items.back()) == item &&
+           "Profile item is not the innermost executing one");
+    active_profile_items.pop_back();
+    if (item->parent >= 0 && !item->skipped) {
+        profile_items.at(item->parent).nested_duration += item->duration;
+    }
+}
+
 eval_res_t parser_t::eval(const wcstring &cmd, const io_chain_t &io,
                           const job_group_ref_t &job_group, enum block_type_t block_type) {
     // Parse the source into a tree, if we can.
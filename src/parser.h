@@ -119,20 +119,47 @@ struct profile_item_t {
     /// Time spent executing the command, including nested blocks.
     microseconds_t duration{};
 
+    /// Time spent executing the commands directly nested in this one, such as the commands of a
+    /// function it calls or of its command substitutions. Skipped commands are not included.
+    microseconds_t nested_duration{};
+
     /// The block level of the specified command. Nested blocks and command substitutions both
     /// increase the block level.
     size_t level{};
 
+    /// The index of the item for the command this one is nested in, or -1 at the top level.
+    long long parent{-1};
+
     /// If the execution of this command was skipped.
     bool skipped{};
 
     /// The command string.
     wcstring cmd{};
 
+    /// The name of the command, or the keyword of a block, e.g. "if".
+    wcstring name{};
+
+    /// The file containing the command, or null if there is none, and its line number in the file.
+    const wchar_t *file{};
+    int line{};
+
+    /// \return the time spent executing the command, excluding nested commands.
+    microseconds_t self_duration() const { return duration - nested_duration; }
+
     /// \return the current time as a microsecond timestamp since the epoch.
     static microseconds_t now() { return get_time(); }
 };
 
+/// Ways of writing profiling data.
+enum class profile_format_t {
+    /// Each command, in order of execution, with its self and total time.
+    log,
+    /// One line per call stack with the time spent in it, as used by flame graph tools.
+    folded,
+    /// For each command name, the number of calls, and the self and total time of all calls.
+    summary,
+};
+
 class parse_execution_context_t;
 class completion_t;
 struct event_t;
@@ -268,6 +295,9 @@ class parser_t : public std::enable_shared_from_this<parser_t> {
     /// to profile_items). deque does not move items on reallocation.
     std::deque<profile_item_t> profile_items;
 
+    /// The indexes in profile_items of the commands which are executing, innermost last.
+    std::vector<size_t> active_profile_items;
+
     // No copying allowed.
     parser_t(const parser_t &);
     parser_t &operator=(const parser_t &);
@@ -395,16 +425,20 @@ class parser_t : public std::enable_shared_from_this<parser_t> {
     /// Returns the job with the given pid.
     job_t *job_get_from_pid(pid_t pid) const;
 
-    /// Returns a new profile item if profiling is active. The caller should fill it in.
-    /// The parser_t will deallocate it.
+    /// Returns a new profile item if profiling is active. The caller should fill it in, and pass it
+    /// to finish_profile_item() once its command is done. Items created in between are nested in
+    /// this one. The parser_t will deallocate it.
     /// If profiling is not active, this returns nullptr.
     profile_item_t *create_profile_item();
 
+    /// Mark that the command of \p item, returned from create_profile_item(), is done.
+    void finish_profile_item(profile_item_t *item);
+
     /// Remove the profiling items.
     void clear_profiling();
 
-    /// Output profiling data to the given filename.
-    void emit_profiling(const char *path) const;
+    /// Output profiling data to the given filename, in the given format.
+    void emit_profiling(const char *path, profile_format_t format = profile_format_t::log) const;
 
     void get_backtrace(const wcstring &src, const parse_error_list_t &errors,
                        wcstring &output) const;
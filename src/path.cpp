@@ -8,19 +8,29 @@
 #include <errno.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#ifdef HAVE_INOTIFY_INIT1
+#include <sys/inotify.h>
+#endif
 
+#include <algorithm>
+#include <chrono>
 #include <cstring>
 #include <cwchar>
+#include <cwctype>
 #include <memory>
 #include <string>
 #include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include "common.h"
 #include "env.h"
 #include "expand.h"
 #include "fallback.h"  // IWYU pragma: keep
+#include "fds.h"
 #include "flog.h"
+#include "inotify_queue.h"
 #include "wcstringutil.h"
 #include "wutil.h"  // IWYU pragma: keep
 
@@ -31,6 +41,195 @@
 // we've already tested.
 const wcstring_list_t dflt_pathsv({L"/bin", L"/usr/bin", PREFIX L"/bin"});
 
+namespace {
+/// The names of the entries in a directory, as of the time it was listed.
+struct dir_listing_t {
+    std::unordered_set<wcstring> names;
+
+    // The directory's identity and modification time when it was listed.
+    file_id_t id;
+
+    // The watch on the directory in the shared inotify queue, or -1 if it is not watched.
+    int watch{-1};
+
+    // When we last checked that the listing is current.
+    std::chrono::steady_clock::time_point validated;
+};
+
+/// A cache of the listings of directories in $PATH, so that looking up or completing a command
+/// does not need syscalls for every directory that cannot contain it. Listings are checked against
+/// the directory's modification time before use. Where inotify is available, a listing is instead
+/// dropped as soon as its directory changes, and only checked against the modification time once a
+/// second, to catch changes that inotify does not report (e.g. on network filesystems).
+class path_cache_t {
+   public:
+    /// \return the listing of the absolute directory \p dir, or nullptr if it cannot be listed.
+    /// The listing is valid until the cache is next modified.
+    const dir_listing_t *get(const wcstring &dir);
+
+    /// Forget all listings.
+    void clear();
+
+   private:
+    // Drop the listing of \p dir, if any.
+    void drop(const wcstring &dir);
+
+    // Drop the listings of any directories that inotify reports have changed.
+    void drain_events();
+
+    // Start watching \p dir, returning the watch or -1 on failure.
+    static int add_watch(const wcstring &dir);
+
+    // Stop watching with \p watch, if it is not -1.
+    static void remove_watch(int watch);
+
+    std::unordered_map<wcstring, dir_listing_t> listings_;
+};
+}  // namespace
+
+// How long to trust a watched directory listing without checking its modification time.
+static constexpr auto kWatchedListingRevalidateInterval = std::chrono::seconds(1);
+
+int path_cache_t::add_watch(const wcstring &dir) {
+#ifdef HAVE_INOTIFY_INIT1
+    uint32_t mask = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF |
+                    IN_MOVE_SELF | IN_ONLYDIR;
+    int watch = inotify_queue_t::shared().acquire()->add_watch(wcs2string(dir), mask);
+    if (watch < 0) FLOGF(path, L"Unable to watch '%ls': %s", dir.c_str(), std::strerror(errno));
+    return watch;
+#else
+    UNUSED(dir);
+    return -1;
+#endif
+}
+
+void path_cache_t::remove_watch(int watch) {
+    if (watch >= 0) inotify_queue_t::shared().acquire()->remove_watch(watch);
+}
+
+void path_cache_t::drain_events() {
+    wcstring_list_t changed;
+    {
+        auto queue = inotify_queue_t::shared().acquire();
+        // Events are only read on the main thread, which also waits for them for the universal
+        // variable notifier. Other threads see what it has read.
+        if (is_main_thread()) queue->read_events();
+        for (const auto &kv : listings_) {
+            // Any event, including lost ones, means that the directory may have changed.
+            if (kv.second.watch >= 0 && !queue->take_events(kv.second.watch).empty()) {
+                changed.push_back(kv.first);
+            }
+        }
+    }
+    for (const wcstring &dir : changed) {
+        FLOGF(path, L"Directory '%ls' changed", dir.c_str());
+        drop(dir);
+    }
+}
+
+void path_cache_t::drop(const wcstring &dir) {
+    auto iter = listings_.find(dir);
+    if (iter == listings_.end()) return;
+    remove_watch(iter->second.watch);
+    listings_.erase(iter);
+}
+
+void path_cache_t::clear() {
+    while (!listings_.empty()) {
+        drop(wcstring(listings_.begin()->first));
+    }
+}
+
+/// \return true if \p dir, whose entries are \p names, may hold a name which differs from all of
+/// them only by case. That is so on case-insensitive filesystems, e.g. the default on macOS, where
+/// a listing cannot show that a name is missing.
+static bool dir_ignores_case(const wcstring &dir, const std::unordered_set<wcstring> &names) {
+    for (const wcstring &name : names) {
+        wcstring swapped = name;
+        for (wchar_t &c : swapped) {
+            c = iswlower(c) ? towupper(c) : towlower(c);
+        }
+        // If both spellings are listed, they must be different files; try another name.
+        if (swapped == name || names.count(swapped)) continue;
+        wcstring path = dir;
+        append_path_component(path, swapped);
+        struct stat buf;
+        return lwstat(path, &buf) == 0;
+    }
+    return false;
+}
+
+const dir_listing_t *path_cache_t::get(const wcstring &dir) {
+    // Relative directories depend on the working directory, so are not cached.
+    if (dir.empty() || dir.front() != L'/') return nullptr;
+    drain_events();
+
+    const auto now = std::chrono::steady_clock::now();
+    auto iter = listings_.find(dir);
+    if (iter != listings_.end()) {
+        dir_listing_t &listing = iter->second;
+        if (listing.watch >= 0 && now - listing.validated < kWatchedListingRevalidateInterval) {
+            return &listing;
+        }
+        if (file_id_for_path(dir) == listing.id) {
+            listing.validated = now;
+            return &listing;
+        }
+        drop(dir);
+    }
+
+    // Watch the directory before listing it, so that we see any change made while listing.
+    dir_listing_t listing;
+    listing.watch = add_watch(dir);
+    listing.id = file_id_for_path(dir);
+    listing.validated = now;
+    dir_t dir_handle(dir);
+    bool cacheable = listing.id != kInvalidFileID && dir_handle.valid();
+    if (cacheable && listing.watch < 0) {
+        // Without a watch, we rely on the modification time. A directory modified within the
+        // timestamp's granularity of listing it may change again without its time changing.
+        cacheable = listing.id.mod_seconds < time(nullptr) - 1;
+    }
+    if (cacheable) {
+        wcstring name;
+        while (dir_handle.read(name)) {
+            listing.names.insert(std::move(name));
+        }
+        cacheable = !dir_ignores_case(dir, listing.names);
+    }
+    if (!cacheable) {
+        remove_watch(listing.watch);
+        return nullptr;
+    }
+    auto result = listings_.emplace(dir, std::move(listing));
+    return &result.first->second;
+}
+
+static owning_lock<path_cache_t> s_path_cache;
+
+/// \return true if \p dir is known not to contain an entry named \p name, so there is no need to
+/// check for a file there.
+static bool path_dir_lacks_entry(const wcstring &dir, const wcstring &name) {
+    // These are in every directory, whether or not readdir reports them.
+    if (name.empty() || name == L"." || name == L"..") return false;
+    auto cache = s_path_cache.acquire();
+    const dir_listing_t *listing = cache->get(dir);
+    return listing && listing->names.count(name) == 0;
+}
+
+maybe_t<bool> path_dir_has_entry_matching(const wcstring &dir,
+                                          const std::function<bool(const wcstring &)> &pred) {
+    auto cache = s_path_cache.acquire();
+    const dir_listing_t *listing = cache->get(dir);
+    if (!listing) return none();
+    for (const wcstring &name : listing->names) {
+        if (pred(name)) return true;
+    }
+    return false;
+}
+
+void path_invalidate_dir_cache() { s_path_cache.acquire()->clear(); }
+
 static bool path_get_path_core(const wcstring &cmd, wcstring *out_path,
                                const maybe_t<env_var_t> &bin_path_var) {
     // If the command has a slash, it must be an absolute or relative path and thus we don't bother
@@ -62,7 +261,7 @@ static bool path_get_path_core(const wcstring &cmd, wcstring *out_path,
 
     int err = ENOENT;
     for (auto next_path : *pathsv) {
-        if (next_path.empty()) continue;
+        if (next_path.empty() || path_dir_lacks_entry(next_path, cmd)) continue;
         append_path_component(next_path, cmd);
         std::string narrow = wcs2string(next_path);
         if (access(narrow.c_str(), X_OK) == 0) {
@@ -117,7 +316,7 @@ wcstring_list_t path_get_paths(const wcstring &cmd, const environment_t &vars) {
 
     const wcstring_list_t &pathsv = path_var->as_list();
     for (auto path : pathsv) {
-        if (path.empty()) continue;
+        if (path.empty() || path_dir_lacks_entry(path, cmd)) continue;
         append_path_component(path, cmd);
         std::string narrow = wcs2string(path);
         if (path_is_executable(narrow)) paths.push_back(path);
@@ -322,6 +521,11 @@ static const base_directory_t &get_data_directory() {
     return s_dir;
 }
 
+static const base_directory_t &get_cache_directory() {
+    static base_directory_t s_dir = make_base_directory(L"XDG_CACHE_HOME", L"/.cache/fish");
+    return s_dir;
+}
+
 static const base_directory_t &get_config_directory() {
     static base_directory_t s_dir = make_base_directory(L"XDG_CONFIG_HOME", L"/.config/fish");
     return s_dir;
@@ -354,6 +558,12 @@ bool path_get_data(wcstring &path) {
     return dir.success;
 }
 
+bool path_get_cache(wcstring &path) {
+    const auto &dir = get_cache_directory();
+    path = dir.success ? dir.path : L"";
+    return dir.success;
+}
+
 void path_make_canonical(wcstring &path) {
     // Ignore trailing slashes, unless it's the first character.
     size_t len = path.size();
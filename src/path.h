@@ -6,6 +6,8 @@
 
 #include <stddef.h>
 
+#include <functional>
+
 #include "common.h"
 #include "env.h"
 
@@ -29,6 +31,15 @@ bool path_get_config(wcstring &path);
 /// \return whether the directory was returned successfully
 bool path_get_data(wcstring &path);
 
+/// Returns the user cache directory for fish. If the directory or one of its parents doesn't exist,
+/// they are first created.
+///
+/// Files which fish can regenerate at any time, such as parsed scripts, are stored here.
+///
+/// \param path The directory as an out param
+/// \return whether the directory was returned successfully
+bool path_get_cache(wcstring &path);
+
 /// Emit any errors if config directories are missing.
 /// Use the given environment stack to ensure this only occurs once.
 class env_stack_t;
@@ -49,6 +60,15 @@ bool path_get_path(const wcstring &cmd, wcstring *out_path, const environment_t
 /// Return all the paths that match the given command.
 wcstring_list_t path_get_paths(const wcstring &cmd, const environment_t &vars);
 
+/// Check whether the absolute directory \p dir has an entry whose name satisfies \p pred, using the
+/// cached listing kept for command lookups. \return none() if the directory is not cached and
+/// cannot be listed, in which case the caller must look for itself.
+maybe_t<bool> path_dir_has_entry_matching(const wcstring &dir,
+                                          const std::function<bool(const wcstring &)> &pred);
+
+/// Forget the cached listings of $PATH directories. This is called when $PATH changes.
+void path_invalidate_dir_cache();
+
 /// Returns the full path of the specified directory, using the CDPATH variable as a list of base
 /// directories for relative paths.
 ///
@@ -286,14 +286,34 @@ posix_spawner_t::posix_spawner_t(const job_t *j, const dup2_list_t &dup2s) {
         if (check_fail(posix_spawnattr_setsigmask(attr(), &sigmask))) return;
     }
 
+#ifdef HAVE_POSIX_SPAWN_FILE_ACTIONS_ADDTCSETPGRP_NP
+    // Assign the terminal within the child, before it executes and before stdin is redirected, for
+    // the same reasons as child_setup_process(). The child cannot ignore SIGTTOU, but it blocks all
+    // signals while performing the file actions. Only do this if the tty belongs to fish, as the
+    // spawn fails if the child cannot assign it.
+    if (j->group->should_claim_terminal() && tcgetpgrp(STDIN_FILENO) == getpgrp()) {
+        if (check_fail(posix_spawn_file_actions_addtcsetpgrp_np(actions(), STDIN_FILENO))) return;
+    }
+#endif
+
     // Apply our dup2s.
     for (const auto &act : dup2s.get_actions()) {
         if (act.target < 0) {
             if (check_fail(posix_spawn_file_actions_addclose(actions(), act.src))) return;
-        } else {
-            if (check_fail(posix_spawn_file_actions_adddup2(actions(), act.src, act.target)))
-                return;
+            continue;
+        }
+        int src = act.src;
+        if (src == act.target) {
+            // This is a weird case like /bin/cmd 6< file.txt, where the opened file (which is
+            // CLO_EXEC) wants to be dup2'd to its own fd. A dup2 action onto the same fd may be
+            // ignored, leaving the CLO_EXEC bit set, so dup2 from a copy in the high range instead.
+            autoclose_fd_t copy = dup_to_high_fd(src);
+            // The error has been printed; running out of fds is the likely cause.
+            if (!copy.valid() && check_fail(EMFILE)) return;
+            fd_copies_.push_back(std::move(copy));
+            src = fd_copies_.back().fd();
         }
+        if (check_fail(posix_spawn_file_actions_adddup2(actions(), src, act.target))) return;
     }
 }
 
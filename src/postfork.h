@@ -8,6 +8,9 @@
 #include <stddef.h>
 #include <unistd.h>
 
+#include <vector>
+
+#include "fds.h"
 #include "maybe.h"
 #if HAVE_SPAWN_H
 #include <spawn.h>
@@ -85,6 +88,8 @@ class posix_spawner_t {
     int error_{0};
     maybe_t<posix_spawnattr_t> attr_{};
     maybe_t<posix_spawn_file_actions_t> actions_{};
+    // Copies of fds which are redirected to themselves, which must stay open until the spawn.
+    std::vector<autoclose_fd_t> fd_copies_{};
 };
 
 #endif
@@ -45,6 +45,7 @@
 #include <stack>
 
 #include "ast.h"
+#include "ast_cache.h"
 #include "color.h"
 #include "common.h"
 #include "complete.h"
@@ -631,6 +632,9 @@ class reader_data_t : public std::enable_shared_from_this<reader_data_t> {
     wcstring in_flight_highlight_request;
     wcstring in_flight_autosuggest_request;
 
+    /// The results of the I/O checks of highlighting, kept across highlighting requests.
+    const std::shared_ptr<highlight_cache_t> highlight_cache{std::make_shared<highlight_cache_t>()};
+
     bool is_navigating_pager_contents() const { return this->pager.is_navigating_contents(); }
 
     /// The line that is currently being edited. Typically the command line, but may be the search
@@ -2465,16 +2469,19 @@ void reader_data_t::highlight_complete(highlight_result_t result) {
 
 // Given text and  whether IO is allowed, return a function that performs highlighting. The function
 // may be invoked on a background thread.
-static std::function<highlight_result_t(void)> get_highlight_performer(parser_t &parser,
-                                                                       const wcstring &text,
-                                                                       bool io_ok) {
+// If \p cache is set, the results of I/O checks are kept in it.
+static std::function<highlight_result_t(void)> get_highlight_performer(
+    parser_t &parser, const wcstring &text, bool io_ok,
+    std::shared_ptr<highlight_cache_t> cache = nullptr) {
     auto vars = parser.vars().snapshot();
     uint32_t generation_count = read_generation_count();
+    uint64_t exec_count = parser.libdata().exec_count;
     return [=]() -> highlight_result_t {
         if (text.empty()) return {};
         operation_context_t ctx = get_bg_context(vars, generation_count);
+        if (cache) cache->discard_if_stale(vars->get_pwd_slash(), exec_count);
         std::vector<highlight_spec_t> colors(text.size(), highlight_spec_t{});
-        highlight_shell(text, colors, ctx, io_ok);
+        highlight_shell(text, colors, ctx, io_ok, cache.get());
         return highlight_result_t{std::move(colors), text};
     };
 }
@@ -2489,7 +2496,8 @@ void reader_data_t::super_highlight_me_plenty() {
     in_flight_highlight_request = el->text();
 
     FLOG(reader_render, L"Highlighting");
-    auto highlight_performer = get_highlight_performer(parser(), el->text(), true /* io_ok */);
+    auto highlight_performer =
+        get_highlight_performer(parser(), el->text(), true /* io_ok */, highlight_cache);
     auto shared_this = this->shared_from_this();
     debounce_highlighting().perform(highlight_performer, [shared_this](highlight_result_t result) {
         shared_this->highlight_complete(std::move(result));
@@ -3861,8 +3869,11 @@ maybe_t<wcstring> reader_data_t::readline(int nchars_or_0) {
     }
 
     s_reset_abandoning_line(&screen, termsize_last().width);
+    startup_profile_mark(L"reader setup");
     event_fire_generic(parser(), L"fish_prompt");
+    startup_profile_mark(L"fish_prompt event handlers");
     exec_prompt();
+    startup_profile_finish(L"first prompt");
 
     /// A helper that kicks off syntax highlighting, autosuggestion computing, and repaints.
     auto color_suggest_repaint_now = [this] {
@@ -4184,17 +4195,28 @@ static int read_ni(parser_t &parser, int fd, const io_chain_t &io) {
         str.erase(0, 1);
     }
 
+    // Files sourced by absolute path, like autoloaded functions and config files, may have their
+    // ast in the cache. The cache only holds asts without errors.
+    const wchar_t *filename = parser.libdata().current_filename;
+    struct stat buf;
+    bool cacheable =
+        filename && filename[0] == L'/' && fstat(fd, &buf) == 0 && S_ISREG(buf.st_mode);
+    maybe_t<ast::ast_t> cached{};
+    if (cacheable) cached = ast_cache_load(filename, buf, str);
+    bool cache_hit = cached.has_value();
+
     // Parse into an ast and detect errors.
     parse_error_list_t errors;
-    auto ast = ast::ast_t::parse(str, parse_flag_none, &errors);
+    auto ast = cache_hit ? cached.acquire() : ast::ast_t::parse(str, parse_flag_none, &errors);
     bool errored = ast.errored();
-    if (!errored) {
+    if (!errored && !cache_hit) {
         errored = parse_util_detect_errors(ast, str, &errors);
     }
     if (!errored) {
         // Construct a parsed source ref.
         // Be careful to transfer ownership, this could be a very large string.
         parsed_source_ref_t ps = std::make_shared<parsed_source_t>(std::move(str), std::move(ast));
+        if (cacheable && !cache_hit) ast_cache_store(filename, buf, *ps);
         parser.eval(ps, io);
         return 0;
     } else {
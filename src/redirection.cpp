@@ -36,7 +36,12 @@ dup2_list_t dup2_list_t::resolve_chain(const io_chain_t &io_chain) {
     ASSERT_IS_NOT_FORKED_CHILD();
     dup2_list_t result;
     for (const auto &io : io_chain) {
-        if (io->source_fd < 0) {
+        if (io->io_mode == io_mode_t::bufferfill) {
+            // The pipe to fill the buffer is created on demand, see io_buffer_t::ensure_pipe().
+            int write_fd = static_cast<const io_bufferfill_t &>(*io).write_fd();
+            assert(write_fd >= 0 && "Buffer pipe should have been created before resolving");
+            result.add_dup2(write_fd, io->fd);
+        } else if (io->source_fd < 0) {
             result.add_close(io->fd);
         } else {
             result.add_dup2(io->source_fd, io->fd);
@@ -35,6 +35,7 @@
 
 #include <algorithm>
 #include <cstring>
+#include <cwctype>
 #include <iterator>
 #include <utility>
 
@@ -46,6 +47,7 @@ using te_fun0 = double (*)();
 
 enum {
     TE_CONSTANT = 0,
+    TE_VARIABLE,
     TE_FUNCTION0,
     TE_FUNCTION1,
     TE_FUNCTION2,
@@ -57,6 +59,7 @@ enum {
     TOK_OPEN,
     TOK_CLOSE,
     TOK_NUMBER,
+    TOK_VARIABLE,
     TOK_INFIX
 };
 
@@ -67,14 +70,16 @@ static int get_arity(const int type) {
     return 0;
 }
 
-typedef struct te_expr {
+struct te_expr {
     int type;
     union {
         double value;
         const void *function;
+        // For TE_VARIABLE, the index of its value in the values passed to te_eval.
+        int index;
     };
     te_expr *parameters[];
-} te_expr;
+};
 
 using te_builtin = struct {
     const wchar_t *name;
@@ -86,24 +91,20 @@ using state = struct {
     union {
         double value;
         const void *function;
+        int index;
     };
     const wchar_t *start;
     const wchar_t *next;
     int type;
     te_error_type_t error;
+    // The names of the variables, which get the first indexes.
+    const wchar_t *const *var_names;
+    int var_count;
+    // If set, numbers become variables too, indexed after the named ones.
+    bool literals_as_values;
+    int literal_count;
 };
 
-/* Parses the input expression. */
-/* Returns NULL on error. */
-te_expr *te_compile(const wchar_t *expression, te_error_t *error);
-
-/* Evaluates the expression. */
-double te_eval(const te_expr *n);
-
-/* Frees the expression. */
-/* This is safe to call on NULL pointers. */
-void te_free(te_expr *n);
-
 // TODO: That move there? Ouch. Replace with a proper class with a constructor.
 #define NEW_EXPR(type, ...) new_expr((type), std::move((const te_expr *[]){__VA_ARGS__}))
 
@@ -241,6 +242,23 @@ static constexpr double divide(double a, double b) {
 
 static constexpr double negate(double a) { return -a; }
 
+/// Read a plain integer into s->value, and return true. Return false if the number might be more
+/// than that, like "1.5", "2e3" or "0x10". Integers are the most common numbers, and wcstod is
+/// slow.
+static bool read_integer(state *s) {
+    const wchar_t *end = s->next;
+    double value = 0;
+    // Up to 15 digits, every step is exact.
+    while (*end >= '0' && *end <= '9' && end - s->next < 15) {
+        value = value * 10 + (*end - '0');
+        end++;
+    }
+    if (end == s->next || std::iswalnum(*end) || *end == '.' || *end == '_') return false;
+    s->value = value;
+    s->next = end;
+    return true;
+}
+
 static void next_token(state *s) {
     s->type = TOK_NULL;
 
@@ -252,8 +270,14 @@ static void next_token(state *s) {
 
         /* Try reading a number. */
         if ((s->next[0] >= '0' && s->next[0] <= '9') || s->next[0] == '.') {
-            s->value = fish_wcstod(s->next, const_cast<wchar_t **>(&s->next));
+            if (!read_integer(s)) {
+                s->value = fish_wcstod(s->next, const_cast<wchar_t **>(&s->next));
+            }
             s->type = TOK_NUMBER;
+            if (s->literals_as_values) {
+                s->index = s->var_count + s->literal_count++;
+                s->type = TOK_VARIABLE;
+            }
         } else {
             /* Look for a function call. */
             // But not when it's an "x" followed by whitespace
@@ -266,9 +290,20 @@ static void next_token(state *s) {
                        (s->next[0] >= '0' && s->next[0] <= '9') || (s->next[0] == '_'))
                     s->next++;
 
-                const te_builtin *var = find_builtin(start, s->next - start);
+                const int len = s->next - start;
+                const te_builtin *var = nullptr;
+                for (int i = 0; i < s->var_count; i++) {
+                    if (std::wcsncmp(s->var_names[i], start, len) == 0 &&
+                        s->var_names[i][len] == 0) {
+                        s->type = TOK_VARIABLE;
+                        s->index = i;
+                        break;
+                    }
+                }
 
-                if (var) {
+                if (s->type == TOK_VARIABLE) {
+                    // Variables take precedence over functions of the same name.
+                } else if ((var = find_builtin(start, len))) {
                     switch (var->type) {
                         case TE_FUNCTION0:
                         case TE_FUNCTION1:
@@ -362,6 +397,12 @@ static te_expr *base(state *s) {
             next_token(s);
             break;
 
+        case TOK_VARIABLE:
+            ret = new_expr(TE_VARIABLE, nullptr);
+            ret->index = s->index;
+            next_token(s);
+            break;
+
         case TE_FUNCTION0:
             ret = new_expr(s->type, nullptr);
             ret->function = s->function;
@@ -529,14 +570,16 @@ static te_expr *expr(state *s) {
 }
 
 #define TE_FUN(...) ((double (*)(__VA_ARGS__))n->function)
-#define M(e) te_eval(n->parameters[e])
+#define M(e) te_eval(n->parameters[e], values)
 
-double te_eval(const te_expr *n) {
+double te_eval(const te_expr *n, const double *values) {
     if (!n) return NAN;
 
     switch (n->type) {
         case TE_CONSTANT:
             return n->value;
+        case TE_VARIABLE:
+            return values[n->index];
         case TE_FUNCTION0:
             return TE_FUN(void)();
         case TE_FUNCTION1:
@@ -555,7 +598,7 @@ double te_eval(const te_expr *n) {
 
 static void optimize(te_expr *n) {
     /* Evaluates as much as possible. */
-    if (n->type == TE_CONSTANT) return;
+    if (n->type == TE_CONSTANT || n->type == TE_VARIABLE) return;
 
     const int arity = get_arity(n->type);
     bool known = true;
@@ -566,17 +609,22 @@ static void optimize(te_expr *n) {
         }
     }
     if (known) {
-        const double value = te_eval(n);
+        const double value = te_eval(n, nullptr);
         te_free_parameters(n);
         n->type = TE_CONSTANT;
         n->value = value;
     }
 }
 
-te_expr *te_compile(const wchar_t *expression, te_error_t *error) {
+te_expr *te_compile(const wchar_t *expression, const wchar_t *const *var_names, int var_count,
+                    bool literals_as_values, te_error_t *error) {
     state s;
     s.start = s.next = expression;
     s.error = TE_ERROR_NONE;
+    s.var_names = var_names;
+    s.var_count = var_count;
+    s.literals_as_values = literals_as_values;
+    s.literal_count = 0;
 
     next_token(&s);
     te_expr *root = expr(&s);
@@ -604,11 +652,45 @@ te_expr *te_compile(const wchar_t *expression, te_error_t *error) {
     }
 }
 
+bool te_split_literals(const wchar_t *expression, std::wstring *shape,
+                       std::vector<double> *literals) {
+    state s;
+    s.start = s.next = expression;
+    s.error = TE_ERROR_NONE;
+    s.var_names = nullptr;
+    s.var_count = 0;
+    s.literals_as_values = false;
+
+    for (;;) {
+        const wchar_t *prev = s.next;
+        next_token(&s);
+        if (s.type == TOK_END) {
+            shape->append(prev, s.next);
+            return true;
+        } else if (s.type == TOK_ERROR || s.next == prev) {
+            // The expression will not compile. Note a number that reads nothing (like a lone ".")
+            // keeps producing tokens at the same place.
+            return false;
+        } else if (s.type == TOK_NUMBER) {
+            // Keep the whitespace in front of the number, it can change what comes before it.
+            const wchar_t *number = prev;
+            while (*number == ' ' || *number == '\t' || *number == '\n' || *number == '\r') {
+                number++;
+            }
+            shape->append(prev, number);
+            shape->push_back(L'#');
+            literals->push_back(s.value);
+        } else {
+            shape->append(prev, s.next);
+        }
+    }
+}
+
 double te_interp(const wchar_t *expression, te_error_t *error) {
-    te_expr *n = te_compile(expression, error);
+    te_expr *n = te_compile(expression, nullptr, 0, false, error);
     double ret;
     if (n) {
-        ret = te_eval(n);
+        ret = te_eval(n, nullptr);
         te_free(n);
     } else {
         ret = NAN;
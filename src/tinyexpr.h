@@ -27,6 +27,9 @@
 #ifndef __TINYEXPR_H__
 #define __TINYEXPR_H__
 
+#include <string>
+#include <vector>
+
 typedef enum {
     TE_ERROR_NONE = 0,
     TE_ERROR_UNKNOWN_FUNCTION = 1,
@@ -45,6 +48,31 @@ typedef struct te_error_t {
     int position;
 } te_error_t;
 
+struct te_expr;
+
+/* Parses the input expression. */
+/* An identifier that is one of var_names evaluates to the value with the same index. If */
+/* literals_as_values is set, the numbers in the expression also become values, indexed after */
+/* the named ones in the order they appear, so that the result can be evaluated again for other */
+/* numbers in the same places. */
+/* Returns NULL on error. */
+te_expr *te_compile(const wchar_t *expression, const wchar_t *const *var_names, int var_count,
+                    bool literals_as_values, te_error_t *error);
+
+/* Evaluates the expression, taking the values of its variables from values. */
+double te_eval(const te_expr *n, const double *values);
+
+/* Frees the expression. */
+/* This is safe to call on NULL pointers. */
+void te_free(te_expr *n);
+
+/* Appends the expression to shape with every number replaced by '#', and appends the numbers */
+/* to literals. Expressions with the same shape compile to the same thing with */
+/* literals_as_values, so the shape can be used to cache that. */
+/* Returns false if it finds that the expression will not compile. */
+bool te_split_literals(const wchar_t *expression, std::wstring *shape,
+                       std::vector<double> *literals);
+
 /* Parses the input expression, evaluates it, and frees it. */
 /* Returns NaN on error. */
 double te_interp(const wchar_t *expression, te_error_t *error);
@@ -6,22 +6,32 @@
 
 #include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <stddef.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
 #include <cwchar>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <unordered_map>
 #include <unordered_set>
 #include <utility>
+#include <vector>
 
 #include "common.h"
 #include "complete.h"
 #include "expand.h"
 #include "fallback.h"  // IWYU pragma: keep
 #include "future_feature_flags.h"
+#include "global_safety.h"
+#include "iothread.h"
 #include "path.h"
 #include "reader.h"
 #include "wcstringutil.h"
@@ -526,6 +536,163 @@ static bool wildcard_test_flags_then_complete(const wcstring &filepath, const wc
            wildcard_result_t::match;
 }
 
+namespace {
+/// An entry in a directory listing.
+struct dir_entry_t {
+    wcstring name;
+
+    // False if the directory entry's type says this is neither a directory nor a symlink.
+    bool maybe_dir{true};
+
+    // Whether we have stat'ed this entry (following symlinks), and if so and it is a directory,
+    // its file ID.
+    bool stat_done{false};
+    maybe_t<file_id_t> dir_id{};
+};
+using dir_listing_t = std::vector<dir_entry_t>;
+
+/// Read the entries of \p dir. If \p stat_subdirs is set, also stat (relative to the directory's
+/// fd) each entry which may be a directory, except hidden ones.
+dir_listing_t read_dir_listing(DIR *dir, bool stat_subdirs) {
+    dir_listing_t result;
+    while (const struct dirent *ent = readdir(dir)) {
+        dir_entry_t entry;
+        entry.name = str2wcstring(ent->d_name);
+#ifdef HAVE_STRUCT_DIRENT_D_TYPE
+        entry.maybe_dir = ent->d_type == DT_DIR || ent->d_type == DT_LNK ||
+                          ent->d_type == DT_UNKNOWN;
+#endif
+        if (stat_subdirs && entry.maybe_dir && ent->d_name[0] != '.') {
+            struct stat buf;
+            entry.stat_done = true;
+            if (fstatat(dirfd(dir), ent->d_name, &buf, 0) == 0 && S_ISDIR(buf.st_mode)) {
+                entry.dir_id = file_id_t::from_stat(buf);
+            }
+        }
+        result.push_back(std::move(entry));
+    }
+    return result;
+}
+
+/// Stop reading ahead after this many directory entries, so that a recursive wildcard over an
+/// enormous tree doesn't hold it all in memory. Directories we did not get to are read one at a
+/// time as the expansion reaches them.
+constexpr size_t kMaxPrefetchedEntries = 512 * 1024;
+
+/// The listings of every directory under some directory, keyed by path.
+using dir_tree_listing_t = std::unordered_map<wcstring, dir_listing_t>;
+
+/// Reads a directory tree using several threads at once, in preparation for expanding a recursive
+/// wildcard over it. Hidden directories are skipped, as ** does not descend into them, and each
+/// directory is read only once even if symlinks lead to it more than once.
+class dir_tree_reader_t {
+    struct pending_dir_t {
+        // The directory's path as the wildcard expander knows it, ending in a slash.
+        wcstring base_dir;
+        // The path to actually open.
+        std::string path;
+    };
+
+    std::mutex lock_;
+    std::condition_variable cond_;
+
+    // Directories waiting to be read.
+    std::vector<pending_dir_t> pending_;
+
+    // How many directories are being read.
+    size_t active_{0};
+
+    // The results so far.
+    dir_tree_listing_t listings_;
+    std::unordered_set<file_id_t> seen_;
+    size_t entry_count_{0};
+
+    // Set if we are cancelled, hit the entry limit, or have handed off our results.
+    relaxed_atomic_bool_t stop_{false};
+
+    // Read directories until there are none left, or we are told to stop. \p cancel_checker is
+    // only passed to the thread which started the read.
+    void run(const cancel_checker_t &cancel_checker) {
+        std::unique_lock<std::mutex> locker(lock_);
+        while (!stop_) {
+            if (pending_.empty()) {
+                if (active_ == 0) break;
+                cond_.wait_for(locker, std::chrono::milliseconds(10));
+                if (cancel_checker) {
+                    locker.unlock();
+                    if (cancel_checker()) stop_ = true;
+                    locker.lock();
+                }
+                continue;
+            }
+            pending_dir_t dir = std::move(pending_.back());
+            pending_.pop_back();
+            active_++;
+            locker.unlock();
+
+            if (cancel_checker && cancel_checker()) stop_ = true;
+            dir_listing_t listing;
+            bool did_read = false;
+            int fd = open(dir.path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if (fd >= 0) {
+                if (DIR *dirp = fdopendir(fd)) {
+                    listing = read_dir_listing(dirp, true);
+                    did_read = true;
+                    closedir(dirp);
+                } else {
+                    close(fd);
+                }
+            }
+
+            locker.lock();
+            active_--;
+            if (did_read && !stop_) this->add_listing(dir, std::move(listing));
+            cond_.notify_all();
+        }
+        cond_.notify_all();
+    }
+
+    // Record the listing for \p dir, and queue its subdirectories.
+    void add_listing(const pending_dir_t &dir, dir_listing_t &&listing) {
+        entry_count_ += listing.size();
+        if (entry_count_ > kMaxPrefetchedEntries) stop_ = true;
+        for (const dir_entry_t &entry : listing) {
+            if (!entry.dir_id || !seen_.insert(*entry.dir_id).second) continue;
+            pending_dir_t child;
+            child.base_dir = dir.base_dir + entry.name + L'/';
+            child.path = dir.path;
+            child.path.push_back('/');
+            child.path.append(wcs2string(entry.name));
+            pending_.push_back(std::move(child));
+        }
+        listings_.emplace(dir.base_dir, std::move(listing));
+    }
+
+   public:
+    /// Read the tree at \p path, which the expander knows as \p base_dir. \return the listings of
+    /// the directories that were read, which may not be all of them.
+    static dir_tree_listing_t read(const wcstring &base_dir, const wcstring &path,
+                                   const cancel_checker_t &cancel_checker) {
+        auto reader = std::make_shared<dir_tree_reader_t>();
+        reader->pending_.push_back(pending_dir_t{base_dir, wcs2string(path)});
+
+        // The calling thread takes part too, so we make progress even if the thread pool is busy.
+        // Only the main thread may post to the pool; highlighting and autosuggestions expand on
+        // background threads, which read the tree alone.
+        unsigned threads = std::min(std::max(std::thread::hardware_concurrency(), 1U), 8U);
+        for (unsigned i = 1; i < threads && is_main_thread(); i++) {
+            iothread_perform_bulk([reader] { reader->run(cancel_checker_t{}); });
+        }
+        reader->run(cancel_checker);
+
+        // Other threads may still be finishing a directory; tell them to discard it.
+        auto locker = std::unique_lock<std::mutex>(reader->lock_);
+        reader->stop_ = true;
+        return std::move(reader->listings_);
+    }
+};
+}  // namespace
+
 class wildcard_expander_t {
     // A function to call to check cancellation.
     cancel_checker_t cancel_checker;
@@ -535,6 +702,9 @@ class wildcard_expander_t {
     std::unordered_set<wcstring> completion_set;
     // The set of file IDs we have visited, used to avoid symlink loops.
     std::unordered_set<file_id_t> visited_files;
+    // Listings of directories read ahead of time for recursive wildcards, keyed by base_dir.
+    dir_tree_listing_t prefetched_dirs;
+    size_t prefetched_entries{0};
     // Flags controlling expansion.
     const expand_flags_t flags;
     // Resolved items get inserted into here. This is transient of course.
@@ -553,11 +723,12 @@ class wildcard_expander_t {
     /// We are a trailing slash - expand at the end.
     void expand_trailing_slash(const wcstring &base_dir, const wcstring &prefix);
 
-    /// Given a directory base_dir, which is opened as base_dir_fp, expand an intermediate segment
-    /// of the wildcard. Treat ANY_STRING_RECURSIVE as ANY_STRING. wc_segment is the wildcard
-    /// segment for this directory, wc_remainder is the wildcard for subdirectories,
+    /// Given a directory base_dir, whose entries are base_dir_listing, expand an intermediate
+    /// segment of the wildcard. Treat ANY_STRING_RECURSIVE as ANY_STRING. wc_segment is the
+    /// wildcard segment for this directory, wc_remainder is the wildcard for subdirectories,
     /// prefix is the prefix for completions.
-    void expand_intermediate_segment(const wcstring &base_dir, DIR *base_dir_fp,
+    void expand_intermediate_segment(const wcstring &base_dir,
+                                     const dir_listing_t &base_dir_listing,
                                      const wcstring &wc_segment, const wchar_t *wc_remainder,
                                      const wcstring &prefix);
 
@@ -568,12 +739,12 @@ class wildcard_expander_t {
                                                        const wchar_t *wc_remainder,
                                                        const wcstring &prefix);
 
-    /// Given a directory base_dir, which is opened as base_dir_fp, expand the last segment of the
-    /// wildcard. Treat ANY_STRING_RECURSIVE as ANY_STRING. wc is the wildcard segment to use for
-    /// matching, wc_remainder is the wildcard for subdirectories, prefix is the prefix for
+    /// Given a directory base_dir, whose entries are base_dir_listing, expand the last segment of
+    /// the wildcard. Treat ANY_STRING_RECURSIVE as ANY_STRING. wc is the wildcard segment to use
+    /// for matching, wc_remainder is the wildcard for subdirectories, prefix is the prefix for
     /// completions.
-    void expand_last_segment(const wcstring &base_dir, DIR *base_dir_fp, const wcstring &wc,
-                             const wcstring &prefix);
+    void expand_last_segment(const wcstring &base_dir, const dir_listing_t &base_dir_listing,
+                             const wcstring &wc, const wcstring &prefix);
 
     /// Indicate whether we should cancel wildcard expansion. This latches 'interrupt'.
     bool interrupted_or_overflowed() {
@@ -753,26 +924,34 @@ void wildcard_expander_t::expand_trailing_slash(const wcstring &base_dir, const
     }
 }
 
-void wildcard_expander_t::expand_intermediate_segment(const wcstring &base_dir, DIR *base_dir_fp,
+void wildcard_expander_t::expand_intermediate_segment(const wcstring &base_dir,
+                                                      const dir_listing_t &base_dir_listing,
                                                       const wcstring &wc_segment,
                                                       const wchar_t *wc_remainder,
                                                       const wcstring &prefix) {
-    wcstring name_str;
-    while (!interrupted_or_overflowed() && wreaddir_for_dirs(base_dir_fp, &name_str)) {
+    for (const dir_entry_t &entry : base_dir_listing) {
+        if (interrupted_or_overflowed()) break;
+        const wcstring &name_str = entry.name;
         // Note that it's critical we ignore leading dots here, else we may descend into . and ..
-        if (!wildcard_match(name_str, wc_segment, true)) {
-            // Doesn't match the wildcard for this segment, skip it.
+        if (!entry.maybe_dir || !wildcard_match(name_str, wc_segment, true)) {
+            // Not a directory, or doesn't match the wildcard for this segment, skip it.
             continue;
         }
 
         wcstring full_path = base_dir + name_str;
-        struct stat buf;
-        if (0 != wstat(full_path, &buf) || !S_ISDIR(buf.st_mode)) {
-            // We either can't stat it, or we did but it's not a directory.
-            continue;
+        file_id_t file_id{};
+        if (entry.stat_done) {
+            if (!entry.dir_id) continue;
+            file_id = *entry.dir_id;
+        } else {
+            struct stat buf;
+            if (0 != wstat(full_path, &buf) || !S_ISDIR(buf.st_mode)) {
+                // We either can't stat it, or we did but it's not a directory.
+                continue;
+            }
+            file_id = file_id_t::from_stat(buf);
         }
 
-        const file_id_t file_id = file_id_t::from_stat(buf);
         if (!this->visited_files.insert(file_id).second) {
             // Symlink loop! This directory was already visited, so skip it.
             continue;
@@ -848,10 +1027,12 @@ void wildcard_expander_t::expand_literal_intermediate_segment_with_fuzz(const wc
     }
 }
 
-void wildcard_expander_t::expand_last_segment(const wcstring &base_dir, DIR *base_dir_fp,
+void wildcard_expander_t::expand_last_segment(const wcstring &base_dir,
+                                              const dir_listing_t &base_dir_listing,
                                               const wcstring &wc, const wcstring &prefix) {
-    wcstring name_str;
-    while (!interrupted_or_overflowed() && wreaddir(base_dir_fp, name_str)) {
+    for (const dir_entry_t &entry : base_dir_listing) {
+        if (interrupted_or_overflowed()) break;
+        const wcstring &name_str = entry.name;
         if (flags & expand_flag::for_completions) {
             this->try_add_completion_result(base_dir + name_str, name_str, wc, prefix);
         } else {
@@ -931,6 +1112,19 @@ void wildcard_expander_t::expand(const wcstring &base_dir, const wchar_t *wc,
     } else {
         assert(!wc_segment.empty() && (segment_has_wildcards || is_last_segment));
 
+        if (wc_segment.front() == ANY_STRING_RECURSIVE &&
+            !(flags & expand_flag::for_completions) && !prefetched_dirs.count(base_dir) &&
+            prefetched_entries < kMaxPrefetchedEntries) {
+            // This matches everything beneath us, so read the whole tree up front, in parallel.
+            // Matching is still done here, so results and their order are unaffected.
+            wcstring path = this->working_directory;
+            append_path_component(path, base_dir);
+            for (auto &kv : dir_tree_reader_t::read(base_dir, path, this->cancel_checker)) {
+                prefetched_entries += kv.second.size();
+                prefetched_dirs.insert(std::move(kv));
+            }
+        }
+
         if (!is_last_segment && wc_segment == wcstring{ANY_STRING_RECURSIVE}) {
             // Hack for #7222. This is an intermediate wc segment that is exactly **. The
             // tail matches in subdirectories as normal, but also the current directory.
@@ -944,15 +1138,26 @@ void wildcard_expander_t::expand(const wcstring &base_dir, const wchar_t *wc,
             }
         }
 
-        DIR *dir = open_dir(base_dir);
-        if (dir) {
+        // Use the listing we read ahead of time, if any.
+        dir_listing_t local_listing;
+        const dir_listing_t *listing = nullptr;
+        auto prefetched = prefetched_dirs.find(base_dir);
+        if (prefetched != prefetched_dirs.end()) {
+            listing = &prefetched->second;
+        } else if (DIR *dir = open_dir(base_dir)) {
+            local_listing = read_dir_listing(dir, false);
+            listing = &local_listing;
+            closedir(dir);
+        }
+
+        if (listing) {
             if (is_last_segment) {
                 // Last wildcard segment, nonempty wildcard.
-                this->expand_last_segment(base_dir, dir, wc_segment, effective_prefix);
+                this->expand_last_segment(base_dir, *listing, wc_segment, effective_prefix);
             } else {
                 // Not the last segment, nonempty wildcard.
                 assert(next_slash != nullptr);
-                this->expand_intermediate_segment(base_dir, dir, wc_segment, wc_remainder,
+                this->expand_intermediate_segment(base_dir, *listing, wc_segment, wc_remainder,
                                                   effective_prefix + wc_segment + L'/');
             }
 
@@ -967,11 +1172,9 @@ void wildcard_expander_t::expand(const wcstring &base_dir, const wchar_t *wc,
                 assert(head_any.at(head_any.size() - 1) == ANY_STRING_RECURSIVE);
                 assert(any_tail[0] == ANY_STRING_RECURSIVE);
 
-                rewinddir(dir);
-                this->expand_intermediate_segment(base_dir, dir, head_any, any_tail,
+                this->expand_intermediate_segment(base_dir, *listing, head_any, any_tail,
                                                   effective_prefix);
             }
-            closedir(dir);
         }
     }
 }
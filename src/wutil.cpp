@@ -113,7 +113,8 @@ bool wreaddir_for_dirs(DIR *dir, wcstring *out_name) {
                 break;  // these may be directories
             }
             default: {
-                break;  // nothing else can
+                result = nullptr;  // nothing else can
+                break;
             }
         }
 #else
@@ -0,0 +1,59 @@
+#RUN: %fish -C 'set -g fish %fish' %s
+# Scripts sourced by absolute path are cached in parsed form. Changes to a script must never be
+# hidden by the cache.
+
+set -l dir (mktemp -d)
+set -gx XDG_CACHE_HOME $dir/cache
+set -l script $dir/script.fish
+
+# Recently modified files are not cached, so backdate the script.
+echo 'function f; echo one; end; f' >$script
+touch -t 200001010000 $script
+$fish -c "source $script"
+# CHECK: one
+grep -lF $script $XDG_CACHE_HOME/fish/parsed/* | count
+# CHECK: 1
+
+# Sourcing from the cache behaves the same.
+$fish -c "source $script; functions f"
+# CHECK: one
+# CHECK: # Defined in {{.*}}/script.fish @ line 1
+# CHECK: function f
+# CHECK: echo one;
+# CHECK: end
+
+# A change which keeps the size and modification time is still seen.
+echo 'function f; echo two; end; f' >$script
+touch -t 200001010000 $script
+$fish -c "source $script"
+# CHECK: two
+
+# Errors are still reported, and a damaged cache entry is ignored.
+echo 'echo (' >$script
+touch -t 200001010000 $script
+$fish -c "source $script"
+# CHECKERR: {{.*}}/script.fish (line 1): Unexpected end of string, expecting ')'
+# CHECKERR: echo (
+# CHECKERR: ^
+# CHECKERR: from sourcing file {{.*}}/script.fish
+# CHECKERR: source: Error while reading file '{{.*}}/script.fish'
+echo 'echo three' >$script
+touch -t 200001010000 $script
+$fish -c "source $script"
+# CHECK: three
+for entry in (grep -lF $script $XDG_CACHE_HOME/fish/parsed/*)
+    head -c 100 $entry >$entry.tmp
+    mv $entry.tmp $entry
+end
+$fish -c "source $script"
+# CHECK: three
+
+# A script which was just written is not cached.
+set -l fresh $dir/fresh.fish
+echo 'echo four' >$fresh
+$fish -c "source $fresh"
+# CHECK: four
+grep -lF $fresh $XDG_CACHE_HOME/fish/parsed/* | count
+# CHECK: 0
+
+rm -r $dir
@@ -72,3 +72,17 @@ or echo expected status 122, saw $saved_status >&2
 #CHECKERR: {{.*}}: Too much data emitted by command substitution so it was discarded
 #CHECKERR: echo this will fail (string repeat --max 513 b) to output anything
 #CHECKERR:                     ^
+
+# Builtins write to the substitution's buffer directly; external commands and
+# redirections get a pipe. The limit applies either way.
+string join , (echo one; command echo two)
+#CHECK: one,two
+string join , (echo three 2>&1) (command sh -c 'echo four >&2' 2>&1)
+#CHECK: three,four
+set d (command printf '%0600d' 0)
+set saved_status $status
+test $saved_status -eq 122
+or echo expected status 122, saw $saved_status >&2
+#CHECKERR: {{.*}}: Too much data emitted by command substitution so it was discarded
+#CHECKERR: set d (command printf '%0600d' 0)
+#CHECKERR:       ^
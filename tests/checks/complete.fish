@@ -387,3 +387,74 @@ complete -C ': $dir/'
 # CHECK: $dir/target
 rm $dir/target
 rmdir $dir
+
+# Options are found by their names, and adding and removing options takes effect right away.
+complete -c indexed -f
+complete -c indexed -l Color -xa 'red blue'
+complete -c indexed -o old -d Old-style
+complete -c indexed -s v -d Verbose
+complete -C'indexed --col'
+# CHECK: --Color
+complete -C'indexed --Color='
+# CHECK: --Color=red
+# CHECK: --Color=blue
+complete -c indexed -l colour -d British
+complete -C'indexed --co'
+# CHECK: --colour	British
+# CHECK: --Color
+complete -c indexed -e -l Color
+complete -C'indexed --co'
+# CHECK: --colour	British
+complete -c indexed -n 'test (count (commandline -opc)) -gt 1' -s q -d Quiet
+complete -C'indexed -'
+# CHECK: --colour	British
+# CHECK: -v	Verbose
+# CHECK: -old	Old-style
+complete -C'indexed -v -'
+# CHECK: -q	Quiet
+# CHECK: --colour	British
+# CHECK: -v	Verbose
+# CHECK: -old	Old-style
+
+# The completion helpers look at the command line being completed.
+complete -c helpers -f
+complete -c helpers -n __fish_use_subcommand -a 'add remove'
+complete -c helpers -n '__fish_seen_subcommand_from add; and not __fish_contains_opt -s f force' -s f -l force
+complete -c helpers -n '__fish_seen_subcommand_from "remove" && __fish_contains_opt all || __fish_seen_subcommand_from add' -a everything
+complete -c helpers -n '__fish_seen_subcommand_from remove' -l all
+complete -C'helpers '
+# CHECK: add
+# CHECK: remove
+complete -C'helpers -x '
+# CHECK: add
+# CHECK: remove
+complete -C'helpers add '
+# CHECK: everything
+complete -C'helpers add --'
+# CHECK: --force
+complete -C'helpers add -xf --'
+complete -C'helpers add --force '
+# CHECK: everything
+complete -C'helpers remove '
+complete -C'helpers remove --all '
+# CHECK: everything
+complete -C'helpers remove -'
+# CHECK: --all
+
+# Functions with the same names replace them.
+function __fish_use_subcommand
+    echo shadowed >&2
+    return 1
+end
+complete -C'helpers '
+# CHECKERR: shadowed
+functions -e __fish_use_subcommand
+complete -C'helpers '
+# CHECK: add
+# CHECK: remove
+
+__fish_contains_opt -s
+echo $status
+# CHECK: 1
+__fish_contains_opt --foo
+# CHECKERR: __fish_contains_opt: Unknown option --foo
@@ -1,49 +1,55 @@
 #RUN: %fish %s
-function commandline
-    if test $argv[1] = -ct
-        echo --long4\n-4
-    else if test $argv[1] = -cpo
-        echo cmd\n-z\n-bc\n--long1\narg1\n-d\narg2\n--long2
-    end
+
+# __fish_contains_opt is a builtin, which looks at the command line being completed.
+# Run it from a completion condition to give it one.
+complete -c cmd -n '__fish_contains_opt $contains_opt_args; and set -g found' -f
+function contains_opt
+    set -g contains_opt_args $argv
+    set -e found
+    complete -C"$cmdline" >/dev/null
+    set -q found
 end
 
-__fish_contains_opt -s z
+set cmdline 'cmd -z -bc --long1 arg1 -d arg2 --long2 -4'
+
+contains_opt -s z
 or echo fails to find -z
 
-__fish_contains_opt -s c
+contains_opt -s c
 or echo fails to find -c
 
-__fish_contains_opt -s x
+contains_opt -s x
 and echo should not have found -x
 
-__fish_contains_opt -s x -s z
+contains_opt -s x -s z
 or echo fails to find -z
 
-__fish_contains_opt -s x -s c
+contains_opt -s x -s c
 or echo fails to find -c
 
-__fish_contains_opt -s x long1
+contains_opt -s x long1
 or echo fails to find --long1
 
-__fish_contains_opt long2
+contains_opt long2
 or echo fails to find --long2
 
-__fish_contains_opt long1 long2
+contains_opt long1 long2
 or echo fails to find --long1 or --long2
 
-__fish_contains_opt long3
+contains_opt long3
 and echo should not have found --long3
 
-__fish_contains_opt -s 4 long4
+contains_opt -s 4 long4
 or echo fails to find -4
 
-__fish_contains_opt long4
+set cmdline 'cmd -z -bc --long1 arg1 -d arg2 --long2 --long4'
+contains_opt long4
 and echo should not have found --long4
 
-__fish_contains_opt arg1
+contains_opt arg1
 and echo should not have found --arg1
 
-__fish_contains_opt -s a
+contains_opt -s a
 and echo should not have found -a
 
 # This should result in message written to stderr and an error status.
@@ -51,6 +57,14 @@ __fish_contains_opt -x w
 and '"__fish_contains_opt -x w" should not have succeeded'
 #CHECKERR: __fish_contains_opt: Unknown option -x
 
+function commandline
+    if test $argv[1] = -ct
+        echo --long4\n-4
+    else if test $argv[1] = -cpo
+        echo cmd\n-z\n-bc\n--long1\narg1\n-d\narg2\n--long2
+    end
+end
+
 __fish_not_contain_opt -s z
 and echo should not have found -z
 
@@ -14,3 +14,26 @@ getenvs
 set -e FISH_ENV_TEST_1
 getenvs
 # No output
+
+# The exported environment follows changes between commands, including across scopes.
+set -gx FISH_ENV_TEST_2 global
+set -gx FISH_ENV_TEST_3 unchanged
+for i in 1 2
+    set -gx FISH_ENV_TEST_2 $i
+    getenvs | sort
+end
+# CHECK: FISH_ENV_TEST_2=1
+# CHECK: FISH_ENV_TEST_3=unchanged
+# CHECK: FISH_ENV_TEST_2=2
+# CHECK: FISH_ENV_TEST_3=unchanged
+
+begin
+    set -lx FISH_ENV_TEST_2 local
+    set -lx FISH_ENV_TEST_3 shadowed
+    getenvs | sort
+end
+# CHECK: FISH_ENV_TEST_2=local
+# CHECK: FISH_ENV_TEST_3=shadowed
+getenvs | sort
+# CHECK: FISH_ENV_TEST_2=2
+# CHECK: FISH_ENV_TEST_3=unchanged
@@ -317,3 +317,29 @@ $fish -c 'command (asd)'
 #CHECKERR: command (asd)
 #CHECKERR: ^
 true
+
+# The output of a command substitution is not expanded further, whether it is
+# the whole argument or only part of it.
+set -l special '$HOME' '~' '*' '{a,b}' '\\n' "it's" '' 'x  y'
+printf '%s\n' (printf '%s\n' $special)
+#CHECK: $HOME
+#CHECK: ~
+#CHECK: *
+#CHECK: {a,b}
+#CHECK: \n
+#CHECK: it's
+#CHECK:
+#CHECK: x  y
+printf '[%s]\n' pre(printf '%s\n' $special[1..3])post
+#CHECK: [pre$HOMEpost]
+#CHECK: [pre~post]
+#CHECK: [pre*post]
+printf '%s\n' (printf '%s\n' $special)[2 -1]
+#CHECK: ~
+#CHECK: x  y
+printf '%s\n' (printf '%s\n' $special)[3..1]
+#CHECK: *
+#CHECK: ~
+#CHECK: $HOME
+count (printf 'a\nb\n\n') (true) (printf 'no newline')
+#CHECK: 4
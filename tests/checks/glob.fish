@@ -84,6 +84,34 @@ touch bar foo/bar
 string join \n **/bar | sort
 # CHECK: bar
 # CHECK: foo/bar
+rm -Rf *
+
+# Recursive globs over a wider tree come out sorted, and skip hidden directories
+# unless asked for.
+for d in a b c
+    for e in 1 2 3
+        mkdir -p $d/$e/x
+        touch $d/$e/x/f.txt $d/$e/g.txt
+    end
+end
+mkdir -p .hid/sub b/.hid
+touch .hid/sub/f.txt b/.hid/f.txt
+count **.txt
+# CHECK: 18
+string join \n **/x/f.txt
+# CHECK: a/1/x/f.txt
+# CHECK: a/2/x/f.txt
+# CHECK: a/3/x/f.txt
+# CHECK: b/1/x/f.txt
+# CHECK: b/2/x/f.txt
+# CHECK: b/3/x/f.txt
+# CHECK: c/1/x/f.txt
+# CHECK: c/2/x/f.txt
+# CHECK: c/3/x/f.txt
+string join \n b/.hid/** .hid/**
+# CHECK: b/.hid/f.txt
+# CHECK: .hid/sub
+# CHECK: .hid/sub/f.txt
 
 # Clean up.
 cd $oldpwd
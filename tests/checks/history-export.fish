@@ -0,0 +1,47 @@
+#RUN: %fish -C 'set -g fish %fish' %s
+# Exporting a history file writes the text format, whichever format the file is in.
+
+set -l tmpdir (mktemp -d)
+mkdir $tmpdir/fish
+printf '%s\n' '- cmd: echo one' '  when: 1' '- cmd: echo two' '  when: 2' '  paths:' '    - /tmp' >$tmpdir/fish/exporttest_history
+
+# The fish we run reads this history file.
+set -lx XDG_DATA_HOME $tmpdir
+set -lx fish_history exporttest
+
+$fish -c 'builtin history export'
+#CHECK: - cmd: echo one
+#CHECK:   when: 1
+#CHECK: - cmd: echo two
+#CHECK:   when: 2
+#CHECK:   paths:
+#CHECK:     - /tmp
+
+# Deleting an item rewrites the file, in the binary format if that is turned on.
+$fish --features binary-history -c 'builtin history delete --exact --case-sensitive "echo one"'
+head -c 8 $tmpdir/fish/exporttest_history | tail -c 7
+echo
+#CHECK: fishhs3
+$fish -c 'history export'
+#CHECK: - cmd: echo two
+#CHECK:   when: 2
+#CHECK:   paths:
+#CHECK:     - /tmp
+
+# An older fish appends text, which is exported along with the binary items.
+printf '%s\n' '- cmd: echo three' '  when: 3' >>$tmpdir/fish/exporttest_history
+$fish -c 'history export'
+#CHECK: - cmd: echo two
+#CHECK:   when: 2
+#CHECK:   paths:
+#CHECK:     - /tmp
+#CHECK: - cmd: echo three
+#CHECK:   when: 3
+
+# Without the feature, the next rewrite goes back to the text format.
+$fish -c 'builtin history delete --exact --case-sensitive "echo two"'
+cat $tmpdir/fish/exporttest_history
+#CHECK: - cmd: echo three
+#CHECK:   when: 3
+
+rm -r $tmpdir
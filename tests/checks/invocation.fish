@@ -78,3 +78,54 @@ and echo matched
 string match -rq "echo thisshouldneverbeintheconfig" < $tmp/full.prof
 and echo matched
 # CHECK: matched
+
+# Folded stacks have the commands with their location, outermost first.
+echo 'function f; g; end
+function g; true; end
+f
+set -l x (f)' >$tmp/script.fish
+$fish --profile $tmp/folded.prof --profile-format folded $tmp/script.fish
+string replace -r ' \d+$' '' <$tmp/folded.prof | string replace -a $tmp/ ''
+# CHECK: f (script.fish:3)
+# CHECK: f (script.fish:3);g (script.fish:1)
+# CHECK: f (script.fish:3);g (script.fish:1);true (script.fish:2)
+# CHECK: function (script.fish:1)
+# CHECK: function (script.fish:2)
+# CHECK: set (script.fish:4)
+# CHECK: set (script.fish:4);f (script.fish:4)
+# CHECK: set (script.fish:4);f (script.fish:4);g (script.fish:1)
+# CHECK: set (script.fish:4);f (script.fish:4);g (script.fish:1);true (script.fish:2)
+
+# The summary has the calls and times for each command.
+$fish --profile $tmp/summary.prof --profile-format summary $tmp/script.fish
+head -n 1 $tmp/summary.prof
+# CHECK: Calls{{\s+}}Time{{\s+}}Sum{{\s+}}Command
+string match -r '^\d+\t\d+\t\d+\t(?:f|g|true)$' <$tmp/summary.prof | string replace -r '\t\d+\t\d+\t' ' ' | sort -k2
+# CHECK: 2 f
+# CHECK: 2 g
+# CHECK: 2 true
+
+$fish --profile $tmp/bad.prof --profile-format bogus -c true
+# CHECKERR: fish: Invalid profile format 'bogus'
+
+# The startup profile lists the phases of startup, after the rest of the output.
+$fish --print-startup-profile -c 'echo hello' 2>&1 | string replace -r '^\s*[\d.]+\s+[\d.]+\s+' '' | string replace -r '[\d.]+ ms for \d+' N
+# CHECK: hello
+# CHECK: startup profile:
+# CHECK: total ms   phase ms  phase
+# CHECK: environment
+# CHECK: terminal and input setup
+# CHECK: universal variables
+# CHECK: proc_init, builtin_init, misc_init
+# CHECK: reader_init
+# CHECK: $__fish_data_dir/config.fish
+# CHECK: $__fish_sysconf_dir/config.fish
+# CHECK: $__fish_config_dir/config.fish
+# CHECK: startup finished
+# CHECK: autoloading: N file(s)
+
+# With --no-config, no configuration is read, so e.g. fish_function_path is unset.
+$fish --no-config -c 'set -q fish_function_path; echo $status'
+# CHECK: 1
+$fish -c 'set -q fish_function_path; echo $status'
+# CHECK: 0
@@ -186,3 +186,55 @@ math --base notabase
 # CHECKERR: math: 'notabase' is not a valid base value
 echo $status
 # CHECK: 2
+
+# The same expression with other numbers reuses its compiled form.
+for i in 1 2 3
+    math $i x 2 + $i
+end
+# CHECK: 3
+# CHECK: 6
+# CHECK: 9
+math 3 / 0
+# CHECKERR: math: Error: Result is infinite
+# CHECKERR: '3 / 0'
+math 10 / 4
+# CHECK: 2.5
+math '2x 3'
+# CHECK: 6
+math '2x.5'
+# CHECKERR: math: Error: Unknown function
+# CHECKERR: '2x.5'
+# CHECKERR:   ^
+math 2 x .5
+# CHECK: 1
+
+math --each=n 'n ^ 2' 1 2 0x10 1.5
+# CHECK: 1
+# CHECK: 4
+# CHECK: 256
+# CHECK: 2.25
+seq 3 | math -s1 --each n 'n * 2 + pi'
+# CHECK: 5.1
+# CHECK: 7.1
+# CHECK: 9.1
+math --each n '1 / n' 2 0 abc 4
+# CHECK: 0.5
+# CHECKERR: math: Error: Result is infinite
+# CHECKERR: '1 / n' with n = 0
+# CHECKERR: math: 'abc' is not a number
+# CHECK: 0.25
+echo $status
+# CHECK: 1
+math --each n 'n +' 1
+# CHECKERR: math: Error: Too few arguments
+# CHECKERR: 'n +'
+# CHECKERR:    ^
+math --each=pi 'pi + 1' 1
+# CHECK: 2
+math --each x 'x * 2' 1
+# CHECKERR: math: 'x' is not a valid variable name
+echo 1 | math --each n n 2
+# CHECKERR: math: Too many arguments
+math --each n 'n + 1'
+echo $status
+# CHECK: 0
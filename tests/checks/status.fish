@@ -57,6 +57,7 @@ status features
 #CHECK: stderr-nocaret	off	3.0	^ no longer redirects stderr
 #CHECK: qmark-noglob	off	3.0	? no longer globs
 #CHECK: regex-easyesc	off	3.1	string replace -r needs fewer \'s
+#CHECK: binary-history	off	3.3	history is saved in a binary format
 status test-feature stderr-nocaret
 echo $status
 #CHECK: 1
@@ -64,6 +65,13 @@ status test-feature not-a-feature
 echo $status
 #CHECK: 2
 
+status thread-pool | string replace -ar '[0-9.]+' N
+#CHECK: Threads: N (N waiting)
+#CHECK: Interactive work: N queued (max N), N performed, average wait N ms, max wait N ms
+#CHECK: Bulk work: N queued (max N), N performed, average wait N ms, max wait N ms
+status thread-pool extra
+#CHECKERR: status thread-pool: Expected 0 args, got 1
+
 # Ensure $status isn't reset before a function is executed
 function echo_last
     echo $status
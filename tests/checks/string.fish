@@ -713,3 +713,55 @@ end
 
 string escape \x7F
 # CHECK: \x7f
+
+# Compiled regexes are reused between invocations; make sure options are part of that.
+for i in 1 2
+    string match -r A a
+    string match -ri A a
+    string replace -r A X a
+    string replace -ri A X a
+end
+# CHECK: a
+# CHECK: a
+# CHECK: X
+# CHECK: a
+# CHECK: a
+# CHECK: X
+
+# A pattern that failed to compile still reports an error the second time.
+for i in 1 2
+    string match -r '[' x
+end
+# CHECKERR: string match: Regular expression compile error: missing terminating ] for character class
+# CHECKERR: string match: [
+# CHECKERR: string match: ^
+# CHECKERR: string match: Regular expression compile error: missing terminating ] for character class
+# CHECKERR: string match: [
+# CHECKERR: string match: ^
+
+# Globs without ? are matched by searching for the text between the stars.
+string match 'a*a' a; or echo nomatch
+# CHECK: nomatch
+string match 'a*b*c' abc aXbYc acb abcb
+# CHECK: abc
+# CHECK: aXbYc
+string match '*ab*ab' abab ab xabyab
+# CHECK: abab
+# CHECK: xabyab
+string match -i 'A*b' aB Ab ba
+# CHECK: aB
+# CHECK: Ab
+string match -e b abc cde
+# CHECK: abc
+string match '' '' a
+# CHECK:
+
+# Long and numerous lines from stdin.
+string repeat -n 10000 ab | string length
+# CHECK: 20000
+string repeat -n 3000 é | string length
+# CHECK: 3000
+seq 5000 | string match '*99*' | count
+# CHECK: 95
+seq 3 | string split -f2 '' ; echo $status
+# CHECK: 1
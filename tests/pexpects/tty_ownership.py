@@ -15,3 +15,13 @@ expect_prompt()
 
 sendline("echo it worked")
 expect_prompt("it worked")
+
+# A foreground job owns the terminal as soon as it starts, whether it is launched with posix_spawn
+# or with fork.
+for use_posix_spawn in ["1", "0"]:
+    sendline("set -g fish_use_posix_spawn " + use_posix_spawn)
+    expect_prompt()
+    sendline("$fish_test_helper report_foreground")
+    expect_prompt("foreground")
+    sendline("$fish_test_helper report_foreground 2>| cat")
+    expect_prompt("foreground")
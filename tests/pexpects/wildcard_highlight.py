@@ -0,0 +1,26 @@
+#!/usr/bin/env python3
+from pexpect_helper import SpawnedProc
+
+sp = SpawnedProc()
+send, sendline, expect_prompt, expect_str = (
+    sp.send,
+    sp.sendline,
+    sp.expect_prompt,
+    sp.expect_str,
+)
+expect_prompt()
+
+sendline("set -l tmpdir (mktemp -d); mkdir -p $tmpdir/a/b; touch $tmpdir/a/b/x; cd $tmpdir")
+expect_prompt()
+
+# Highlighting checks redirection targets off the main thread, where a recursive wildcard must not
+# use the thread pool.
+send("echo hi > **/x")
+expect_str("off of main thread", timeout=1, shouldfail=True)
+# Clear the line rather than run it.
+send("\x15")
+sendline("echo done")
+expect_prompt("done")
+
+sendline("cd /; rm -r $tmpdir")
+expect_prompt()